@@ -0,0 +1,547 @@
+// AsyncFileWriter.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "AsyncFileWriter.h"
+#include <cstdio>
+
+#ifndef _WIN32
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/// <summary>
+/// Round a size up to a multiple of SectorAlignment
+/// </summary>
+static inline DWORD AlignToSector(DWORD dwSize)
+{
+    return (dwSize + SectorAlignment - 1) & ~static_cast<DWORD>(SectorAlignment - 1);
+}
+
+/// <summary>
+/// Allocate a ring slot, sector-aligned and sector-sized including its header room
+/// </summary>
+/// <param name="nSize">size of the pixel data in bytes</param>
+/// <returns>pointer to the pixel data, NULL if out of memory</returns>
+BYTE* AllocateFrameSlot(size_t nSize)
+{
+#ifdef _WIN32
+    BYTE* pSlot = static_cast<BYTE*>(_aligned_malloc(AlignToSector(static_cast<DWORD>(FrameHeaderRoom + nSize)), SectorAlignment));
+#else
+    void* pMemory = NULL;
+    BYTE* pSlot = (0 == posix_memalign(&pMemory, SectorAlignment, AlignToSector(static_cast<DWORD>(FrameHeaderRoom + nSize)))) ? static_cast<BYTE*>(pMemory) : NULL;
+#endif
+    return pSlot ? pSlot + FrameHeaderRoom : NULL;
+}
+
+/// <summary>
+/// Release a ring slot allocated with AllocateFrameSlot
+/// </summary>
+/// <param name="pPixels">pointer to the pixel data, may be NULL</param>
+void FreeFrameSlot(void* pPixels)
+{
+    if (pPixels)
+    {
+#ifdef _WIN32
+        _aligned_free(static_cast<BYTE*>(pPixels) - FrameHeaderRoom);
+#else
+        free(static_cast<BYTE*>(pPixels) - FrameHeaderRoom);
+#endif
+    }
+}
+
+/// <summary>
+/// Write a PNM (P5/P6) header filling the header room of a ring slot
+/// </summary>
+/// <param name="pPixels">pixel data of the slot</param>
+/// <param name="cType">'5' for PGM, '6' for PPM</param>
+/// <param name="lWidth">width (in pixels) of the image</param>
+/// <param name="lHeight">height (in pixels) of the image</param>
+/// <param name="lMaxPixel">max value of a pixel</param>
+void PutPNMHeader(BYTE* pPixels, char cType, LONG lWidth, LONG lHeight, LONG lMaxPixel)
+{
+    CHAR szTail[64];
+    int nTail = sprintf_s(szTail, _countof(szTail), "\n%d %d\n%d\n", lWidth, lHeight, lMaxPixel);
+
+    // Any amount of white space may separate the magic number from the width
+    BYTE* pHeader = pPixels - FrameHeaderRoom;
+    pHeader[0] = 'P';
+    pHeader[1] = cType;
+    memset(pHeader + 2, ' ', FrameHeaderRoom - 2 - nTail);
+    memcpy(pPixels - nTail, szTail, nTail);
+}
+
+/// <summary>
+/// Write a PAM (P7) header filling the header room of a ring slot
+/// </summary>
+/// <param name="pPixels">pixel data of the slot</param>
+/// <param name="lWidth">width (in pixels) of the image</param>
+/// <param name="lHeight">height (in pixels) of the image</param>
+/// <param name="wBytesPerPixel">bytes per pixel (PAM depth)</param>
+/// <param name="lMaxPixel">max value of a byte</param>
+/// <param name="szTupleType">layout of a pixel</param>
+void PutPAMHeader(BYTE* pPixels, LONG lWidth, LONG lHeight, WORD wBytesPerPixel, LONG lMaxPixel, LPCSTR szTupleType)
+{
+    CHAR szTail[FrameHeaderRoom];
+    int nTail = sprintf_s(szTail, _countof(szTail), "\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+        lWidth, lHeight, wBytesPerPixel, lMaxPixel, szTupleType);
+
+    // The padding goes into a comment line
+    BYTE* pHeader = pPixels - FrameHeaderRoom;
+    memcpy(pHeader, "P7\n#", 4);
+    memset(pHeader + 4, ' ', FrameHeaderRoom - 4 - nTail);
+    memcpy(pPixels - nTail, szTail, nTail);
+}
+
+/// <summary>
+/// Write a top-down BMP header filling the header room of a ring slot
+/// </summary>
+/// <param name="pPixels">pixel data of the slot</param>
+/// <param name="lWidth">width (in pixels) of the image</param>
+/// <param name="lHeight">height (in pixels) of the image</param>
+/// <param name="wBitsPerPixel">bits per pixel of the image</param>
+void PutBMPHeader(BYTE* pPixels, LONG lWidth, LONG lHeight, WORD wBitsPerPixel)
+{
+    BITMAPINFOHEADER bmpInfoHeader = { 0 };
+    bmpInfoHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmpInfoHeader.biBitCount = wBitsPerPixel;
+    bmpInfoHeader.biCompression = BI_RGB;
+    bmpInfoHeader.biWidth = lWidth;
+    bmpInfoHeader.biHeight = -lHeight;                  // negative indicates it's stored right-side-up
+    bmpInfoHeader.biPlanes = 1;
+    bmpInfoHeader.biSizeImage = lWidth * lHeight * (wBitsPerPixel / 8);
+
+    // The pixels start right after the header room, whatever the size of the headers
+    BITMAPFILEHEADER bfh = { 0 };
+    bfh.bfType = 0x4D42;
+    bfh.bfOffBits = FrameHeaderRoom;
+    bfh.bfSize = bfh.bfOffBits + bmpInfoHeader.biSizeImage;
+
+    BYTE* pHeader = pPixels - FrameHeaderRoom;
+    memset(pHeader, 0, FrameHeaderRoom);
+    memcpy(pHeader, &bfh, sizeof(bfh));
+    memcpy(pHeader + sizeof(bfh), &bmpInfoHeader, sizeof(bmpInfoHeader));
+}
+
+#ifdef _WIN32
+
+/// <summary>
+/// Constructor
+/// </summary>
+AsyncFileWriter::AsyncFileWriter() :
+m_nFront(0),
+m_nBack(0)
+{
+    for (UINT i = 0; i < AsyncWritesPerLane; ++i)
+    {
+        m_aWrites[i].hFile = INVALID_HANDLE_VALUE;
+        m_aEvents[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+}
+
+/// <summary>
+/// Destructor, waits for the writes in flight
+/// </summary>
+AsyncFileWriter::~AsyncFileWriter()
+{
+    Flush();
+
+    for (UINT i = 0; i < AsyncWritesPerLane; ++i)
+    {
+        if (m_aEvents[i])
+        {
+            CloseHandle(m_aEvents[i]);
+        }
+    }
+}
+
+/// <summary>
+/// Check if the writes are queued to the system rather than made blocking
+/// </summary>
+bool AsyncFileWriter::IsQueued() const
+{
+    return true;
+}
+
+/// <summary>
+/// Start writing a file, falling back to a plain blocking write if unbuffered I/O is refused.
+/// The data must stay untouched until the file is completed.
+/// </summary>
+/// <param name="lpszFilePath">full file path to write to</param>
+/// <param name="pData">file content, sector-aligned and readable up to the next sector boundary</param>
+/// <param name="dwSize">file size in bytes</param>
+void AsyncFileWriter::Submit(LPCWSTR lpszFilePath, const BYTE* pData, DWORD dwSize)
+{
+    UINT nIndex = m_nBack % AsyncWritesPerLane;
+    AsyncWrite& write = m_aWrites[nIndex];
+    write.dwSize = dwSize;
+    write.hr = S_OK;
+    ZeroMemory(&write.overlapped, sizeof(write.overlapped));
+    write.overlapped.hEvent = m_aEvents[nIndex];
+    ++m_nBack;
+
+    // The whole last sector is written, the padding is cut off by Complete()
+    write.hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+    if (INVALID_HANDLE_VALUE != write.hFile)
+    {
+        if (WriteFile(write.hFile, pData, AlignToSector(dwSize), NULL, &write.overlapped) || ERROR_IO_PENDING == GetLastError())
+        {
+            return;
+        }
+
+        CloseHandle(write.hFile);
+        write.hFile = INVALID_HANDLE_VALUE;
+    }
+
+    // e.g. a volume with sectors larger than SectorAlignment
+    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        write.hr = E_ACCESSDENIED;
+        return;
+    }
+
+    DWORD dwBytesWritten = 0;
+    if (!WriteFile(hFile, pData, dwSize, &dwBytesWritten, NULL) || dwBytesWritten != dwSize)
+    {
+        write.hr = E_FAIL;
+    }
+    CloseHandle(hFile);
+}
+
+/// <summary>
+/// Wait for the oldest file in flight and close it
+/// </summary>
+/// <returns>indicates success or failure of the file</returns>
+HRESULT AsyncFileWriter::Complete()
+{
+    if (m_nFront == m_nBack)
+    {
+        return E_FAIL;
+    }
+
+    AsyncWrite& write = m_aWrites[m_nFront % AsyncWritesPerLane];
+    ++m_nFront;
+
+    if (INVALID_HANDLE_VALUE == write.hFile)
+    {
+        return write.hr;
+    }
+
+    DWORD dwBytesWritten = 0;
+    if (!GetOverlappedResult(write.hFile, &write.overlapped, &dwBytesWritten, TRUE) || dwBytesWritten < AlignToSector(write.dwSize))
+    {
+        // A short write would leave the end of the file unwritten
+        write.hr = E_FAIL;
+    }
+    else if (dwBytesWritten != write.dwSize)
+    {
+        // Cut the sector padding off
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = write.dwSize;
+        if (!SetFileInformationByHandle(write.hFile, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+        {
+            write.hr = E_FAIL;
+        }
+    }
+
+    CloseHandle(write.hFile);
+    write.hFile = INVALID_HANDLE_VALUE;
+    return write.hr;
+}
+
+#else // _WIN32
+
+/// <summary>
+/// Constructor
+/// </summary>
+AsyncFileWriter::AsyncFileWriter() :
+m_nRing(-1),
+m_pSubmitRing(NULL),
+m_nSubmitRingSize(0),
+m_pCompleteRing(NULL),
+m_nCompleteRingSize(0),
+m_pEntries(NULL),
+m_nFront(0),
+m_nBack(0)
+{
+    for (UINT i = 0; i < AsyncWritesPerLane; ++i)
+    {
+        m_aWrites[i].nFile = -1;
+    }
+
+    OpenRing();
+}
+
+/// <summary>
+/// Destructor, waits for the writes in flight
+/// </summary>
+AsyncFileWriter::~AsyncFileWriter()
+{
+    Flush();
+    CloseRing();
+}
+
+/// <summary>
+/// Map the rings of a new io_uring, leaving m_nRing at -1 on failure
+/// </summary>
+void AsyncFileWriter::OpenRing()
+{
+    ZeroMemory(&m_ringParams, sizeof(m_ringParams));
+    m_nRing = static_cast<int>(syscall(__NR_io_uring_setup, AsyncWritesPerLane, &m_ringParams));
+    if (m_nRing < 0)
+    {
+        m_nRing = -1;
+        return;
+    }
+
+    m_nSubmitRingSize = m_ringParams.sq_off.array + m_ringParams.sq_entries * sizeof(UINT32);
+    m_nCompleteRingSize = m_ringParams.cq_off.cqes + m_ringParams.cq_entries * sizeof(io_uring_cqe);
+
+    void* pSubmitRing = mmap(NULL, m_nSubmitRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_SQ_RING);
+    void* pCompleteRing = mmap(NULL, m_nCompleteRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_CQ_RING);
+    void* pEntries = mmap(NULL, m_ringParams.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_SQES);
+    m_pSubmitRing = (MAP_FAILED != pSubmitRing) ? static_cast<BYTE*>(pSubmitRing) : NULL;
+    m_pCompleteRing = (MAP_FAILED != pCompleteRing) ? static_cast<BYTE*>(pCompleteRing) : NULL;
+    m_pEntries = (MAP_FAILED != pEntries) ? static_cast<io_uring_sqe*>(pEntries) : NULL;
+
+    if (!m_pSubmitRing || !m_pCompleteRing || !m_pEntries)
+    {
+        CloseRing();
+    }
+}
+
+/// <summary>
+/// Unmap the rings and close the io_uring
+/// </summary>
+void AsyncFileWriter::CloseRing()
+{
+    if (m_pEntries)
+    {
+        munmap(m_pEntries, m_ringParams.sq_entries * sizeof(io_uring_sqe));
+        m_pEntries = NULL;
+    }
+    if (m_pCompleteRing)
+    {
+        munmap(m_pCompleteRing, m_nCompleteRingSize);
+        m_pCompleteRing = NULL;
+    }
+    if (m_pSubmitRing)
+    {
+        munmap(m_pSubmitRing, m_nSubmitRingSize);
+        m_pSubmitRing = NULL;
+    }
+    if (m_nRing >= 0)
+    {
+        close(m_nRing);
+        m_nRing = -1;
+    }
+}
+
+/// <summary>
+/// Queue the write of an entry and submit it
+/// </summary>
+/// <param name="nIndex">entry of the write</param>
+/// <returns>true if the system took the write</returns>
+bool AsyncFileWriter::SubmitRing(UINT nIndex)
+{
+    UINT32* pHead = reinterpret_cast<UINT32*>(m_pSubmitRing + m_ringParams.sq_off.head);
+    UINT32* pTail = reinterpret_cast<UINT32*>(m_pSubmitRing + m_ringParams.sq_off.tail);
+    UINT32* pArray = reinterpret_cast<UINT32*>(m_pSubmitRing + m_ringParams.sq_off.array);
+    UINT32 nMask = *reinterpret_cast<UINT32*>(m_pSubmitRing + m_ringParams.sq_off.ring_mask);
+
+    // Only this thread moves the tail, the kernel moves the head as it consumes the entries
+    UINT32 nTail = *pTail;
+    if (nTail - __atomic_load_n(pHead, __ATOMIC_ACQUIRE) >= m_ringParams.sq_entries)
+    {
+        return false;
+    }
+
+    // WRITEV rather than WRITE, which the first io_uring kernels lack
+    AsyncWrite& write = m_aWrites[nIndex];
+    io_uring_sqe* pEntry = m_pEntries + (nTail & nMask);
+    ZeroMemory(pEntry, sizeof(*pEntry));
+    pEntry->opcode = IORING_OP_WRITEV;
+    pEntry->fd = write.nFile;
+    pEntry->addr = reinterpret_cast<UINT64>(&write.iov);
+    pEntry->len = 1;
+    pEntry->off = 0;
+    pEntry->user_data = nIndex;
+    pArray[nTail & nMask] = nTail & nMask;
+    __atomic_store_n(pTail, nTail + 1, __ATOMIC_RELEASE);
+
+    if (1 == syscall(__NR_io_uring_enter, m_nRing, 1, 0, 0, NULL, 0))
+    {
+        return true;
+    }
+
+    // The entry was not consumed, take it back before the file is closed
+    if (__atomic_load_n(pHead, __ATOMIC_ACQUIRE) == nTail)
+    {
+        __atomic_store_n(pTail, nTail, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Record the completions the system has posted
+/// </summary>
+/// <param name="bWait">true to block until at least one completion is posted</param>
+/// <returns>false if waiting failed</returns>
+bool AsyncFileWriter::ReapRing(bool bWait)
+{
+    if (bWait && syscall(__NR_io_uring_enter, m_nRing, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && EINTR != errno)
+    {
+        return false;
+    }
+
+    UINT32* pHead = reinterpret_cast<UINT32*>(m_pCompleteRing + m_ringParams.cq_off.head);
+    UINT32* pTail = reinterpret_cast<UINT32*>(m_pCompleteRing + m_ringParams.cq_off.tail);
+    UINT32 nMask = *reinterpret_cast<UINT32*>(m_pCompleteRing + m_ringParams.cq_off.ring_mask);
+    io_uring_cqe* pEvents = reinterpret_cast<io_uring_cqe*>(m_pCompleteRing + m_ringParams.cq_off.cqes);
+
+    // Completions may arrive in any order, each one names its entry
+    UINT32 nHead = *pHead;
+    UINT32 nTail = __atomic_load_n(pTail, __ATOMIC_ACQUIRE);
+    for (; nHead != nTail; ++nHead)
+    {
+        const io_uring_cqe& event = pEvents[nHead & nMask];
+        AsyncWrite& write = m_aWrites[event.user_data % AsyncWritesPerLane];
+        write.nResult = event.res;
+        write.bDone = true;
+    }
+    __atomic_store_n(pHead, nHead, __ATOMIC_RELEASE);
+    return true;
+}
+
+/// <summary>
+/// Check if the writes are queued to the system rather than made blocking
+/// </summary>
+bool AsyncFileWriter::IsQueued() const
+{
+    return m_nRing >= 0;
+}
+
+/// <summary>
+/// Start writing a file, falling back to a plain blocking write if the io_uring is refused.
+/// The data must stay untouched until the file is completed.
+/// </summary>
+/// <param name="lpszFilePath">full file path to write to</param>
+/// <param name="pData">file content, sector-aligned and readable up to the next sector boundary</param>
+/// <param name="dwSize">file size in bytes</param>
+void AsyncFileWriter::Submit(LPCWSTR lpszFilePath, const BYTE* pData, DWORD dwSize)
+{
+    UINT nIndex = m_nBack % AsyncWritesPerLane;
+    AsyncWrite& write = m_aWrites[nIndex];
+    write.dwSize = dwSize;
+    write.bDone = false;
+    write.nResult = 0;
+    write.hr = S_OK;
+    ++m_nBack;
+
+    std::string szPath = Utf8Path(lpszFilePath);
+    if (m_nRing >= 0)
+    {
+        // The whole last sector is written, the padding is cut off by Complete()
+        write.nFile = open(szPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        write.iov.iov_base = const_cast<BYTE*>(pData);
+        write.iov.iov_len = AlignToSector(dwSize);
+        if (write.nFile < 0 && EINVAL == errno)
+        {
+            // e.g. a file system without direct I/O, the ring still writes through the page cache
+            write.nFile = open(szPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            write.iov.iov_len = dwSize;
+        }
+
+        if (write.nFile >= 0)
+        {
+            if (SubmitRing(nIndex))
+            {
+                return;
+            }
+
+            close(write.nFile);
+            write.nFile = -1;
+        }
+    }
+
+    int nFile = open(szPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (nFile < 0)
+    {
+        write.hr = E_ACCESSDENIED;
+        return;
+    }
+
+    DWORD dwWritten = 0;
+    while (dwWritten < dwSize)
+    {
+        ssize_t nWritten = ::write(nFile, pData + dwWritten, dwSize - dwWritten);
+        if (nWritten <= 0)
+        {
+            write.hr = E_FAIL;
+            break;
+        }
+        dwWritten += static_cast<DWORD>(nWritten);
+    }
+    close(nFile);
+}
+
+/// <summary>
+/// Wait for the oldest file in flight and close it
+/// </summary>
+/// <returns>indicates success or failure of the file</returns>
+HRESULT AsyncFileWriter::Complete()
+{
+    if (m_nFront == m_nBack)
+    {
+        return E_FAIL;
+    }
+
+    AsyncWrite& write = m_aWrites[m_nFront % AsyncWritesPerLane];
+    ++m_nFront;
+
+    if (write.nFile < 0)
+    {
+        return write.hr;
+    }
+
+    while (!write.bDone && ReapRing(true))
+    {
+    }
+
+    if (!write.bDone || write.nResult < 0 || static_cast<size_t>(write.nResult) < write.iov.iov_len)
+    {
+        // A short write would leave the end of the file unwritten
+        write.hr = E_FAIL;
+    }
+    else if (write.iov.iov_len != write.dwSize && 0 != ftruncate(write.nFile, write.dwSize))
+    {
+        // Cut the sector padding off
+        write.hr = E_FAIL;
+    }
+
+    close(write.nFile);
+    write.nFile = -1;
+    return write.hr;
+}
+
+#endif // _WIN32
+
+/// <summary>
+/// Complete every file in flight
+/// </summary>
+void AsyncFileWriter::Flush()
+{
+    while (InFlight())
+    {
+        Complete();
+    }
+}
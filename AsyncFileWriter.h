@@ -0,0 +1,188 @@
+// AsyncFileWriter.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Overlapped, unbuffered (FILE_FLAG_NO_BUFFERING) writes of one file per frame,
+// submitted straight from the ring slots (ASYNC_WRITE). Outside Windows the same
+// writes go through an io_uring with O_DIRECT files.
+//
+// Every ring slot is sector-aligned and reserves FrameHeaderRoom bytes in front
+// of the pixels. The file header is padded to fill them exactly, so that header
+// and pixels go out as a single aligned write; the sector padding at the end of
+// the write is cut off before the file is closed.
+
+
+#pragma once
+
+#ifndef _WIN32
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
+
+/// The FrameHeaderRoom value specifies the bytes reserved in front of the pixels of a ring slot
+#define FrameHeaderRoom     128
+
+/// The SectorAlignment value specifies the alignment of unbuffered writes (512-byte and 4K-sector drives)
+#define SectorAlignment     4096
+
+/// The AsyncWritesPerLane value specifies how many files a writer may have in flight
+#define AsyncWritesPerLane  4
+
+/// <summary>
+/// Allocate a ring slot, sector-aligned and sector-sized including its header room
+/// </summary>
+/// <param name="nSize">size of the pixel data in bytes</param>
+/// <returns>pointer to the pixel data, NULL if out of memory</returns>
+BYTE* AllocateFrameSlot(size_t nSize);
+
+/// <summary>
+/// Release a ring slot allocated with AllocateFrameSlot
+/// </summary>
+/// <param name="pPixels">pointer to the pixel data, may be NULL</param>
+void FreeFrameSlot(void* pPixels);
+
+/// <summary>
+/// Write a PNM (P5/P6) header filling the header room of a ring slot
+/// </summary>
+/// <param name="pPixels">pixel data of the slot</param>
+/// <param name="cType">'5' for PGM, '6' for PPM</param>
+/// <param name="lWidth">width (in pixels) of the image</param>
+/// <param name="lHeight">height (in pixels) of the image</param>
+/// <param name="lMaxPixel">max value of a pixel</param>
+void PutPNMHeader(BYTE* pPixels, char cType, LONG lWidth, LONG lHeight, LONG lMaxPixel);
+
+/// <summary>
+/// Write a PAM (P7) header filling the header room of a ring slot
+/// </summary>
+/// <param name="pPixels">pixel data of the slot</param>
+/// <param name="lWidth">width (in pixels) of the image</param>
+/// <param name="lHeight">height (in pixels) of the image</param>
+/// <param name="wBytesPerPixel">bytes per pixel (PAM depth)</param>
+/// <param name="lMaxPixel">max value of a byte</param>
+/// <param name="szTupleType">layout of a pixel</param>
+void PutPAMHeader(BYTE* pPixels, LONG lWidth, LONG lHeight, WORD wBytesPerPixel, LONG lMaxPixel, LPCSTR szTupleType);
+
+/// <summary>
+/// Write a top-down BMP header filling the header room of a ring slot
+/// </summary>
+/// <param name="pPixels">pixel data of the slot</param>
+/// <param name="lWidth">width (in pixels) of the image</param>
+/// <param name="lHeight">height (in pixels) of the image</param>
+/// <param name="wBitsPerPixel">bits per pixel of the image</param>
+void PutBMPHeader(BYTE* pPixels, LONG lWidth, LONG lHeight, WORD wBitsPerPixel);
+
+class AsyncFileWriter
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    AsyncFileWriter();
+
+    /// <summary>
+    /// Destructor, waits for the writes in flight
+    /// </summary>
+    ~AsyncFileWriter();
+
+    /// <summary>
+    /// Number of files submitted but not completed yet
+    /// </summary>
+    UINT                    InFlight() const { return m_nBack - m_nFront; }
+
+    /// <summary>
+    /// Check if another file may be submitted
+    /// </summary>
+    bool                    CanSubmit() const { return InFlight() < AsyncWritesPerLane; }
+
+    /// <summary>
+    /// Check if the writes are queued to the system rather than made blocking
+    /// </summary>
+    bool                    IsQueued() const;
+
+    /// <summary>
+    /// Start writing a file, falling back to a plain blocking write if unbuffered I/O is refused.
+    /// The data must stay untouched until the file is completed.
+    /// </summary>
+    /// <param name="lpszFilePath">full file path to write to</param>
+    /// <param name="pData">file content, sector-aligned and readable up to the next sector boundary</param>
+    /// <param name="dwSize">file size in bytes</param>
+    void                    Submit(LPCWSTR lpszFilePath, const BYTE* pData, DWORD dwSize);
+
+    /// <summary>
+    /// Wait for the oldest file in flight and close it
+    /// </summary>
+    /// <returns>indicates success or failure of the file</returns>
+    HRESULT                 Complete();
+
+    /// <summary>
+    /// Complete every file in flight
+    /// </summary>
+    void                    Flush();
+
+private:
+#ifdef _WIN32
+    /// <summary>
+    /// One file in flight
+    /// </summary>
+    struct AsyncWrite
+    {
+        HANDLE              hFile;      // INVALID_HANDLE_VALUE once the write is over
+        OVERLAPPED          overlapped;
+        DWORD               dwSize;
+        HRESULT             hr;
+    };
+
+    AsyncWrite              m_aWrites[AsyncWritesPerLane];
+    HANDLE                  m_aEvents[AsyncWritesPerLane];
+#else
+    /// <summary>
+    /// One file in flight
+    /// </summary>
+    struct AsyncWrite
+    {
+        int                 nFile;      // -1 once the write is over
+        struct iovec        iov;        // data submitted, the sector-aligned length with O_DIRECT
+        DWORD               dwSize;
+        bool                bDone;      // the completion has been reaped
+        int                 nResult;    // bytes written, or -errno
+        HRESULT             hr;
+    };
+
+    AsyncWrite              m_aWrites[AsyncWritesPerLane];
+
+    // io_uring of the writer, -1 if the system refused it (blocking writes)
+    int                     m_nRing;
+    io_uring_params         m_ringParams;
+    BYTE*                   m_pSubmitRing;
+    size_t                  m_nSubmitRingSize;
+    BYTE*                   m_pCompleteRing;
+    size_t                  m_nCompleteRingSize;
+    io_uring_sqe*           m_pEntries;
+
+    /// <summary>
+    /// Map the rings of a new io_uring, leaving m_nRing at -1 on failure
+    /// </summary>
+    void                    OpenRing();
+
+    /// <summary>
+    /// Unmap the rings and close the io_uring
+    /// </summary>
+    void                    CloseRing();
+
+    /// <summary>
+    /// Queue the write of an entry and submit it
+    /// </summary>
+    /// <param name="nIndex">entry of the write</param>
+    /// <returns>true if the system took the write</returns>
+    bool                    SubmitRing(UINT nIndex);
+
+    /// <summary>
+    /// Record the completions the system has posted
+    /// </summary>
+    /// <param name="bWait">true to block until at least one completion is posted</param>
+    /// <returns>false if waiting failed</returns>
+    bool                    ReapRing(bool bWait);
+#endif
+    UINT                    m_nFront;   // oldest file in flight
+    UINT                    m_nBack;    // next free entry
+};
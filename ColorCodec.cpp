@@ -0,0 +1,375 @@
+// ColorCodec.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "ColorCodec.h"
+
+#define QOI_OP_INDEX        0x00    // 00xxxxxx
+#define QOI_OP_DIFF         0x40    // 01xxxxxx
+#define QOI_OP_LUMA         0x80    // 10xxxxxx
+#define QOI_OP_RUN          0xC0    // 11xxxxxx
+#define QOI_OP_RGB          0xFE    // 11111110
+#define QOI_OP_RGBA         0xFF    // 11111111
+#define QOI_MASK_2          0xC0
+
+#define QOIMagic            0x716F6966  // 'qoif', stored big-endian
+#define QOIMaxRun           62
+
+/// Pixels are kept as 0xAABBGGRR so that a comparison is a single instruction
+#define QOI_PIXEL(r, g, b, a)   ((static_cast<UINT>(a) << 24) | (static_cast<UINT>(b) << 16) | (static_cast<UINT>(g) << 8) | static_cast<UINT>(r))
+#define QOI_HASH(r, g, b, a)    (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) & 63)
+
+static const BYTE cQOIEnd[QOIEndSize] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+/// <summary>
+/// Store a 32-bit value in big-endian order
+/// </summary>
+static inline void WriteBE32(BYTE* pOutput, UINT nValue)
+{
+    pOutput[0] = static_cast<BYTE>(nValue >> 24);
+    pOutput[1] = static_cast<BYTE>(nValue >> 16);
+    pOutput[2] = static_cast<BYTE>(nValue >> 8);
+    pOutput[3] = static_cast<BYTE>(nValue);
+}
+
+/// <summary>
+/// Load a 32-bit value in big-endian order
+/// </summary>
+static inline UINT ReadBE32(const BYTE* pInput)
+{
+    return (static_cast<UINT>(pInput[0]) << 24) | (static_cast<UINT>(pInput[1]) << 16) | (static_cast<UINT>(pInput[2]) << 8) | pInput[3];
+}
+
+/// <summary>
+/// Write the QOI header of a 24-bit sRGB frame
+/// </summary>
+static DWORD WriteQOIHeader(BYTE* pOutput, int nWidth, int nHeight)
+{
+    WriteBE32(pOutput, QOIMagic);
+    WriteBE32(pOutput + 4, static_cast<UINT>(nWidth));
+    WriteBE32(pOutput + 8, static_cast<UINT>(nHeight));
+    pOutput[12] = 3;    // channels
+    pOutput[13] = 0;    // sRGB with linear alpha
+    return QOIHeaderSize;
+}
+
+/// <summary>
+/// Encode a stripe of pixels independently of the pixels before it
+/// </summary>
+/// <param name="pRGB">pixels of the stripe</param>
+/// <param name="nPixels">number of pixels in the stripe</param>
+/// <param name="bBGR">true if the pixels are in B-G-R order</param>
+/// <param name="pOutput">receives the chunks, at least nPixels * 4 bytes</param>
+/// <returns>size of the chunks in bytes</returns>
+static DWORD CompressQOIStripe(const BYTE* pRGB, int nPixels, bool bBGR, BYTE* pOutput)
+{
+    if (nPixels <= 0)
+    {
+        return 0;
+    }
+
+    const int nRed = bBGR ? 2 : 0;
+    const int nBlue = bBGR ? 0 : 2;
+    UINT aIndex[64] = { 0 };    // alpha 0, so unwritten entries never match
+    BYTE* p = pOutput;
+
+    // The first pixel is a literal, which makes the stripe independent of the previous one
+    int r = pRGB[nRed];
+    int g = pRGB[1];
+    int b = pRGB[nBlue];
+    *p++ = QOI_OP_RGB;
+    *p++ = static_cast<BYTE>(r);
+    *p++ = static_cast<BYTE>(g);
+    *p++ = static_cast<BYTE>(b);
+
+    UINT nPrevious = QOI_PIXEL(r, g, b, 255);
+    aIndex[QOI_HASH(r, g, b, 255)] = nPrevious;
+    int pr = r;
+    int pg = g;
+    int pb = b;
+    int nRun = 0;
+
+    const BYTE* pEnd = pRGB + nPixels * 3;
+    for (pRGB += 3; pRGB != pEnd; pRGB += 3)
+    {
+        r = pRGB[nRed];
+        g = pRGB[1];
+        b = pRGB[nBlue];
+        UINT nPixel = QOI_PIXEL(r, g, b, 255);
+
+        if (nPixel == nPrevious)
+        {
+            if (++nRun == QOIMaxRun)
+            {
+                *p++ = static_cast<BYTE>(QOI_OP_RUN | (nRun - 1));
+                nRun = 0;
+            }
+            continue;
+        }
+
+        if (nRun)
+        {
+            *p++ = static_cast<BYTE>(QOI_OP_RUN | (nRun - 1));
+            nRun = 0;
+        }
+
+        int nHash = QOI_HASH(r, g, b, 255);
+        if (aIndex[nHash] == nPixel)
+        {
+            *p++ = static_cast<BYTE>(QOI_OP_INDEX | nHash);
+        }
+        else
+        {
+            aIndex[nHash] = nPixel;
+
+            // Differences wrap around like the channels of the decoder
+            int dr = static_cast<signed char>(r - pr);
+            int dg = static_cast<signed char>(g - pg);
+            int db = static_cast<signed char>(b - pb);
+            int drg = dr - dg;
+            int dbg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+                *p++ = static_cast<BYTE>(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+            }
+            else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+            {
+                *p++ = static_cast<BYTE>(QOI_OP_LUMA | (dg + 32));
+                *p++ = static_cast<BYTE>(((drg + 8) << 4) | (dbg + 8));
+            }
+            else
+            {
+                *p++ = QOI_OP_RGB;
+                *p++ = static_cast<BYTE>(r);
+                *p++ = static_cast<BYTE>(g);
+                *p++ = static_cast<BYTE>(b);
+            }
+        }
+
+        nPrevious = nPixel;
+        pr = r;
+        pg = g;
+        pb = b;
+    }
+
+    if (nRun)
+    {
+        *p++ = static_cast<BYTE>(QOI_OP_RUN | (nRun - 1));
+    }
+
+    return static_cast<DWORD>(p - pOutput);
+}
+
+/// <summary>
+/// Compress a 24-bit color frame on the calling thread
+/// </summary>
+/// <param name="pRGB">pixels, R-G-B order (or B-G-R if bBGR is set)</param>
+/// <param name="nWidth">width (in pixels) of the frame</param>
+/// <param name="nHeight">height (in pixels) of the frame</param>
+/// <param name="bBGR">true if the pixels are in B-G-R order</param>
+/// <param name="pOutput">receives the QOI file, at least QOIMaxSize(nWidth * nHeight) bytes</param>
+/// <returns>compressed size in bytes</returns>
+DWORD CompressQOI(const BYTE* pRGB, int nWidth, int nHeight, bool bBGR, BYTE* pOutput)
+{
+    DWORD nSize = WriteQOIHeader(pOutput, nWidth, nHeight);
+    nSize += CompressQOIStripe(pRGB, nWidth * nHeight, bBGR, pOutput + nSize);
+    memcpy(pOutput + nSize, cQOIEnd, QOIEndSize);
+    return nSize + QOIEndSize;
+}
+
+/// <summary>
+/// Read the size of a QOI file
+/// </summary>
+/// <param name="pInput">QOI file</param>
+/// <param name="nSize">size of the file in bytes</param>
+/// <param name="pWidth">receives the width (in pixels)</param>
+/// <param name="pHeight">receives the height (in pixels)</param>
+/// <returns>true if the file starts with a valid QOI header</returns>
+bool ParseQOIHeader(const BYTE* pInput, DWORD nSize, int* pWidth, int* pHeight)
+{
+    if (nSize < QOIHeaderSize + QOIEndSize || ReadBE32(pInput) != QOIMagic)
+    {
+        return false;
+    }
+
+    UINT nWidth = ReadBE32(pInput + 4);
+    UINT nHeight = ReadBE32(pInput + 8);
+    if (!nWidth || !nHeight || nWidth > 0x8000 || nHeight > 0x8000 || (pInput[12] != 3 && pInput[12] != 4))
+    {
+        return false;
+    }
+
+    *pWidth = static_cast<int>(nWidth);
+    *pHeight = static_cast<int>(nHeight);
+    return true;
+}
+
+/// <summary>
+/// Decompress a QOI file into 24-bit pixels in R-G-B order
+/// </summary>
+/// <param name="pInput">QOI file</param>
+/// <param name="nSize">size of the file in bytes</param>
+/// <param name="pRGB">receives the pixels, nWidth * nHeight * 3 bytes</param>
+/// <param name="nWidth">expected width (in pixels)</param>
+/// <param name="nHeight">expected height (in pixels)</param>
+/// <returns>S_OK on success, E_FAIL if the file is truncated, corrupt or has another size</returns>
+HRESULT DecompressQOI(const BYTE* pInput, DWORD nSize, BYTE* pRGB, int nWidth, int nHeight)
+{
+    int nFileWidth = 0;
+    int nFileHeight = 0;
+    if (!ParseQOIHeader(pInput, nSize, &nFileWidth, &nFileHeight) || nFileWidth != nWidth || nFileHeight != nHeight)
+    {
+        return E_FAIL;
+    }
+
+    const BYTE* p = pInput + QOIHeaderSize;
+    const BYTE* pChunksEnd = pInput + nSize - QOIEndSize;
+    BYTE* pOut = pRGB;
+    BYTE* pOutEnd = pRGB + static_cast<size_t>(nWidth) * nHeight * 3;
+
+    UINT aIndex[64] = { 0 };
+    int r = 0;
+    int g = 0;
+    int b = 0;
+    int a = 255;
+
+    while (pOut != pOutEnd)
+    {
+        if (p >= pChunksEnd)
+        {
+            return E_FAIL;
+        }
+
+        int nRun = 1;
+        int b1 = *p++;
+
+        if (b1 == QOI_OP_RGB)
+        {
+            if (pChunksEnd - p < 3)
+            {
+                return E_FAIL;
+            }
+            r = p[0];
+            g = p[1];
+            b = p[2];
+            p += 3;
+        }
+        else if (b1 == QOI_OP_RGBA)
+        {
+            if (pChunksEnd - p < 4)
+            {
+                return E_FAIL;
+            }
+            r = p[0];
+            g = p[1];
+            b = p[2];
+            a = p[3];
+            p += 4;
+        }
+        else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+        {
+            UINT nPixel = aIndex[b1];
+            r = nPixel & 0xFF;
+            g = (nPixel >> 8) & 0xFF;
+            b = (nPixel >> 16) & 0xFF;
+            a = nPixel >> 24;
+        }
+        else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+        {
+            r = (r + ((b1 >> 4) & 0x03) - 2) & 0xFF;
+            g = (g + ((b1 >> 2) & 0x03) - 2) & 0xFF;
+            b = (b + (b1 & 0x03) - 2) & 0xFF;
+        }
+        else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+        {
+            if (p == pChunksEnd)
+            {
+                return E_FAIL;
+            }
+            int b2 = *p++;
+            int dg = (b1 & 0x3F) - 32;
+            r = (r + dg - 8 + ((b2 >> 4) & 0x0F)) & 0xFF;
+            g = (g + dg) & 0xFF;
+            b = (b + dg - 8 + (b2 & 0x0F)) & 0xFF;
+        }
+        else
+        {
+            nRun = (b1 & 0x3F) + 1;
+            if (nRun > (pOutEnd - pOut) / 3)
+            {
+                return E_FAIL;
+            }
+        }
+
+        aIndex[QOI_HASH(r, g, b, a)] = QOI_PIXEL(r, g, b, a);
+
+        for (int i = 0; i < nRun; ++i)
+        {
+            pOut[0] = static_cast<BYTE>(r);
+            pOut[1] = static_cast<BYTE>(g);
+            pOut[2] = static_cast<BYTE>(b);
+            pOut += 3;
+        }
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+QOIEncoder::QOIEncoder()
+{
+}
+
+/// <summary>
+/// Start the threads encoding the stripes
+/// </summary>
+/// <param name="nThreads">number of workers besides the calling thread, 0 to encode inline</param>
+void QOIEncoder::Start(UINT nThreads)
+{
+    m_cPool.Start(nThreads, 0, 0);
+}
+
+/// <summary>
+/// Compress a 24-bit color frame
+/// </summary>
+/// <param name="pRGB">pixels, R-G-B order (or B-G-R if bBGR is set)</param>
+/// <param name="nWidth">width (in pixels) of the frame</param>
+/// <param name="nHeight">height (in pixels) of the frame</param>
+/// <param name="bBGR">true if the pixels are in B-G-R order</param>
+/// <returns>compressed size in bytes</returns>
+DWORD QOIEncoder::Encode(const BYTE* pRGB, int nWidth, int nHeight, bool bBGR)
+{
+    int nPixels = nWidth * nHeight;
+    m_vOutput.resize(QOIMaxSize(nPixels));
+    m_vStripes.resize(static_cast<size_t>(nPixels) * 4);
+    m_vStripeSize.assign(nHeight, 0);
+    m_vStripeRows.assign(nHeight, 0);
+
+    // Every stripe gets the worst-case room of its rows
+    BYTE* pStripes = m_vStripes.data();
+    DWORD* pStripeSize = m_vStripeSize.data();
+    int* pStripeRows = m_vStripeRows.data();
+    m_cPool.Run(nHeight, nWidth, [=](int nFirstRow, int nRows)
+    {
+        int nOffset = nFirstRow * nWidth;
+        pStripeSize[nFirstRow] = CompressQOIStripe(pRGB + nOffset * 3, nRows * nWidth, bBGR, pStripes + nOffset * 4);
+        pStripeRows[nFirstRow] = nRows;
+    });
+
+    // Concatenate the stripes behind the header
+    BYTE* pOutput = m_vOutput.data();
+    DWORD nSize = WriteQOIHeader(pOutput, nWidth, nHeight);
+    for (int nRow = 0; nRow < nHeight; nRow += m_vStripeRows[nRow])
+    {
+        memcpy(pOutput + nSize, pStripes + nRow * nWidth * 4, m_vStripeSize[nRow]);
+        nSize += m_vStripeSize[nRow];
+    }
+    memcpy(pOutput + nSize, cQOIEnd, QOIEndSize);
+
+    return nSize + QOIEndSize;
+}
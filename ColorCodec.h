@@ -0,0 +1,102 @@
+// ColorCodec.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Lossless color compression in the QOI format ("Quite OK Image", qoiformat.org).
+//
+// The frame is encoded in horizontal stripes on separate threads. Every stripe
+// starts with a literal pixel and only uses the index entries it has written
+// itself, so the concatenated stripes still form a standard QOI stream that
+// any QOI decoder reads.
+
+
+#pragma once
+
+#include "ConversionPool.h"
+#include <vector>
+
+#define QOIHeaderSize       14
+#define QOIEndSize          8
+
+/// The QOIEncodeThreads value specifies the workers helping the writer thread to encode a frame
+#define QOIEncodeThreads    1
+
+/// <summary>
+/// Upper bound of the compressed size of a color frame
+/// </summary>
+/// <param name="nPixels">number of pixels</param>
+/// <returns>size in bytes the output buffer of CompressQOI must have</returns>
+inline DWORD QOIMaxSize(int nPixels)
+{
+    // at worst every pixel is a 4-byte literal
+    return static_cast<DWORD>(nPixels) * 4 + QOIHeaderSize + QOIEndSize;
+}
+
+/// <summary>
+/// Compress a 24-bit color frame on the calling thread
+/// </summary>
+/// <param name="pRGB">pixels, R-G-B order (or B-G-R if bBGR is set)</param>
+/// <param name="nWidth">width (in pixels) of the frame</param>
+/// <param name="nHeight">height (in pixels) of the frame</param>
+/// <param name="bBGR">true if the pixels are in B-G-R order</param>
+/// <param name="pOutput">receives the QOI file, at least QOIMaxSize(nWidth * nHeight) bytes</param>
+/// <returns>compressed size in bytes</returns>
+DWORD CompressQOI(const BYTE* pRGB, int nWidth, int nHeight, bool bBGR, BYTE* pOutput);
+
+/// <summary>
+/// Read the size of a QOI file
+/// </summary>
+/// <param name="pInput">QOI file</param>
+/// <param name="nSize">size of the file in bytes</param>
+/// <param name="pWidth">receives the width (in pixels)</param>
+/// <param name="pHeight">receives the height (in pixels)</param>
+/// <returns>true if the file starts with a valid QOI header</returns>
+bool ParseQOIHeader(const BYTE* pInput, DWORD nSize, int* pWidth, int* pHeight);
+
+/// <summary>
+/// Decompress a QOI file into 24-bit pixels in R-G-B order
+/// </summary>
+/// <param name="pInput">QOI file</param>
+/// <param name="nSize">size of the file in bytes</param>
+/// <param name="pRGB">receives the pixels, nWidth * nHeight * 3 bytes</param>
+/// <param name="nWidth">expected width (in pixels)</param>
+/// <param name="nHeight">expected height (in pixels)</param>
+/// <returns>S_OK on success, E_FAIL if the file is truncated, corrupt or has another size</returns>
+HRESULT DecompressQOI(const BYTE* pInput, DWORD nSize, BYTE* pRGB, int nWidth, int nHeight);
+
+class QOIEncoder
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    QOIEncoder();
+
+    /// <summary>
+    /// Start the threads encoding the stripes
+    /// </summary>
+    /// <param name="nThreads">number of workers besides the calling thread, 0 to encode inline</param>
+    void                    Start(UINT nThreads);
+
+    /// <summary>
+    /// Compress a 24-bit color frame
+    /// </summary>
+    /// <param name="pRGB">pixels, R-G-B order (or B-G-R if bBGR is set)</param>
+    /// <param name="nWidth">width (in pixels) of the frame</param>
+    /// <param name="nHeight">height (in pixels) of the frame</param>
+    /// <param name="bBGR">true if the pixels are in B-G-R order</param>
+    /// <returns>compressed size in bytes</returns>
+    DWORD                   Encode(const BYTE* pRGB, int nWidth, int nHeight, bool bBGR);
+
+    /// <summary>
+    /// Get the QOI file of the last encoded frame
+    /// </summary>
+    const BYTE*             GetData() const { return m_vOutput.data(); }
+
+private:
+    ConversionPool          m_cPool;
+    std::vector<BYTE>       m_vOutput;
+    std::vector<BYTE>       m_vStripes;
+    std::vector<DWORD>      m_vStripeSize;      // indexed by the first row of a stripe
+    std::vector<int>        m_vStripeRows;      // indexed by the first row of a stripe
+};
@@ -0,0 +1,177 @@
+// ConversionPool.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "ConversionPool.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+ConversionPool::ConversionPool() :
+m_nBands(0),
+m_nGeneration(0),
+m_bStop(false),
+m_pfnBand(NULL),
+m_nRows(0),
+m_nJobBands(0),
+m_nNextBand(0),
+m_nPendingBands(0)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+ConversionPool::~ConversionPool()
+{
+    Stop();
+}
+
+/// <summary>
+/// Start the workers, stopping the previous ones first
+/// </summary>
+/// <param name="nThreads">number of workers, 0 to convert everything inline</param>
+/// <param name="nBands">number of row bands per frame, 0 for one per thread (workers + caller)</param>
+/// <param name="nAffinityMask">cores the workers are pinned to in turn, 0 to leave them unpinned</param>
+void ConversionPool::Start(UINT nThreads, UINT nBands, DWORD_PTR nAffinityMask)
+{
+    Stop();
+
+    m_bStop = false;
+    m_nBands = nBands ? nBands : nThreads + 1;
+
+    // Collect the cores of the mask so that every worker gets its own one (round robin)
+    std::vector<DWORD_PTR> vCores;
+    for (int i = 0; i < static_cast<int>(sizeof(DWORD_PTR) * 8); ++i)
+    {
+        if (nAffinityMask & (static_cast<DWORD_PTR>(1) << i))
+        {
+            vCores.push_back(static_cast<DWORD_PTR>(1) << i);
+        }
+    }
+
+    for (UINT i = 0; i < nThreads; ++i)
+    {
+        DWORD_PTR nAffinity = vCores.empty() ? 0 : vCores[i % vCores.size()];
+        m_vThreads.push_back(std::thread(&ConversionPool::WorkerThread, this, nAffinity));
+    }
+}
+
+/// <summary>
+/// Stop and join the workers
+/// </summary>
+void ConversionPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cvStart.notify_all();
+
+    for (size_t i = 0; i < m_vThreads.size(); ++i)
+    {
+        m_vThreads[i].join();
+    }
+    m_vThreads.clear();
+}
+
+/// <summary>
+/// Worker thread waiting for jobs
+/// </summary>
+/// <param name="nAffinity">affinity mask of the worker, 0 to leave it unpinned</param>
+void ConversionPool::WorkerThread(DWORD_PTR nAffinity)
+{
+#ifdef _WIN32
+    if (nAffinity)
+    {
+        SetThreadAffinityMask(GetCurrentThread(), nAffinity);
+    }
+#else
+    UNREFERENCED_PARAMETER(nAffinity);  // pinning is left to the system
+#endif
+
+    UINT64 nSeen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_bStop && m_nGeneration == nSeen)
+            {
+                m_cvStart.wait(lock);
+            }
+            if (m_bStop)
+            {
+                return;
+            }
+            nSeen = m_nGeneration;
+        }
+
+        RunBands();
+    }
+}
+
+/// <summary>
+/// Convert bands of the current job until none is left
+/// </summary>
+void ConversionPool::RunBands()
+{
+    while (true)
+    {
+        int nBand = m_nNextBand++;
+        if (nBand >= m_nJobBands)
+        {
+            return;
+        }
+
+        int nFirstRow = m_nRows * nBand / m_nJobBands;
+        int nLastRow = m_nRows * (nBand + 1) / m_nJobBands;
+        (*m_pfnBand)(nFirstRow, nLastRow - nFirstRow);
+
+        // The last band wakes up the caller
+        if (--m_nPendingBands == 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cvDone.notify_all();
+        }
+    }
+}
+
+/// <summary>
+/// Run a conversion over all rows of a frame, split in bands
+/// </summary>
+/// <param name="nRows">number of rows of the frame</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="fnBand">converts rows [nFirstRow, nFirstRow + nRows)</param>
+void ConversionPool::Run(int nRows, int nWidth, const std::function<void(int nFirstRow, int nRows)>& fnBand)
+{
+    int nBands = min(static_cast<int>(m_nBands), nRows);
+
+    // Not worth waking up the workers
+    if (m_vThreads.empty() || nBands <= 1 || nRows * nWidth < ConversionInlinePixels)
+    {
+        fnBand(0, nRows);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pfnBand = &fnBand;
+        m_nRows = nRows;
+        m_nJobBands = nBands;
+        m_nPendingBands = nBands;
+        m_nNextBand = 0;
+        ++m_nGeneration;
+    }
+    m_cvStart.notify_all();
+
+    // The caller converts bands as well, then waits for the stragglers (completion barrier)
+    RunBands();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_nPendingBands > 0)
+    {
+        m_cvDone.wait(lock);
+    }
+}
@@ -0,0 +1,89 @@
+// ConversionPool.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Small persistent thread pool splitting frame conversions into row bands.
+// The calling thread works on bands too and returns once all of them are done.
+
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/// Frames with fewer pixels than ConversionInlinePixels are converted inline on the calling thread
+#define ConversionInlinePixels (1 << 18)
+
+/// The ConversionDefaultThreads value specifies the maximum number of workers started by default
+#define ConversionDefaultThreads 3
+
+class ConversionPool
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    ConversionPool();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~ConversionPool();
+
+    /// <summary>
+    /// Start the workers, stopping the previous ones first
+    /// </summary>
+    /// <param name="nThreads">number of workers, 0 to convert everything inline</param>
+    /// <param name="nBands">number of row bands per frame, 0 for one per thread (workers + caller)</param>
+    /// <param name="nAffinityMask">cores the workers are pinned to in turn, 0 to leave them unpinned</param>
+    void                    Start(UINT nThreads, UINT nBands, DWORD_PTR nAffinityMask);
+
+    /// <summary>
+    /// Stop and join the workers
+    /// </summary>
+    void                    Stop();
+
+    /// <summary>
+    /// Get the number of workers
+    /// </summary>
+    UINT                    GetThreadCount() const { return static_cast<UINT>(m_vThreads.size()); }
+
+    /// <summary>
+    /// Run a conversion over all rows of a frame, split in bands
+    /// </summary>
+    /// <param name="nRows">number of rows of the frame</param>
+    /// <param name="nWidth">width (in pixels) of a row</param>
+    /// <param name="fnBand">converts rows [nFirstRow, nFirstRow + nRows)</param>
+    void                    Run(int nRows, int nWidth, const std::function<void(int nFirstRow, int nRows)>& fnBand);
+
+private:
+    std::vector<std::thread> m_vThreads;
+    UINT                    m_nBands;
+    std::mutex              m_mutex;
+    std::condition_variable m_cvStart;
+    std::condition_variable m_cvDone;
+    UINT64                  m_nGeneration;
+    bool                    m_bStop;
+
+    // Current job
+    const std::function<void(int, int)>* m_pfnBand;
+    int                     m_nRows;
+    int                     m_nJobBands;
+    std::atomic<int>        m_nNextBand;
+    std::atomic<int>        m_nPendingBands;
+
+    /// <summary>
+    /// Worker thread waiting for jobs
+    /// </summary>
+    /// <param name="nAffinity">affinity mask of the worker, 0 to leave it unpinned</param>
+    void                    WorkerThread(DWORD_PTR nAffinity);
+
+    /// <summary>
+    /// Convert bands of the current job until none is left
+    /// </summary>
+    void                    RunBands();
+};
@@ -0,0 +1,122 @@
+// ConverterBenchmark.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include <strsafe.h>
+#include <vector>
+#include "ConverterBenchmark.h"
+#include "FrameConverter.h"
+
+static const int cBenchmarkWidth = 1920;
+static const int cBenchmarkHeight = 1080;
+
+/// <summary>
+/// Average time of a conversion in milliseconds
+/// </summary>
+template <class Function>
+static double TimeConversion(double fFreq, Function fn)
+{
+    LARGE_INTEGER qpcStart = { 0 };
+    LARGE_INTEGER qpcEnd = { 0 };
+
+    fn();   // warm up the caches
+    QueryPerformanceCounter(&qpcStart);
+    for (int i = 0; i < BenchmarkIterations; ++i)
+    {
+        fn();
+    }
+    QueryPerformanceCounter(&qpcEnd);
+
+    return 1000.0 * (qpcEnd.QuadPart - qpcStart.QuadPart) / (fFreq * BenchmarkIterations);
+}
+
+/// <summary>
+/// Run the color conversion benchmark on a synthetic 1920x1080 frame
+/// </summary>
+/// <param name="szReport">receives one line of timings per instruction set</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if every kernel matches the scalar reference, E_FAIL otherwise</returns>
+HRESULT RunConverterBenchmark(LPWSTR szReport, size_t cchReport)
+{
+    static const LPCWSTR aLevelNames[] = { L"Scalar", L"SSE2", L"SSSE3", L"AVX2" };
+    const int nPixels = cBenchmarkWidth * cBenchmarkHeight;
+
+    LARGE_INTEGER qpcFreq = { 0 };
+    if (!QueryPerformanceFrequency(&qpcFreq))
+    {
+        return E_FAIL;
+    }
+    double fFreq = double(qpcFreq.QuadPart);
+
+    // Noise, so that no kernel benefits from flat input
+    std::vector<BYTE> vYUY2(nPixels * 2);
+    std::vector<RGBQUAD> vBGRA(nPixels);
+    BYTE* pNoise = reinterpret_cast<BYTE*>(&vBGRA[0]);
+    UINT nSeed = 1;
+    for (int i = 0; i < nPixels * 4; ++i)
+    {
+        nSeed = nSeed * 1103515245 + 12345;
+        pNoise[i] = static_cast<BYTE>(nSeed >> 16);
+        if (i < nPixels * 2)
+        {
+            vYUY2[i] = static_cast<BYTE>(nSeed >> 24);
+        }
+    }
+    const RGBQUAD* pBGRA = &vBGRA[0];
+
+    std::vector<RGBQUAD> vPreview(nPixels), vPreviewRef(nPixels);
+    std::vector<RGBTRIPLE> vRGB(nPixels), vRGBRef(nPixels);
+    std::vector<RGBQUAD> vHalf(nPixels / 4), vHalfRef(nPixels / 4);
+    std::vector<RGBQUAD> vShrink2(nPixels / 4), vShrink2Ref(nPixels / 4);
+    std::vector<RGBQUAD> vShrink4(nPixels / 16), vShrink4Ref(nPixels / 16);
+    std::vector<RGBTRIPLE> vColor(nPixels), vColorRef(nPixels);
+
+    SimdLevel nPrevious = GetSimdLevel();
+    SimdLevel nSupported = SetSimdLevel(SimdLevel_AVX2);
+    HRESULT hr = S_OK;
+
+    StringCchPrintf(szReport, cchReport, L"%dx%d, ms per frame (Color = BGRA to RGB, Preview = BGRA at 1/2, 1/4 size, YUY2 = to BGRA, to RGB, half size)\n", cBenchmarkWidth, cBenchmarkHeight);
+
+    for (int nLevel = SimdLevel_None; nLevel <= nSupported; ++nLevel)
+    {
+        SetSimdLevel(static_cast<SimdLevel>(nLevel));
+
+        bool bReference = (SimdLevel_None == nLevel);
+        RGBTRIPLE* pColor = bReference ? &vColorRef[0] : &vColor[0];
+        RGBQUAD* pPreview = bReference ? &vPreviewRef[0] : &vPreview[0];
+        RGBTRIPLE* pRGB = bReference ? &vRGBRef[0] : &vRGB[0];
+        RGBQUAD* pHalf = bReference ? &vHalfRef[0] : &vHalf[0];
+        RGBQUAD* pShrink2 = bReference ? &vShrink2Ref[0] : &vShrink2[0];
+        RGBQUAD* pShrink4 = bReference ? &vShrink4Ref[0] : &vShrink4[0];
+        const BYTE* pYUY2 = &vYUY2[0];
+
+        double fColor = TimeConversion(fFreq, [=]{ ConvertColor(pBGRA, pColor, NULL, cBenchmarkWidth, cBenchmarkHeight, false); });
+        double fPreview = TimeConversion(fFreq, [=]{ ConvertYUY2(pYUY2, pPreview, cBenchmarkWidth, cBenchmarkHeight, YUVMatrix_BT601, true); });
+        double fRGB = TimeConversion(fFreq, [=]{ ConvertYUY2ToRGB(pYUY2, pRGB, cBenchmarkWidth, cBenchmarkHeight, YUVMatrix_BT601, true, false); });
+        double fHalf = TimeConversion(fFreq, [=]{ DownscaleYUY2(pYUY2, pHalf, cBenchmarkWidth, cBenchmarkHeight, YUVMatrix_BT601, true); });
+        double fShrink2 = TimeConversion(fFreq, [=]{ DownscaleBGRA(pBGRA, pShrink2, cBenchmarkWidth, cBenchmarkHeight, 2, true); });
+        double fShrink4 = TimeConversion(fFreq, [=]{ DownscaleBGRA(pBGRA, pShrink4, cBenchmarkWidth, cBenchmarkHeight, 4, true); });
+
+        bool bMatch = bReference ||
+            (0 == memcmp(&vColor[0], &vColorRef[0], vColor.size() * sizeof(RGBTRIPLE)) &&
+            0 == memcmp(&vPreview[0], &vPreviewRef[0], vPreview.size() * sizeof(RGBQUAD)) &&
+            0 == memcmp(&vRGB[0], &vRGBRef[0], vRGB.size() * sizeof(RGBTRIPLE)) &&
+            0 == memcmp(&vHalf[0], &vHalfRef[0], vHalf.size() * sizeof(RGBQUAD)) &&
+            0 == memcmp(&vShrink2[0], &vShrink2Ref[0], vShrink2.size() * sizeof(RGBQUAD)) &&
+            0 == memcmp(&vShrink4[0], &vShrink4Ref[0], vShrink4.size() * sizeof(RGBQUAD)));
+        if (!bMatch)
+        {
+            hr = E_FAIL;
+        }
+
+        WCHAR szLine[256];
+        StringCchPrintf(szLine, _countof(szLine), L"%s:\tColor %.2f\tPreview %.2f / %.2f\tYUY2 %.2f / %.2f / %.2f%s\n",
+            aLevelNames[nLevel], fColor, fShrink2, fShrink4, fPreview, fRGB, fHalf, bMatch ? L"" : L"\tMISMATCH");
+        StringCchCat(szReport, cchReport, szLine);
+    }
+
+    SetSimdLevel(nPrevious);
+    return hr;
+}
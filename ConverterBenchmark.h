@@ -0,0 +1,20 @@
+// ConverterBenchmark.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Times the color conversion kernels at every instruction set the CPU supports
+// and checks their output against the scalar reference.
+
+
+#pragma once
+
+/// The BenchmarkIterations value specifies how many times every kernel converts the test frame
+#define BenchmarkIterations 20
+
+/// <summary>
+/// Run the color conversion benchmark on a synthetic 1920x1080 frame
+/// </summary>
+/// <param name="szReport">receives one line of timings per instruction set</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if every kernel matches the scalar reference, E_FAIL otherwise</returns>
+HRESULT RunConverterBenchmark(LPWSTR szReport, size_t cchReport);
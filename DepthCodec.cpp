@@ -0,0 +1,172 @@
+// DepthCodec.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "DepthCodec.h"
+
+/// <summary>
+/// Append a value as 3-bit groups, the high bit of a nibble flagging a following group
+/// </summary>
+static inline void EncodeVLE(UINT nValue, UINT& nWord, int& nNibbles, UINT*& pOutput)
+{
+    // Most deltas and run lengths fit a single nibble
+    if (nValue < 8)
+    {
+        nWord = (nWord << 4) | nValue;
+        if (++nNibbles == 8)
+        {
+            *pOutput++ = static_cast<UINT>(nWord);
+            nNibbles = 0;
+        }
+        return;
+    }
+
+    do
+    {
+        UINT nNibble = nValue & 0x7;
+        nValue >>= 3;
+        if (nValue)
+        {
+            nNibble |= 0x8;
+        }
+        nWord = (nWord << 4) | nNibble;
+        if (++nNibbles == 8)
+        {
+            *pOutput++ = static_cast<UINT>(nWord);
+            nNibbles = 0;
+        }
+    } while (nValue);
+}
+
+/// <summary>
+/// Read a value written by EncodeVLE
+/// </summary>
+static inline bool DecodeVLE(UINT& nValue, UINT& nWord, int& nNibbles, const UINT*& pInput, const UINT* pEnd)
+{
+    nValue = 0;
+    for (int nShift = 0; nShift < 32; nShift += 3)
+    {
+        if (!nNibbles)
+        {
+            if (pInput == pEnd)
+            {
+                return false;
+            }
+            nWord = *pInput++;
+            nNibbles = 8;
+        }
+
+        UINT nNibble = nWord >> 28;
+        nWord <<= 4;
+        --nNibbles;
+
+        nValue |= (nNibble & 0x7) << nShift;
+        if (!(nNibble & 0x8))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Compress a big-endian depth frame
+/// </summary>
+/// <param name="pDepth">big-endian depth values</param>
+/// <param name="nPixels">number of pixels</param>
+/// <param name="pOutput">receives the compressed stream, at least RVLMaxSize(nPixels) bytes</param>
+/// <returns>compressed size in bytes</returns>
+DWORD CompressRVL(const UINT16* pDepth, int nPixels, BYTE* pOutput)
+{
+    UINT* pWords = reinterpret_cast<UINT*>(pOutput);
+    const UINT16* pEnd = pDepth + nPixels;
+    UINT nWord = 0;
+    int nNibbles = 0;
+    int nPrevious = 0;
+
+    while (pDepth != pEnd)
+    {
+        // run of invalid (zero) pixels
+        const UINT16* pRun = pDepth;
+        while (pDepth != pEnd && !*pDepth)
+        {
+            ++pDepth;
+        }
+        EncodeVLE(static_cast<UINT>(pDepth - pRun), nWord, nNibbles, pWords);
+
+        // run of valid pixels
+        pRun = pDepth;
+        while (pDepth != pEnd && *pDepth)
+        {
+            ++pDepth;
+        }
+        EncodeVLE(static_cast<UINT>(pDepth - pRun), nWord, nNibbles, pWords);
+
+        // zigzag-coded deltas of the valid pixels
+        for (; pRun != pDepth; ++pRun)
+        {
+            int nCurrent = static_cast<UINT16>((*pRun >> 8) | (*pRun << 8));
+            int nDelta = nCurrent - nPrevious;
+            EncodeVLE(static_cast<UINT>((nDelta << 1) ^ (nDelta >> 31)), nWord, nNibbles, pWords);
+            nPrevious = nCurrent;
+        }
+    }
+
+    if (nNibbles)
+    {
+        *pWords++ = static_cast<UINT>(nWord << (4 * (8 - nNibbles)));
+    }
+
+    return static_cast<DWORD>(reinterpret_cast<BYTE*>(pWords) - pOutput);
+}
+
+/// <summary>
+/// Decompress a depth frame into big-endian depth values
+/// </summary>
+/// <param name="pInput">compressed stream</param>
+/// <param name="nSize">compressed size in bytes</param>
+/// <param name="pDepth">receives the big-endian depth values</param>
+/// <param name="nPixels">number of pixels</param>
+/// <returns>S_OK on success, E_FAIL if the stream is truncated or corrupt</returns>
+HRESULT DecompressRVL(const BYTE* pInput, DWORD nSize, UINT16* pDepth, int nPixels)
+{
+    const UINT* pWords = reinterpret_cast<const UINT*>(pInput);
+    const UINT* pWordsEnd = pWords + nSize / sizeof(UINT);
+    UINT16* pEnd = pDepth + nPixels;
+    UINT nWord = 0;
+    int nNibbles = 0;
+    int nPrevious = 0;
+
+    while (pDepth != pEnd)
+    {
+        UINT nZeros = 0;
+        UINT nValid = 0;
+        if (!DecodeVLE(nZeros, nWord, nNibbles, pWords, pWordsEnd) || nZeros > static_cast<UINT>(pEnd - pDepth))
+        {
+            return E_FAIL;
+        }
+        memset(pDepth, 0, nZeros * sizeof(UINT16));
+        pDepth += nZeros;
+
+        if (!DecodeVLE(nValid, nWord, nNibbles, pWords, pWordsEnd) || nValid > static_cast<UINT>(pEnd - pDepth))
+        {
+            return E_FAIL;
+        }
+        for (UINT i = 0; i < nValid; ++i)
+        {
+            UINT nPositive = 0;
+            if (!DecodeVLE(nPositive, nWord, nNibbles, pWords, pWordsEnd))
+            {
+                return E_FAIL;
+            }
+
+            int nCurrent = nPrevious + static_cast<int>((nPositive >> 1) ^ (0 - (nPositive & 1)));
+            *pDepth++ = static_cast<UINT16>((nCurrent >> 8) | (nCurrent << 8));
+            nPrevious = nCurrent;
+        }
+    }
+
+    return S_OK;
+}
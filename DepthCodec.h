@@ -0,0 +1,58 @@
+// DepthCodec.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Lossless depth compression based on RVL (run length of zeros followed by
+// variable-length zigzag deltas), see A. Wilson, "Fast Lossless Depth Image
+// Compression", ISS 2017.
+//
+// The codec works on big-endian depth as kept in the ring buffers, so the
+// decoded frame is byte-identical to what would have been written as PGM.
+// The compressed stream is a sequence of little-endian 32-bit words, each
+// holding 8 nibbles starting from the most significant one.
+
+
+#pragma once
+
+#define RVLFileMagic        0x314C5652  // 'RVL1'
+
+/// Header of a *.rvl depth file, followed by the compressed stream
+#pragma pack(push, 1)
+struct RVLFileHeader
+{
+    DWORD                   nMagic;
+    WORD                    nWidth;
+    WORD                    nHeight;
+    DWORD                   nSize;          // compressed size in bytes
+};
+#pragma pack(pop)
+
+/// <summary>
+/// Upper bound of the compressed size of a depth frame
+/// </summary>
+/// <param name="nPixels">number of pixels</param>
+/// <returns>size in bytes the output buffer of CompressRVL must have</returns>
+inline DWORD RVLMaxSize(int nPixels)
+{
+    // at worst a zigzag delta takes 6 nibbles and each pixel adds two run lengths
+    return static_cast<DWORD>(nPixels) * 4 + 16;
+}
+
+/// <summary>
+/// Compress a big-endian depth frame
+/// </summary>
+/// <param name="pDepth">big-endian depth values</param>
+/// <param name="nPixels">number of pixels</param>
+/// <param name="pOutput">receives the compressed stream, at least RVLMaxSize(nPixels) bytes</param>
+/// <returns>compressed size in bytes</returns>
+DWORD CompressRVL(const UINT16* pDepth, int nPixels, BYTE* pOutput);
+
+/// <summary>
+/// Decompress a depth frame into big-endian depth values
+/// </summary>
+/// <param name="pInput">compressed stream</param>
+/// <param name="nSize">compressed size in bytes</param>
+/// <param name="pDepth">receives the big-endian depth values</param>
+/// <param name="nPixels">number of pixels</param>
+/// <returns>S_OK on success, E_FAIL if the stream is truncated or corrupt</returns>
+HRESULT DecompressRVL(const BYTE* pInput, DWORD nSize, UINT16* pDepth, int nPixels);
@@ -0,0 +1,275 @@
+// DepthCodecTest.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#ifdef _WIN32
+#include <strsafe.h>
+#endif
+#include "DepthCodecTest.h"
+#include "DepthCodec.h"
+
+static const int cTestWidth = 512;
+static const int cTestHeight = 424;
+
+/// The guard bytes written behind the compressed stream to catch an encoder overrun
+static const BYTE cGuardByte = 0xA5;
+static const DWORD cGuardSize = 64;
+
+/// <summary>
+/// Kind of synthetic test frame
+/// </summary>
+enum TestFrame
+{
+    TestFrame_Zero = 0,         // no valid pixel at all
+    TestFrame_Maximum,          // every pixel at the largest depth value
+    TestFrame_MaximumDeltas,    // valid pixels alternating between the smallest and the largest value
+    TestFrame_LongRuns,         // runs of zeros and of valid pixels spanning several rows
+    TestFrame_Scene,            // smooth depth with short holes, as delivered by the sensor
+    TestFrame_Noise,            // random depth with random holes
+    TestFrame_Count
+};
+
+/// <summary>
+/// Fill a synthetic test frame, the same on every run
+/// </summary>
+static void FillTestFrame(TestFrame nFrame, std::vector<UINT16>& vDepth)
+{
+    UINT nSeed = 1;
+    for (size_t i = 0; i < vDepth.size(); ++i)
+    {
+        nSeed = nSeed * 1103515245 + 12345;
+        UINT nRandom = nSeed >> 16;
+        int x = static_cast<int>(i % cTestWidth);
+        int y = static_cast<int>(i / cTestWidth);
+
+        switch (nFrame)
+        {
+        case TestFrame_Zero:
+            vDepth[i] = 0;
+            break;
+        case TestFrame_Maximum:
+            vDepth[i] = 0xFFFF;
+            break;
+        case TestFrame_MaximumDeltas:
+            vDepth[i] = (i & 1) ? 0x0100 : 0xFFFF;  // big-endian 1 and 65535
+            break;
+        case TestFrame_LongRuns:
+            // 3 rows of zeros, 100 rows of valid pixels, then the same again
+            vDepth[i] = ((y % 103) < 3) ? 0 : static_cast<UINT16>(500 + y * 8 + x);
+            break;
+        case TestFrame_Scene:
+            vDepth[i] = ((nRandom & 0x1F) == 0) ? 0 : static_cast<UINT16>(800 + y * 4 + (x >> 2) + (nRandom & 3));
+            break;
+        default:
+            vDepth[i] = ((nRandom & 3) == 0) ? 0 : static_cast<UINT16>(nSeed ^ (nSeed >> 20));
+            break;
+        }
+    }
+}
+
+/// <summary>
+/// Compress and decompress a frame, checking the output against the input and the bound of the compressed size
+/// </summary>
+/// <param name="vDepth">frame to round trip</param>
+/// <param name="pSize">receives the compressed size in bytes</param>
+/// <returns>true if the frame comes back unchanged</returns>
+static bool RoundTripFrame(const std::vector<UINT16>& vDepth, DWORD* pSize)
+{
+    int nPixels = static_cast<int>(vDepth.size());
+    DWORD nMaxSize = RVLMaxSize(nPixels);
+    std::vector<BYTE> vCompressed(nMaxSize + cGuardSize, cGuardByte);
+    std::vector<UINT16> vDecoded(vDepth.size() + 1, 0x5A5A);
+
+    *pSize = CompressRVL(vDepth.data(), nPixels, vCompressed.data());
+    for (DWORD i = nMaxSize; i < vCompressed.size(); ++i)
+    {
+        if (vCompressed[i] != cGuardByte)
+        {
+            return false;
+        }
+    }
+
+    // The decoder must not write past the frame either
+    return *pSize <= nMaxSize &&
+        SUCCEEDED(DecompressRVL(vCompressed.data(), *pSize, vDecoded.data(), nPixels)) &&
+        0 == memcmp(vDecoded.data(), vDepth.data(), vDepth.size() * sizeof(UINT16)) &&
+        0x5A5A == vDecoded[vDepth.size()];
+}
+
+/// <summary>
+/// Read a whole file
+/// </summary>
+static HRESULT ReadTestFile(LPCWSTR lpszFilePath, std::vector<BYTE>& vData)
+{
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    LARGE_INTEGER fileSize = { 0 };
+    HRESULT hr = GetFileSizeEx(hFile, &fileSize) ? S_OK : E_FAIL;
+
+    if (SUCCEEDED(hr))
+    {
+        DWORD dwBytesRead = 0;
+        vData.resize(static_cast<size_t>(fileSize.QuadPart));
+        if (!vData.empty() && (!ReadFile(hFile, &vData[0], static_cast<DWORD>(vData.size()), &dwBytesRead, NULL) || dwBytesRead != vData.size()))
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    CloseHandle(hFile);
+    return hr;
+#else
+    FILE* pFile = fopen(Utf8Path(lpszFilePath).c_str(), "rb");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    vData.clear();
+    BYTE buffer[65536];
+    size_t nRead = 0;
+    while ((nRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+    {
+        vData.insert(vData.end(), buffer, buffer + nRead);
+    }
+    HRESULT hr = ferror(pFile) ? E_FAIL : S_OK;
+    fclose(pFile);
+    return hr;
+#endif
+}
+
+/// <summary>
+/// Decode a recorded .rvl file and encode it again, which must give back the recorded stream
+/// </summary>
+/// <param name="lpszFilePath">file to check</param>
+/// <param name="szResult">receives the outcome</param>
+/// <param name="cchResult">size of szResult in characters</param>
+/// <returns>true if the file round trips exactly</returns>
+static bool CheckRVLFile(LPCWSTR lpszFilePath, LPWSTR szResult, size_t cchResult)
+{
+    std::vector<BYTE> vFile;
+    if (FAILED(ReadTestFile(lpszFilePath, vFile)))
+    {
+        StringCchCopyW(szResult, cchResult, L"cannot be read");
+        return false;
+    }
+
+    RVLFileHeader header = { 0 };
+    if (vFile.size() >= sizeof(header))
+    {
+        memcpy(&header, vFile.data(), sizeof(header));
+    }
+    if (header.nMagic != RVLFileMagic || header.nSize > vFile.size() - sizeof(header) || !header.nWidth || !header.nHeight)
+    {
+        StringCchCopyW(szResult, cchResult, L"not an RVL file");
+        return false;
+    }
+
+    // The stream is copied so that the codec reads aligned words
+    int nPixels = header.nWidth * header.nHeight;
+    std::vector<BYTE> vStream(vFile.begin() + sizeof(header), vFile.begin() + sizeof(header) + header.nSize);
+    std::vector<UINT16> vDepth(nPixels);
+    if (vStream.empty() || FAILED(DecompressRVL(vStream.data(), header.nSize, vDepth.data(), nPixels)))
+    {
+        StringCchCopyW(szResult, cchResult, L"corrupt stream");
+        return false;
+    }
+
+    std::vector<BYTE> vCompressed(RVLMaxSize(nPixels));
+    DWORD nSize = CompressRVL(vDepth.data(), nPixels, vCompressed.data());
+    if (nSize != header.nSize || memcmp(vCompressed.data(), vStream.data(), nSize))
+    {
+        StringCchCopyW(szResult, cchResult, L"MISMATCH");
+        return false;
+    }
+
+    DWORD nCheckedSize = 0;
+    if (!RoundTripFrame(vDepth, &nCheckedSize))
+    {
+        StringCchCopyW(szResult, cchResult, L"MISMATCH");
+        return false;
+    }
+
+    StringCchPrintfW(szResult, cchResult, L"%ux%u, %u bytes, ok", header.nWidth, header.nHeight, header.nSize);
+    return true;
+}
+
+/// <summary>
+/// Round trip synthetic depth frames, then the given .rvl files, through the RVL codec
+/// </summary>
+/// <param name="vFiles">recorded .rvl files to check, may be empty</param>
+/// <param name="szReport">receives one line per frame or file</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if every round trip is exact, E_FAIL otherwise</returns>
+HRESULT RunDepthCodecSelfTest(const std::vector<std::wstring>& vFiles, LPWSTR szReport, size_t cchReport)
+{
+    static const LPCWSTR aFrameNames[TestFrame_Count] = { L"All zero", L"All maximum", L"Maximum deltas", L"Long runs", L"Scene", L"Noise" };
+    HRESULT hr = S_OK;
+    WCHAR szLine[MAX_PATH + 64];
+
+    StringCchPrintfW(szReport, cchReport, L"RVL round trip, %dx%d synthetic frames\n", cTestWidth, cTestHeight);
+
+    std::vector<UINT16> vDepth(cTestWidth * cTestHeight);
+    for (int i = 0; i < TestFrame_Count; ++i)
+    {
+        FillTestFrame(static_cast<TestFrame>(i), vDepth);
+
+        DWORD nSize = 0;
+        bool bMatch = RoundTripFrame(vDepth, &nSize);
+        StringCchPrintfW(szLine, _countof(szLine), L"%ls:\t%u bytes\t%ls\n", aFrameNames[i], nSize, bMatch ? L"ok" : L"MISMATCH");
+        StringCchCatW(szReport, cchReport, szLine);
+        if (!bMatch)
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    // Frames of a single pixel, valid or not
+    for (int i = 0; i < 2; ++i)
+    {
+        std::vector<UINT16> vPixel(1, static_cast<UINT16>(i ? 0xFFFF : 0));
+        DWORD nSize = 0;
+        bool bMatch = RoundTripFrame(vPixel, &nSize);
+        StringCchPrintfW(szLine, _countof(szLine), L"Single %ls pixel:\t%u bytes\t%ls\n", i ? L"valid" : L"zero", nSize, bMatch ? L"ok" : L"MISMATCH");
+        StringCchCatW(szReport, cchReport, szLine);
+        if (!bMatch)
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    // A stream missing its last word has to be rejected rather than decoded
+    {
+        FillTestFrame(TestFrame_Scene, vDepth);
+        std::vector<BYTE> vCompressed(RVLMaxSize(static_cast<int>(vDepth.size())));
+        DWORD nSize = CompressRVL(vDepth.data(), static_cast<int>(vDepth.size()), vCompressed.data());
+        std::vector<UINT16> vDecoded(vDepth.size());
+        bool bRejected = FAILED(DecompressRVL(vCompressed.data(), nSize - sizeof(UINT), vDecoded.data(), static_cast<int>(vDecoded.size())));
+        StringCchPrintfW(szLine, _countof(szLine), L"Truncated stream:\t%ls\n", bRejected ? L"rejected, ok" : L"ACCEPTED");
+        StringCchCatW(szReport, cchReport, szLine);
+        if (!bRejected)
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    for (size_t i = 0; i < vFiles.size(); ++i)
+    {
+        WCHAR szResult[64];
+        if (!CheckRVLFile(vFiles[i].c_str(), szResult, _countof(szResult)))
+        {
+            hr = E_FAIL;
+        }
+        StringCchPrintfW(szLine, _countof(szLine), L"%ls:\t%ls\n", vFiles[i].c_str(), szResult);
+        StringCchCatW(szReport, cchReport, szLine);
+    }
+
+    return hr;
+}
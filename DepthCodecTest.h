@@ -0,0 +1,22 @@
+// DepthCodecTest.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Deterministic round trip of the RVL depth codec: synthetic frames covering
+// the edge cases of the format, then any recorded .rvl file, are decoded and
+// encoded again and compared bit for bit.
+
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+/// <summary>
+/// Round trip synthetic depth frames, then the given .rvl files, through the RVL codec
+/// </summary>
+/// <param name="vFiles">recorded .rvl files to check, may be empty</param>
+/// <param name="szReport">receives one line per frame or file</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if every round trip is exact, E_FAIL otherwise</returns>
+HRESULT RunDepthCodecSelfTest(const std::vector<std::wstring>& vFiles, LPWSTR szReport, size_t cchReport);
@@ -0,0 +1,254 @@
+// DepthColorizer.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include "DepthColorizer.h"
+#include "FrameConverter.h"
+#include <math.h>
+
+/// <summary>
+/// Make an opaque color from components in [0, 1]
+/// </summary>
+static RGBQUAD MakeColor(double fRed, double fGreen, double fBlue)
+{
+    RGBQUAD color;
+    color.rgbRed = static_cast<BYTE>(min(1.0, max(0.0, fRed)) * 255.0 + 0.5);
+    color.rgbGreen = static_cast<BYTE>(min(1.0, max(0.0, fGreen)) * 255.0 + 0.5);
+    color.rgbBlue = static_cast<BYTE>(min(1.0, max(0.0, fBlue)) * 255.0 + 0.5);
+    color.rgbReserved = 0xFF;
+    return color;
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+DepthColorizer::DepthColorizer() :
+m_pLUT(NULL),
+m_nColormap(DepthColormap_WrapGray),
+m_nMinDepth(0),
+m_nMaxDepth(0),
+m_bDirty(true),
+m_nFramesSinceBuild(0),
+m_pHistogram(NULL)
+{
+    // Values outside the reliable depth range keep the original blue
+    m_invalidColor.rgbRed = 34;
+    m_invalidColor.rgbGreen = 132;
+    m_invalidColor.rgbBlue = 212;
+    m_invalidColor.rgbReserved = 0xFF;
+
+    m_pLUT = new RGBQUAD[cTableSize];
+    m_pHistogram = new UINT[cTableSize];
+    BuildPalette();
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+DepthColorizer::~DepthColorizer()
+{
+    if (m_pLUT)
+    {
+        delete[] m_pLUT;
+        m_pLUT = NULL;
+    }
+
+    if (m_pHistogram)
+    {
+        delete[] m_pHistogram;
+        m_pHistogram = NULL;
+    }
+}
+
+/// <summary>
+/// Select the colormap
+/// </summary>
+/// <param name="nColormap">colormap used from the next frame on</param>
+void DepthColorizer::SetColormap(DepthColormap nColormap)
+{
+    if (nColormap < 0 || nColormap >= DepthColormap_Count || nColormap == m_nColormap)
+    {
+        return;
+    }
+
+    m_nColormap = nColormap;
+    BuildPalette();
+    m_bDirty = true;
+}
+
+/// <summary>
+/// Set the color of depth values outside the reliable range
+/// </summary>
+/// <param name="invalidColor">color used from the next frame on</param>
+void DepthColorizer::SetInvalidColor(RGBQUAD invalidColor)
+{
+    m_invalidColor = invalidColor;
+    m_invalidColor.rgbReserved = 0xFF;
+    m_bDirty = true;
+}
+
+/// <summary>
+/// Find a colormap by name
+/// </summary>
+/// <param name="szName">wrap, gray, turbo, jet or histogram</param>
+/// <param name="pColormap">receives the colormap</param>
+/// <returns>true if the name is known</returns>
+bool DepthColorizer::ParseColormap(LPCWSTR szName, DepthColormap* pColormap)
+{
+    static const LPCWSTR aNames[DepthColormap_Count] = { L"wrap", L"gray", L"turbo", L"jet", L"histogram" };
+
+    for (int i = 0; i < DepthColormap_Count; ++i)
+    {
+        if (0 == _wcsicmp(szName, aNames[i]))
+        {
+            *pColormap = static_cast<DepthColormap>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Fill m_aPalette with the 256 colors of the selected colormap
+/// </summary>
+void DepthColorizer::BuildPalette()
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        double x = i / 255.0;
+
+        switch (m_nColormap)
+        {
+        case DepthColormap_Turbo:
+            // Polynomial approximation of Google's Turbo colormap
+            m_aPalette[i] = MakeColor(
+                0.13572138 + x * (4.61539260 + x * (-42.66032258 + x * (132.13108234 + x * (-152.94239396 + x * 59.28637943)))),
+                0.09140261 + x * (2.19418839 + x * (4.84296658 + x * (-14.18503333 + x * (4.27729857 + x * 2.82956604)))),
+                0.10667330 + x * (12.64194608 + x * (-60.58204836 + x * (110.36276771 + x * (-89.90310912 + x * 27.34824973)))));
+            break;
+        case DepthColormap_Jet:
+            m_aPalette[i] = MakeColor(1.5 - fabs(4.0 * x - 3.0), 1.5 - fabs(4.0 * x - 2.0), 1.5 - fabs(4.0 * x - 1.0));
+            break;
+        default:
+            m_aPalette[i] = MakeColor(x, x, x);
+            break;
+        }
+    }
+}
+
+/// <summary>
+/// Rebuild the lookup table for the current range and colormap
+/// </summary>
+/// <param name="pBuffer">depth frame, used by the histogram colormap</param>
+/// <param name="nPixels">number of pixels in the frame</param>
+void DepthColorizer::BuildLUT(const UINT16* pBuffer, int nPixels)
+{
+    int nMin = m_nMinDepth;
+    int nMax = m_nMaxDepth;
+    int nRange = max(1, nMax - nMin);
+
+    for (int i = 0; i < nMin && i < cTableSize; ++i)
+    {
+        m_pLUT[i] = m_invalidColor;
+    }
+    for (int i = nMax + 1; i < cTableSize; ++i)
+    {
+        m_pLUT[i] = m_invalidColor;
+    }
+
+    switch (m_nColormap)
+    {
+    case DepthColormap_WrapGray:
+        // To convert to a byte, we're discarding the most-significant
+        // rather than least-significant bits.
+        // We're preserving detail, although the intensity will "wrap."
+        for (int i = nMin; i <= nMax; ++i)
+        {
+            m_pLUT[i] = m_aPalette[i & 0xFF];
+        }
+        break;
+
+    case DepthColormap_Histogram:
+        {
+            // Cumulative distribution of the reliable depth values of the frame
+            memset(m_pHistogram, 0, cTableSize * sizeof(UINT));
+            for (int i = 0; i < nPixels; ++i)
+            {
+                ++m_pHistogram[pBuffer[i]];
+            }
+
+            UINT64 nTotal = 0;
+            for (int i = nMin; i <= nMax; ++i)
+            {
+                nTotal += m_pHistogram[i];
+            }
+
+            UINT64 nCumulative = 0;
+            for (int i = nMin; i <= nMax; ++i)
+            {
+                nCumulative += m_pHistogram[i];
+                m_pLUT[i] = m_aPalette[nTotal ? static_cast<int>(nCumulative * 255 / nTotal) : 0];
+            }
+        }
+        break;
+
+    default:
+        for (int i = nMin; i <= nMax; ++i)
+        {
+            m_pLUT[i] = m_aPalette[(i - nMin) * 255 / nRange];
+        }
+        break;
+    }
+
+    m_bDirty = false;
+    m_nFramesSinceBuild = 0;
+}
+
+/// <summary>
+/// Bring the lookup table up to date for a depth frame
+/// </summary>
+/// <param name="pBuffer">depth frame as delivered by the sensor</param>
+/// <param name="nPixels">number of pixels in the frame</param>
+/// <param name="nMinDepth">minimum reliable depth</param>
+/// <param name="nMaxDepth">maximum reliable depth</param>
+/// <returns>color of every depth value, valid until the next call</returns>
+const RGBQUAD* DepthColorizer::Prepare(const UINT16* pBuffer, int nPixels, USHORT nMinDepth, USHORT nMaxDepth)
+{
+    if (nMinDepth != m_nMinDepth || nMaxDepth != m_nMaxDepth)
+    {
+        m_nMinDepth = nMinDepth;
+        m_nMaxDepth = nMaxDepth;
+        m_bDirty = true;
+    }
+
+    // The histogram follows the scene, everything else only changes with the range or the colormap
+    if (m_nColormap == DepthColormap_Histogram && ++m_nFramesSinceBuild >= cHistogramInterval)
+    {
+        m_bDirty = true;
+    }
+
+    if (m_bDirty)
+    {
+        BuildLUT(pBuffer, nPixels);
+    }
+
+    return m_pLUT;
+}
+
+/// <summary>
+/// Convert a depth frame into the mirrored RGBX preview and the mirrored big-endian storage
+/// </summary>
+/// <param name="pBuffer">depth frame as delivered by the sensor</param>
+/// <param name="pRGBX">receives the preview</param>
+/// <param name="pUINT16">receives the storage, 0 outside the reliable range</param>
+/// <param name="nWidth">width (in pixels) of the frame</param>
+/// <param name="nHeight">height (in pixels) of the frame</param>
+/// <param name="nMinDepth">minimum reliable depth</param>
+/// <param name="nMaxDepth">maximum reliable depth</param>
+void DepthColorizer::Colorize(const UINT16* pBuffer, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nHeight, USHORT nMinDepth, USHORT nMaxDepth)
+{
+    const RGBQUAD* pLUT = Prepare(pBuffer, nWidth * nHeight, nMinDepth, nMaxDepth);
+    ConvertDepth(pBuffer, pLUT, pRGBX, pUINT16, nWidth, nHeight, nMinDepth, nMaxDepth);
+}
@@ -0,0 +1,106 @@
+// DepthColorizer.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Depth visualization through a 64K-entry lookup table, rebuilt only when
+// the reliable range or the colormap changes.
+
+
+#pragma once
+
+/// Colormaps available for the depth view
+enum DepthColormap
+{
+    DepthColormap_WrapGray = 0,     // depth % 256, preserves detail but wraps
+    DepthColormap_LinearGray,       // reliable range stretched over [0, 255]
+    DepthColormap_Turbo,
+    DepthColormap_Jet,
+    DepthColormap_Histogram,        // histogram-equalized gray
+    DepthColormap_Count
+};
+
+class DepthColorizer
+{
+    static const int        cTableSize = 65536;
+    static const UINT       cHistogramInterval = 15;    // frames between histogram updates
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    DepthColorizer();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~DepthColorizer();
+
+    /// <summary>
+    /// Select the colormap
+    /// </summary>
+    /// <param name="nColormap">colormap used from the next frame on</param>
+    void                    SetColormap(DepthColormap nColormap);
+
+    /// <summary>
+    /// Get the selected colormap
+    /// </summary>
+    DepthColormap           GetColormap() const { return m_nColormap; }
+
+    /// <summary>
+    /// Set the color of depth values outside the reliable range
+    /// </summary>
+    /// <param name="invalidColor">color used from the next frame on</param>
+    void                    SetInvalidColor(RGBQUAD invalidColor);
+
+    /// <summary>
+    /// Find a colormap by name
+    /// </summary>
+    /// <param name="szName">wrap, gray, turbo, jet or histogram</param>
+    /// <param name="pColormap">receives the colormap</param>
+    /// <returns>true if the name is known</returns>
+    static bool             ParseColormap(LPCWSTR szName, DepthColormap* pColormap);
+
+    /// <summary>
+    /// Bring the lookup table up to date for a depth frame
+    /// </summary>
+    /// <param name="pBuffer">depth frame as delivered by the sensor</param>
+    /// <param name="nPixels">number of pixels in the frame</param>
+    /// <param name="nMinDepth">minimum reliable depth</param>
+    /// <param name="nMaxDepth">maximum reliable depth</param>
+    /// <returns>color of every depth value, valid until the next call</returns>
+    const RGBQUAD*          Prepare(const UINT16* pBuffer, int nPixels, USHORT nMinDepth, USHORT nMaxDepth);
+
+    /// <summary>
+    /// Convert a depth frame into the mirrored RGBX preview and the mirrored big-endian storage
+    /// </summary>
+    /// <param name="pBuffer">depth frame as delivered by the sensor</param>
+    /// <param name="pRGBX">receives the preview</param>
+    /// <param name="pUINT16">receives the storage, 0 outside the reliable range</param>
+    /// <param name="nWidth">width (in pixels) of the frame</param>
+    /// <param name="nHeight">height (in pixels) of the frame</param>
+    /// <param name="nMinDepth">minimum reliable depth</param>
+    /// <param name="nMaxDepth">maximum reliable depth</param>
+    void                    Colorize(const UINT16* pBuffer, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nHeight, USHORT nMinDepth, USHORT nMaxDepth);
+
+private:
+    RGBQUAD*                m_pLUT;
+    RGBQUAD                 m_aPalette[256];
+    RGBQUAD                 m_invalidColor;
+    DepthColormap           m_nColormap;
+    USHORT                  m_nMinDepth;
+    USHORT                  m_nMaxDepth;
+    bool                    m_bDirty;
+    UINT                    m_nFramesSinceBuild;
+    UINT*                   m_pHistogram;
+
+    /// <summary>
+    /// Fill m_aPalette with the 256 colors of the selected colormap
+    /// </summary>
+    void                    BuildPalette();
+
+    /// <summary>
+    /// Rebuild the lookup table for the current range and colormap
+    /// </summary>
+    /// <param name="pBuffer">depth frame, used by the histogram colormap</param>
+    /// <param name="nPixels">number of pixels in the frame</param>
+    void                    BuildLUT(const UINT16* pBuffer, int nPixels);
+};
@@ -0,0 +1,740 @@
+// FrameContainer.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include "FrameContainer.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+FrameContainerWriter::FrameContainerWriter() :
+m_hFile(INVALID_HANDLE_VALUE),
+m_pChunk(NULL),
+m_nChunkUsed(0),
+m_nOffset(0)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+FrameContainerWriter::~FrameContainerWriter()
+{
+    Close();
+}
+
+/// <summary>
+/// Create the container file and write its header
+/// </summary>
+/// <param name="lpszFilePath">full file path of the container</param>
+/// <param name="nExpectedSize">expected size of the container, reserved on disk up front (0 for none)</param>
+/// <returns>indicates success or failure</returns>
+HRESULT FrameContainerWriter::Open(LPCWSTR lpszFilePath, UINT64 nExpectedSize)
+{
+    Close();
+
+    if (!m_pChunk)
+    {
+        m_pChunk = static_cast<BYTE*>(_aligned_malloc(ContainerChunkSize, ContainerAlignment));
+        if (!m_pChunk)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    m_hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == m_hFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    // Reserve the extents of the whole record so that the chunks land in one contiguous run.
+    // Only the allocation grows: the end of file still follows the data (the forward scan relies on it)
+    // and the unused part of the reservation is released when the file is closed.
+    if (nExpectedSize)
+    {
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize.QuadPart = (nExpectedSize + ContainerAlignment - 1) & ~static_cast<UINT64>(ContainerAlignment - 1);
+        SetFileInformationByHandle(m_hFile, FileAllocationInfo, &allocation, sizeof(allocation));   // a failure only costs contiguity
+    }
+
+    m_nChunkUsed = 0;
+    m_nOffset = 0;
+    m_vIndex.clear();
+    m_vIndex.reserve(1800);
+
+    ContainerHeader header = { 0 };
+    header.nMagic = ContainerMagic;
+    header.nVersion = ContainerVersion;
+    header.nHeaderSize = sizeof(ContainerHeader);
+    header.nChunkSize = ContainerChunkSize;
+
+    return Append(reinterpret_cast<const BYTE*>(&header), sizeof(header));
+}
+
+/// <summary>
+/// Append a frame record
+/// </summary>
+/// <param name="nStream">stream the frame belongs to</param>
+/// <param name="nCodec">layout of the payload</param>
+/// <param name="nTime">relative time of the frame</param>
+/// <param name="nWidth">width (in pixels) of the frame</param>
+/// <param name="nHeight">height (in pixels) of the frame</param>
+/// <param name="pData">payload</param>
+/// <param name="nSize">payload size in bytes</param>
+/// <returns>indicates success or failure</returns>
+HRESULT FrameContainerWriter::AppendFrame(FrameStream nStream, FrameCodec nCodec, INT64 nTime, int nWidth, int nHeight, const BYTE* pData, DWORD nSize)
+{
+    if (!IsOpen())
+    {
+        return E_FAIL;
+    }
+
+    FrameRecordHeader record = { 0 };
+    record.nMagic = FrameRecordMagic;
+    record.nStream = static_cast<WORD>(nStream);
+    record.nCodec = static_cast<WORD>(nCodec);
+    record.nTime = nTime;
+    record.nSize = nSize;
+    record.nWidth = static_cast<WORD>(nWidth);
+    record.nHeight = static_cast<WORD>(nHeight);
+
+    FrameIndexEntry entry = { 0 };
+    entry.nTime = nTime;
+    entry.nOffset = m_nOffset;
+    entry.nSize = nSize;
+    entry.nStream = record.nStream;
+    entry.nCodec = record.nCodec;
+    entry.nWidth = record.nWidth;
+    entry.nHeight = record.nHeight;
+
+    HRESULT hr = Append(reinterpret_cast<const BYTE*>(&record), sizeof(record));
+
+    if (SUCCEEDED(hr))
+    {
+        hr = Append(pData, nSize);
+    }
+
+    // Keep every record header 8-byte aligned
+    if (SUCCEEDED(hr) && (nSize & 7))
+    {
+        const BYTE padding[8] = { 0 };
+        hr = Append(padding, 8 - (nSize & 7));
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_vIndex.push_back(entry);
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Flush the pending chunk, write the index footer and close the file
+/// </summary>
+/// <returns>indicates success or failure</returns>
+HRESULT FrameContainerWriter::Close()
+{
+    HRESULT hr = S_OK;
+
+    if (IsOpen())
+    {
+        ContainerTrailer trailer = { 0 };
+        trailer.nIndexOffset = m_nOffset;
+        trailer.nCount = static_cast<DWORD>(m_vIndex.size());
+        trailer.nMagic = ContainerIndexMagic;
+
+        if (!m_vIndex.empty())
+        {
+            hr = Append(reinterpret_cast<const BYTE*>(&m_vIndex[0]), static_cast<DWORD>(m_vIndex.size() * sizeof(FrameIndexEntry)));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = Append(reinterpret_cast<const BYTE*>(&trailer), sizeof(trailer));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = FlushChunk();
+        }
+
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    if (m_pChunk)
+    {
+        _aligned_free(m_pChunk);
+        m_pChunk = NULL;
+    }
+
+    m_vIndex.clear();
+
+    return hr;
+}
+
+/// <summary>
+/// Copy bytes to the chunk buffer, writing the chunk whenever it is full
+/// </summary>
+HRESULT FrameContainerWriter::Append(const BYTE* pData, DWORD nSize)
+{
+    while (nSize)
+    {
+        DWORD nCopy = min(nSize, static_cast<DWORD>(ContainerChunkSize) - m_nChunkUsed);
+        memcpy(m_pChunk + m_nChunkUsed, pData, nCopy);
+        m_nChunkUsed += nCopy;
+        m_nOffset += nCopy;
+        pData += nCopy;
+        nSize -= nCopy;
+
+        if (m_nChunkUsed == ContainerChunkSize)
+        {
+            HRESULT hr = FlushChunk();
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Write the used part of the chunk buffer to the file
+/// </summary>
+HRESULT FrameContainerWriter::FlushChunk()
+{
+    if (m_nChunkUsed)
+    {
+        DWORD dwBytesWritten = 0;
+        if (!WriteFile(m_hFile, m_pChunk, m_nChunkUsed, &dwBytesWritten, NULL) || dwBytesWritten != m_nChunkUsed)
+        {
+            return E_FAIL;
+        }
+        m_nChunkUsed = 0;
+    }
+
+    return S_OK;
+}
+
+/// Mapped views start on the allocation granularity of Windows
+#define MappedViewAlignment (64 * 1024)
+
+/// <summary>
+/// Constructor
+/// </summary>
+MappedContainerWriter::MappedContainerWriter() :
+m_hFile(INVALID_HANDLE_VALUE),
+m_bOpen(false),
+m_bBusy(false),
+m_nStride(0),
+m_nWindowFrames(0),
+m_nMapped(0),
+m_nReleased(0),
+m_nProduced(0),
+m_nCommitted(0)
+{
+    ZeroMemory(&m_record, sizeof(m_record));
+    ZeroMemory(m_aViews, sizeof(m_aViews));
+    ZeroMemory(m_aViewSizes, sizeof(m_aViewSizes));
+    ZeroMemory(m_aFirstRecords, sizeof(m_aFirstRecords));
+    ZeroMemory(m_abInPlace, sizeof(m_abInPlace));
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+MappedContainerWriter::~MappedContainerWriter()
+{
+    Close();
+}
+
+/// <summary>
+/// Create the container file, reserve its extents and map the first windows
+/// </summary>
+/// <param name="lpszFilePath">full file path of the container</param>
+/// <param name="nStream">stream of the frames</param>
+/// <param name="nCodec">layout of the frames</param>
+/// <param name="nWidth">width (in pixels) of the frames</param>
+/// <param name="nHeight">height (in pixels) of the frames</param>
+/// <param name="nFrameSize">payload size of every frame in bytes</param>
+/// <param name="nExpectedSize">expected size of the container, reserved on disk up front (0 for none)</param>
+/// <returns>indicates success or failure</returns>
+HRESULT MappedContainerWriter::Open(LPCWSTR lpszFilePath, FrameStream nStream, FrameCodec nCodec, int nWidth, int nHeight, DWORD nFrameSize, UINT64 nExpectedSize)
+{
+    Close();
+
+    // A writable mapping needs read access as well
+    m_hFile = CreateFileW(lpszFilePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == m_hFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    if (nExpectedSize)
+    {
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize.QuadPart = (nExpectedSize + ContainerAlignment - 1) & ~static_cast<UINT64>(ContainerAlignment - 1);
+        SetFileInformationByHandle(m_hFile, FileAllocationInfo, &allocation, sizeof(allocation));   // a failure only costs contiguity
+    }
+
+    // Same record layout as FrameContainerWriter
+    m_record.nMagic = FrameRecordMagic;
+    m_record.nStream = static_cast<WORD>(nStream);
+    m_record.nCodec = static_cast<WORD>(nCodec);
+    m_record.nSize = nFrameSize;
+    m_record.nWidth = static_cast<WORD>(nWidth);
+    m_record.nHeight = static_cast<WORD>(nHeight);
+    m_nStride = sizeof(FrameRecordHeader) + ((nFrameSize + 7) & ~7);
+    m_nWindowFrames = max(1u, static_cast<UINT>(MappedWindowSize / m_nStride));
+
+    m_nMapped = 0;
+    m_nReleased = 0;
+    m_nProduced = 0;
+    m_nCommitted = 0;
+    m_vIndex.clear();
+    m_vIndex.reserve(1800);
+
+    HRESULT hr = S_OK;
+    for (UINT i = 0; i < MappedWindowCount && SUCCEEDED(hr); ++i)
+    {
+        hr = MapWindow();
+    }
+
+    // Only the first window is required, the others are retried by CommitFrame
+    if (!m_nMapped)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+        return hr;
+    }
+
+    ContainerHeader header = { 0 };
+    header.nMagic = ContainerMagic;
+    header.nVersion = ContainerVersion;
+    header.nHeaderSize = sizeof(ContainerHeader);
+    header.nChunkSize = MappedWindowSize;
+    memcpy(m_aViews[0], &header, sizeof(header));
+
+    m_bOpen = true;
+    return S_OK;
+}
+
+/// <summary>
+/// Producer: get the payload of the next record, to be released with ReleaseFrame
+/// </summary>
+/// <returns>payload to fill, NULL if the container is closed or the record is not mapped yet</returns>
+BYTE* MappedContainerWriter::AcquireFrame()
+{
+    // Close() clears m_bOpen before waiting for m_bBusy, so one of the two sees the other
+    m_bBusy = true;
+    if (!m_bOpen)
+    {
+        m_bBusy = false;
+        return NULL;
+    }
+
+    UINT nWindow = m_nProduced / m_nWindowFrames;
+    if (nWindow >= m_nMapped.load(std::memory_order_acquire))
+    {
+        m_bBusy = false;
+        return NULL;
+    }
+
+    // The window cannot be released before this record is committed
+    return m_aFirstRecords[nWindow % MappedWindowCount] + (m_nProduced - nWindow * m_nWindowFrames) * m_nStride + sizeof(FrameRecordHeader);
+}
+
+/// <summary>
+/// Producer: hand the next frame over to the writer
+/// </summary>
+/// <param name="pFrame">payload returned by AcquireFrame, NULL if the frame is in the producer's buffer</param>
+/// <param name="bQueued">true if the frame is queued for CommitFrame, false if it is discarded</param>
+void MappedContainerWriter::ReleaseFrame(BYTE* pFrame, bool bQueued)
+{
+    // The frame queue publishes the flag along with the frame
+    if (bQueued && m_bOpen)
+    {
+        m_abInPlace[m_nProduced % MappedFramesInFlight] = (pFrame != NULL);
+        ++m_nProduced;
+    }
+
+    if (pFrame)
+    {
+        m_bBusy = false;
+    }
+}
+
+/// <summary>
+/// Writer: complete the record of the oldest queued frame
+/// </summary>
+/// <param name="nTime">relative time of the frame</param>
+/// <param name="pSource">producer's buffer holding the frame if it was not filled in place</param>
+/// <returns>indicates success or failure</returns>
+HRESULT MappedContainerWriter::CommitFrame(INT64 nTime, const BYTE* pSource)
+{
+    if (!m_bOpen)
+    {
+        return E_FAIL;
+    }
+
+    // A window the writer could not map ahead is retried now; giving up ends the container
+    UINT nWindow = m_nCommitted / m_nWindowFrames;
+    if (nWindow >= m_nMapped && FAILED(MapWindow()))
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    BYTE* pRecord = m_aFirstRecords[nWindow % MappedWindowCount] + (m_nCommitted - nWindow * m_nWindowFrames) * m_nStride;
+
+    FrameRecordHeader record = m_record;
+    record.nTime = nTime;
+    memcpy(pRecord, &record, sizeof(record));
+
+    if (!m_abInPlace[m_nCommitted % MappedFramesInFlight])
+    {
+        memcpy(pRecord + sizeof(record), pSource, record.nSize);
+    }
+
+    FrameIndexEntry entry = { 0 };
+    entry.nTime = nTime;
+    entry.nOffset = RecordOffset(m_nCommitted);
+    entry.nSize = record.nSize;
+    entry.nStream = record.nStream;
+    entry.nCodec = record.nCodec;
+    entry.nWidth = record.nWidth;
+    entry.nHeight = record.nHeight;
+    m_vIndex.push_back(entry);
+
+    // Write the full window back and keep MappedWindowCount windows ahead of the producer
+    if (++m_nCommitted % m_nWindowFrames == 0)
+    {
+        ReleaseWindow();
+        MapWindow();
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Unmap the windows, write the index footer and close the file
+/// </summary>
+/// <returns>indicates success or failure</returns>
+HRESULT MappedContainerWriter::Close()
+{
+    HRESULT hr = S_OK;
+
+    m_bOpen = false;
+    while (m_bBusy)
+    {
+        Sleep(0);
+    }
+
+    while (m_nReleased < m_nMapped)
+    {
+        ReleaseWindow();
+    }
+
+    if (INVALID_HANDLE_VALUE != m_hFile)
+    {
+        // Cut the windows mapped ahead off and append the index footer
+        UINT64 nEnd = RecordOffset(m_nCommitted);
+
+        FILE_END_OF_FILE_INFO endOfFile;
+        endOfFile.EndOfFile.QuadPart = nEnd;
+        if (!SetFileInformationByHandle(m_hFile, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+        {
+            hr = E_FAIL;
+        }
+
+        ContainerTrailer trailer = { 0 };
+        trailer.nIndexOffset = nEnd;
+        trailer.nCount = static_cast<DWORD>(m_vIndex.size());
+        trailer.nMagic = ContainerIndexMagic;
+
+        if (SUCCEEDED(hr) && !m_vIndex.empty())
+        {
+            hr = WriteAt(nEnd, &m_vIndex[0], trailer.nCount * sizeof(FrameIndexEntry));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = WriteAt(nEnd + trailer.nCount * sizeof(FrameIndexEntry), &trailer, sizeof(trailer));
+        }
+
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_nMapped = 0;
+    m_nReleased = 0;
+    m_vIndex.clear();
+
+    return hr;
+}
+
+/// <summary>
+/// Map the next window, growing the file to its end
+/// </summary>
+HRESULT MappedContainerWriter::MapWindow()
+{
+    UINT nWindow = m_nMapped;
+    if (nWindow - m_nReleased >= MappedWindowCount)
+    {
+        return E_FAIL;
+    }
+
+    UINT64 nStart = nWindow ? RecordOffset(nWindow * m_nWindowFrames) : 0;
+    UINT64 nEnd = RecordOffset((nWindow + 1) * m_nWindowFrames);
+    UINT64 nViewStart = nStart & ~static_cast<UINT64>(MappedViewAlignment - 1);
+
+    HANDLE hMapping = CreateFileMappingW(m_hFile, NULL, PAGE_READWRITE, static_cast<DWORD>(nEnd >> 32), static_cast<DWORD>(nEnd), NULL);
+    if (!hMapping)
+    {
+        return E_FAIL;
+    }
+
+    // The view keeps the mapping alive
+    BYTE* pView = static_cast<BYTE*>(MapViewOfFile(hMapping, FILE_MAP_WRITE, static_cast<DWORD>(nViewStart >> 32), static_cast<DWORD>(nViewStart), static_cast<SIZE_T>(nEnd - nViewStart)));
+    CloseHandle(hMapping);
+    if (!pView)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    UINT nIndex = nWindow % MappedWindowCount;
+    m_aViews[nIndex] = pView;
+    m_aViewSizes[nIndex] = static_cast<SIZE_T>(nEnd - nViewStart);
+    m_aFirstRecords[nIndex] = pView + (RecordOffset(nWindow * m_nWindowFrames) - nViewStart);
+    m_nMapped.store(nWindow + 1, std::memory_order_release);
+    return S_OK;
+}
+
+/// <summary>
+/// Write bytes at a given offset, past the mapped windows
+/// </summary>
+HRESULT MappedContainerWriter::WriteAt(UINT64 nOffset, const void* pData, DWORD nSize)
+{
+    OVERLAPPED overlapped = { 0 };
+    overlapped.Offset = static_cast<DWORD>(nOffset);
+    overlapped.OffsetHigh = static_cast<DWORD>(nOffset >> 32);
+
+    DWORD dwBytesWritten = 0;
+    if (!WriteFile(m_hFile, pData, nSize, &dwBytesWritten, &overlapped) || dwBytesWritten != nSize)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Flush and unmap the oldest window
+/// </summary>
+void MappedContainerWriter::ReleaseWindow()
+{
+    UINT nIndex = m_nReleased % MappedWindowCount;
+
+    // Starts writing the dirty pages back without waiting for the disk
+    FlushViewOfFile(m_aViews[nIndex], m_aViewSizes[nIndex]);
+    UnmapViewOfFile(m_aViews[nIndex]);
+    m_aViews[nIndex] = NULL;
+    ++m_nReleased;
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+FrameContainerReader::FrameContainerReader() :
+m_hFile(INVALID_HANDLE_VALUE),
+m_bRecovered(false)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+FrameContainerReader::~FrameContainerReader()
+{
+    Close();
+}
+
+/// <summary>
+/// Open a container and load its index, scanning the records if the footer is missing
+/// </summary>
+/// <param name="lpszFilePath">full file path of the container</param>
+/// <returns>indicates success or failure</returns>
+HRESULT FrameContainerReader::Open(LPCWSTR lpszFilePath)
+{
+    Close();
+
+    m_hFile = CreateFileW(lpszFilePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == m_hFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    LARGE_INTEGER fileSize = { 0 };
+    if (!GetFileSizeEx(m_hFile, &fileSize))
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    ContainerHeader header = { 0 };
+    HRESULT hr = ReadAt(0, &header, sizeof(header));
+    if (SUCCEEDED(hr) && (header.nMagic != ContainerMagic || header.nVersion != ContainerVersion))
+    {
+        hr = E_FAIL;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_bRecovered = FAILED(ReadIndex(fileSize.QuadPart));
+        if (m_bRecovered)
+        {
+            hr = ScanRecords(fileSize.QuadPart);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Close the container
+/// </summary>
+void FrameContainerReader::Close()
+{
+    if (INVALID_HANDLE_VALUE != m_hFile)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+    m_vIndex.clear();
+    m_bRecovered = false;
+}
+
+/// <summary>
+/// Read the payload of a frame
+/// </summary>
+/// <param name="nFrame">frame number</param>
+/// <param name="pBuffer">buffer receiving the payload</param>
+/// <param name="nBufferSize">size of the buffer in bytes</param>
+/// <returns>indicates success or failure</returns>
+HRESULT FrameContainerReader::ReadFrame(UINT nFrame, BYTE* pBuffer, DWORD nBufferSize)
+{
+    if (nFrame >= m_vIndex.size() || nBufferSize < m_vIndex[nFrame].nSize)
+    {
+        return E_INVALIDARG;
+    }
+
+    return ReadAt(m_vIndex[nFrame].nOffset + sizeof(FrameRecordHeader), pBuffer, m_vIndex[nFrame].nSize);
+}
+
+/// <summary>
+/// Load the index footer
+/// </summary>
+HRESULT FrameContainerReader::ReadIndex(UINT64 nFileSize)
+{
+    if (nFileSize < sizeof(ContainerHeader) + sizeof(ContainerTrailer))
+    {
+        return E_FAIL;
+    }
+
+    ContainerTrailer trailer = { 0 };
+    HRESULT hr = ReadAt(nFileSize - sizeof(ContainerTrailer), &trailer, sizeof(trailer));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    if (trailer.nMagic != ContainerIndexMagic ||
+        trailer.nIndexOffset + UINT64(trailer.nCount) * sizeof(FrameIndexEntry) + sizeof(ContainerTrailer) != nFileSize)
+    {
+        return E_FAIL;
+    }
+
+    m_vIndex.resize(trailer.nCount);
+    if (trailer.nCount)
+    {
+        hr = ReadAt(trailer.nIndexOffset, &m_vIndex[0], static_cast<DWORD>(trailer.nCount * sizeof(FrameIndexEntry)));
+    }
+
+    if (FAILED(hr))
+    {
+        m_vIndex.clear();
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Rebuild the index by walking the frame records
+/// </summary>
+HRESULT FrameContainerReader::ScanRecords(UINT64 nFileSize)
+{
+    m_vIndex.clear();
+
+    UINT64 nOffset = sizeof(ContainerHeader);
+    while (nOffset + sizeof(FrameRecordHeader) <= nFileSize)
+    {
+        FrameRecordHeader record = { 0 };
+        if (FAILED(ReadAt(nOffset, &record, sizeof(record))) || record.nMagic != FrameRecordMagic)
+        {
+            break;
+        }
+
+        // A truncated payload means the recording stopped while writing this frame
+        UINT64 nNext = nOffset + sizeof(FrameRecordHeader) + ((UINT64(record.nSize) + 7) & ~UINT64(7));
+        if (nOffset + sizeof(FrameRecordHeader) + record.nSize > nFileSize)
+        {
+            break;
+        }
+
+        FrameIndexEntry entry = { 0 };
+        entry.nTime = record.nTime;
+        entry.nOffset = nOffset;
+        entry.nSize = record.nSize;
+        entry.nStream = record.nStream;
+        entry.nCodec = record.nCodec;
+        entry.nWidth = record.nWidth;
+        entry.nHeight = record.nHeight;
+        m_vIndex.push_back(entry);
+
+        nOffset = nNext;
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Read bytes at a given offset
+/// </summary>
+HRESULT FrameContainerReader::ReadAt(UINT64 nOffset, void* pBuffer, DWORD nSize)
+{
+    LARGE_INTEGER offset;
+    offset.QuadPart = static_cast<LONGLONG>(nOffset);
+    if (!SetFilePointerEx(m_hFile, offset, NULL, FILE_BEGIN))
+    {
+        return E_FAIL;
+    }
+
+    DWORD dwBytesRead = 0;
+    if (!ReadFile(m_hFile, pBuffer, nSize, &dwBytesRead, NULL) || dwBytesRead != nSize)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
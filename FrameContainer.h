@@ -0,0 +1,343 @@
+// FrameContainer.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Append-only recording container: every frame of a stream goes into one file
+// written in large aligned chunks, followed by a seekable index footer.
+//
+// Layout
+//   ContainerHeader
+//   { FrameRecordHeader, payload, padding to 8 bytes } * N
+//   FrameIndexEntry * N
+//   ContainerTrailer
+//
+// If the footer is missing (e.g. the program crashed), the index is rebuilt
+// by scanning the frame records forward from the header.
+
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+
+/// The ContainerChunkSize value specifies the size of a single write to the container file
+#define ContainerChunkSize (16 * 1024 * 1024)
+
+/// The ContainerAlignment value specifies the alignment of the chunk buffer and of each chunk in the file
+#define ContainerAlignment 4096
+
+/// The MappedWindowSize value specifies the target size of a mapped window of a MappedContainerWriter
+#define MappedWindowSize (64 * 1024 * 1024)
+
+/// The MappedWindowCount value specifies how many windows a MappedContainerWriter keeps mapped ahead
+#define MappedWindowCount 3
+
+/// The MappedFramesInFlight value specifies how many frames may be queued between producer and writer (at least BufferSize)
+#define MappedFramesInFlight 64
+
+/// The StripeManifestName value specifies the file listing the record folders of a striped record, one per line (UTF-16)
+#define StripeManifestName L"stripes.txt"
+
+#define ContainerMagic      0x4332564B  // 'KV2C'
+#define FrameRecordMagic    0x454D5246  // 'FRME'
+#define ContainerIndexMagic 0x5844494B  // 'KIDX'
+#define ContainerVersion    1
+
+/// <summary>
+/// Stream a frame belongs to
+/// </summary>
+enum FrameStream
+{
+    FrameStream_Infrared = 0,
+    FrameStream_Depth = 1,
+    FrameStream_Color = 2
+};
+
+/// <summary>
+/// Layout of a frame payload
+/// </summary>
+enum FrameCodec
+{
+    FrameCodec_Gray16BE = 0,    // 16 bits per pixel, big-endian (same as PGM)
+    FrameCodec_RGB24 = 1,       // 24 bits per pixel, R-G-B order (same as PPM)
+    FrameCodec_BGR24 = 2,       // 24 bits per pixel, B-G-R order (same as BMP)
+    FrameCodec_DepthRVL = 3,    // RVL-compressed Gray16BE (see DepthCodec.h)
+    FrameCodec_QOI = 4,         // QOI file of a 24-bit color frame (see ColorCodec.h)
+    FrameCodec_JPEG = 5,        // JPEG file of a 24-bit color frame (see JpegEncoder.h)
+    FrameCodec_YUY2 = 6         // 16 bits per pixel, Y0-U-Y1-V as delivered by the sensor (not mirrored)
+};
+
+#pragma pack(push, 1)
+struct ContainerHeader
+{
+    DWORD                   nMagic;
+    WORD                    nVersion;
+    WORD                    nHeaderSize;
+    DWORD                   nChunkSize;
+    DWORD                   nReserved;
+};
+
+struct FrameRecordHeader
+{
+    DWORD                   nMagic;
+    WORD                    nStream;
+    WORD                    nCodec;
+    INT64                   nTime;          // relative time (unit: 100 ns)
+    DWORD                   nSize;          // payload size in bytes (without padding)
+    WORD                    nWidth;
+    WORD                    nHeight;
+};
+
+struct FrameIndexEntry
+{
+    INT64                   nTime;
+    UINT64                  nOffset;        // file offset of the FrameRecordHeader
+    DWORD                   nSize;
+    WORD                    nStream;
+    WORD                    nCodec;
+    WORD                    nWidth;
+    WORD                    nHeight;
+};
+
+struct ContainerTrailer
+{
+    UINT64                  nIndexOffset;
+    DWORD                   nCount;
+    DWORD                   nMagic;
+};
+#pragma pack(pop)
+
+class FrameContainerWriter
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    FrameContainerWriter();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~FrameContainerWriter();
+
+    /// <summary>
+    /// Create the container file and write its header
+    /// </summary>
+    /// <param name="lpszFilePath">full file path of the container</param>
+    /// <param name="nExpectedSize">expected size of the container, reserved on disk up front (0 for none)</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 Open(LPCWSTR lpszFilePath, UINT64 nExpectedSize = 0);
+
+    /// <summary>
+    /// Append a frame record
+    /// </summary>
+    /// <param name="nStream">stream the frame belongs to</param>
+    /// <param name="nCodec">layout of the payload</param>
+    /// <param name="nTime">relative time of the frame</param>
+    /// <param name="nWidth">width (in pixels) of the frame</param>
+    /// <param name="nHeight">height (in pixels) of the frame</param>
+    /// <param name="pData">payload</param>
+    /// <param name="nSize">payload size in bytes</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 AppendFrame(FrameStream nStream, FrameCodec nCodec, INT64 nTime, int nWidth, int nHeight, const BYTE* pData, DWORD nSize);
+
+    /// <summary>
+    /// Flush the pending chunk, write the index footer and close the file
+    /// </summary>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 Close();
+
+    /// <summary>
+    /// Check if a container file is open
+    /// </summary>
+    bool                    IsOpen() const { return m_hFile != INVALID_HANDLE_VALUE; }
+
+private:
+    HANDLE                  m_hFile;
+    BYTE*                   m_pChunk;
+    DWORD                   m_nChunkUsed;
+    UINT64                  m_nOffset;      // logical end of the container
+    std::vector<FrameIndexEntry> m_vIndex;
+
+    /// <summary>
+    /// Copy bytes to the chunk buffer, writing the chunk whenever it is full
+    /// </summary>
+    HRESULT                 Append(const BYTE* pData, DWORD nSize);
+
+    /// <summary>
+    /// Write the used part of the chunk buffer to the file
+    /// </summary>
+    HRESULT                 FlushChunk();
+};
+
+/// <summary>
+/// Container writer for frames of a fixed size, whose records are produced in place in mapped windows of the file.
+/// The writer keeps MappedWindowCount windows mapped ahead; the producer converts a frame straight into its record
+/// (AcquireFrame/ReleaseFrame), or into its own buffer when the record is not mapped yet, in which case CommitFrame
+/// copies it. Full windows are flushed and unmapped by the writer, the index footer is written on Close.
+/// </summary>
+class MappedContainerWriter
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    MappedContainerWriter();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~MappedContainerWriter();
+
+    /// <summary>
+    /// Create the container file, reserve its extents and map the first windows
+    /// </summary>
+    /// <param name="lpszFilePath">full file path of the container</param>
+    /// <param name="nStream">stream of the frames</param>
+    /// <param name="nCodec">layout of the frames</param>
+    /// <param name="nWidth">width (in pixels) of the frames</param>
+    /// <param name="nHeight">height (in pixels) of the frames</param>
+    /// <param name="nFrameSize">payload size of every frame in bytes</param>
+    /// <param name="nExpectedSize">expected size of the container, reserved on disk up front (0 for none)</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 Open(LPCWSTR lpszFilePath, FrameStream nStream, FrameCodec nCodec, int nWidth, int nHeight, DWORD nFrameSize, UINT64 nExpectedSize);
+
+    /// <summary>
+    /// Producer: get the payload of the next record, to be released with ReleaseFrame
+    /// </summary>
+    /// <returns>payload to fill, NULL if the container is closed or the record is not mapped yet</returns>
+    BYTE*                   AcquireFrame();
+
+    /// <summary>
+    /// Producer: hand the next frame over to the writer
+    /// </summary>
+    /// <param name="pFrame">payload returned by AcquireFrame, NULL if the frame is in the producer's buffer</param>
+    /// <param name="bQueued">true if the frame is queued for CommitFrame, false if it is discarded</param>
+    void                    ReleaseFrame(BYTE* pFrame, bool bQueued);
+
+    /// <summary>
+    /// Writer: complete the record of the oldest queued frame
+    /// </summary>
+    /// <param name="nTime">relative time of the frame</param>
+    /// <param name="pSource">producer's buffer holding the frame if it was not filled in place</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 CommitFrame(INT64 nTime, const BYTE* pSource);
+
+    /// <summary>
+    /// Unmap the windows, write the index footer and close the file
+    /// </summary>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 Close();
+
+    /// <summary>
+    /// Check if a container file is open
+    /// </summary>
+    bool                    IsOpen() const { return m_bOpen; }
+
+private:
+    HANDLE                  m_hFile;
+    std::atomic<bool>       m_bOpen;
+    std::atomic<bool>       m_bBusy;            // the producer is filling a mapped record
+    FrameRecordHeader       m_record;           // header shared by every record but the time
+    DWORD                   m_nStride;          // record size including padding
+    UINT                    m_nWindowFrames;    // records per window
+    BYTE*                   m_aViews[MappedWindowCount];
+    SIZE_T                  m_aViewSizes[MappedWindowCount];
+    BYTE*                   m_aFirstRecords[MappedWindowCount];
+    std::atomic<UINT>       m_nMapped;          // windows mapped so far
+    UINT                    m_nReleased;        // windows flushed and unmapped so far
+    UINT                    m_nProduced;        // records handed over by the producer
+    UINT                    m_nCommitted;       // records completed by the writer
+    bool                    m_abInPlace[MappedFramesInFlight];
+    std::vector<FrameIndexEntry> m_vIndex;
+
+    /// <summary>
+    /// File offset of a record
+    /// </summary>
+    UINT64                  RecordOffset(UINT nRecord) const { return sizeof(ContainerHeader) + static_cast<UINT64>(nRecord) * m_nStride; }
+
+    /// <summary>
+    /// Map the next window, growing the file to its end
+    /// </summary>
+    HRESULT                 MapWindow();
+
+    /// <summary>
+    /// Flush and unmap the oldest window
+    /// </summary>
+    void                    ReleaseWindow();
+
+    /// <summary>
+    /// Write bytes at a given offset, past the mapped windows
+    /// </summary>
+    HRESULT                 WriteAt(UINT64 nOffset, const void* pData, DWORD nSize);
+};
+
+class FrameContainerReader
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    FrameContainerReader();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~FrameContainerReader();
+
+    /// <summary>
+    /// Open a container and load its index, scanning the records if the footer is missing
+    /// </summary>
+    /// <param name="lpszFilePath">full file path of the container</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 Open(LPCWSTR lpszFilePath);
+
+    /// <summary>
+    /// Close the container
+    /// </summary>
+    void                    Close();
+
+    /// <summary>
+    /// Number of frames in the container
+    /// </summary>
+    UINT                    GetFrameCount() const { return static_cast<UINT>(m_vIndex.size()); }
+
+    /// <summary>
+    /// Index entry of a frame
+    /// </summary>
+    const FrameIndexEntry&  GetEntry(UINT nFrame) const { return m_vIndex[nFrame]; }
+
+    /// <summary>
+    /// Check if the index had to be rebuilt by a forward scan
+    /// </summary>
+    bool                    IsRecovered() const { return m_bRecovered; }
+
+    /// <summary>
+    /// Read the payload of a frame
+    /// </summary>
+    /// <param name="nFrame">frame number</param>
+    /// <param name="pBuffer">buffer receiving the payload</param>
+    /// <param name="nBufferSize">size of the buffer in bytes</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 ReadFrame(UINT nFrame, BYTE* pBuffer, DWORD nBufferSize);
+
+private:
+    HANDLE                  m_hFile;
+    bool                    m_bRecovered;
+    std::vector<FrameIndexEntry> m_vIndex;
+
+    /// <summary>
+    /// Load the index footer
+    /// </summary>
+    HRESULT                 ReadIndex(UINT64 nFileSize);
+
+    /// <summary>
+    /// Rebuild the index by walking the frame records
+    /// </summary>
+    HRESULT                 ScanRecords(UINT64 nFileSize);
+
+    /// <summary>
+    /// Read bytes at a given offset
+    /// </summary>
+    HRESULT                 ReadAt(UINT64 nOffset, void* pBuffer, DWORD nSize);
+};
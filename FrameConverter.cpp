@@ -0,0 +1,1199 @@
+// FrameConverter.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "FrameConverter.h"
+#include <utility>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CONVERTER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Functions using AVX2 intrinsics have to be flagged for GCC/Clang, MSVC accepts them anywhere
+#if defined(CONVERTER_X86) && defined(__GNUC__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#define SSSE3_FUNCTION __attribute__((target("ssse3")))
+#else
+#define AVX2_FUNCTION
+#define SSSE3_FUNCTION
+#endif
+
+// 1 / (InfraredSourceValueMaximum * InfraredSceneValueAverage * InfraredSceneStandardDeviations),
+// multiplying by it gives the same floats as the two divisions for every UINT16 input
+static const float cInfraredScale = 1.0f / (InfraredSourceValueMaximum * (InfraredSceneValueAverage * InfraredSceneStandardDeviations));
+
+/// <summary>
+/// Detect the highest instruction set supported by the CPU and the OS
+/// </summary>
+static SimdLevel DetectSimdLevel()
+{
+#if defined(NO_SIMD) || !defined(CONVERTER_X86)
+    return SimdLevel_None;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int nIds = info[0];
+
+    __cpuid(info, 1);
+    if (!(info[3] & (1 << 26)))
+    {
+        return SimdLevel_None;
+    }
+    if (!(info[2] & (1 << 9)))
+    {
+        return SimdLevel_SSE2;
+    }
+
+    // AVX2 needs the OS to save the YMM registers (OSXSAVE + XCR0)
+    bool bAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    if (bAVX && nIds >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+        {
+            return SimdLevel_AVX2;
+        }
+    }
+    return SimdLevel_SSSE3;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel_AVX2;
+    if (__builtin_cpu_supports("ssse3")) return SimdLevel_SSSE3;
+    if (__builtin_cpu_supports("sse2")) return SimdLevel_SSE2;
+    return SimdLevel_None;
+#endif
+}
+
+static const SimdLevel s_nSupportedLevel = DetectSimdLevel();
+static SimdLevel s_nSimdLevel = s_nSupportedLevel;
+
+/// <summary>
+/// Get the instruction set currently used by the conversion kernels
+/// </summary>
+/// <returns>the highest level supported by the CPU, unless lowered by SetSimdLevel</returns>
+SimdLevel GetSimdLevel()
+{
+    return s_nSimdLevel;
+}
+
+/// <summary>
+/// Limit the instruction set used by the conversion kernels
+/// </summary>
+/// <param name="nLevel">requested level, clamped to what the CPU supports</param>
+/// <returns>the level actually in use</returns>
+SimdLevel SetSimdLevel(SimdLevel nLevel)
+{
+    s_nSimdLevel = (nLevel < s_nSupportedLevel) ? nLevel : s_nSupportedLevel;
+    return s_nSimdLevel;
+}
+
+/// <summary>
+/// Convert a single infrared pixel, reference implementation of the SIMD kernels
+/// </summary>
+static inline void ConvertInfraredPixel(UINT16 value, RGBQUAD* pRGBX, UINT16* pUINT16)
+{
+    // normalize the incoming infrared data (ushort) to a float ranging from
+    // [InfraredOutputValueMinimum, InfraredOutputValueMaximum] by
+    // 1. dividing the incoming value by the source maximum value
+    float intensityRatio = static_cast<float>(value) / InfraredSourceValueMaximum;
+
+    // 2. dividing by the (average scene value * standard deviations)
+    intensityRatio /= InfraredSceneValueAverage * InfraredSceneStandardDeviations;
+
+    // 3. limiting the value to InfraredOutputValueMaximum
+    intensityRatio = min(InfraredOutputValueMaximum, intensityRatio);
+
+    // 4. limiting the lower value InfraredOutputValueMinimym
+    intensityRatio = max(InfraredOutputValueMinimum, intensityRatio);
+
+    // 5. converting the normalized value to a byte and using the result
+    // as the RGB components required by the image
+    byte intensity = static_cast<byte>(intensityRatio * 255.0f);
+    pRGBX->rgbRed = intensity;
+    pRGBX->rgbGreen = intensity;
+    pRGBX->rgbBlue = intensity;
+    pRGBX->rgbReserved = 0xFF;
+
+    // convert UINT16 to Big-Endian format
+    *pUINT16 = (value >> 8) | (value << 8);
+}
+
+/// <summary>
+/// Convert the mirrored pixels [nFirst, nWidth) of an infrared row with scalar code
+/// </summary>
+static void ConvertInfraredRowScalar(const UINT16* pRow, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nFirst)
+{
+    for (int j = nFirst; j < nWidth; ++j)
+    {
+        ConvertInfraredPixel(pRow[nWidth - 1 - j], pRGBX + j, pUINT16 + j);
+    }
+}
+
+/// <summary>
+/// Convert the mirrored pixels [nFirst, nWidth) of a depth row with scalar code
+/// </summary>
+static void ConvertDepthRowScalar(const UINT16* pRow, const RGBQUAD* pLUT, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nFirst, USHORT nMinDepth, USHORT nMaxDepth)
+{
+    for (int j = nFirst; j < nWidth; ++j)
+    {
+        USHORT depth = pRow[nWidth - 1 - j];
+        pRGBX[j] = pLUT[depth];
+
+        // Values outside the reliable depth range are stored as 0
+        depth = ((depth < nMinDepth) || (depth > nMaxDepth)) ? 0 : depth;
+
+        // convert UINT16 to Big-Endian format
+        pUINT16[j] = (depth >> 8) | (depth << 8);
+    }
+}
+
+/// <summary>
+/// Convert the mirrored pixels [nFirst, nWidth) of a BGRA color row with scalar code
+/// </summary>
+static void ConvertColorRowScalar(const RGBQUAD* pRow, RGBTRIPLE* pRGB, RGBQUAD* pPreview, int nWidth, int nFirst, bool bBGR)
+{
+    for (int j = nFirst; j < nWidth; ++j)
+    {
+        const RGBQUAD& pixel = pRow[nWidth - 1 - j];
+        if (bBGR)
+        {
+            pRGB[j].rgbtRed = pixel.rgbRed;
+            pRGB[j].rgbtGreen = pixel.rgbGreen;
+            pRGB[j].rgbtBlue = pixel.rgbBlue;
+        }
+        else
+        {
+            // PPM stores R-G-B, i.e. the reverse of the RGBTRIPLE layout
+            pRGB[j].rgbtRed = pixel.rgbBlue;
+            pRGB[j].rgbtGreen = pixel.rgbGreen;
+            pRGB[j].rgbtBlue = pixel.rgbRed;
+        }
+
+        if (pPreview)
+        {
+            pPreview[j] = pixel;
+        }
+    }
+}
+
+/// <summary>
+/// Shrink the output pixels [nFirst, nWidth) of nFactor BGRA rows into one row with scalar code
+/// </summary>
+static void DownscaleBGRARowScalar(const RGBQUAD* pRow, int nStride, RGBQUAD* pRGBX, int nWidth, int nFirst, int nFactor, bool bMirror)
+{
+    const int nShift = (nFactor == 4) ? 4 : 2;
+    const int nRound = 1 << (nShift - 1);
+
+    for (int j = nFirst; j < nWidth; ++j)
+    {
+        int nBlue = nRound, nGreen = nRound, nRed = nRound, nAlpha = nRound;
+        for (int y = 0; y < nFactor; ++y)
+        {
+            const RGBQUAD* pPixel = pRow + y * nStride + j * nFactor;
+            for (int x = 0; x < nFactor; ++x)
+            {
+                nBlue += pPixel[x].rgbBlue;
+                nGreen += pPixel[x].rgbGreen;
+                nRed += pPixel[x].rgbRed;
+                nAlpha += pPixel[x].rgbReserved;
+            }
+        }
+
+        RGBQUAD& output = pRGBX[bMirror ? nWidth - 1 - j : j];
+        output.rgbBlue = static_cast<BYTE>(nBlue >> nShift);
+        output.rgbGreen = static_cast<BYTE>(nGreen >> nShift);
+        output.rgbRed = static_cast<BYTE>(nRed >> nShift);
+        output.rgbReserved = static_cast<BYTE>(nAlpha >> nShift);
+    }
+}
+
+/// <summary>
+/// Clamp a fixed-point color component (8 fractional bits) to a byte
+/// </summary>
+static inline BYTE ClampComponent(int nValue)
+{
+    nValue >>= 8;
+    return static_cast<BYTE>(nValue < 0 ? 0 : (nValue > 255 ? 255 : nValue));
+}
+
+/// <summary>
+/// Fixed-point (8 fractional bits) coefficients of a video range YUV matrix, luma always being scaled by 298
+/// </summary>
+struct YUVCoefficients
+{
+    int                     nRV;    // V to red
+    int                     nGU;    // U to green (subtracted)
+    int                     nGV;    // V to green (subtracted)
+    int                     nBU;    // U to blue
+};
+
+static const YUVCoefficients s_aYUVCoefficients[YUVMatrix_Count] =
+{
+    { 409, 100, 208, 516 },     // BT.601
+    { 459, 55, 136, 541 }       // BT.709
+};
+
+/// <summary>
+/// Convert one YUV sample into an opaque BGRA pixel
+/// </summary>
+static inline RGBQUAD YUVToRGBX(int y, int u, int v, const YUVCoefficients& k)
+{
+    int c = 298 * (y - 16) + 128;
+    int d = u - 128;
+    int e = v - 128;
+
+    RGBQUAD pixel;
+    pixel.rgbRed = ClampComponent(c + k.nRV * e);
+    pixel.rgbGreen = ClampComponent(c - k.nGU * d - k.nGV * e);
+    pixel.rgbBlue = ClampComponent(c + k.nBU * d);
+    pixel.rgbReserved = 0xFF;
+    return pixel;
+}
+
+/// <summary>
+/// Store a pixel as 24 bits in B-G-R or R-G-B byte order
+/// </summary>
+static inline void StoreRGB(const RGBQUAD& pixel, RGBTRIPLE* pRGB, bool bBGR)
+{
+    pRGB->rgbtRed = bBGR ? pixel.rgbRed : pixel.rgbBlue;
+    pRGB->rgbtGreen = pixel.rgbGreen;
+    pRGB->rgbtBlue = bBGR ? pixel.rgbBlue : pixel.rgbRed;
+}
+
+/// <summary>
+/// Rounded average of two bytes, the same as _mm_avg_epu8
+/// </summary>
+static inline int Average(int a, int b)
+{
+    return (a + b + 1) >> 1;
+}
+
+/// <summary>
+/// Convert the pixels [nFirst, nWidth) of a YUY2 row into BGRA with scalar code, nFirst being even
+/// </summary>
+static void ConvertYUY2RowScalar(const BYTE* pRow, RGBQUAD* pRGBX, int nWidth, int nFirst, const YUVCoefficients& k, bool bMirror)
+{
+    for (int j = nFirst; j < nWidth; j += 2)
+    {
+        const BYTE* pPair = pRow + j * 2;
+        RGBQUAD first = YUVToRGBX(pPair[0], pPair[1], pPair[3], k);
+        RGBQUAD second = YUVToRGBX(pPair[2], pPair[1], pPair[3], k);
+
+        if (bMirror)
+        {
+            pRGBX[nWidth - 1 - j] = first;
+            pRGBX[nWidth - 2 - j] = second;
+        }
+        else
+        {
+            pRGBX[j] = first;
+            pRGBX[j + 1] = second;
+        }
+    }
+}
+
+/// <summary>
+/// Convert the pixels [nFirst, nWidth) of a YUY2 row into 24-bit pixels with scalar code, nFirst being even
+/// </summary>
+static void ConvertYUY2RGBRowScalar(const BYTE* pRow, RGBTRIPLE* pRGB, int nWidth, int nFirst, const YUVCoefficients& k, bool bMirror, bool bBGR)
+{
+    for (int j = nFirst; j < nWidth; j += 2)
+    {
+        const BYTE* pPair = pRow + j * 2;
+        RGBQUAD first = YUVToRGBX(pPair[0], pPair[1], pPair[3], k);
+        RGBQUAD second = YUVToRGBX(pPair[2], pPair[1], pPair[3], k);
+
+        StoreRGB(first, pRGB + (bMirror ? nWidth - 1 - j : j), bBGR);
+        StoreRGB(second, pRGB + (bMirror ? nWidth - 2 - j : j + 1), bBGR);
+    }
+}
+
+/// <summary>
+/// Convert the output pixels [nFirst, nWidth) of two YUY2 rows into one BGRA row of half their width with scalar code
+/// </summary>
+static void DownscaleYUY2RowScalar(const BYTE* pRow0, const BYTE* pRow1, RGBQUAD* pRGBX, int nWidth, int nFirst, const YUVCoefficients& k, bool bMirror)
+{
+    for (int j = nFirst; j < nWidth; ++j)
+    {
+        const BYTE* pPair0 = pRow0 + j * 4;
+        const BYTE* pPair1 = pRow1 + j * 4;
+
+        // Average the rows first, then the two samples of a pair, like the SIMD code
+        int y = Average(Average(pPair0[0], pPair1[0]), Average(pPair0[2], pPair1[2]));
+        int u = Average(pPair0[1], pPair1[1]);
+        int v = Average(pPair0[3], pPair1[3]);
+
+        pRGBX[bMirror ? nWidth - 1 - j : j] = YUVToRGBX(y, u, v, k);
+    }
+}
+
+#ifdef CONVERTER_X86
+/// <summary>
+/// Normalize four infrared values (INT32 lanes) into opaque gray RGBX pixels
+/// </summary>
+static inline __m128i InfraredToRGBX(__m128i value)
+{
+    __m128 intensityRatio = _mm_mul_ps(_mm_cvtepi32_ps(value), _mm_set1_ps(cInfraredScale));
+    intensityRatio = _mm_min_ps(intensityRatio, _mm_set1_ps(InfraredOutputValueMaximum));
+    intensityRatio = _mm_max_ps(intensityRatio, _mm_set1_ps(InfraredOutputValueMinimum));
+    __m128i intensity = _mm_cvttps_epi32(_mm_mul_ps(intensityRatio, _mm_set1_ps(255.0f)));
+
+    // replicate the byte into B, G and R
+    __m128i rgbx = _mm_or_si128(intensity, _mm_slli_epi32(intensity, 8));
+    rgbx = _mm_or_si128(rgbx, _mm_slli_epi32(intensity, 16));
+    return _mm_or_si128(rgbx, _mm_set1_epi32(0xFF000000));
+}
+
+/// <summary>
+/// Convert a mirrored infrared row, 8 pixels per step
+/// </summary>
+static void ConvertInfraredRowSSE2(const UINT16* pRow, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int j = 0;
+
+    for (; j + 8 <= nWidth; j += 8)
+    {
+        // reversed-lane load of the 8 source pixels ending at the mirrored position
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + nWidth - 8 - j));
+        value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+        value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+        value = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pUINT16 + j), _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j), InfraredToRGBX(_mm_unpacklo_epi16(value, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j + 4), InfraredToRGBX(_mm_unpackhi_epi16(value, zero)));
+    }
+
+    ConvertInfraredRowScalar(pRow, pRGBX, pUINT16, nWidth, j);
+}
+
+/// <summary>
+/// Normalize eight infrared values (INT32 lanes) into opaque gray RGBX pixels
+/// </summary>
+AVX2_FUNCTION static inline __m256i InfraredToRGBX(__m256i value)
+{
+    __m256 intensityRatio = _mm256_mul_ps(_mm256_cvtepi32_ps(value), _mm256_set1_ps(cInfraredScale));
+    intensityRatio = _mm256_min_ps(intensityRatio, _mm256_set1_ps(InfraredOutputValueMaximum));
+    intensityRatio = _mm256_max_ps(intensityRatio, _mm256_set1_ps(InfraredOutputValueMinimum));
+    __m256i intensity = _mm256_cvttps_epi32(_mm256_mul_ps(intensityRatio, _mm256_set1_ps(255.0f)));
+
+    // replicate the byte into B, G and R
+    __m256i rgbx = _mm256_or_si256(intensity, _mm256_slli_epi32(intensity, 8));
+    rgbx = _mm256_or_si256(rgbx, _mm256_slli_epi32(intensity, 16));
+    return _mm256_or_si256(rgbx, _mm256_set1_epi32(0xFF000000));
+}
+
+/// <summary>
+/// Convert a mirrored infrared row, 16 pixels per step
+/// </summary>
+AVX2_FUNCTION static void ConvertInfraredRowAVX2(const UINT16* pRow, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth)
+{
+    // reversing the bytes of a 128-bit lane reverses its words and swaps their bytes at once
+    const __m256i reverseWords = _mm256_setr_epi8(
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    const __m256i reverseBytes = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    int j = 0;
+
+    for (; j + 16 <= nWidth; j += 16)
+    {
+        __m256i source = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRow + nWidth - 16 - j));
+        source = _mm256_permute4x64_epi64(source, _MM_SHUFFLE(1, 0, 3, 2));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pUINT16 + j), _mm256_shuffle_epi8(source, reverseBytes));
+
+        __m256i value = _mm256_shuffle_epi8(source, reverseWords);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + j), InfraredToRGBX(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(value))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + j + 8), InfraredToRGBX(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(value, 1))));
+    }
+
+    ConvertInfraredRowScalar(pRow, pRGBX, pUINT16, nWidth, j);
+}
+
+/// <summary>
+/// Convert a mirrored depth row, 8 pixels per step
+/// </summary>
+static void ConvertDepthRowSSE2(const UINT16* pRow, const RGBQUAD* pLUT, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, USHORT nMinDepth, USHORT nMaxDepth)
+{
+    const __m128i minDepth = _mm_set1_epi16(static_cast<short>(nMinDepth));
+    const __m128i maxDepth = _mm_set1_epi16(static_cast<short>(nMaxDepth));
+    const __m128i zero = _mm_setzero_si128();
+    int j = 0;
+
+    for (; j + 8 <= nWidth; j += 8)
+    {
+        const UINT16* pSource = pRow + nWidth - 8 - j;
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource));
+        value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+        value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+        value = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+
+        // unsigned range test: both saturated differences are zero inside [nMinDepth, nMaxDepth]
+        __m128i outside = _mm_or_si128(_mm_subs_epu16(minDepth, value), _mm_subs_epu16(value, maxDepth));
+        value = _mm_and_si128(value, _mm_cmpeq_epi16(outside, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pUINT16 + j), _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8)));
+
+        // no gather before AVX2
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j), _mm_setr_epi32(
+            *reinterpret_cast<const int*>(pLUT + pSource[7]), *reinterpret_cast<const int*>(pLUT + pSource[6]),
+            *reinterpret_cast<const int*>(pLUT + pSource[5]), *reinterpret_cast<const int*>(pLUT + pSource[4])));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j + 4), _mm_setr_epi32(
+            *reinterpret_cast<const int*>(pLUT + pSource[3]), *reinterpret_cast<const int*>(pLUT + pSource[2]),
+            *reinterpret_cast<const int*>(pLUT + pSource[1]), *reinterpret_cast<const int*>(pLUT + pSource[0])));
+    }
+
+    ConvertDepthRowScalar(pRow, pLUT, pRGBX, pUINT16, nWidth, j, nMinDepth, nMaxDepth);
+}
+
+/// <summary>
+/// Convert a mirrored depth row, 16 pixels per step
+/// </summary>
+AVX2_FUNCTION static void ConvertDepthRowAVX2(const UINT16* pRow, const RGBQUAD* pLUT, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, USHORT nMinDepth, USHORT nMaxDepth)
+{
+    const __m256i reverseWords = _mm256_setr_epi8(
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    const __m256i swapBytes = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i minDepth = _mm256_set1_epi16(static_cast<short>(nMinDepth));
+    const __m256i maxDepth = _mm256_set1_epi16(static_cast<short>(nMaxDepth));
+    const int* pTable = reinterpret_cast<const int*>(pLUT);
+    int j = 0;
+
+    for (; j + 16 <= nWidth; j += 16)
+    {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRow + nWidth - 16 - j));
+        value = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(value, _MM_SHUFFLE(1, 0, 3, 2)), reverseWords);
+
+        // one gather per 8 pixels, no branch on the reliable range
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + j), _mm256_i32gather_epi32(pTable, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(value)), 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + j + 8), _mm256_i32gather_epi32(pTable, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(value, 1)), 4));
+
+        __m256i inside = _mm256_cmpeq_epi16(_mm256_min_epu16(_mm256_max_epu16(value, minDepth), maxDepth), value);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pUINT16 + j), _mm256_shuffle_epi8(_mm256_and_si256(value, inside), swapBytes));
+    }
+
+    ConvertDepthRowScalar(pRow, pLUT, pRGBX, pUINT16, nWidth, j, nMinDepth, nMaxDepth);
+}
+
+/// <summary>
+/// Convert a mirrored BGRA color row into packed 24-bit pixels, 16 pixels per step
+/// </summary>
+SSSE3_FUNCTION static void ConvertColorRowSSSE3(const RGBQUAD* pRow, RGBTRIPLE* pRGB, RGBQUAD* pPreview, int nWidth, bool bBGR)
+{
+    // Reverse the 4 pixels of a register and drop their alpha, leaving 12 bytes at the bottom
+    const __m128i packBGR = _mm_setr_epi8(12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1);
+    const __m128i packRGB = _mm_setr_epi8(14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0, -1, -1, -1, -1);
+    const __m128i pack = bBGR ? packBGR : packRGB;
+    BYTE* pOutput = reinterpret_cast<BYTE*>(pRGB);
+    int j = 0;
+
+    for (; j + 16 <= nWidth; j += 16)
+    {
+        const RGBQUAD* pSource = pRow + nWidth - 16 - j;
+        __m128i pixel0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + 12));
+        __m128i pixel1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + 8));
+        __m128i pixel2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + 4));
+        __m128i pixel3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource));
+
+        if (pPreview)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pPreview + j), _mm_shuffle_epi32(pixel0, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pPreview + j + 4), _mm_shuffle_epi32(pixel1, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pPreview + j + 8), _mm_shuffle_epi32(pixel2, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pPreview + j + 12), _mm_shuffle_epi32(pixel3, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+
+        pixel0 = _mm_shuffle_epi8(pixel0, pack);
+        pixel1 = _mm_shuffle_epi8(pixel1, pack);
+        pixel2 = _mm_shuffle_epi8(pixel2, pack);
+        pixel3 = _mm_shuffle_epi8(pixel3, pack);
+
+        // 4 x 12 bytes -> 3 x 16 bytes
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + j * 3), _mm_or_si128(pixel0, _mm_slli_si128(pixel1, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + j * 3 + 16), _mm_or_si128(_mm_srli_si128(pixel1, 4), _mm_slli_si128(pixel2, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + j * 3 + 32), _mm_or_si128(_mm_srli_si128(pixel2, 8), _mm_slli_si128(pixel3, 4)));
+    }
+
+    ConvertColorRowScalar(pRow, pRGB, pPreview, nWidth, j, bBGR);
+}
+
+/// <summary>
+/// Convert a mirrored BGRA color row into packed 24-bit pixels, 16 pixels per step
+/// </summary>
+AVX2_FUNCTION static void ConvertColorRowAVX2(const RGBQUAD* pRow, RGBTRIPLE* pRGB, RGBQUAD* pPreview, int nWidth, bool bBGR)
+{
+    // Per 128-bit lane: reverse the 4 pixels and drop their alpha (dwords 0-2 valid)
+    const __m256i packBGR = _mm256_setr_epi8(
+        12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1,
+        12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1);
+    const __m256i packRGB = _mm256_setr_epi8(
+        14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0, -1, -1, -1, -1,
+        14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0, -1, -1, -1, -1);
+    const __m256i pack = bBGR ? packBGR : packRGB;
+    const __m256i reversePixels = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i compact0 = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 0, 0);
+    const __m256i compact1 = _mm256_setr_epi32(2, 4, 5, 6, 0, 0, 0, 1);
+    BYTE* pOutput = reinterpret_cast<BYTE*>(pRGB);
+    int j = 0;
+
+    for (; j + 16 <= nWidth; j += 16)
+    {
+        const RGBQUAD* pSource = pRow + nWidth - 16 - j;
+        __m256i pixel0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource + 8));
+        __m256i pixel1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource));
+
+        if (pPreview)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pPreview + j), _mm256_permutevar8x32_epi32(pixel0, reversePixels));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pPreview + j + 8), _mm256_permutevar8x32_epi32(pixel1, reversePixels));
+        }
+
+        // swap the lanes, then reverse and pack within each lane
+        pixel0 = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(pixel0, _MM_SHUFFLE(1, 0, 3, 2)), pack);
+        pixel1 = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(pixel1, _MM_SHUFFLE(1, 0, 3, 2)), pack);
+
+        // 2 x 24 bytes -> 32 + 16 bytes
+        pixel0 = _mm256_permutevar8x32_epi32(pixel0, compact0);
+        pixel1 = _mm256_permutevar8x32_epi32(pixel1, compact1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutput + j * 3), _mm256_blend_epi32(pixel0, pixel1, 0xC0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + j * 3 + 32), _mm256_castsi256_si128(pixel1));
+    }
+
+    ConvertColorRowScalar(pRow, pRGB, pPreview, nWidth, j, bBGR);
+}
+
+/// <summary>
+/// Sum the pixel pairs (0, 1) and (2, 3) of 4 BGRA pixels into 16-bit lanes, added to an accumulator
+/// </summary>
+static inline __m128i AccumulatePixels(__m128i sum, __m128i pixels)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_add_epi16(sum, _mm_add_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero)));
+}
+
+/// <summary>
+/// Store 4 output pixels computed from consecutive source blocks
+/// </summary>
+static inline void StoreBlocks(__m128i pixels, RGBQUAD* pRGBX, int nWidth, int j, bool bMirror)
+{
+    if (bMirror)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + nWidth - 4 - j), _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+    else
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j), pixels);
+    }
+}
+
+/// <summary>
+/// Shrink 2 BGRA rows into one row of half their width, 4 output pixels per step
+/// </summary>
+static void DownscaleBGRA2RowSSE2(const RGBQUAD* pRow, int nStride, RGBQUAD* pRGBX, int nWidth, bool bMirror)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    int j = 0;
+
+    for (; j + 4 <= nWidth; j += 4)
+    {
+        const RGBQUAD* pSource = pRow + j * 2;
+        __m128i row00 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource));
+        __m128i row01 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + 4));
+        __m128i row10 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + nStride));
+        __m128i row11 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + nStride + 4));
+
+        // Vertical sums of the source pixels 0-1, 2-3, 4-5 and 6-7
+        __m128i sum0 = _mm_add_epi16(_mm_unpacklo_epi8(row00, zero), _mm_unpacklo_epi8(row10, zero));
+        __m128i sum1 = _mm_add_epi16(_mm_unpackhi_epi8(row00, zero), _mm_unpackhi_epi8(row10, zero));
+        __m128i sum2 = _mm_add_epi16(_mm_unpacklo_epi8(row01, zero), _mm_unpacklo_epi8(row11, zero));
+        __m128i sum3 = _mm_add_epi16(_mm_unpackhi_epi8(row01, zero), _mm_unpackhi_epi8(row11, zero));
+
+        // Horizontal sums of the pairs, then the rounded average
+        __m128i blocks01 = _mm_add_epi16(_mm_unpacklo_epi64(sum0, sum1), _mm_unpackhi_epi64(sum0, sum1));
+        __m128i blocks23 = _mm_add_epi16(_mm_unpacklo_epi64(sum2, sum3), _mm_unpackhi_epi64(sum2, sum3));
+        blocks01 = _mm_srli_epi16(_mm_add_epi16(blocks01, round), 2);
+        blocks23 = _mm_srli_epi16(_mm_add_epi16(blocks23, round), 2);
+
+        StoreBlocks(_mm_packus_epi16(blocks01, blocks23), pRGBX, nWidth, j, bMirror);
+    }
+
+    DownscaleBGRARowScalar(pRow, nStride, pRGBX, nWidth, j, 2, bMirror);
+}
+
+/// <summary>
+/// Shrink 4 BGRA rows into one row of a quarter of their width, 4 output pixels per step
+/// </summary>
+static void DownscaleBGRA4RowSSE2(const RGBQUAD* pRow, int nStride, RGBQUAD* pRGBX, int nWidth, bool bMirror)
+{
+    const __m128i round = _mm_set1_epi16(8);
+    int j = 0;
+
+    for (; j + 4 <= nWidth; j += 4)
+    {
+        // Each block of 4 pixels per row accumulates into two pixel sums, 16 pixels at most 4080 per lane
+        __m128i aSums[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (int y = 0; y < 4; ++y)
+        {
+            const RGBQUAD* pSource = pRow + y * nStride + j * 4;
+            for (int k = 0; k < 4; ++k)
+            {
+                aSums[k] = AccumulatePixels(aSums[k], _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + k * 4)));
+            }
+        }
+
+        __m128i blocks01 = _mm_add_epi16(_mm_unpacklo_epi64(aSums[0], aSums[1]), _mm_unpackhi_epi64(aSums[0], aSums[1]));
+        __m128i blocks23 = _mm_add_epi16(_mm_unpacklo_epi64(aSums[2], aSums[3]), _mm_unpackhi_epi64(aSums[2], aSums[3]));
+        blocks01 = _mm_srli_epi16(_mm_add_epi16(blocks01, round), 4);
+        blocks23 = _mm_srli_epi16(_mm_add_epi16(blocks23, round), 4);
+
+        StoreBlocks(_mm_packus_epi16(blocks01, blocks23), pRGBX, nWidth, j, bMirror);
+    }
+
+    DownscaleBGRARowScalar(pRow, nStride, pRGBX, nWidth, j, 4, bMirror);
+}
+
+/// <summary>
+/// YUV matrix coefficients laid out for _mm_madd_epi16
+/// </summary>
+struct YUVRegisters
+{
+    __m128i                 luma;   // (Y, 1) pairs to 298 * (Y - 16) + 128
+    __m128i                 red;    // (U - 128, V - 128) pairs to the red term
+    __m128i                 green;  // (U - 128, V - 128) pairs to the green term
+    __m128i                 blue;   // (U - 128, V - 128) pairs to the blue term
+};
+
+/// <summary>
+/// Repeat a pair of 16-bit values over a register
+/// </summary>
+static inline __m128i SetPair(int a, int b)
+{
+    return _mm_setr_epi16(static_cast<short>(a), static_cast<short>(b), static_cast<short>(a), static_cast<short>(b),
+        static_cast<short>(a), static_cast<short>(b), static_cast<short>(a), static_cast<short>(b));
+}
+
+/// <summary>
+/// Lay out the coefficients of a YUV matrix for the SIMD kernels
+/// </summary>
+static inline YUVRegisters LoadYUVRegisters(const YUVCoefficients& k)
+{
+    YUVRegisters r;
+    r.luma = SetPair(298, 128 - 298 * 16);
+    r.red = SetPair(0, k.nRV);
+    r.green = SetPair(-k.nGU, -k.nGV);
+    r.blue = SetPair(k.nBU, 0);
+    return r;
+}
+
+/// <summary>
+/// Add chroma terms to luma terms (INT32 lanes) and scale the sums down to 8 components (INT16 lanes)
+/// </summary>
+static inline __m128i CombineComponent(__m128i luma0, __m128i luma1, __m128i chroma0, __m128i chroma1)
+{
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(luma0, chroma0), 8), _mm_srai_epi32(_mm_add_epi32(luma1, chroma1), 8));
+}
+
+/// <summary>
+/// Clamp 8 blue, green and red components (INT16 lanes) and interleave them into 2 x 4 opaque BGRA pixels
+/// </summary>
+static inline void PackBGRA(__m128i blue, __m128i green, __m128i red, __m128i* pPixels0, __m128i* pPixels1)
+{
+    __m128i bg = _mm_packus_epi16(blue, green);
+    __m128i ra = _mm_packus_epi16(red, _mm_set1_epi16(0xFF));
+    bg = _mm_unpacklo_epi8(bg, _mm_srli_si128(bg, 8));
+    ra = _mm_unpacklo_epi8(ra, _mm_srli_si128(ra, 8));
+    *pPixels0 = _mm_unpacklo_epi16(bg, ra);
+    *pPixels1 = _mm_unpackhi_epi16(bg, ra);
+}
+
+/// <summary>
+/// Convert 8 YUY2 pixels (16 bytes) into 2 x 4 opaque BGRA pixels
+/// </summary>
+static inline void YUY2ToBGRA(__m128i yuy2, const YUVRegisters& r, __m128i* pPixels0, __m128i* pPixels1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowWord = _mm_set1_epi32(0xFFFF);
+    const __m128i one = _mm_set1_epi32(0x10000);
+
+    // Y0 U0 Y1 V0 Y2 U1 Y3 V1 as INT16, for pixels 0-3 and 4-7
+    __m128i lo = _mm_unpacklo_epi8(yuy2, zero);
+    __m128i hi = _mm_unpackhi_epi8(yuy2, zero);
+
+    __m128i luma0 = _mm_madd_epi16(_mm_or_si128(_mm_and_si128(lo, lowWord), one), r.luma);
+    __m128i luma1 = _mm_madd_epi16(_mm_or_si128(_mm_and_si128(hi, lowWord), one), r.luma);
+
+    // (U - 128, V - 128) of the 4 pairs, every term then being used by two pixels
+    __m128i chroma = _mm_sub_epi16(_mm_packs_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16)), _mm_set1_epi16(128));
+    __m128i red = _mm_madd_epi16(chroma, r.red);
+    __m128i green = _mm_madd_epi16(chroma, r.green);
+    __m128i blue = _mm_madd_epi16(chroma, r.blue);
+
+    PackBGRA(
+        CombineComponent(luma0, luma1, _mm_unpacklo_epi32(blue, blue), _mm_unpackhi_epi32(blue, blue)),
+        CombineComponent(luma0, luma1, _mm_unpacklo_epi32(green, green), _mm_unpackhi_epi32(green, green)),
+        CombineComponent(luma0, luma1, _mm_unpacklo_epi32(red, red), _mm_unpackhi_epi32(red, red)),
+        pPixels0, pPixels1);
+}
+
+/// <summary>
+/// Convert a YUY2 row into BGRA, 8 pixels per step
+/// </summary>
+static void ConvertYUY2RowSSE2(const BYTE* pRow, RGBQUAD* pRGBX, int nWidth, const YUVCoefficients& k, bool bMirror)
+{
+    const YUVRegisters r = LoadYUVRegisters(k);
+    int j = 0;
+
+    for (; j + 8 <= nWidth; j += 8)
+    {
+        __m128i pixel0, pixel1;
+        YUY2ToBGRA(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + j * 2)), r, &pixel0, &pixel1);
+
+        if (bMirror)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + nWidth - 4 - j), _mm_shuffle_epi32(pixel0, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + nWidth - 8 - j), _mm_shuffle_epi32(pixel1, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+        else
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j), pixel0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j + 4), pixel1);
+        }
+    }
+
+    ConvertYUY2RowScalar(pRow, pRGBX, nWidth, j, k, bMirror);
+}
+
+/// <summary>
+/// Convert a YUY2 row into packed 24-bit pixels, 16 pixels per step
+/// </summary>
+SSSE3_FUNCTION static void ConvertYUY2RGBRowSSSE3(const BYTE* pRow, RGBTRIPLE* pRGB, int nWidth, const YUVCoefficients& k, bool bMirror, bool bBGR)
+{
+    // Drop the alpha of 4 pixels, reversing them when mirroring, leaving 12 bytes at the bottom
+    const __m128i packBGR = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i packRGB = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i packMirroredBGR = _mm_setr_epi8(12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1);
+    const __m128i packMirroredRGB = _mm_setr_epi8(14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0, -1, -1, -1, -1);
+    const __m128i pack = bMirror ? (bBGR ? packMirroredBGR : packMirroredRGB) : (bBGR ? packBGR : packRGB);
+    const YUVRegisters r = LoadYUVRegisters(k);
+    BYTE* pOutput = reinterpret_cast<BYTE*>(pRGB);
+    int j = 0;
+
+    for (; j + 16 <= nWidth; j += 16)
+    {
+        __m128i pixel0, pixel1, pixel2, pixel3;
+        YUY2ToBGRA(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + j * 2)), r, &pixel0, &pixel1);
+        YUY2ToBGRA(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + j * 2 + 16)), r, &pixel2, &pixel3);
+
+        int nOffset = j * 3;
+        if (bMirror)
+        {
+            // The last source pixels come first
+            std::swap(pixel0, pixel3);
+            std::swap(pixel1, pixel2);
+            nOffset = (nWidth - 16 - j) * 3;
+        }
+
+        pixel0 = _mm_shuffle_epi8(pixel0, pack);
+        pixel1 = _mm_shuffle_epi8(pixel1, pack);
+        pixel2 = _mm_shuffle_epi8(pixel2, pack);
+        pixel3 = _mm_shuffle_epi8(pixel3, pack);
+
+        // 4 x 12 bytes -> 3 x 16 bytes
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + nOffset), _mm_or_si128(pixel0, _mm_slli_si128(pixel1, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + nOffset + 16), _mm_or_si128(_mm_srli_si128(pixel1, 4), _mm_slli_si128(pixel2, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutput + nOffset + 32), _mm_or_si128(_mm_srli_si128(pixel2, 8), _mm_slli_si128(pixel3, 4)));
+    }
+
+    ConvertYUY2RGBRowScalar(pRow, pRGB, nWidth, j, k, bMirror, bBGR);
+}
+
+/// <summary>
+/// Convert 4 YUY2 pairs (16 bytes), already averaged over two rows, into the luma and chroma terms of 4 pixels
+/// </summary>
+static inline void DownscalePairs(__m128i pairs, const YUVRegisters& r, __m128i* pLuma, __m128i* pRed, __m128i* pGreen, __m128i* pBlue)
+{
+    const __m128i lowByte = _mm_set1_epi32(0xFF);
+    const __m128i one = _mm_set1_epi32(0x10000);
+
+    // Byte 0 of every INT32 lane becomes the average of Y0 and Y1
+    __m128i luma = _mm_and_si128(_mm_avg_epu8(pairs, _mm_srli_epi32(pairs, 16)), lowByte);
+    *pLuma = _mm_madd_epi16(_mm_or_si128(luma, one), r.luma);
+
+    __m128i chroma = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pairs, 8), lowByte), _mm_slli_epi32(_mm_srli_epi32(pairs, 24), 16));
+    chroma = _mm_sub_epi16(chroma, _mm_set1_epi16(128));
+    *pRed = _mm_madd_epi16(chroma, r.red);
+    *pGreen = _mm_madd_epi16(chroma, r.green);
+    *pBlue = _mm_madd_epi16(chroma, r.blue);
+}
+
+/// <summary>
+/// Convert two YUY2 rows into one BGRA row of half their width, 8 output pixels per step
+/// </summary>
+static void DownscaleYUY2RowSSE2(const BYTE* pRow0, const BYTE* pRow1, RGBQUAD* pRGBX, int nWidth, const YUVCoefficients& k, bool bMirror)
+{
+    const YUVRegisters r = LoadYUVRegisters(k);
+    int j = 0;
+
+    for (; j + 8 <= nWidth; j += 8)
+    {
+        __m128i pairs0 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + j * 4)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + j * 4)));
+        __m128i pairs1 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + j * 4 + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + j * 4 + 16)));
+
+        __m128i luma0, red0, green0, blue0;
+        __m128i luma1, red1, green1, blue1;
+        DownscalePairs(pairs0, r, &luma0, &red0, &green0, &blue0);
+        DownscalePairs(pairs1, r, &luma1, &red1, &green1, &blue1);
+
+        __m128i pixel0, pixel1;
+        PackBGRA(
+            CombineComponent(luma0, luma1, blue0, blue1),
+            CombineComponent(luma0, luma1, green0, green1),
+            CombineComponent(luma0, luma1, red0, red1),
+            &pixel0, &pixel1);
+
+        if (bMirror)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + nWidth - 4 - j), _mm_shuffle_epi32(pixel0, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + nWidth - 8 - j), _mm_shuffle_epi32(pixel1, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+        else
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j), pixel0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRGBX + j + 4), pixel1);
+        }
+    }
+
+    DownscaleYUY2RowScalar(pRow0, pRow1, pRGBX, nWidth, j, k, bMirror);
+}
+
+/// <summary>
+/// Convert a YUY2 row into BGRA, 16 pixels per step
+/// </summary>
+AVX2_FUNCTION static void ConvertYUY2RowAVX2(const BYTE* pRow, RGBQUAD* pRGBX, int nWidth, const YUVCoefficients& k, bool bMirror)
+{
+    const YUVRegisters r = LoadYUVRegisters(k);
+    const __m256i lumaCoefficients = _mm256_broadcastsi128_si256(r.luma);
+    const __m256i redCoefficients = _mm256_broadcastsi128_si256(r.red);
+    const __m256i greenCoefficients = _mm256_broadcastsi128_si256(r.green);
+    const __m256i blueCoefficients = _mm256_broadcastsi128_si256(r.blue);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lowWord = _mm256_set1_epi32(0xFFFF);
+    const __m256i one = _mm256_set1_epi32(0x10000);
+    const __m256i reversePixels = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    int j = 0;
+
+    for (; j + 16 <= nWidth; j += 16)
+    {
+        // Same steps as YUY2ToBGRA, each 128-bit lane holding 8 pixels
+        __m256i yuy2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRow + j * 2));
+        __m256i lo = _mm256_unpacklo_epi8(yuy2, zero);
+        __m256i hi = _mm256_unpackhi_epi8(yuy2, zero);
+
+        __m256i luma0 = _mm256_madd_epi16(_mm256_or_si256(_mm256_and_si256(lo, lowWord), one), lumaCoefficients);
+        __m256i luma1 = _mm256_madd_epi16(_mm256_or_si256(_mm256_and_si256(hi, lowWord), one), lumaCoefficients);
+
+        __m256i chroma = _mm256_sub_epi16(_mm256_packs_epi32(_mm256_srli_epi32(lo, 16), _mm256_srli_epi32(hi, 16)), _mm256_set1_epi16(128));
+        __m256i red = _mm256_madd_epi16(chroma, redCoefficients);
+        __m256i green = _mm256_madd_epi16(chroma, greenCoefficients);
+        __m256i blue = _mm256_madd_epi16(chroma, blueCoefficients);
+
+        blue = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_add_epi32(luma0, _mm256_unpacklo_epi32(blue, blue)), 8),
+            _mm256_srai_epi32(_mm256_add_epi32(luma1, _mm256_unpackhi_epi32(blue, blue)), 8));
+        green = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_add_epi32(luma0, _mm256_unpacklo_epi32(green, green)), 8),
+            _mm256_srai_epi32(_mm256_add_epi32(luma1, _mm256_unpackhi_epi32(green, green)), 8));
+        red = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_add_epi32(luma0, _mm256_unpacklo_epi32(red, red)), 8),
+            _mm256_srai_epi32(_mm256_add_epi32(luma1, _mm256_unpackhi_epi32(red, red)), 8));
+
+        __m256i bg = _mm256_packus_epi16(blue, green);
+        __m256i ra = _mm256_packus_epi16(red, _mm256_set1_epi16(0xFF));
+        bg = _mm256_unpacklo_epi8(bg, _mm256_srli_si256(bg, 8));
+        ra = _mm256_unpacklo_epi8(ra, _mm256_srli_si256(ra, 8));
+
+        // Pixels 0-3 | 8-11 and 4-7 | 12-15 -> 0-7 and 8-15
+        __m256i pixel0 = _mm256_unpacklo_epi16(bg, ra);
+        __m256i pixel1 = _mm256_unpackhi_epi16(bg, ra);
+        __m256i first = _mm256_permute2x128_si256(pixel0, pixel1, 0x20);
+        __m256i second = _mm256_permute2x128_si256(pixel0, pixel1, 0x31);
+
+        if (bMirror)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + nWidth - 8 - j), _mm256_permutevar8x32_epi32(first, reversePixels));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + nWidth - 16 - j), _mm256_permutevar8x32_epi32(second, reversePixels));
+        }
+        else
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + j), first);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pRGBX + j + 8), second);
+        }
+    }
+
+    ConvertYUY2RowScalar(pRow, pRGBX, nWidth, j, k, bMirror);
+}
+#endif
+
+/// <summary>
+/// Convert infrared rows into the mirrored RGBX preview and the mirrored big-endian storage
+/// </summary>
+/// <param name="pBuffer">source rows as delivered by the sensor</param>
+/// <param name="pRGBX">receives the preview rows</param>
+/// <param name="pUINT16">receives the storage rows</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="nHeight">number of rows</param>
+void ConvertInfrared(const UINT16* pBuffer, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nHeight)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+
+    for (int i = 0; i < nHeight; ++i)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_AVX2)
+        {
+            ConvertInfraredRowAVX2(pBuffer, pRGBX, pUINT16, nWidth);
+        }
+        else if (nLevel >= SimdLevel_SSE2)
+        {
+            ConvertInfraredRowSSE2(pBuffer, pRGBX, pUINT16, nWidth);
+        }
+        else
+#endif
+        {
+            ConvertInfraredRowScalar(pBuffer, pRGBX, pUINT16, nWidth, 0);
+        }
+
+        pBuffer += nWidth;
+        pRGBX += nWidth;
+        pUINT16 += nWidth;
+    }
+}
+
+/// <summary>
+/// Convert depth rows into the mirrored RGBX preview (through a lookup table) and the mirrored big-endian storage
+/// </summary>
+/// <param name="pBuffer">source rows as delivered by the sensor</param>
+/// <param name="pLUT">color of every depth value</param>
+/// <param name="pRGBX">receives the preview rows</param>
+/// <param name="pUINT16">receives the storage rows, 0 outside the reliable range</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="nMinDepth">minimum reliable depth</param>
+/// <param name="nMaxDepth">maximum reliable depth</param>
+void ConvertDepth(const UINT16* pBuffer, const RGBQUAD* pLUT, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nHeight, USHORT nMinDepth, USHORT nMaxDepth)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+
+    for (int i = 0; i < nHeight; ++i)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_AVX2)
+        {
+            ConvertDepthRowAVX2(pBuffer, pLUT, pRGBX, pUINT16, nWidth, nMinDepth, nMaxDepth);
+        }
+        else if (nLevel >= SimdLevel_SSE2)
+        {
+            ConvertDepthRowSSE2(pBuffer, pLUT, pRGBX, pUINT16, nWidth, nMinDepth, nMaxDepth);
+        }
+        else
+#endif
+        {
+            ConvertDepthRowScalar(pBuffer, pLUT, pRGBX, pUINT16, nWidth, 0, nMinDepth, nMaxDepth);
+        }
+
+        pBuffer += nWidth;
+        pRGBX += nWidth;
+        pUINT16 += nWidth;
+    }
+}
+
+/// <summary>
+/// Convert BGRA color rows into mirrored packed 24-bit storage and, optionally, a mirrored BGRA preview
+/// </summary>
+/// <param name="pBuffer">source rows as delivered by the sensor, left untouched</param>
+/// <param name="pRGB">receives the storage rows</param>
+/// <param name="pPreview">receives the preview rows, may be NULL</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="bBGR">true for B-G-R byte order (BMP), false for R-G-B (PPM)</param>
+void ConvertColor(const RGBQUAD* pBuffer, RGBTRIPLE* pRGB, RGBQUAD* pPreview, int nWidth, int nHeight, bool bBGR)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+
+    for (int i = 0; i < nHeight; ++i)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_AVX2)
+        {
+            ConvertColorRowAVX2(pBuffer, pRGB, pPreview, nWidth, bBGR);
+        }
+        else if (nLevel >= SimdLevel_SSSE3)
+        {
+            ConvertColorRowSSSE3(pBuffer, pRGB, pPreview, nWidth, bBGR);
+        }
+        else
+#endif
+        {
+            ConvertColorRowScalar(pBuffer, pRGB, pPreview, nWidth, 0, bBGR);
+        }
+
+        pBuffer += nWidth;
+        pRGB += nWidth;
+        if (pPreview)
+        {
+            pPreview += nWidth;
+        }
+    }
+}
+
+/// <summary>
+/// Shrink BGRA rows by an integer factor, optionally mirrored.
+/// Every output pixel is the rounded average of a nFactor x nFactor block.
+/// </summary>
+/// <param name="pBuffer">source rows</param>
+/// <param name="pRGBX">receives nHeight / nFactor BGRA rows of nWidth / nFactor pixels</param>
+/// <param name="nWidth">width (in pixels) of a source row, a multiple of nFactor</param>
+/// <param name="nHeight">number of source rows, a multiple of nFactor</param>
+/// <param name="nFactor">2 or 4</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+void DownscaleBGRA(const RGBQUAD* pBuffer, RGBQUAD* pRGBX, int nWidth, int nHeight, int nFactor, bool bMirror)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+    int nOutputWidth = nWidth / nFactor;
+
+    for (int i = 0; i + nFactor <= nHeight; i += nFactor)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_SSE2 && nFactor == 2)
+        {
+            DownscaleBGRA2RowSSE2(pBuffer, nWidth, pRGBX, nOutputWidth, bMirror);
+        }
+        else if (nLevel >= SimdLevel_SSE2 && nFactor == 4)
+        {
+            DownscaleBGRA4RowSSE2(pBuffer, nWidth, pRGBX, nOutputWidth, bMirror);
+        }
+        else
+#endif
+        {
+            DownscaleBGRARowScalar(pBuffer, nWidth, pRGBX, nOutputWidth, 0, nFactor, bMirror);
+        }
+
+        pBuffer += nWidth * nFactor;
+        pRGBX += nOutputWidth;
+    }
+}
+
+/// <summary>
+/// Convert YUY2 color rows into BGRA, optionally mirrored
+/// </summary>
+/// <param name="pBuffer">source rows, 2 bytes per pixel (Y0 U Y1 V)</param>
+/// <param name="pRGBX">receives the BGRA rows</param>
+/// <param name="nWidth">width (in pixels) of a row, even</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="nMatrix">color matrix of the source</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+void ConvertYUY2(const BYTE* pBuffer, RGBQUAD* pRGBX, int nWidth, int nHeight, YUVMatrix nMatrix, bool bMirror)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+    const YUVCoefficients& k = s_aYUVCoefficients[nMatrix];
+
+    for (int i = 0; i < nHeight; ++i)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_AVX2)
+        {
+            ConvertYUY2RowAVX2(pBuffer, pRGBX, nWidth, k, bMirror);
+        }
+        else if (nLevel >= SimdLevel_SSE2)
+        {
+            ConvertYUY2RowSSE2(pBuffer, pRGBX, nWidth, k, bMirror);
+        }
+        else
+#endif
+        {
+            ConvertYUY2RowScalar(pBuffer, pRGBX, nWidth, 0, k, bMirror);
+        }
+
+        pBuffer += nWidth * 2;
+        pRGBX += nWidth;
+    }
+}
+
+/// <summary>
+/// Convert YUY2 color rows into packed 24-bit pixels, optionally mirrored
+/// </summary>
+/// <param name="pBuffer">source rows, 2 bytes per pixel (Y0 U Y1 V)</param>
+/// <param name="pRGB">receives the 24-bit rows</param>
+/// <param name="nWidth">width (in pixels) of a row, even</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="nMatrix">color matrix of the source</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+/// <param name="bBGR">true for B-G-R byte order (BMP), false for R-G-B (PPM)</param>
+void ConvertYUY2ToRGB(const BYTE* pBuffer, RGBTRIPLE* pRGB, int nWidth, int nHeight, YUVMatrix nMatrix, bool bMirror, bool bBGR)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+    const YUVCoefficients& k = s_aYUVCoefficients[nMatrix];
+
+    for (int i = 0; i < nHeight; ++i)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_SSSE3)
+        {
+            ConvertYUY2RGBRowSSSE3(pBuffer, pRGB, nWidth, k, bMirror, bBGR);
+        }
+        else
+#endif
+        {
+            ConvertYUY2RGBRowScalar(pBuffer, pRGB, nWidth, 0, k, bMirror, bBGR);
+        }
+
+        pBuffer += nWidth * 2;
+        pRGB += nWidth;
+    }
+}
+
+/// <summary>
+/// Convert YUY2 color rows into BGRA at half the width and height, optionally mirrored.
+/// Every output pixel is the average of a 2x2 block.
+/// </summary>
+/// <param name="pBuffer">source rows, 2 bytes per pixel (Y0 U Y1 V)</param>
+/// <param name="pRGBX">receives nHeight / 2 BGRA rows of nWidth / 2 pixels</param>
+/// <param name="nWidth">width (in pixels) of a source row, even</param>
+/// <param name="nHeight">number of source rows, even</param>
+/// <param name="nMatrix">color matrix of the source</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+void DownscaleYUY2(const BYTE* pBuffer, RGBQUAD* pRGBX, int nWidth, int nHeight, YUVMatrix nMatrix, bool bMirror)
+{
+    SimdLevel nLevel = s_nSimdLevel;
+    const YUVCoefficients& k = s_aYUVCoefficients[nMatrix];
+    int nOutputWidth = nWidth / 2;
+
+    for (int i = 0; i + 1 < nHeight; i += 2)
+    {
+#ifdef CONVERTER_X86
+        if (nLevel >= SimdLevel_SSE2)
+        {
+            DownscaleYUY2RowSSE2(pBuffer, pBuffer + nWidth * 2, pRGBX, nOutputWidth, k, bMirror);
+        }
+        else
+#endif
+        {
+            DownscaleYUY2RowScalar(pBuffer, pBuffer + nWidth * 2, pRGBX, nOutputWidth, 0, k, bMirror);
+        }
+
+        pBuffer += nWidth * 4;
+        pRGBX += nOutputWidth;
+    }
+}
@@ -0,0 +1,147 @@
+// FrameConverter.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Pixel conversion kernels turning sensor frames into the mirrored preview
+// and storage formats, with SIMD paths selected at run time.
+
+
+#pragma once
+
+// InfraredSourceValueMaximum is the highest value that can be returned in the InfraredFrame.
+// It is cast to a float for readability in the visualization code.
+#define InfraredSourceValueMaximum static_cast<float>(USHRT_MAX)
+
+// The InfraredOutputValueMinimum value is used to set the lower limit, post processing, of the
+// infrared data that we will render.
+// Increasing or decreasing this value sets a brightness "wall" either closer or further away.
+#define InfraredOutputValueMinimum 0.01f 
+
+// The InfraredOutputValueMaximum value is the upper limit, post processing, of the
+// infrared data that we will render.
+#define InfraredOutputValueMaximum 1.0f
+
+// The InfraredSceneValueAverage value specifies the average infrared value of the scene.
+// This value was selected by analyzing the average pixel intensity for a given scene.
+// Depending on the visualization requirements for a given application, this value can be
+// hard coded, as was done here, or calculated by averaging the intensity for each pixel prior
+// to rendering.
+#define InfraredSceneValueAverage 0.08f
+
+/// The InfraredSceneStandardDeviations value specifies the number of standard deviations
+/// to apply to InfraredSceneValueAverage. This value was selected by analyzing data
+/// from a given scene.
+/// Depending on the visualization requirements for a given application, this value can be
+/// hard coded, as was done here, or calculated at runtime.
+#define InfraredSceneStandardDeviations 3.0f
+
+/// Instruction set used by the conversion kernels
+enum SimdLevel
+{
+    SimdLevel_None = 0,     // portable scalar code
+    SimdLevel_SSE2 = 1,
+    SimdLevel_SSSE3 = 2,
+    SimdLevel_AVX2 = 3
+};
+
+/// <summary>
+/// Get the instruction set currently used by the conversion kernels
+/// </summary>
+/// <returns>the highest level supported by the CPU, unless lowered by SetSimdLevel</returns>
+SimdLevel GetSimdLevel();
+
+/// <summary>
+/// Limit the instruction set used by the conversion kernels
+/// </summary>
+/// <param name="nLevel">requested level, clamped to what the CPU supports</param>
+/// <returns>the level actually in use</returns>
+SimdLevel SetSimdLevel(SimdLevel nLevel);
+
+/// <summary>
+/// Convert infrared rows into the mirrored RGBX preview and the mirrored big-endian storage
+/// </summary>
+/// <param name="pBuffer">source rows as delivered by the sensor</param>
+/// <param name="pRGBX">receives the preview rows</param>
+/// <param name="pUINT16">receives the storage rows</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="nHeight">number of rows</param>
+void ConvertInfrared(const UINT16* pBuffer, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nHeight);
+
+/// <summary>
+/// Convert depth rows into the mirrored RGBX preview (through a lookup table) and the mirrored big-endian storage
+/// </summary>
+/// <param name="pBuffer">source rows as delivered by the sensor</param>
+/// <param name="pLUT">color of every depth value</param>
+/// <param name="pRGBX">receives the preview rows</param>
+/// <param name="pUINT16">receives the storage rows, 0 outside the reliable range</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="nMinDepth">minimum reliable depth</param>
+/// <param name="nMaxDepth">maximum reliable depth</param>
+void ConvertDepth(const UINT16* pBuffer, const RGBQUAD* pLUT, RGBQUAD* pRGBX, UINT16* pUINT16, int nWidth, int nHeight, USHORT nMinDepth, USHORT nMaxDepth);
+
+/// <summary>
+/// Convert BGRA color rows into mirrored packed 24-bit storage and, optionally, a mirrored BGRA preview
+/// </summary>
+/// <param name="pBuffer">source rows as delivered by the sensor, left untouched</param>
+/// <param name="pRGB">receives the storage rows</param>
+/// <param name="pPreview">receives the preview rows, may be NULL</param>
+/// <param name="nWidth">width (in pixels) of a row</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="bBGR">true for B-G-R byte order (BMP), false for R-G-B (PPM)</param>
+void ConvertColor(const RGBQUAD* pBuffer, RGBTRIPLE* pRGB, RGBQUAD* pPreview, int nWidth, int nHeight, bool bBGR);
+
+/// <summary>
+/// Shrink BGRA rows by an integer factor, optionally mirrored.
+/// Every output pixel is the rounded average of a nFactor x nFactor block.
+/// </summary>
+/// <param name="pBuffer">source rows</param>
+/// <param name="pRGBX">receives nHeight / nFactor BGRA rows of nWidth / nFactor pixels</param>
+/// <param name="nWidth">width (in pixels) of a source row, a multiple of nFactor</param>
+/// <param name="nHeight">number of source rows, a multiple of nFactor</param>
+/// <param name="nFactor">2 or 4</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+void DownscaleBGRA(const RGBQUAD* pBuffer, RGBQUAD* pRGBX, int nWidth, int nHeight, int nFactor, bool bMirror);
+
+/// Color matrix of YUV frames, both in video range (Y 16-235, U/V 16-240)
+enum YUVMatrix
+{
+    YUVMatrix_BT601 = 0,    // SD video, the conversion used by the Kinect SDK
+    YUVMatrix_BT709,        // HD video
+    YUVMatrix_Count
+};
+
+/// <summary>
+/// Convert YUY2 color rows into BGRA, optionally mirrored
+/// </summary>
+/// <param name="pBuffer">source rows, 2 bytes per pixel (Y0 U Y1 V)</param>
+/// <param name="pRGBX">receives the BGRA rows</param>
+/// <param name="nWidth">width (in pixels) of a row, even</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="nMatrix">color matrix of the source</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+void ConvertYUY2(const BYTE* pBuffer, RGBQUAD* pRGBX, int nWidth, int nHeight, YUVMatrix nMatrix, bool bMirror);
+
+/// <summary>
+/// Convert YUY2 color rows into packed 24-bit pixels, optionally mirrored
+/// </summary>
+/// <param name="pBuffer">source rows, 2 bytes per pixel (Y0 U Y1 V)</param>
+/// <param name="pRGB">receives the 24-bit rows</param>
+/// <param name="nWidth">width (in pixels) of a row, even</param>
+/// <param name="nHeight">number of rows</param>
+/// <param name="nMatrix">color matrix of the source</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+/// <param name="bBGR">true for B-G-R byte order (BMP), false for R-G-B (PPM)</param>
+void ConvertYUY2ToRGB(const BYTE* pBuffer, RGBTRIPLE* pRGB, int nWidth, int nHeight, YUVMatrix nMatrix, bool bMirror, bool bBGR);
+
+/// <summary>
+/// Convert YUY2 color rows into BGRA at half the width and height, optionally mirrored.
+/// Every output pixel is the average of a 2x2 block.
+/// </summary>
+/// <param name="pBuffer">source rows, 2 bytes per pixel (Y0 U Y1 V)</param>
+/// <param name="pRGBX">receives nHeight / 2 BGRA rows of nWidth / 2 pixels</param>
+/// <param name="nWidth">width (in pixels) of a source row, even</param>
+/// <param name="nHeight">number of source rows, even</param>
+/// <param name="nMatrix">color matrix of the source</param>
+/// <param name="bMirror">true to mirror the rows like the other conversions</param>
+void DownscaleYUY2(const BYTE* pBuffer, RGBQUAD* pRGBX, int nWidth, int nHeight, YUVMatrix nMatrix, bool bMirror);
@@ -0,0 +1,282 @@
+// FrameQueue.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Bounded single-producer/single-consumer queue used to hand frames from one
+// thread of the pipeline over to the next: sensor frames from the capture thread
+// to the conversion thread, recorded frames from there to the writer threads.
+
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/// The CacheLineSize value specifies the padding used to keep producer and consumer state apart
+#define CacheLineSize 64
+
+/// <summary>
+/// Describes one frame waiting in a FrameQueue
+/// </summary>
+struct FrameDesc
+{
+    UINT                    nSlot;          // index of the ring buffer slot holding the frame data
+    INT64                   nTime;          // timestamp relative to the start of the record (unit: 100 ns)
+    UINT                    nGeneration;    // running frame number of the stream, dropped frames included
+};
+
+/// <summary>
+/// Wakes up the consumer when any of the queues sharing it receives a frame
+/// </summary>
+class FrameSignal
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    FrameSignal() : m_nSequence(0) {}
+
+    /// <summary>
+    /// Get the current sequence number, to be passed to Wait() later on
+    /// </summary>
+    /// <returns>sequence number</returns>
+    UINT64 Sequence()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_nSequence;
+    }
+
+    /// <summary>
+    /// Wake up all waiting consumers
+    /// </summary>
+    void Notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_nSequence;
+        }
+        m_cvSignal.notify_all();
+    }
+
+    /// <summary>
+    /// Block until Notify() has been called after Sequence() returned nSeen
+    /// </summary>
+    /// <param name="nSeen">sequence number observed before checking the queues</param>
+    /// <param name="nTimeoutMsec">maximum waiting time in milliseconds</param>
+    void Wait(UINT64 nSeen, DWORD nTimeoutMsec)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvSignal.wait_for(lock, std::chrono::milliseconds(nTimeoutMsec), [&]{ return m_nSequence != nSeen; });
+    }
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_cvSignal;
+    UINT64                  m_nSequence;
+};
+
+/// <summary>
+/// Lock-free bounded SPSC queue of frame descriptors.
+/// The queue also owns the slot allocation of the ring buffer it describes:
+/// a slot is handed out by NextSlot() only while it is not waiting to be written,
+/// and it is given back when the consumer calls Pop() after writing it.
+/// </summary>
+template <UINT Capacity>
+class FrameQueue
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    FrameQueue() :
+        m_nHead(0),
+        m_nGeneration(0),
+        m_nDropped(0),
+        m_pSignal(NULL),
+        m_nTail(0),
+        m_nFailed(0)
+    {
+    }
+
+    /// <summary>
+    /// Set the signal to notify whenever a frame is pushed
+    /// </summary>
+    /// <param name="pSignal">signal shared with the consumer</param>
+    void SetSignal(FrameSignal* pSignal)
+    {
+        m_pSignal = pSignal;
+    }
+
+    /// <summary>
+    /// Producer: check if the slot returned by NextSlot() may be filled
+    /// </summary>
+    /// <returns>true if a free slot is available</returns>
+    bool CanPush() const
+    {
+        return m_nHead.load(std::memory_order_relaxed) - m_nTail.load(std::memory_order_acquire) < Capacity;
+    }
+
+    /// <summary>
+    /// Producer: slot the next frame has to be stored into
+    /// </summary>
+    /// <returns>slot index in [0, Capacity)</returns>
+    UINT NextSlot() const
+    {
+        return m_nHead.load(std::memory_order_relaxed) % Capacity;
+    }
+
+    /// <summary>
+    /// Producer: publish the frame stored in NextSlot()
+    /// </summary>
+    /// <param name="nTime">timestamp relative to the start of the record</param>
+    /// <returns>false if the queue was full and the frame has been counted as dropped</returns>
+    bool Push(INT64 nTime)
+    {
+        if (!CanPush())
+        {
+            Drop();
+            return false;
+        }
+
+        UINT nHead = m_nHead.load(std::memory_order_relaxed);
+        FrameDesc& desc = m_aDesc[nHead % Capacity];
+        desc.nSlot = nHead % Capacity;
+        desc.nTime = nTime;
+        desc.nGeneration = m_nGeneration++;
+        m_nHead.store(nHead + 1, std::memory_order_release);
+
+        if (m_pSignal)
+        {
+            m_pSignal->Notify();
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Producer: account for a frame which could not be queued
+    /// </summary>
+    void Drop()
+    {
+        ++m_nGeneration;
+        m_nDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Consumer: get the oldest frame without releasing its slot
+    /// </summary>
+    /// <param name="pDesc">receives the frame descriptor</param>
+    /// <returns>false if the queue is empty</returns>
+    bool Front(FrameDesc* pDesc) const
+    {
+        UINT nTail = m_nTail.load(std::memory_order_relaxed);
+        if (nTail == m_nHead.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        *pDesc = m_aDesc[nTail % Capacity];
+        return true;
+    }
+
+    /// <summary>
+    /// Consumer: get a waiting frame without releasing any slot
+    /// </summary>
+    /// <param name="nIndex">position of the frame, 0 for the oldest one</param>
+    /// <param name="pDesc">receives the frame descriptor</param>
+    /// <returns>false if fewer than nIndex + 1 frames are waiting</returns>
+    bool Peek(UINT nIndex, FrameDesc* pDesc) const
+    {
+        UINT nTail = m_nTail.load(std::memory_order_relaxed);
+        if (m_nHead.load(std::memory_order_acquire) - nTail <= nIndex)
+        {
+            return false;
+        }
+
+        *pDesc = m_aDesc[(nTail + nIndex) % Capacity];
+        return true;
+    }
+
+    /// <summary>
+    /// Consumer: release the slot of the oldest frame
+    /// </summary>
+    void Pop()
+    {
+        m_nTail.store(m_nTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /// <summary>
+    /// Consumer: release the slot of the oldest frame, which could not be written, counting it as dropped
+    /// </summary>
+    void Fail()
+    {
+        m_nFailed.fetch_add(1, std::memory_order_relaxed);
+        Pop();
+    }
+
+    /// <summary>
+    /// Check if there are no frames waiting
+    /// </summary>
+    bool Empty() const
+    {
+        return m_nHead.load(std::memory_order_acquire) == m_nTail.load(std::memory_order_acquire);
+    }
+
+    /// <summary>
+    /// Number of frames waiting
+    /// </summary>
+    UINT Size() const
+    {
+        return m_nHead.load(std::memory_order_acquire) - m_nTail.load(std::memory_order_acquire);
+    }
+
+    /// <summary>
+    /// Number of frames dropped because the consumer fell Capacity frames behind or failed to write them
+    /// </summary>
+    UINT Dropped() const
+    {
+        return m_nDropped.load(std::memory_order_relaxed) + Failed();
+    }
+
+    /// <summary>
+    /// Number of frames the consumer failed to write
+    /// </summary>
+    UINT Failed() const
+    {
+        return m_nFailed.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Producer: number of frames pushed or dropped since ResetCounters()
+    /// </summary>
+    UINT Generation() const
+    {
+        return m_nGeneration;
+    }
+
+    /// <summary>
+    /// Producer: restart frame numbering and drop statistics, the queue must be empty
+    /// </summary>
+    void ResetCounters()
+    {
+        m_nGeneration = 0;
+        m_nDropped.store(0, std::memory_order_relaxed);
+        m_nFailed.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    // Producer side
+    std::atomic<UINT>       m_nHead;
+    UINT                    m_nGeneration;
+    std::atomic<UINT>       m_nDropped;
+    FrameSignal*            m_pSignal;
+    BYTE                    m_pad0[CacheLineSize];
+
+    // Consumer side
+    std::atomic<UINT>       m_nTail;
+    std::atomic<UINT>       m_nFailed;
+    BYTE                    m_pad1[CacheLineSize];
+
+    FrameDesc               m_aDesc[Capacity];
+};
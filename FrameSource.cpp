@@ -0,0 +1,440 @@
+// FrameSource.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// These codes are written mainly based on codes from Kinect for Windows SDK 2.0
+// https://www.microsoft.com/en-us/download/details.aspx?id=44561
+
+
+#include "stdafx.h"
+#include "FrameSource.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+KinectFrameSource::KinectFrameSource() :
+m_pKinectSensor(NULL),
+m_pInfraredFrameReader(NULL),
+m_pDepthFrameReader(NULL),
+m_pColorFrameReader(NULL),
+m_pInfraredFrame(NULL),
+m_pDepthFrame(NULL),
+m_pColorFrame(NULL),
+m_pColorRGBX(NULL),
+m_bRawColor(false)
+{
+    ZeroMemory(m_aFrameEvents, sizeof(m_aFrameEvents));
+
+    // create heap storage for color pixel data in RGBX format
+    m_pColorRGBX = new RGBQUAD[cColorWidth * cColorHeight];
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+KinectFrameSource::~KinectFrameSource()
+{
+    SafeRelease(m_pInfraredFrame);
+    SafeRelease(m_pDepthFrame);
+    SafeRelease(m_pColorFrame);
+
+    // stop the frame arrival events
+    if (m_aFrameEvents[0])
+    {
+        m_pInfraredFrameReader->UnsubscribeFrameArrived(m_aFrameEvents[0]);
+    }
+
+    if (m_aFrameEvents[1])
+    {
+        m_pDepthFrameReader->UnsubscribeFrameArrived(m_aFrameEvents[1]);
+    }
+
+    if (m_aFrameEvents[2])
+    {
+        m_pColorFrameReader->UnsubscribeFrameArrived(m_aFrameEvents[2]);
+    }
+
+    // done with infrared frame reader
+    SafeRelease(m_pInfraredFrameReader);
+
+    // done with depth frame reader
+    SafeRelease(m_pDepthFrameReader);
+
+    // done with color frame reader
+    SafeRelease(m_pColorFrameReader);
+
+    // close the Kinect Sensor
+    if (m_pKinectSensor)
+    {
+        m_pKinectSensor->Close();
+    }
+
+    SafeRelease(m_pKinectSensor);
+
+    if (m_pColorRGBX)
+    {
+        delete[] m_pColorRGBX;
+        m_pColorRGBX = NULL;
+    }
+}
+
+/// <summary>
+/// Initializes the default Kinect sensor
+/// </summary>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT KinectFrameSource::Initialize()
+{
+    HRESULT hr;
+
+    hr = GetDefaultKinectSensor(&m_pKinectSensor);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    if (m_pKinectSensor)
+    {
+        // Initialize the Kinect and get the readers
+        IInfraredFrameSource* pInfraredFrameSource = NULL;
+        IDepthFrameSource* pDepthFrameSource = NULL;
+        IColorFrameSource* pColorFrameSource = NULL;
+
+        hr = m_pKinectSensor->Open();
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pKinectSensor->get_InfraredFrameSource(&pInfraredFrameSource);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pInfraredFrameSource->OpenReader(&m_pInfraredFrameReader);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pKinectSensor->get_DepthFrameSource(&pDepthFrameSource);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pDepthFrameSource->OpenReader(&m_pDepthFrameReader);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pKinectSensor->get_ColorFrameSource(&pColorFrameSource);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = pColorFrameSource->OpenReader(&m_pColorFrameReader);
+        }
+
+        // Get signaled when frames arrive instead of polling the readers
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pInfraredFrameReader->SubscribeFrameArrived(&m_aFrameEvents[0]);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pDepthFrameReader->SubscribeFrameArrived(&m_aFrameEvents[1]);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pColorFrameReader->SubscribeFrameArrived(&m_aFrameEvents[2]);
+        }
+
+        SafeRelease(pInfraredFrameSource);
+        SafeRelease(pDepthFrameSource);
+        SafeRelease(pColorFrameSource);
+    }
+
+    if (!m_pKinectSensor || FAILED(hr))
+    {
+        return E_FAIL;
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Acquire the latest infrared frame
+/// </summary>
+/// <param name="pFrame">receives the frame</param>
+/// <returns>S_OK on success, E_PENDING if no new frame is available, otherwise failure code</returns>
+HRESULT KinectFrameSource::AcquireInfraredFrame(SourceFrame* pFrame)
+{
+    if (!m_pInfraredFrameReader)
+    {
+        return E_FAIL;
+    }
+
+    ReleaseInfraredFrame();
+
+    // Get an infrared frame from Kinect
+    HRESULT hr = m_pInfraredFrameReader->AcquireLatestFrame(&m_pInfraredFrame);
+
+    if (SUCCEEDED(hr))
+    {
+        IFrameDescription* pFrameDescription = NULL;
+        UINT nBufferSize = 0;
+        UINT16 *pBuffer = NULL;
+
+        // Unit: 100 ns
+        hr = m_pInfraredFrame->get_RelativeTime(&pFrame->nTime);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pInfraredFrame->get_FrameDescription(&pFrameDescription);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pFrameDescription->get_Width(&pFrame->nWidth);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pFrameDescription->get_Height(&pFrame->nHeight);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pInfraredFrame->AccessUnderlyingBuffer(&nBufferSize, &pBuffer);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            pFrame->nBufferSize = nBufferSize * sizeof(UINT16);
+            pFrame->pBuffer = reinterpret_cast<BYTE*>(pBuffer);
+        }
+
+        SafeRelease(pFrameDescription);
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Acquire the latest depth frame
+/// </summary>
+/// <param name="pFrame">receives the frame</param>
+/// <returns>S_OK on success, E_PENDING if no new frame is available, otherwise failure code</returns>
+HRESULT KinectFrameSource::AcquireDepthFrame(SourceFrame* pFrame)
+{
+    if (!m_pDepthFrameReader)
+    {
+        return E_FAIL;
+    }
+
+    ReleaseDepthFrame();
+
+    // Get a depth frame from Kinect
+    HRESULT hr = m_pDepthFrameReader->AcquireLatestFrame(&m_pDepthFrame);
+
+    if (SUCCEEDED(hr))
+    {
+        IFrameDescription* pFrameDescription = NULL;
+        UINT nBufferSize = 0;
+        UINT16 *pBuffer = NULL;
+
+        // Unit: 100 ns
+        hr = m_pDepthFrame->get_RelativeTime(&pFrame->nTime);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pDepthFrame->get_FrameDescription(&pFrameDescription);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pFrameDescription->get_Width(&pFrame->nWidth);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pFrameDescription->get_Height(&pFrame->nHeight);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pDepthFrame->get_DepthMinReliableDistance(&pFrame->nMinReliableDistance);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pDepthFrame->get_DepthMaxReliableDistance(&pFrame->nMaxReliableDistance);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pDepthFrame->AccessUnderlyingBuffer(&nBufferSize, &pBuffer);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            pFrame->nBufferSize = nBufferSize * sizeof(UINT16);
+            pFrame->pBuffer = reinterpret_cast<BYTE*>(pBuffer);
+        }
+
+        SafeRelease(pFrameDescription);
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Acquire the latest color frame in BGRA format
+/// </summary>
+/// <param name="pFrame">receives the frame</param>
+/// <returns>S_OK on success, E_PENDING if no new frame is available, otherwise failure code</returns>
+HRESULT KinectFrameSource::AcquireColorFrame(SourceFrame* pFrame)
+{
+    if (!m_pColorFrameReader)
+    {
+        return E_FAIL;
+    }
+
+    ReleaseColorFrame();
+
+    // Get a color frame from Kinect
+    HRESULT hr = m_pColorFrameReader->AcquireLatestFrame(&m_pColorFrame);
+
+    if (SUCCEEDED(hr))
+    {
+        IFrameDescription* pFrameDescription = NULL;
+        ColorImageFormat imageFormat = ColorImageFormat_None;
+        UINT nBufferSize = 0;
+        RGBQUAD *pBuffer = NULL;
+
+        // Unit: 100 ns
+        hr = m_pColorFrame->get_RelativeTime(&pFrame->nTime);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pColorFrame->get_FrameDescription(&pFrameDescription);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pFrameDescription->get_Width(&pFrame->nWidth);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pFrameDescription->get_Height(&pFrame->nHeight);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pColorFrame->get_RawColorImageFormat(&imageFormat);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            if (imageFormat == ColorImageFormat_Bgra || (m_bRawColor && imageFormat == ColorImageFormat_Yuy2))
+            {
+                // No conversion at all, the frame keeps its buffer until it is released
+                hr = m_pColorFrame->AccessRawUnderlyingBuffer(&nBufferSize, reinterpret_cast<BYTE**>(&pBuffer));
+                pFrame->nColorFormat = imageFormat;
+            }
+            else if (m_pColorRGBX)
+            {
+                pBuffer = m_pColorRGBX;
+                nBufferSize = cColorWidth * cColorHeight * sizeof(RGBQUAD);
+                hr = m_pColorFrame->CopyConvertedFrameDataToArray(nBufferSize, reinterpret_cast<BYTE*>(pBuffer), ColorImageFormat_Bgra);
+                pFrame->nColorFormat = ColorImageFormat_Bgra;
+            }
+            else
+            {
+                hr = E_FAIL;
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            pFrame->nBufferSize = nBufferSize;
+            pFrame->pBuffer = reinterpret_cast<BYTE*>(pBuffer);
+        }
+
+        SafeRelease(pFrameDescription);
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Release the infrared frame returned by the last AcquireInfraredFrame call
+/// </summary>
+void KinectFrameSource::ReleaseInfraredFrame()
+{
+    SafeRelease(m_pInfraredFrame);
+}
+
+/// <summary>
+/// Release the depth frame returned by the last AcquireDepthFrame call
+/// </summary>
+void KinectFrameSource::ReleaseDepthFrame()
+{
+    SafeRelease(m_pDepthFrame);
+}
+
+/// <summary>
+/// Release the color frame returned by the last AcquireColorFrame call
+/// </summary>
+void KinectFrameSource::ReleaseColorFrame()
+{
+    SafeRelease(m_pColorFrame);
+}
+
+/// <summary>
+/// Deliver color frames in the YUY2 format of the sensor instead of converting them to BGRA
+/// </summary>
+/// <param name="bRaw">true for YUY2, false for BGRA</param>
+/// <returns>false if the source cannot deliver the requested format</returns>
+bool KinectFrameSource::SetRawColor(bool bRaw)
+{
+    // The color camera of Kinect V2 always delivers YUY2
+    m_bRawColor = bRaw;
+    return true;
+}
+
+/// <summary>
+/// Block until a reader signals a new frame
+/// </summary>
+/// <param name="dwTimeout">longest wait in milliseconds</param>
+/// <returns>true if a frame has arrived, false if the wait timed out</returns>
+bool KinectFrameSource::WaitForFrame(DWORD dwTimeout)
+{
+    if (!m_aFrameEvents[0] || !m_aFrameEvents[1] || !m_aFrameEvents[2])
+    {
+        return FrameSource::WaitForFrame(dwTimeout);
+    }
+
+    HANDLE aEvents[3] = { reinterpret_cast<HANDLE>(m_aFrameEvents[0]), reinterpret_cast<HANDLE>(m_aFrameEvents[1]), reinterpret_cast<HANDLE>(m_aFrameEvents[2]) };
+    DWORD dwResult = WaitForMultipleObjects(_countof(aEvents), aEvents, FALSE, dwTimeout);
+    if (dwResult >= WAIT_OBJECT_0 + _countof(aEvents))
+    {
+        return false;
+    }
+
+    // Taking the event data resets the events, do it for every reader signaled so far so that the next wait blocks
+    if (WAIT_OBJECT_0 == WaitForSingleObject(aEvents[0], 0))
+    {
+        IInfraredFrameArrivedEventArgs* pArgs = NULL;
+        m_pInfraredFrameReader->GetFrameArrivedEventData(m_aFrameEvents[0], &pArgs);
+        SafeRelease(pArgs);
+    }
+
+    if (WAIT_OBJECT_0 == WaitForSingleObject(aEvents[1], 0))
+    {
+        IDepthFrameArrivedEventArgs* pArgs = NULL;
+        m_pDepthFrameReader->GetFrameArrivedEventData(m_aFrameEvents[1], &pArgs);
+        SafeRelease(pArgs);
+    }
+
+    if (WAIT_OBJECT_0 == WaitForSingleObject(aEvents[2], 0))
+    {
+        IColorFrameArrivedEventArgs* pArgs = NULL;
+        m_pColorFrameReader->GetFrameArrivedEventData(m_aFrameEvents[2], &pArgs);
+        SafeRelease(pArgs);
+    }
+
+    return true;
+}
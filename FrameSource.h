@@ -0,0 +1,151 @@
+// FrameSource.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Abstraction of where infrared, depth and color frames come from, so that the
+// conversion, queueing and writer stages can run without a physical sensor.
+
+
+#pragma once
+
+#include <atomic>
+
+/// <summary>
+/// Frame handed out by a FrameSource.
+/// The buffer stays valid until the matching Release call.
+/// </summary>
+struct SourceFrame
+{
+    INT64                   nTime;                  // relative time (unit: 100 ns)
+    int                     nWidth;
+    int                     nHeight;
+    USHORT                  nMinReliableDistance;   // depth only
+    USHORT                  nMaxReliableDistance;   // depth only
+    UINT                    nBufferSize;            // size of pBuffer in bytes
+    BYTE*                   pBuffer;                // UINT16 for infrared and depth, see nColorFormat for color
+    ColorImageFormat        nColorFormat;           // color only: ColorImageFormat_Bgra (RGBQUAD) or ColorImageFormat_Yuy2
+};
+
+class FrameSource
+{
+public:
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    virtual ~FrameSource() {}
+
+    /// <summary>
+    /// Acquire the latest infrared frame
+    /// </summary>
+    /// <param name="pFrame">receives the frame</param>
+    /// <returns>S_OK on success, E_PENDING if no new frame is available, otherwise failure code</returns>
+    virtual HRESULT         AcquireInfraredFrame(SourceFrame* pFrame) = 0;
+
+    /// <summary>
+    /// Acquire the latest depth frame
+    /// </summary>
+    /// <param name="pFrame">receives the frame</param>
+    /// <returns>S_OK on success, E_PENDING if no new frame is available, otherwise failure code</returns>
+    virtual HRESULT         AcquireDepthFrame(SourceFrame* pFrame) = 0;
+
+    /// <summary>
+    /// Acquire the latest color frame in BGRA format, or in YUY2 format once SetRawColor(true) succeeded
+    /// </summary>
+    /// <param name="pFrame">receives the frame</param>
+    /// <returns>S_OK on success, E_PENDING if no new frame is available, otherwise failure code</returns>
+    virtual HRESULT         AcquireColorFrame(SourceFrame* pFrame) = 0;
+
+    /// <summary>
+    /// Block until a new frame may be available on any stream, so that the capture thread does not spin on Acquire calls
+    /// </summary>
+    /// <param name="dwTimeout">longest wait in milliseconds</param>
+    /// <returns>true if a frame may be available, false if the wait timed out</returns>
+    virtual bool            WaitForFrame(DWORD dwTimeout) { UNREFERENCED_PARAMETER(dwTimeout); Sleep(1); return true; }
+
+    /// <summary>
+    /// Deliver color frames in the YUY2 format of the sensor instead of converting them to BGRA
+    /// </summary>
+    /// <param name="bRaw">true for YUY2, false for BGRA</param>
+    /// <returns>false if the source cannot deliver the requested format</returns>
+    virtual bool            SetRawColor(bool bRaw) { return !bRaw; }
+
+    /// <summary>
+    /// Nominal frame rate of the streams, 30 fps for the sensor
+    /// </summary>
+    /// <returns>frames per second</returns>
+    virtual double          GetFrameRate() const { return 30.0; }
+
+    /// <summary>
+    /// Release the infrared frame returned by the last AcquireInfraredFrame call
+    /// </summary>
+    virtual void            ReleaseInfraredFrame() = 0;
+
+    /// <summary>
+    /// Release the depth frame returned by the last AcquireDepthFrame call
+    /// </summary>
+    virtual void            ReleaseDepthFrame() = 0;
+
+    /// <summary>
+    /// Release the color frame returned by the last AcquireColorFrame call
+    /// </summary>
+    virtual void            ReleaseColorFrame() = 0;
+};
+
+#ifndef HEADLESS
+/// <summary>
+/// Frame source reading from the default Kinect V2 sensor
+/// </summary>
+class KinectFrameSource : public FrameSource
+{
+    static const int        cColorWidth = 1920;
+    static const int        cColorHeight = 1080;
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    KinectFrameSource();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    virtual ~KinectFrameSource();
+
+    /// <summary>
+    /// Initializes the default Kinect sensor
+    /// </summary>
+    /// <returns>S_OK on success, otherwise failure code</returns>
+    HRESULT                 Initialize();
+
+    virtual HRESULT         AcquireInfraredFrame(SourceFrame* pFrame);
+    virtual HRESULT         AcquireDepthFrame(SourceFrame* pFrame);
+    virtual HRESULT         AcquireColorFrame(SourceFrame* pFrame);
+    virtual void            ReleaseInfraredFrame();
+    virtual void            ReleaseDepthFrame();
+    virtual void            ReleaseColorFrame();
+    virtual bool            SetRawColor(bool bRaw);
+    virtual bool            WaitForFrame(DWORD dwTimeout);
+
+private:
+    // Current Kinect
+    IKinectSensor*          m_pKinectSensor;
+
+    // Frame reader
+    IInfraredFrameReader*   m_pInfraredFrameReader;
+    IDepthFrameReader*      m_pDepthFrameReader;
+    IColorFrameReader*      m_pColorFrameReader;
+
+    // Frame arrival events of the readers (infrared, depth, color)
+    WAITABLE_HANDLE         m_aFrameEvents[3];
+
+    // Frames currently held
+    IInfraredFrame*         m_pInfraredFrame;
+    IDepthFrame*            m_pDepthFrame;
+    IColorFrame*            m_pColorFrame;
+
+    // Storage for color frames whose raw format is not BGRA
+    RGBQUAD*                m_pColorRGBX;
+
+    // Hand out the YUY2 buffer of the sensor as is, set by the UI thread and read by the capture thread
+    std::atomic<bool>       m_bRawColor;
+};
+#endif // HEADLESS
@@ -0,0 +1,435 @@
+// HeadlessRecorder.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Runs the recording pipeline without a sensor, a window or a disk: frames of
+// the synthetic source are converted in row bands, queued per stream and
+// encoded by the writer pool (infrared copied as is, depth to RVL, color to
+// QOI), then the throughput and losses of every stage are reported.
+
+
+#include "PortableTypes.h"
+#include "SyntheticFrameSource.h"
+#include "FrameConverter.h"
+#include "FrameQueue.h"
+#include "ConversionPool.h"
+#include "WriterPool.h"
+#include "DepthCodec.h"
+#include "ColorCodec.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+
+/// The HeadlessBufferSize value specifies the number of ring slots per stream
+#define HeadlessBufferSize 8
+
+static const int cInfraredWidth = 512;
+static const int cInfraredHeight = 424;
+static const int cDepthWidth = 512;
+static const int cDepthHeight = 424;
+static const int cColorWidth = 1920;
+static const int cColorHeight = 1080;
+
+/// <summary>
+/// Ring, queue and statistics of one recorded stream
+/// </summary>
+struct HeadlessStream
+{
+    const char*             szName;
+    FrameQueue<HeadlessBufferSize> queue;
+    std::vector<BYTE>       vSlots[HeadlessBufferSize];
+    std::vector<BYTE>       vOutput;        // written frame, touched by the lane's writer only
+    std::vector<BYTE>       vCheck;         // decoded frame when verifying
+    UINT                    nAcquired;      // frames handed out by the source
+    UINT                    nWritten;       // frames encoded (and verified) successfully
+    UINT64                  nBytes;         // output bytes of the written frames
+    double                  fConvertMs;     // total conversion time
+};
+
+/// <summary>
+/// Options of a run
+/// </summary>
+struct HeadlessOptions
+{
+    double                  fSeconds;
+    double                  fFps;
+    UINT                    nWorkers;
+    UINT                    nBands;
+    UINT                    nWriters;
+    bool                    bYUY2;
+    bool                    bVerify;
+};
+
+/// <summary>
+/// Check if a stream has a frame to be written, the oldest timestamp being the earliest deadline
+/// </summary>
+/// <param name="stream">stream to check</param>
+/// <param name="pDeadline">receives the timestamp of the oldest frame</param>
+/// <param name="pDepth">receives the number of frames waiting</param>
+/// <returns>true if a frame is waiting</returns>
+static bool StreamFrameReady(const HeadlessStream& stream, INT64* pDeadline, UINT* pDepth)
+{
+    FrameDesc desc;
+    *pDepth = stream.queue.Size();
+    if (!stream.queue.Front(&desc))
+    {
+        return false;
+    }
+
+    *pDeadline = desc.nTime;
+    return true;
+}
+
+/// <summary>
+/// Release the oldest frame of a stream, counting it as written only if it was
+/// </summary>
+/// <param name="stream">stream of the frame</param>
+/// <param name="nSize">output size in bytes</param>
+/// <param name="bSuccess">true if the frame was encoded (and verified)</param>
+static void ReleaseStreamFrame(HeadlessStream& stream, DWORD nSize, bool bSuccess)
+{
+    if (bSuccess)
+    {
+        ++stream.nWritten;
+        stream.nBytes += nSize;
+        stream.queue.Pop();
+    }
+    else
+    {
+        stream.queue.Fail();
+    }
+}
+
+/// <summary>
+/// Copy the oldest infrared frame as the PGM writer would
+/// </summary>
+static void WriteInfraredFrame(HeadlessStream& stream)
+{
+    FrameDesc desc;
+    if (!stream.queue.Front(&desc))
+    {
+        return;
+    }
+
+    const std::vector<BYTE>& vSlot = stream.vSlots[desc.nSlot];
+    memcpy(stream.vOutput.data(), vSlot.data(), vSlot.size());
+    ReleaseStreamFrame(stream, static_cast<DWORD>(vSlot.size()), true);
+}
+
+/// <summary>
+/// Compress the oldest depth frame to RVL, decoding it again when verifying
+/// </summary>
+static void WriteDepthFrame(HeadlessStream& stream, bool bVerify)
+{
+    FrameDesc desc;
+    if (!stream.queue.Front(&desc))
+    {
+        return;
+    }
+
+    const int nPixels = cDepthWidth * cDepthHeight;
+    const UINT16* pDepth = reinterpret_cast<const UINT16*>(stream.vSlots[desc.nSlot].data());
+    DWORD nSize = CompressRVL(pDepth, nPixels, stream.vOutput.data());
+
+    bool bSuccess = true;
+    if (bVerify)
+    {
+        UINT16* pCheck = reinterpret_cast<UINT16*>(stream.vCheck.data());
+        bSuccess = SUCCEEDED(DecompressRVL(stream.vOutput.data(), nSize, pCheck, nPixels)) &&
+            0 == memcmp(pCheck, pDepth, nPixels * sizeof(UINT16));
+    }
+    ReleaseStreamFrame(stream, nSize, bSuccess);
+}
+
+/// <summary>
+/// Compress the oldest color frame to QOI, decoding it again when verifying
+/// </summary>
+static void WriteColorFrame(HeadlessStream& stream, QOIEncoder& cEncoder, bool bVerify)
+{
+    FrameDesc desc;
+    if (!stream.queue.Front(&desc))
+    {
+        return;
+    }
+
+    const BYTE* pRGB = stream.vSlots[desc.nSlot].data();
+    DWORD nSize = cEncoder.Encode(pRGB, cColorWidth, cColorHeight, false);
+
+    bool bSuccess = (nSize > 0);
+    if (bSuccess && bVerify)
+    {
+        bSuccess = SUCCEEDED(DecompressQOI(cEncoder.GetData(), nSize, stream.vCheck.data(), cColorWidth, cColorHeight)) &&
+            0 == memcmp(stream.vCheck.data(), pRGB, cColorWidth * cColorHeight * sizeof(RGBTRIPLE));
+    }
+    ReleaseStreamFrame(stream, nSize, bSuccess);
+}
+
+/// <summary>
+/// Milliseconds elapsed since a point in time
+/// </summary>
+static double ElapsedMs(std::chrono::steady_clock::time_point tStart)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+/// <summary>
+/// Parse the command line
+/// </summary>
+/// <returns>false if an option is unknown or misses its value</returns>
+static bool ParseOptions(int argc, char* argv[], HeadlessOptions* pOptions)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        bool bValue = (i + 1 < argc);
+        if (0 == strcmp(argv[i], "-seconds") && bValue)
+        {
+            pOptions->fSeconds = atof(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-fps") && bValue)
+        {
+            pOptions->fFps = atof(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-workers") && bValue)
+        {
+            pOptions->nWorkers = static_cast<UINT>(atoi(argv[++i]));
+        }
+        else if (0 == strcmp(argv[i], "-bands") && bValue)
+        {
+            pOptions->nBands = static_cast<UINT>(atoi(argv[++i]));
+        }
+        else if (0 == strcmp(argv[i], "-writers") && bValue)
+        {
+            pOptions->nWriters = static_cast<UINT>(atoi(argv[++i]));
+        }
+        else if (0 == strcmp(argv[i], "-yuy2"))
+        {
+            pOptions->bYUY2 = true;
+        }
+        else if (0 == strcmp(argv[i], "-verify"))
+        {
+            pOptions->bVerify = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return pOptions->fSeconds > 0 && pOptions->fFps > 0;
+}
+
+/// <summary>
+/// Entry point
+/// </summary>
+/// <returns>0 if every stream wrote frames and none failed, 1 otherwise, 2 on a bad command line</returns>
+int main(int argc, char* argv[])
+{
+    HeadlessOptions options = { 5.0, 30.0, ConversionDefaultThreads, 0, WriterDefaultThreads, false, false };
+    if (!ParseOptions(argc, argv, &options))
+    {
+        fprintf(stderr, "usage: %s [-seconds s] [-fps f] [-workers n] [-bands n] [-writers n] [-yuy2] [-verify]\n", argv[0]);
+        return 2;
+    }
+
+    // Same ring sizes as the recorder: big-endian UINT16 for infrared and depth, packed RGB for color
+    static HeadlessStream aStreams[3];
+    const size_t aSlotSizes[3] =
+    {
+        cInfraredWidth * cInfraredHeight * sizeof(UINT16),
+        cDepthWidth * cDepthHeight * sizeof(UINT16),
+        cColorWidth * cColorHeight * sizeof(RGBTRIPLE)
+    };
+    const char* aNames[3] = { "Infrared", "Depth", "Color" };
+    FrameSignal sFrameSignal;
+    for (int i = 0; i < 3; ++i)
+    {
+        HeadlessStream& stream = aStreams[i];
+        stream.szName = aNames[i];
+        for (int j = 0; j < HeadlessBufferSize; ++j)
+        {
+            stream.vSlots[j].resize(aSlotSizes[i]);
+        }
+        stream.nAcquired = 0;
+        stream.nWritten = 0;
+        stream.nBytes = 0;
+        stream.fConvertMs = 0.0;
+        stream.queue.SetSignal(&sFrameSignal);
+    }
+    aStreams[0].vOutput.resize(aSlotSizes[0]);
+    aStreams[1].vOutput.resize(RVLMaxSize(cDepthWidth * cDepthHeight));
+    aStreams[1].vCheck.resize(aSlotSizes[1]);
+    aStreams[2].vCheck.resize(aSlotSizes[2]);
+
+    // Previews are converted as in the recorder but never drawn
+    std::vector<RGBQUAD> vInfraredPreview(cInfraredWidth * cInfraredHeight);
+    std::vector<RGBQUAD> vDepthPreview(cDepthWidth * cDepthHeight);
+    std::vector<RGBQUAD> vColorPreview((cColorWidth / 2) * (cColorHeight / 2));
+    std::vector<RGBQUAD> vLUT(USHRT_MAX + 1);
+    for (size_t i = 0; i < vLUT.size(); ++i)
+    {
+        BYTE intensity = static_cast<BYTE>(i % 256);
+        RGBQUAD color = { intensity, intensity, intensity, 0xFF };
+        vLUT[i] = color;
+    }
+
+    ConversionPool cConversionPool;
+    cConversionPool.Start(options.nWorkers, options.nBands, 0);
+
+    QOIEncoder cColorEncoder;
+    cColorEncoder.Start(QOIEncodeThreads);
+
+    // One writer lane per stream, as in the recorder
+    WriterPool cWriterPool;
+    const bool bVerify = options.bVerify;
+    cWriterPool.AddLane([](INT64* pDeadline, UINT* pDepth) { return StreamFrameReady(aStreams[0], pDeadline, pDepth); },
+        [] { WriteInfraredFrame(aStreams[0]); });
+    cWriterPool.AddLane([](INT64* pDeadline, UINT* pDepth) { return StreamFrameReady(aStreams[1], pDeadline, pDepth); },
+        [=] { WriteDepthFrame(aStreams[1], bVerify); });
+    cWriterPool.AddLane([](INT64* pDeadline, UINT* pDepth) { return StreamFrameReady(aStreams[2], pDeadline, pDepth); },
+        [&cColorEncoder, bVerify] { WriteColorFrame(aStreams[2], cColorEncoder, bVerify); });
+    cWriterPool.Start(&sFrameSignal, options.nWriters);
+
+    static const char* aSimdNames[] = { "scalar", "SSE2", "SSSE3", "AVX2" };
+    printf("Headless record: %.1f s at %.1f fps, %s color, %u conversion workers, %u writer threads, %s kernels%s\n",
+        options.fSeconds, options.fFps, options.bYUY2 ? "YUY2" : "BGRA", cConversionPool.GetThreadCount(), cWriterPool.GetThreadCount(),
+        aSimdNames[GetSimdLevel()], options.bVerify ? ", verified" : "");
+
+    // The conversion thread of the recorder: acquire, convert into a free ring slot and queue
+    SyntheticFrameSource cSource(options.fFps);
+    cSource.SetRawColor(options.bYUY2);
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    while (ElapsedMs(tStart) < options.fSeconds * 1000.0)
+    {
+        cSource.WaitForFrame(100);
+
+        SourceFrame frame;
+        if (SUCCEEDED(cSource.AcquireInfraredFrame(&frame)))
+        {
+            HeadlessStream& stream = aStreams[0];
+            ++stream.nAcquired;
+            if (stream.queue.CanPush())
+            {
+                std::chrono::steady_clock::time_point tConvert = std::chrono::steady_clock::now();
+                const UINT16* pBuffer = reinterpret_cast<const UINT16*>(frame.pBuffer);
+                UINT16* pUINT16 = reinterpret_cast<UINT16*>(stream.vSlots[stream.queue.NextSlot()].data());
+                RGBQUAD* pRGBX = vInfraredPreview.data();
+                cConversionPool.Run(cInfraredHeight, cInfraredWidth, [=](int nFirstRow, int nRows)
+                {
+                    int nOffset = nFirstRow * cInfraredWidth;
+                    ConvertInfrared(pBuffer + nOffset, pRGBX + nOffset, pUINT16 + nOffset, cInfraredWidth, nRows);
+                });
+                stream.fConvertMs += ElapsedMs(tConvert);
+                stream.queue.Push(frame.nTime);
+            }
+            else
+            {
+                stream.queue.Drop();
+            }
+            cSource.ReleaseInfraredFrame();
+        }
+
+        if (SUCCEEDED(cSource.AcquireDepthFrame(&frame)))
+        {
+            HeadlessStream& stream = aStreams[1];
+            ++stream.nAcquired;
+            if (stream.queue.CanPush())
+            {
+                std::chrono::steady_clock::time_point tConvert = std::chrono::steady_clock::now();
+                const UINT16* pBuffer = reinterpret_cast<const UINT16*>(frame.pBuffer);
+                UINT16* pUINT16 = reinterpret_cast<UINT16*>(stream.vSlots[stream.queue.NextSlot()].data());
+                RGBQUAD* pRGBX = vDepthPreview.data();
+                const RGBQUAD* pLUT = vLUT.data();
+                USHORT nMinDepth = frame.nMinReliableDistance;
+                USHORT nMaxDepth = frame.nMaxReliableDistance;
+                cConversionPool.Run(cDepthHeight, cDepthWidth, [=](int nFirstRow, int nRows)
+                {
+                    int nOffset = nFirstRow * cDepthWidth;
+                    ConvertDepth(pBuffer + nOffset, pLUT, pRGBX + nOffset, pUINT16 + nOffset, cDepthWidth, nRows, nMinDepth, nMaxDepth);
+                });
+                stream.fConvertMs += ElapsedMs(tConvert);
+                stream.queue.Push(frame.nTime);
+            }
+            else
+            {
+                stream.queue.Drop();
+            }
+            cSource.ReleaseDepthFrame();
+        }
+
+        if (SUCCEEDED(cSource.AcquireColorFrame(&frame)))
+        {
+            HeadlessStream& stream = aStreams[2];
+            ++stream.nAcquired;
+            if (stream.queue.CanPush())
+            {
+                std::chrono::steady_clock::time_point tConvert = std::chrono::steady_clock::now();
+                const BYTE* pBuffer = frame.pBuffer;
+                RGBTRIPLE* pRGB = reinterpret_cast<RGBTRIPLE*>(stream.vSlots[stream.queue.NextSlot()].data());
+                RGBQUAD* pPreview = vColorPreview.data();
+                if (frame.nColorFormat == ColorImageFormat_Yuy2)
+                {
+                    cConversionPool.Run(cColorHeight, cColorWidth, [=](int nFirstRow, int nRows)
+                    {
+                        int nOffset = nFirstRow * cColorWidth;
+                        ConvertYUY2ToRGB(pBuffer + nOffset * 2, pRGB + nOffset, cColorWidth, nRows, YUVMatrix_BT601, true, false);
+                    });
+                    DownscaleYUY2(pBuffer, pPreview, cColorWidth, cColorHeight, YUVMatrix_BT601, true);
+                }
+                else
+                {
+                    // The half-size preview is shrunk from the rows of each band, as in the recorder
+                    const RGBQUAD* pBGRA = reinterpret_cast<const RGBQUAD*>(pBuffer);
+                    cConversionPool.Run(cColorHeight, cColorWidth, [=](int nFirstRow, int nRows)
+                    {
+                        int nOffset = nFirstRow * cColorWidth;
+                        ConvertColor(pBGRA + nOffset, pRGB + nOffset, NULL, cColorWidth, nRows, false);
+                        int nFirst = (nFirstRow + 1) / 2;
+                        int nEnd = min((nFirstRow + nRows + 1) / 2, cColorHeight / 2);
+                        if (nFirst < nEnd)
+                        {
+                            DownscaleBGRA(pBGRA + nFirst * 2 * cColorWidth, pPreview + nFirst * (cColorWidth / 2), cColorWidth, (nEnd - nFirst) * 2, 2, true);
+                        }
+                    });
+                }
+                stream.fConvertMs += ElapsedMs(tConvert);
+                stream.queue.Push(frame.nTime);
+            }
+            else
+            {
+                stream.queue.Drop();
+            }
+            cSource.ReleaseColorFrame();
+        }
+    }
+    double fElapsedMs = ElapsedMs(tStart);
+
+    // Let the writers drain the queues before stopping them
+    std::chrono::steady_clock::time_point tDrain = std::chrono::steady_clock::now();
+    while ((!aStreams[0].queue.Empty() || !aStreams[1].queue.Empty() || !aStreams[2].queue.Empty()) && ElapsedMs(tDrain) < 10000.0)
+    {
+        Sleep(1);
+    }
+    cWriterPool.Stop();
+    cConversionPool.Stop();
+
+    int nResult = 0;
+    printf("%-10s %8s %8s %8s %8s %8s %10s %10s\n", "Stream", "Acquired", "Written", "Dropped", "Failed", "Peak", "Convert", "Frame");
+    for (UINT i = 0; i < 3; ++i)
+    {
+        const HeadlessStream& stream = aStreams[i];
+        WriterLaneStats stats = cWriterPool.GetStats(i);
+        UINT nConverted = stream.queue.Generation() - stream.queue.Dropped() + stream.queue.Failed();
+        printf("%-10s %8u %8u %8u %8u %8u %7.2f ms %7.0f KB\n",
+            stream.szName, stream.nAcquired, stream.nWritten, stream.queue.Dropped(), stream.queue.Failed(), stats.nMaxDepth,
+            nConverted ? stream.fConvertMs / nConverted : 0.0, stream.nWritten ? stream.nBytes / 1024.0 / stream.nWritten : 0.0);
+
+        if (0 == stream.nWritten || stream.queue.Failed() > 0)
+        {
+            nResult = 1;
+        }
+    }
+    printf("Written: %.1f fps per stream on average\n", (aStreams[0].nWritten + aStreams[1].nWritten + aStreams[2].nWritten) / 3.0 / (fElapsedMs / 1000.0));
+
+    return nResult;
+}
@@ -87,6 +87,7 @@ void ImageRenderer::DiscardResources()
 /// <summary>
 /// Set the window to draw to as well as the video format
 /// Implied bits per pixel is 32
+/// May be called again to change the format, the resources are recreated at the next draw
 /// </summary>
 /// <param name="hWnd">window to draw to</param>
 /// <param name="pD2DFactory">already created D2D factory object</param>
@@ -101,13 +102,16 @@ HRESULT ImageRenderer::Initialize(HWND hWnd, ID2D1Factory* pD2DFactory, int sour
         return E_INVALIDARG;
     }
 
+    // The render target and bitmap are sized to the source, drop the old ones
+    DiscardResources();
+
     m_hWnd = hWnd;
 
     // One factory for the entire application so save a pointer here
+    pD2DFactory->AddRef();
+    SafeRelease(m_pD2DFactory);
     m_pD2DFactory = pD2DFactory;
 
-    m_pD2DFactory->AddRef();
-
     // Get the frame size
     m_sourceWidth  = sourceWidth;
     m_sourceHeight = sourceHeight;
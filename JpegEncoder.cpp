@@ -0,0 +1,272 @@
+// JpegEncoder.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include "JpegEncoder.h"
+
+#ifdef USE_TURBOJPEG
+
+#include <turbojpeg.h>
+
+#pragma comment(lib, "turbojpeg.lib")
+
+/// <summary>
+/// Constructor
+/// </summary>
+JpegEncoderPool::JpegEncoderPool() :
+m_pSignal(NULL),
+m_nQuality(JpegDefaultQuality),
+m_nWidth(0),
+m_nHeight(0),
+m_nFront(0),
+m_nNext(0),
+m_nBack(0),
+m_bStop(false)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+JpegEncoderPool::~JpegEncoderPool()
+{
+    Stop();
+
+    for (size_t i = 0; i < m_vJobs.size(); ++i)
+    {
+        tjFree(m_vJobs[i].pJpeg);
+    }
+    m_vJobs.clear();
+}
+
+/// <summary>
+/// Start the encoder threads, stopping the previous ones first
+/// </summary>
+/// <param name="nThreads">number of encoder threads</param>
+/// <param name="nQuality">JPEG quality (1-100)</param>
+/// <param name="nWidth">width (in pixels) of the frames</param>
+/// <param name="nHeight">height (in pixels) of the frames</param>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT JpegEncoderPool::Start(UINT nThreads, int nQuality, int nWidth, int nHeight)
+{
+    Stop();
+
+    nThreads = max(nThreads, 1U);
+    m_nQuality = min(max(nQuality, 1), 100);
+    m_nWidth = nWidth;
+    m_nHeight = nHeight;
+
+    // Output buffers are sized for the worst case once, so that the encoders never reallocate
+    unsigned long nBufferSize = tjBufSize(nWidth, nHeight, TJSAMP_420);
+    for (size_t i = 0; i < m_vJobs.size(); ++i)
+    {
+        tjFree(m_vJobs[i].pJpeg);
+    }
+    m_vJobs.resize(nThreads * JpegJobsPerThread);
+    for (size_t i = 0; i < m_vJobs.size(); ++i)
+    {
+        JpegJob& job = m_vJobs[i];
+        job.pRGB = NULL;
+        job.bBGR = false;
+        job.pJpeg = tjAlloc(static_cast<int>(nBufferSize));
+        job.nSize = 0;
+        job.bDone = false;
+        if (!job.pJpeg)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    m_bStop = false;
+    for (UINT i = 0; i < nThreads; ++i)
+    {
+        m_vThreads.push_back(std::thread(&JpegEncoderPool::WorkerThread, this));
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Stop the encoder threads and drop the frames in flight
+/// </summary>
+void JpegEncoderPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cvJob.notify_all();
+
+    for (size_t i = 0; i < m_vThreads.size(); ++i)
+    {
+        m_vThreads[i].join();
+    }
+    m_vThreads.clear();
+
+    for (size_t i = 0; i < m_vJobs.size(); ++i)
+    {
+        m_vJobs[i].bDone = false;
+    }
+    m_nFront = m_nNext = m_nBack = 0;
+}
+
+/// <summary>
+/// Number of frames submitted but not popped yet
+/// </summary>
+UINT JpegEncoderPool::InFlight()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nBack - m_nFront;
+}
+
+/// <summary>
+/// Queue a 24-bit frame for encoding, the pixels must stay untouched until the frame is popped
+/// </summary>
+/// <param name="pRGB">pixels, R-G-B order (or B-G-R if bBGR is set)</param>
+/// <param name="bBGR">true if the pixels are in B-G-R order</param>
+/// <returns>false if the pool already holds as many frames as it can take</returns>
+bool JpegEncoderPool::Submit(const BYTE* pRGB, bool bBGR)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_vThreads.empty() || m_nBack - m_nFront >= m_vJobs.size())
+        {
+            return false;
+        }
+
+        JpegJob& job = m_vJobs[m_nBack % m_vJobs.size()];
+        job.pRGB = pRGB;
+        job.bBGR = bBGR;
+        job.nSize = 0;
+        job.bDone = false;
+        ++m_nBack;
+    }
+    m_cvJob.notify_one();
+    return true;
+}
+
+/// <summary>
+/// Get the oldest frame in flight once it is encoded
+/// </summary>
+/// <param name="ppData">receives the JPEG file, valid until Pop()</param>
+/// <param name="pSize">receives the size of the JPEG file, 0 if encoding failed</param>
+/// <returns>false if the pool is empty or the oldest frame is still being encoded</returns>
+bool JpegEncoderPool::Front(const BYTE** ppData, DWORD* pSize)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_nFront == m_nBack)
+    {
+        return false;
+    }
+
+    const JpegJob& job = m_vJobs[m_nFront % m_vJobs.size()];
+    if (!job.bDone)
+    {
+        return false;
+    }
+
+    *ppData = job.pJpeg;
+    *pSize = job.nSize;
+    return true;
+}
+
+/// <summary>
+/// Release the oldest frame
+/// </summary>
+void JpegEncoderPool::Pop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_nFront != m_nBack)
+    {
+        m_vJobs[m_nFront % m_vJobs.size()].bDone = false;
+        ++m_nFront;
+    }
+}
+
+/// <summary>
+/// Encoder thread
+/// </summary>
+void JpegEncoderPool::WorkerThread()
+{
+    // A turbojpeg handle must not be shared between threads
+    tjhandle hEncoder = tjInitCompress();
+
+    while (true)
+    {
+        JpegJob* pJob = NULL;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_bStop && m_nNext == m_nBack)
+            {
+                m_cvJob.wait(lock);
+            }
+            if (m_bStop)
+            {
+                break;
+            }
+            pJob = &m_vJobs[m_nNext++ % m_vJobs.size()];
+        }
+
+        unsigned char* pJpeg = pJob->pJpeg;
+        unsigned long nSize = 0;
+        int nResult = -1;
+        if (hEncoder)
+        {
+            nResult = tjCompress2(hEncoder, pJob->pRGB, m_nWidth, m_nWidth * 3, m_nHeight, pJob->bBGR ? TJPF_BGR : TJPF_RGB,
+                &pJpeg, &nSize, TJSAMP_420, m_nQuality, TJFLAG_NOREALLOC | TJFLAG_FASTDCT);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pJob->nSize = (0 == nResult) ? static_cast<DWORD>(nSize) : 0;
+            pJob->bDone = true;
+        }
+
+        if (m_pSignal)
+        {
+            m_pSignal->Notify();
+        }
+    }
+
+    if (hEncoder)
+    {
+        tjDestroy(hEncoder);
+    }
+}
+
+/// <summary>
+/// Decompress a JPEG file into 24-bit pixels in R-G-B order
+/// </summary>
+/// <param name="pInput">JPEG file</param>
+/// <param name="nSize">size of the file in bytes</param>
+/// <param name="pRGB">receives the pixels, nWidth * nHeight * 3 bytes</param>
+/// <param name="nWidth">expected width (in pixels)</param>
+/// <param name="nHeight">expected height (in pixels)</param>
+/// <returns>S_OK on success, E_FAIL if the file is corrupt or has another size</returns>
+HRESULT DecompressJPEG(const BYTE* pInput, DWORD nSize, BYTE* pRGB, int nWidth, int nHeight)
+{
+    tjhandle hDecoder = tjInitDecompress();
+    if (!hDecoder)
+    {
+        return E_FAIL;
+    }
+
+    HRESULT hr = E_FAIL;
+    int nFileWidth = 0;
+    int nFileHeight = 0;
+    int nSubsamp = 0;
+    int nColorspace = 0;
+    if (0 == tjDecompressHeader3(hDecoder, pInput, nSize, &nFileWidth, &nFileHeight, &nSubsamp, &nColorspace) &&
+        nFileWidth == nWidth && nFileHeight == nHeight &&
+        0 == tjDecompress2(hDecoder, pInput, nSize, pRGB, nWidth, nWidth * 3, nHeight, TJPF_RGB, TJFLAG_FASTDCT))
+    {
+        hr = S_OK;
+    }
+
+    tjDestroy(hDecoder);
+    return hr;
+}
+
+#endif // USE_TURBOJPEG
@@ -0,0 +1,132 @@
+// JpegEncoder.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Pool of libjpeg-turbo encoders for the color stream (USE_TURBOJPEG).
+// Frames are handed out to the workers in submission order and handed back
+// in the same order, however long the single encodes take.
+
+
+#pragma once
+
+/// The JpegDefaultThreads value specifies the number of encoder threads started by default
+#define JpegDefaultThreads  2
+
+/// The JpegDefaultQuality value specifies the JPEG quality (1-100) used by default
+#define JpegDefaultQuality  90
+
+#ifdef USE_TURBOJPEG
+
+#include "FrameQueue.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// The JpegJobsPerThread value specifies how many frames each encoder may have in flight
+#define JpegJobsPerThread   2
+
+class JpegEncoderPool
+{
+    /// <summary>
+    /// One frame on its way through the pool
+    /// </summary>
+    struct JpegJob
+    {
+        const BYTE*         pRGB;
+        bool                bBGR;
+        BYTE*               pJpeg;
+        DWORD               nSize;
+        bool                bDone;
+    };
+
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    JpegEncoderPool();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~JpegEncoderPool();
+
+    /// <summary>
+    /// Set the signal to notify whenever an encode finishes
+    /// </summary>
+    /// <param name="pSignal">signal shared with the consumer</param>
+    void                    SetSignal(FrameSignal* pSignal) { m_pSignal = pSignal; }
+
+    /// <summary>
+    /// Start the encoder threads, stopping the previous ones first
+    /// </summary>
+    /// <param name="nThreads">number of encoder threads</param>
+    /// <param name="nQuality">JPEG quality (1-100)</param>
+    /// <param name="nWidth">width (in pixels) of the frames</param>
+    /// <param name="nHeight">height (in pixels) of the frames</param>
+    /// <returns>S_OK on success, otherwise failure code</returns>
+    HRESULT                 Start(UINT nThreads, int nQuality, int nWidth, int nHeight);
+
+    /// <summary>
+    /// Stop the encoder threads and drop the frames in flight
+    /// </summary>
+    void                    Stop();
+
+    /// <summary>
+    /// Number of frames submitted but not popped yet
+    /// </summary>
+    UINT                    InFlight();
+
+    /// <summary>
+    /// Queue a 24-bit frame for encoding, the pixels must stay untouched until the frame is popped
+    /// </summary>
+    /// <param name="pRGB">pixels, R-G-B order (or B-G-R if bBGR is set)</param>
+    /// <param name="bBGR">true if the pixels are in B-G-R order</param>
+    /// <returns>false if the pool already holds as many frames as it can take</returns>
+    bool                    Submit(const BYTE* pRGB, bool bBGR);
+
+    /// <summary>
+    /// Get the oldest frame in flight once it is encoded
+    /// </summary>
+    /// <param name="ppData">receives the JPEG file, valid until Pop()</param>
+    /// <param name="pSize">receives the size of the JPEG file, 0 if encoding failed</param>
+    /// <returns>false if the pool is empty or the oldest frame is still being encoded</returns>
+    bool                    Front(const BYTE** ppData, DWORD* pSize);
+
+    /// <summary>
+    /// Release the oldest frame
+    /// </summary>
+    void                    Pop();
+
+private:
+    std::vector<std::thread> m_vThreads;
+    std::vector<JpegJob>    m_vJobs;            // ring of m_vJobs.size() frames
+    std::mutex              m_mutex;
+    std::condition_variable m_cvJob;
+    FrameSignal*            m_pSignal;
+    int                     m_nQuality;
+    int                     m_nWidth;
+    int                     m_nHeight;
+    UINT                    m_nFront;           // oldest frame in flight
+    UINT                    m_nNext;            // next frame to be picked up by an encoder
+    UINT                    m_nBack;            // next free job
+    bool                    m_bStop;
+
+    /// <summary>
+    /// Encoder thread
+    /// </summary>
+    void                    WorkerThread();
+};
+
+/// <summary>
+/// Decompress a JPEG file into 24-bit pixels in R-G-B order
+/// </summary>
+/// <param name="pInput">JPEG file</param>
+/// <param name="nSize">size of the file in bytes</param>
+/// <param name="pRGB">receives the pixels, nWidth * nHeight * 3 bytes</param>
+/// <param name="nWidth">expected width (in pixels)</param>
+/// <param name="nHeight">expected height (in pixels)</param>
+/// <returns>S_OK on success, E_FAIL if the file is corrupt or has another size</returns>
+HRESULT DecompressJPEG(const BYTE* pInput, DWORD nSize, BYTE* pRGB, int nWidth, int nHeight);
+
+#endif // USE_TURBOJPEG
@@ -10,9 +10,13 @@
 #include <strsafe.h>
 #include "resource.h"
 #include "KinectV2Recorder.h"
+#include "SyntheticFrameSource.h"
+#include "ReplayFrameSource.h"
+#include "DepthCodec.h"
+#include "ConverterBenchmark.h"
+#include "DepthCodecTest.h"
 #include <algorithm>
 #include <vector>
-#include <queue>
 
 #ifdef USE_IPP
 #include <ippi.h>
@@ -26,6 +30,11 @@
 /// <param name="lpCmdLine">command line arguments</param>
 /// <param name="nCmdShow">whether to display minimized, maximized, or normally</param>
 /// <returns>status</returns>
+/// <remarks>
+/// -synthetic [fps]    use generated frames instead of the Kinect sensor (default 30 fps)
+/// -benchmark          time the color conversion kernels and exit
+/// -probe [seconds]    write test frames of the configured formats to the record target, report what it sustains and exit
+/// </remarks>
 int APIENTRY wWinMain(
     _In_ HINSTANCE hInstance,
     _In_opt_ HINSTANCE hPrevInstance,
@@ -37,7 +46,185 @@ int APIENTRY wWinMain(
     UNREFERENCED_PARAMETER(lpCmdLine);
 
     CKinectV2Recorder application;
-    application.Run(hInstance, nShowCmd);
+
+    UINT nWorkers = std::thread::hardware_concurrency();
+    nWorkers = (nWorkers > 1) ? min(nWorkers - 1, static_cast<UINT>(ConversionDefaultThreads)) : 0;
+    UINT nBands = 0;
+    DWORD_PTR nAffinityMask = 0;
+    int nJpegQuality = JpegDefaultQuality;
+    UINT nJpegThreads = JpegDefaultThreads;
+    UINT nWriterThreads = WriterDefaultThreads;
+    UINT nRecordSeconds = RecordDefaultSeconds;
+    UINT nShardFrames = 0;
+    UINT nProbeSeconds = 0;
+    double fPreviewFps = PreviewDefaultFps;
+
+    int nArgs = 0;
+    LPWSTR* szArgList = CommandLineToArgvW(GetCommandLineW(), &nArgs);
+    for (int i = 1; szArgList && i < nArgs; ++i)
+    {
+        if (0 == _wcsicmp(szArgList[i], L"-synthetic"))
+        {
+            double fFps = (i + 1 < nArgs && _wtof(szArgList[i + 1]) > 0) ? _wtof(szArgList[++i]) : 30.0;
+            application.SetFrameSource(new SyntheticFrameSource(fFps));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-replay") && i + 1 < nArgs)
+        {
+            LPCWSTR szFolder = szArgList[++i];
+            bool bMaxSpeed = (i + 1 < nArgs && 0 == _wcsicmp(szArgList[i + 1], L"-maxspeed"));
+            if (bMaxSpeed) ++i;
+
+            ReplayFrameSource* pReplay = new ReplayFrameSource(szFolder, bMaxSpeed);
+            if (FAILED(pReplay->Initialize()))
+            {
+                MessageBox(NULL,
+                    L"Failed to open the record to replay!\n",
+                    L"Error",
+                    MB_OK | MB_ICONERROR
+                    );
+                delete pReplay;
+                LocalFree(szArgList);
+                return 1;
+            }
+            application.SetFrameSource(pReplay);
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-benchmark"))
+        {
+            WCHAR szReport[1024];
+            HRESULT hr = RunConverterBenchmark(szReport, _countof(szReport));
+            MessageBox(NULL,
+                szReport,
+                SUCCEEDED(hr) ? L"Conversion Benchmark" : L"Conversion Benchmark (mismatch)",
+                MB_OK | (SUCCEEDED(hr) ? MB_ICONINFORMATION : MB_ICONERROR)
+                );
+            LocalFree(szArgList);
+            return SUCCEEDED(hr) ? 0 : 1;
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-selftest"))
+        {
+            // Every following argument up to the next option is a recorded .rvl file
+            std::vector<std::wstring> vFiles;
+            while (i + 1 < nArgs && szArgList[i + 1][0] != L'-')
+            {
+                vFiles.push_back(szArgList[++i]);
+            }
+
+            WCHAR szReport[4096];
+            HRESULT hr = RunDepthCodecSelfTest(vFiles, szReport, _countof(szReport));
+            MessageBox(NULL,
+                szReport,
+                SUCCEEDED(hr) ? L"Depth Codec Self-Test" : L"Depth Codec Self-Test (mismatch)",
+                MB_OK | (SUCCEEDED(hr) ? MB_ICONINFORMATION : MB_ICONERROR)
+                );
+            LocalFree(szArgList);
+            return SUCCEEDED(hr) ? 0 : 1;
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-probe"))
+        {
+            nProbeSeconds = (i + 1 < nArgs && _wtoi(szArgList[i + 1]) > 0) ? static_cast<UINT>(_wtoi(szArgList[++i])) : StorageProbeDefaultSeconds;
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-workers") && i + 1 < nArgs)
+        {
+            nWorkers = static_cast<UINT>(_wtoi(szArgList[++i]));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-bands") && i + 1 < nArgs)
+        {
+            nBands = static_cast<UINT>(_wtoi(szArgList[++i]));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-affinity") && i + 1 < nArgs)
+        {
+            nAffinityMask = static_cast<DWORD_PTR>(wcstoull(szArgList[++i], NULL, 16));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-color") && i + 1 < nArgs)
+        {
+            ColorFormat nFormat;
+            if (CKinectV2Recorder::ParseColorFormat(szArgList[++i], &nFormat))
+            {
+                application.SetColorFormat(nFormat);
+            }
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-jpegquality") && i + 1 < nArgs)
+        {
+            nJpegQuality = _wtoi(szArgList[++i]);
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-jpegthreads") && i + 1 < nArgs)
+        {
+            nJpegThreads = static_cast<UINT>(_wtoi(szArgList[++i]));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-writers") && i + 1 < nArgs)
+        {
+            nWriterThreads = static_cast<UINT>(_wtoi(szArgList[++i]));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-duration") && i + 1 < nArgs)
+        {
+            nRecordSeconds = static_cast<UINT>(_wtoi(szArgList[++i]));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-shard") && i + 1 < nArgs)
+        {
+            nShardFrames = static_cast<UINT>(_wtoi(szArgList[++i]));
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-roots") && i + 1 < nArgs)
+        {
+            application.SetRecordRoots(szArgList[++i]);
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-previewfps") && i + 1 < nArgs)
+        {
+            fPreviewFps = _wtof(szArgList[++i]);
+        }
+        else if (0 == _wcsicmp(szArgList[i], L"-colormap") && i + 1 < nArgs)
+        {
+            DepthColormap nColormap;
+            if (DepthColorizer::ParseColormap(szArgList[++i], &nColormap))
+            {
+                application.SetDepthColormap(nColormap);
+            }
+        }
+    }
+    LocalFree(szArgList);
+
+    application.SetConversionThreads(nWorkers, nBands, nAffinityMask);
+    application.SetJpegOptions(nJpegQuality, nJpegThreads);
+    application.SetWriterThreads(nWriterThreads);
+    application.SetRecordDuration(nRecordSeconds);
+    application.SetShardFrames(nShardFrames);
+    application.SetPreviewRate(fPreviewFps);
+
+    // The probe runs once every option is known, so that it writes what a record would
+    if (nProbeSeconds)
+    {
+        WCHAR szReport[1024];
+        HRESULT hr = application.ProbeStorage(nProbeSeconds, szReport, _countof(szReport));
+        MessageBox(NULL,
+            szReport,
+            (S_OK == hr) ? L"Storage Probe" : (SUCCEEDED(hr) ? L"Storage Probe (too slow)" : L"Storage Probe (failed)"),
+            MB_OK | ((S_OK == hr) ? MB_ICONINFORMATION : MB_ICONWARNING)
+            );
+        return (S_OK == hr) ? 0 : 1;
+    }
+
+    return application.Run(hInstance, nShowCmd);
+}
+
+/// <summary>
+/// Check if a frame queue has a frame to be written.
+/// All rings hold BufferSize frames of the same frame rate, so the oldest timestamp is also
+/// the earliest deadline: that slot is the first one the conversion thread needs back.
+/// </summary>
+/// <param name="queue">queue of the stream</param>
+/// <param name="pDeadline">receives the timestamp of the oldest frame</param>
+/// <param name="pDepth">receives the number of frames waiting</param>
+/// <returns>true if a frame is waiting</returns>
+static bool QueueFrameReady(const FrameQueue<BufferSize>& queue, INT64* pDeadline, UINT* pDepth)
+{
+    FrameDesc desc;
+    *pDepth = queue.Size();
+    if (!queue.Front(&desc))
+    {
+        return false;
+    }
+
+    *pDeadline = desc.nTime;
+    return true;
 }
 
 /// <summary>
@@ -56,29 +243,41 @@ m_fFreq(0),
 m_nNextStatusTime(0LL),
 m_bRecord(false),
 m_bShot(false),
-m_bShotReady(false),
 m_bSelect2D(true),
-m_pKinectSensor(NULL),
-m_pInfraredFrameReader(NULL),
-m_pDepthFrameReader(NULL),
-m_pColorFrameReader(NULL),
+m_pFrameSource(NULL),
 m_pD2DFactory(NULL),
 m_pDrawInfrared(NULL),
 m_pDrawDepth(NULL),
 m_pDrawColor(NULL),
-m_pInfraredRGBX(NULL),
-m_pDepthRGBX(NULL),
-m_pColorRGBX(NULL),
-m_nInfraredIndex(0),
-m_nDepthIndex(0),
-m_nColorIndex(0),
+m_fPreviewFps(PreviewDefaultFps),
+m_nColorPreviewScale(1),
+m_nInfraredSlot(0),
+m_nDepthSlot(0),
+m_nColorSlot(0),
 m_nModel2DIndex(0),
 m_nModel3DIndex(0),
 m_nTypeIndex(0),
 m_nLevelIndex(0),
 m_nSideIndex(0),
-m_tSaveThread(),
-m_bStopThread(false)
+m_nWriterThreads(WriterDefaultThreads),
+m_bFoldersReady(false),
+m_bRecordStopping(false),
+m_bCheckRecord(false),
+m_nShardFrames(0),
+m_bContainerOpen(false),
+m_nRecordSeconds(RecordDefaultSeconds),
+m_pDepthRVL(NULL),
+m_nColorFormat(ColorFormat_PPM),
+m_bColorBGR(false),
+m_nJpegQuality(JpegDefaultQuality),
+m_nJpegThreads(JpegDefaultThreads),
+m_bStorageProbe(false),
+m_hrStorageProbe(S_OK),
+m_nSyncUnmatched(0),
+m_nSyncResyncs(0),
+m_bStopCapture(false),
+m_bStatusPosted(false),
+m_szRecordTitle(NULL)
 {
     LARGE_INTEGER qpf = { 0 };
     if (QueryPerformanceFrequency(&qpf))
@@ -86,31 +285,82 @@ m_bStopThread(false)
         m_fFreq = double(qpf.QuadPart);
     }
 
-    // create heap storage for infrared pixel data in RGBX format
-    m_pInfraredRGBX = new RGBQUAD[cInfraredWidth * cInfraredHeight];
+    // compile-time default of the color format
+#if defined(COLOR_QOI)
+    m_nColorFormat = ColorFormat_QOI;
+#elif defined(COLOR_BMP)
+    m_nColorFormat = ColorFormat_BMP;
+    m_bColorBGR = true;
+#endif
+
+    // create heap storage for the infrared, depth and mirrored color previews in RGBX format
+    m_aPreviews[FrameStream_Infrared].Allocate(cInfraredWidth * cInfraredHeight * sizeof(RGBQUAD));
+    m_aPreviews[FrameStream_Depth].Allocate(cDepthWidth * cDepthHeight * sizeof(RGBQUAD));
+    m_aPreviews[FrameStream_Color].Allocate(cColorWidth * cColorHeight * sizeof(RGBQUAD));
+    for (int i = 0; i < _countof(m_aPreviews); ++i)
+    {
+        m_aPreviews[i].SetSignal(&m_sPreviewSignal);
+    }
+
+#ifdef DEPTH_RVL
+    // create heap storage for compressed depth data
+    m_pDepthRVL = new BYTE[RVLMaxSize(cDepthWidth * cDepthHeight)];
+#endif
 
-    // create heap storage for depth pixel data in RGBX  & UINT16 format
-    m_pDepthRGBX = new RGBQUAD[cDepthWidth * cDepthHeight];
+    ZeroMemory(m_aShards, sizeof(m_aShards));
+    ZeroMemory(m_aLatestTimes, sizeof(m_aLatestTimes));
+    for (int i = 0; i < _countof(m_aInRingSlot); ++i)
+    {
+        m_aInRingSlot[i] = true;
+    }
+    ZeroMemory(m_aWrittenFrames, sizeof(m_aWrittenFrames));
+    m_cStreamSync.SetResyncThreshold(cMinTimestampDifferenceForFrameReSync * 10000LL);
+    m_szStorageProbeReport[0] = L'\0';
+    m_szStatusMessage[0] = L'\0';
+    m_szRecordMessage[0] = L'\0';
+    ZeroMemory(m_aTimings, sizeof(m_aTimings));
 
-    // create heap storage for color pixel data in RGBX format
-    m_pColorRGBX = new RGBQUAD[cColorWidth * cColorHeight];
+    // create heap storage for the sensor frames waiting for conversion
+    const UINT aRawSizes[3] = { cInfraredWidth * cInfraredHeight * sizeof(UINT16), cDepthWidth * cDepthHeight * sizeof(UINT16), cColorWidth * cColorHeight * sizeof(RGBQUAD) };
+    for (int i = 0; i < _countof(m_aRawFrames); ++i)
+    {
+        RawFrameRing& ring = m_aRawFrames[i];
+        ring.nBufferSize = aRawSizes[i];
+        for (int j = 0; j < RawQueueDepth; ++j)
+        {
+            ring.aBuffers[j] = new BYTE[ring.nBufferSize];
+        }
+        ZeroMemory(ring.aFrames, sizeof(ring.aFrames));
+        ZeroMemory(ring.aQueuedCounters, sizeof(ring.aQueuedCounters));
+        ring.qFrames.SetSignal(&m_sRawSignal);
+    }
 
-    for (int i = 0; i < BufferSize; ++i)
+    // ring slots are sector-aligned, with room for a file header in front (see AsyncFileWriter.h)
+    for (int i = 0; i < BufferSize + 1; ++i)
     {
         // create heap storage for infrared pixel data in UINT16 format
-        m_pInfraredUINT16[i] = new UINT16[cInfraredWidth * cInfraredHeight];
+        m_pInfraredUINT16[i] = reinterpret_cast<UINT16*>(AllocateFrameSlot(cInfraredWidth * cInfraredHeight * sizeof(UINT16)));
 
         // create heap storage for depth pixel data in UINT16 format
-        m_pDepthUINT16[i] = new UINT16[cDepthWidth * cDepthHeight];
+        m_pDepthUINT16[i] = reinterpret_cast<UINT16*>(AllocateFrameSlot(cDepthWidth * cDepthHeight * sizeof(UINT16)));
 
         // create heap storage for color pixel data in RGB format
-        m_pColorRGB[i] = new RGBTRIPLE[cColorWidth * cColorHeight];
-    }
-    
-    // create heap storage for file lists
-    m_vInfraredList.reserve(1800);
-    m_vDepthList.reserve(1800);
-    m_vColorList.reserve(1800);
+        m_pColorRGB[i] = reinterpret_cast<RGBTRIPLE*>(AllocateFrameSlot(cColorWidth * cColorHeight * sizeof(RGBTRIPLE)));
+    }
+
+    // wake up the writers whenever a frame is enqueued
+    m_qInfraredFrameQueue.SetSignal(&m_sFrameSignal);
+    m_qDepthFrameQueue.SetSignal(&m_sFrameSignal);
+    m_qColorFrameQueue.SetSignal(&m_sFrameSignal);
+
+    // one writer lane per stream, added in FrameStream order
+    m_cWriterPool.AddLane([this](INT64* pDeadline, UINT* pDepth) { return QueueFrameReady(m_qInfraredFrameQueue, pDeadline, pDepth); },
+        [this] { SaveInfraredFrame(); });
+    m_cWriterPool.AddLane([this](INT64* pDeadline, UINT* pDepth) { return QueueFrameReady(m_qDepthFrameQueue, pDeadline, pDepth); },
+        [this] { SaveDepthFrame(); });
+    m_cWriterPool.AddLane([this](INT64* pDeadline, UINT* pDepth) { return ColorFrameReady(pDeadline, pDepth); },
+        [this] { SaveColorFrame(); });
+    m_cWriterPool.SetIdle([this] { FinishRecord(); });
 }
 
 
@@ -119,6 +369,28 @@ m_bStopThread(false)
 /// </summary>
 CKinectV2Recorder::~CKinectV2Recorder()
 {
+    // nothing may be captured while tearing down
+    StopCapture();
+
+    // the storage probe is not interrupted, wait for it
+    if (m_tStorageProbe.joinable())
+    {
+        m_tStorageProbe.join();
+    }
+
+    // stop the writers before releasing the buffers they read from
+    m_cWriterPool.Stop();
+#ifdef ASYNC_WRITE
+    for (UINT i = 0; i < _countof(m_aAsyncWriters); ++i)
+    {
+        m_aAsyncWriters[i].Flush();
+    }
+#endif
+    CloseContainers();
+#ifdef USE_TURBOJPEG
+    m_cJpegEncoder.Stop();
+#endif
+
     // clean up Direct2D renderer
     if (m_pDrawInfrared)
     {
@@ -138,41 +410,38 @@ CKinectV2Recorder::~CKinectV2Recorder()
         m_pDrawColor = NULL;
     }
 
-    if (m_pInfraredRGBX)
-    {
-        delete[] m_pInfraredRGBX;
-        m_pInfraredRGBX = NULL;
-    }
-
-    if (m_pDepthRGBX)
+    if (m_pDepthRVL)
     {
-        delete[] m_pDepthRGBX;
-        m_pDepthRGBX = NULL;
+        delete[] m_pDepthRVL;
+        m_pDepthRVL = NULL;
     }
 
-    if (m_pColorRGBX)
+    for (int i = 0; i < _countof(m_aRawFrames); ++i)
     {
-        delete[] m_pColorRGBX;
-        m_pColorRGBX = NULL;
+        for (int j = 0; j < RawQueueDepth; ++j)
+        {
+            delete[] m_aRawFrames[i].aBuffers[j];
+            m_aRawFrames[i].aBuffers[j] = NULL;
+        }
     }
 
-    for (int i = 0; i < BufferSize; ++i)
+    for (int i = 0; i < BufferSize + 1; ++i)
     {
         if (m_pInfraredUINT16[i])
         {
-            delete[] m_pInfraredUINT16[i];
+            FreeFrameSlot(m_pInfraredUINT16[i]);
             m_pInfraredUINT16[i] = NULL;
         }
 
         if (m_pDepthUINT16[i])
         {
-            delete[] m_pDepthUINT16[i];
+            FreeFrameSlot(m_pDepthUINT16[i]);
             m_pDepthUINT16[i] = NULL;
         }
 
         if (m_pColorRGB[i])
         {
-            delete[] m_pColorRGB[i];
+            FreeFrameSlot(m_pColorRGB[i]);
             m_pColorRGB[i] = NULL;
         }
     }
@@ -180,25 +449,12 @@ CKinectV2Recorder::~CKinectV2Recorder()
     // clean up Direct2D
     SafeRelease(m_pD2DFactory);
 
-    // done with infrared frame reader
-    SafeRelease(m_pInfraredFrameReader);
-
-    // done with depth frame reader
-    SafeRelease(m_pDepthFrameReader);
-
-    // done with color frame reader
-    SafeRelease(m_pColorFrameReader);
-
-    // close the Kinect Sensor
-    if (m_pKinectSensor)
+    // done with the frame source (closes the Kinect sensor)
+    if (m_pFrameSource)
     {
-        m_pKinectSensor->Close();
+        delete m_pFrameSource;
+        m_pFrameSource = NULL;
     }
-
-    SafeRelease(m_pKinectSensor);
-
-    m_bStopThread = true;
-    if (m_tSaveThread.joinable()) m_tSaveThread.join();
 }
 
 /// <summary>
@@ -236,22 +492,17 @@ int CKinectV2Recorder::Run(HINSTANCE hInstance, int nCmdShow)
     // Show window
     ShowWindow(hWndApp, nCmdShow);
 
-    // Main message loop
-    while (WM_QUIT != msg.message)
+    // Main message loop, the frames are processed by the capture and conversion threads
+    while (GetMessageW(&msg, NULL, 0, 0) > 0)
     {
-        Update();
-
-        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE))
+        // If a dialog message will be taken care of by the dialog proc
+        if (hWndApp && IsDialogMessageW(hWndApp, &msg))
         {
-            // If a dialog message will be taken care of by the dialog proc
-            if (hWndApp && IsDialogMessageW(hWndApp, &msg))
-            {
-                continue;
-            }
-
-            TranslateMessage(&msg);
-            DispatchMessageW(&msg);
+            continue;
         }
+
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
     }
 
     return static_cast<int>(msg.wParam);
@@ -262,246 +513,452 @@ int CKinectV2Recorder::Run(HINSTANCE hInstance, int nCmdShow)
 /// </summary>
 void CKinectV2Recorder::StartMultithreading()
 {
-    m_tSaveThread = std::thread(&CKinectV2Recorder::SaveRecordImages, this);
+    // Raw color needs a source able to deliver it
+    if (m_nColorFormat == ColorFormat_YUY2 && !(m_pFrameSource && m_pFrameSource->SetRawColor(true)))
+    {
+        m_nColorFormat = ColorFormat_PPM;
+    }
+
+    if (m_nColorFormat == ColorFormat_QOI)
+    {
+        m_cColorEncoder.Start(QOIEncodeThreads);
+    }
+#ifdef USE_TURBOJPEG
+    if (m_nColorFormat == ColorFormat_JPEG)
+    {
+        m_cJpegEncoder.SetSignal(&m_sFrameSignal);
+        if (FAILED(m_cJpegEncoder.Start(m_nJpegThreads, m_nJpegQuality, cColorWidth, cColorHeight)))
+        {
+            // Fall back to the lossless format sharing the byte order of the ring slots
+            m_cJpegEncoder.Stop();
+            m_nColorFormat = ColorFormat_PPM;
+        }
+    }
+#endif
+    m_cWriterPool.Start(&m_sFrameSignal, m_nWriterThreads);
+}
+
+/// <summary>
+/// Start the capture thread, which copies the frames as they arrive, the conversion thread processing them and the preview thread
+/// </summary>
+void CKinectV2Recorder::StartCapture()
+{
+    m_bStopCapture = false;
+    m_tPreview = std::thread(&CKinectV2Recorder::RenderPreviews, this);
+    m_tConvert = std::thread(&CKinectV2Recorder::ConvertFrames, this);
+    m_tCapture = std::thread(&CKinectV2Recorder::CaptureFrames, this);
 }
 
 /// <summary>
-/// Main processing function
+/// Stop and join the capture, conversion and preview threads
 /// </summary>
-void CKinectV2Recorder::Update()
+void CKinectV2Recorder::StopCapture()
 {
-    if (!m_pInfraredFrameReader | !m_pDepthFrameReader | !m_pColorFrameReader)
+    m_bStopCapture = true;
+    if (m_tCapture.joinable())
     {
-        return;
+        m_tCapture.join();
     }
 
-    INT64 currentInfraredFrameTime = 0;
-    INT64 currentDepthFrameTime = 0;
-    INT64 currentColorFrameTime = 0;
-
-    IInfraredFrame* pInfraredFrame = NULL;
-    IDepthFrame* pDepthFrame = NULL;
-    IColorFrame* pColorFrame = NULL;
-
-
-    // Get an infrared frame from Kinect
-    HRESULT hrInfrared = m_pInfraredFrameReader->AcquireLatestFrame(&pInfraredFrame);
-    // Get a depth frame from Kinect
-    HRESULT hrDepth = m_pDepthFrameReader->AcquireLatestFrame(&pDepthFrame);
-    // Get a color frame from Kinect
-    HRESULT hrColor = m_pColorFrameReader->AcquireLatestFrame(&pColorFrame);
-
-    if (SUCCEEDED(hrInfrared))
+    m_sRawSignal.Notify();
+    if (m_tConvert.joinable())
     {
-        INT64 currentInfraredFrameTime = 0;
-        IFrameDescription* pFrameDescription = NULL;
-        int nWidth = 0;
-        int nHeight = 0;
-        UINT nBufferSize = 0;
-        UINT16 *pBuffer = NULL;
+        m_tConvert.join();
+    }
 
-        // Unit: 100 ns
-        HRESULT hr = pInfraredFrame->get_RelativeTime(&currentInfraredFrameTime);
+    m_sPreviewSignal.Notify();
+    if (m_tPreview.joinable())
+    {
+        m_tPreview.join();
+    }
+}
 
-        if (SUCCEEDED(hr))
+/// <summary>
+/// Capture thread: wait for frames and queue them until stopped
+/// </summary>
+void CKinectV2Recorder::CaptureFrames()
+{
+    while (!m_bStopCapture)
+    {
+        if (!m_pFrameSource)
         {
-            hr = pInfraredFrame->get_FrameDescription(&pFrameDescription);
+            std::this_thread::sleep_for(std::chrono::milliseconds(CaptureWaitTimeout));
+            continue;
         }
 
-        if (SUCCEEDED(hr))
+        if (!m_pFrameSource->WaitForFrame(CaptureWaitTimeout))
         {
-            hr = pFrameDescription->get_Width(&nWidth);
+            continue;
         }
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pFrameDescription->get_Height(&nHeight);
-        }
+        LARGE_INTEGER qpcWake = { 0 };
+        QueryPerformanceCounter(&qpcWake);
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pInfraredFrame->AccessUnderlyingBuffer(&nBufferSize, &pBuffer);
-        }
+        Update();
 
-        if (SUCCEEDED(hr))
+        LARGE_INTEGER qpcDone = { 0 };
+        if (QueryPerformanceCounter(&qpcDone))
         {
-            ProcessInfrared(currentInfraredFrameTime, pBuffer, nWidth, nHeight);
+            AddStageTiming(PipelineStage_Capture, qpcDone.QuadPart - qpcWake.QuadPart);
         }
-
-        SafeRelease(pFrameDescription);
     }
+}
 
-    SafeRelease(pInfraredFrame);
-
-    if (SUCCEEDED(hrDepth))
+/// <summary>
+/// Conversion thread: process the queued sensor frames until stopped
+/// </summary>
+void CKinectV2Recorder::ConvertFrames()
+{
+    while (!m_bStopCapture)
     {
-        INT64 currentDepthFrameTime = 0;
-        IFrameDescription* pFrameDescription = NULL;
-        int nWidth = 0;
-        int nHeight = 0;
-        USHORT nDepthMinReliableDistance = 0;
-        USHORT nDepthMaxDistance = 0;
-        UINT nBufferSize = 0;
-        UINT16 *pBuffer = NULL;
-
-        // Unit: 100 ns
-        HRESULT hr = pDepthFrame->get_RelativeTime(&currentDepthFrameTime);
-
-        if (SUCCEEDED(hr))
-        {
-            hr = pDepthFrame->get_FrameDescription(&pFrameDescription);
-        }
+        UINT64 nSeen = m_sRawSignal.Sequence();
+        bool bProcessed = false;
 
-        if (SUCCEEDED(hr))
+        // One frame per stream in turn, so that a color backlog does not hold back infrared and depth
+        for (int i = 0; i < _countof(m_aRawFrames); ++i)
         {
-            hr = pFrameDescription->get_Width(&nWidth);
-        }
+            RawFrameRing& ring = m_aRawFrames[i];
+            FrameDesc desc;
+            if (!ring.qFrames.Front(&desc))
+            {
+                continue;
+            }
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pFrameDescription->get_Height(&nHeight);
-        }
+            const SourceFrame& frame = ring.aFrames[desc.nSlot];
+            LARGE_INTEGER qpcStart = { 0 };
+            QueryPerformanceCounter(&qpcStart);
+            AddStageTiming(PipelineStage_Queue, qpcStart.QuadPart - ring.aQueuedCounters[desc.nSlot]);
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pDepthFrame->get_DepthMinReliableDistance(&nDepthMinReliableDistance);
-        }
+            {
+                std::lock_guard<std::mutex> lock(m_mProcess);
+                switch (i)
+                {
+                case FrameStream_Infrared:
+                    ProcessInfrared(frame.nTime, reinterpret_cast<const UINT16*>(frame.pBuffer), frame.nWidth, frame.nHeight);
+                    break;
+                case FrameStream_Depth:
+                    ProcessDepth(frame.nTime, reinterpret_cast<const UINT16*>(frame.pBuffer), frame.nWidth, frame.nHeight,
+                        frame.nMinReliableDistance, frame.nMaxReliableDistance);
+                    break;
+                case FrameStream_Color:
+                    ProcessColor(frame.nTime, frame.pBuffer, frame.nColorFormat, frame.nWidth, frame.nHeight);
+                    break;
+                }
+            }
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pDepthFrame->get_DepthMaxReliableDistance(&nDepthMaxDistance);
-        }
+            LARGE_INTEGER qpcDone = { 0 };
+            QueryPerformanceCounter(&qpcDone);
+            AddStageTiming(PipelineStage_Convert, qpcDone.QuadPart - qpcStart.QuadPart);
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pDepthFrame->AccessUnderlyingBuffer(&nBufferSize, &pBuffer);
+            ring.qFrames.Pop();
+            bProcessed = true;
         }
 
-        if (SUCCEEDED(hr))
+        if (!bProcessed)
         {
-            ProcessDepth(currentDepthFrameTime, pBuffer, nWidth, nHeight, nDepthMinReliableDistance, nDepthMaxDistance);
+            m_sRawSignal.Wait(nSeen, CaptureWaitTimeout);
         }
-
-        SafeRelease(pFrameDescription);
     }
+}
 
-    SafeRelease(pDepthFrame);
+/// <summary>
+/// Preview thread: draw the newest image of every stream, at most at the preview rate, until stopped
+/// </summary>
+void CKinectV2Recorder::RenderPreviews()
+{
+    ImageRenderer* aRenderers[3] = { m_pDrawInfrared, m_pDrawDepth, m_pDrawColor };
+    const int aViews[3] = { IDC_INFRAREDVIEW, IDC_DEPTHVIEW, IDC_COLORVIEW };
+    UINT aWidths[3] = { cInfraredWidth, cDepthWidth, cColorWidth };
+    UINT aHeights[3] = { cInfraredHeight, cDepthHeight, cColorHeight };
+    std::chrono::nanoseconds interval(m_fPreviewFps > 0 ? static_cast<INT64>(1e9 / m_fPreviewFps) : 0);
 
-    if (SUCCEEDED(hrColor))
+    while (!m_bStopCapture)
     {
-        INT64 currentColorFrameTime = 0;
-        IFrameDescription* pFrameDescription = NULL;
-        int nWidth = 0;
-        int nHeight = 0;
-        ColorImageFormat imageFormat = ColorImageFormat_None;
-        UINT nBufferSize = 0;
-        RGBQUAD *pBuffer = NULL;
-
-        // Unit: 100 ns
-        HRESULT hr = pColorFrame->get_RelativeTime(&currentColorFrameTime);
-
-        if (SUCCEEDED(hr))
-        {
-            hr = pColorFrame->get_FrameDescription(&pFrameDescription);
-        }
-
-        if (SUCCEEDED(hr))
-        {
-            hr = pFrameDescription->get_Width(&nWidth);
-        }
+        UINT64 nSeen = m_sPreviewSignal.Sequence();
+        std::chrono::steady_clock::time_point tDraw = std::chrono::steady_clock::now();
 
-        if (SUCCEEDED(hr))
+        // Images published since the last round replace each other, only the newest one is drawn
+        bool bDrawn = false;
+        for (int i = 0; i < _countof(m_aPreviews); ++i)
         {
-            hr = pFrameDescription->get_Height(&nHeight);
-        }
+            UINT nWidth, nHeight;
+            BYTE* pImage = m_aPreviews[i].Latest(&nWidth, &nHeight);
+            if (pImage && aRenderers[i])
+            {
+                // The renderer is sized to the image, a shrunk image also shrinks its render target
+                if (nWidth != aWidths[i] || nHeight != aHeights[i])
+                {
+                    aRenderers[i]->Initialize(GetDlgItem(m_hWnd, aViews[i]), m_pD2DFactory, nWidth, nHeight, nWidth * sizeof(RGBQUAD));
+                    aWidths[i] = nWidth;
+                    aHeights[i] = nHeight;
+                }
 
-        if (SUCCEEDED(hr))
-        {
-            hr = pColorFrame->get_RawColorImageFormat(&imageFormat);
+                aRenderers[i]->Draw(pImage, nWidth * nHeight * sizeof(RGBQUAD));
+                bDrawn = true;
+            }
         }
 
-        if (SUCCEEDED(hr))
+        if (!bDrawn)
         {
-            if (imageFormat == ColorImageFormat_Bgra)
-            {
-                hr = pColorFrame->AccessRawUnderlyingBuffer(&nBufferSize, reinterpret_cast<BYTE**>(&pBuffer));
-            }
-            else if (m_pColorRGBX)
-            {
-                pBuffer = m_pColorRGBX;
-                nBufferSize = cColorWidth * cColorHeight * sizeof(RGBQUAD);
-                hr = pColorFrame->CopyConvertedFrameDataToArray(nBufferSize, reinterpret_cast<BYTE*>(pBuffer), ColorImageFormat_Bgra);
-            }
-            else
-            {
-                hr = E_FAIL;
-            }
+            m_sPreviewSignal.Wait(nSeen, CaptureWaitTimeout);
         }
-
-        if (SUCCEEDED(hr))
+        else if (interval.count())
         {
-            ProcessColor(currentColorFrameTime, pBuffer, nWidth, nHeight);
+            std::this_thread::sleep_until(tDraw + interval);
         }
-        SafeRelease(pFrameDescription);
     }
-
-    SafeRelease(pColorFrame);
 }
 
 /// <summary>
-/// Initialize the UI
+/// Pick the factor the color preview is shrunk by from the size of its view
 /// </summary>
-void CKinectV2Recorder::InitializeUIControls()
+void CKinectV2Recorder::UpdatePreviewScale()
 {
-    const wchar_t *Models[] = { L"Wing", L"Duck", L"City", L"Beach", L"Firework", L"Maple" };
-    const wchar_t *Types[] = { L"Translation", L"Zoom", L"In-plane Rotation", L"Out-of-plane Rotation",
-        L"Flashing Light", L"Moving Light", L"Free Movement" };
-    const wchar_t *Levels[] = { L"1", L"2", L"3", L"4", L"5" };
-    const wchar_t *Sides[] = { L"Front", L"Left", L"Back", L"Right" };
-
-    // Set the radio button for selection between 2D and 3D
-    if (m_bSelect2D)
-    {
-        CheckDlgButton(m_hWnd, IDC_2D, BST_CHECKED);
-    }
-    else
+    RECT rc;
+    if (!GetClientRect(GetDlgItem(m_hWnd, IDC_COLORVIEW), &rc) || rc.right <= 0 || rc.bottom <= 0)
     {
-        CheckDlgButton(m_hWnd, IDC_3D, BST_CHECKED);
+        // Minimized, keep the current factor
+        return;
     }
 
-    for (int i = 0; i < 6; i++)
+    // Shrink as long as the view does not have to stretch the image by more than PreviewMaxStretch
+    UINT nScale = 1;
+    while (nScale < PreviewMaxScale &&
+        cColorWidth / (nScale * 2) * PreviewMaxStretch >= rc.right &&
+        cColorHeight / (nScale * 2) * PreviewMaxStretch >= rc.bottom)
     {
-        SendDlgItemMessage(m_hWnd, IDC_MODEL_CBO, CB_ADDSTRING, 0, (LPARAM)Models[i]);
+        nScale *= 2;
     }
 
-    for (int i = 0; i < 7; i++)
-    {
-        SendDlgItemMessage(m_hWnd, IDC_TYPE_CBO, CB_ADDSTRING, 0, (LPARAM)Types[i]);
-    }
+    m_nColorPreviewScale = nScale;
+}
 
-    for (int i = 0; i < 5; i++)
+/// <summary>
+/// Add a duration to the timing of a pipeline stage
+/// </summary>
+/// <param name="nStage">stage</param>
+/// <param name="nCounters">duration in performance counter ticks</param>
+void CKinectV2Recorder::AddStageTiming(PipelineStage nStage, INT64 nCounters)
+{
+    if (!m_fFreq)
     {
-        SendDlgItemMessage(m_hWnd, IDC_LEVEL_CBO, CB_ADDSTRING, 0, (LPARAM)Levels[i]);
+        return;
     }
 
-    for (int i = 0; i < 4; i++)
+    double fMsec = 1000.0 * nCounters / m_fFreq;
+    std::lock_guard<std::mutex> lock(m_mTimings);
+    StageTiming& timing = m_aTimings[nStage];
+    timing.fAverage += (fMsec - timing.fAverage) / 16;
+    timing.fMax = max(timing.fMax, fMsec);
+}
+
+/// <summary>
+/// Use the given frame source instead of the default Kinect sensor
+/// </summary>
+/// <param name="pFrameSource">frame source, owned by the recorder from now on</param>
+void CKinectV2Recorder::SetFrameSource(FrameSource* pFrameSource)
+{
+    if (m_pFrameSource)
     {
-        SendDlgItemMessage(m_hWnd, IDC_SIDE_CBO, CB_ADDSTRING, 0, (LPARAM)Sides[i]);
+        delete m_pFrameSource;
     }
+    m_pFrameSource = pFrameSource;
+}
 
-    // Set combo box index
-    SendDlgItemMessage(m_hWnd, IDC_MODEL_CBO, CB_SETCURSEL, m_nModel2DIndex, 0);
-    SendDlgItemMessage(m_hWnd, IDC_TYPE_CBO, CB_SETCURSEL, m_nTypeIndex, 0);
-    SendDlgItemMessage(m_hWnd, IDC_LEVEL_CBO, CB_SETCURSEL, m_nLevelIndex, 0);
-    SendDlgItemMessage(m_hWnd, IDC_SIDE_CBO, CB_SETCURSEL, m_nSideIndex, 0);
+/// <summary>
+/// Select the colormap of the depth view
+/// </summary>
+/// <param name="nColormap">colormap used from the next depth frame on</param>
+void CKinectV2Recorder::SetDepthColormap(DepthColormap nColormap)
+{
+    m_cDepthColorizer.SetColormap(nColormap);
+}
 
-    // Disable the side text & combo box
-    EnableWindow(GetDlgItem(m_hWnd, IDC_SIDE_TEXT), false);
-    EnableWindow(GetDlgItem(m_hWnd, IDC_SIDE_CBO), false);
+/// <summary>
+/// Configure the threads converting the frames
+/// </summary>
+/// <param name="nThreads">number of workers besides the conversion thread, 0 to convert inline</param>
+/// <param name="nBands">number of row bands per frame, 0 for one per thread</param>
+/// <param name="nAffinityMask">cores the workers are pinned to in turn, 0 to leave them unpinned</param>
+void CKinectV2Recorder::SetConversionThreads(UINT nThreads, UINT nBands, DWORD_PTR nAffinityMask)
+{
+    m_cConversionPool.Start(nThreads, nBands, nAffinityMask);
+}
 
-    // Set button icons
-    m_hRecord = LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_RECORD), IMAGE_ICON, 128, 128, LR_DEFAULTCOLOR);
-    m_hStop = LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_STOP), IMAGE_ICON, 128, 128, LR_DEFAULTCOLOR);
+/// <summary>
+/// Select the format the color stream is recorded in, before the recorder is run
+/// </summary>
+/// <param name="nFormat">color format</param>
+void CKinectV2Recorder::SetColorFormat(ColorFormat nFormat)
+{
+    m_nColorFormat = nFormat;
+
+    // BMP keeps the byte order of the sensor, everything else is written R-G-B
+    m_bColorBGR = (nFormat == ColorFormat_BMP);
+}
+
+/// <summary>
+/// Configure the JPEG encoding of the color stream, before the recorder is run
+/// </summary>
+/// <param name="nQuality">JPEG quality (1-100)</param>
+/// <param name="nThreads">number of encoder threads</param>
+void CKinectV2Recorder::SetJpegOptions(int nQuality, UINT nThreads)
+{
+    m_nJpegQuality = min(max(nQuality, 1), 100);
+    m_nJpegThreads = max(nThreads, 1U);
+}
+
+/// <summary>
+/// Find a color format by name
+/// </summary>
+/// <param name="szName">ppm, bmp, qoi, jpeg or yuy2</param>
+/// <param name="pFormat">receives the color format</param>
+/// <returns>true if the name is known and the format is available in this build</returns>
+bool CKinectV2Recorder::ParseColorFormat(LPCWSTR szName, ColorFormat* pFormat)
+{
+    static const LPCWSTR aNames[ColorFormat_Count] = { L"ppm", L"bmp", L"qoi", L"jpeg", L"yuy2" };
+
+    for (int i = 0; i < ColorFormat_Count; ++i)
+    {
+        if (0 == _wcsicmp(szName, aNames[i]))
+        {
+#ifndef USE_TURBOJPEG
+            if (i == ColorFormat_JPEG)
+            {
+                return false;
+            }
+#endif
+            *pFormat = static_cast<ColorFormat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Main capture function: copy the new sensor frames for the conversion thread and release them
+/// </summary>
+void CKinectV2Recorder::Update()
+{
+    if (!m_pFrameSource)
+    {
+        return;
+    }
+
+    SourceFrame infraredFrame = { 0 };
+    SourceFrame depthFrame = { 0 };
+    SourceFrame colorFrame = { 0 };
+
+    // Get an infrared frame from the source
+    HRESULT hrInfrared = m_pFrameSource->AcquireInfraredFrame(&infraredFrame);
+    // Get a depth frame from the source
+    HRESULT hrDepth = m_pFrameSource->AcquireDepthFrame(&depthFrame);
+    // Get a color frame from the source
+    HRESULT hrColor = m_pFrameSource->AcquireColorFrame(&colorFrame);
+
+    // The frames are only copied, so that the source gets them back before they are converted and drawn
+    if (SUCCEEDED(hrInfrared))
+    {
+        QueueRawFrame(FrameStream_Infrared, infraredFrame);
+    }
+
+    m_pFrameSource->ReleaseInfraredFrame();
+
+    if (SUCCEEDED(hrDepth))
+    {
+        QueueRawFrame(FrameStream_Depth, depthFrame);
+    }
+
+    m_pFrameSource->ReleaseDepthFrame();
+
+    if (SUCCEEDED(hrColor))
+    {
+        QueueRawFrame(FrameStream_Color, colorFrame);
+    }
+
+    m_pFrameSource->ReleaseColorFrame();
+}
+
+/// <summary>
+/// Copy a sensor frame into the next slot of its ring, unless the conversion thread has fallen behind
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="frame">frame held from the source</param>
+void CKinectV2Recorder::QueueRawFrame(FrameStream nStream, const SourceFrame& frame)
+{
+    RawFrameRing& ring = m_aRawFrames[nStream];
+    if (!frame.pBuffer || frame.nBufferSize > ring.nBufferSize || !ring.qFrames.CanPush())
+    {
+        ring.qFrames.Drop();
+        return;
+    }
+
+    UINT nSlot = ring.qFrames.NextSlot();
+    memcpy(ring.aBuffers[nSlot], frame.pBuffer, frame.nBufferSize);
+    ring.aFrames[nSlot] = frame;
+    ring.aFrames[nSlot].pBuffer = ring.aBuffers[nSlot];
+
+    LARGE_INTEGER qpcNow = { 0 };
+    QueryPerformanceCounter(&qpcNow);
+    ring.aQueuedCounters[nSlot] = qpcNow.QuadPart;
+
+    ring.qFrames.Push(frame.nTime);
+}
+
+/// <summary>
+/// Initialize the UI
+/// </summary>
+void CKinectV2Recorder::InitializeUIControls()
+{
+    const wchar_t *Models[] = { L"Wing", L"Duck", L"City", L"Beach", L"Firework", L"Maple" };
+    const wchar_t *Types[] = { L"Translation", L"Zoom", L"In-plane Rotation", L"Out-of-plane Rotation",
+        L"Flashing Light", L"Moving Light", L"Free Movement" };
+    const wchar_t *Levels[] = { L"1", L"2", L"3", L"4", L"5" };
+    const wchar_t *Sides[] = { L"Front", L"Left", L"Back", L"Right" };
+
+    // Set the radio button for selection between 2D and 3D
+    if (m_bSelect2D)
+    {
+        CheckDlgButton(m_hWnd, IDC_2D, BST_CHECKED);
+    }
+    else
+    {
+        CheckDlgButton(m_hWnd, IDC_3D, BST_CHECKED);
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        SendDlgItemMessage(m_hWnd, IDC_MODEL_CBO, CB_ADDSTRING, 0, (LPARAM)Models[i]);
+    }
+
+    for (int i = 0; i < 7; i++)
+    {
+        SendDlgItemMessage(m_hWnd, IDC_TYPE_CBO, CB_ADDSTRING, 0, (LPARAM)Types[i]);
+    }
+
+    for (int i = 0; i < 5; i++)
+    {
+        SendDlgItemMessage(m_hWnd, IDC_LEVEL_CBO, CB_ADDSTRING, 0, (LPARAM)Levels[i]);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        SendDlgItemMessage(m_hWnd, IDC_SIDE_CBO, CB_ADDSTRING, 0, (LPARAM)Sides[i]);
+    }
+
+    // Set combo box index
+    SendDlgItemMessage(m_hWnd, IDC_MODEL_CBO, CB_SETCURSEL, m_nModel2DIndex, 0);
+    SendDlgItemMessage(m_hWnd, IDC_TYPE_CBO, CB_SETCURSEL, m_nTypeIndex, 0);
+    SendDlgItemMessage(m_hWnd, IDC_LEVEL_CBO, CB_SETCURSEL, m_nLevelIndex, 0);
+    SendDlgItemMessage(m_hWnd, IDC_SIDE_CBO, CB_SETCURSEL, m_nSideIndex, 0);
+
+    // Disable the side text & combo box
+    EnableWindow(GetDlgItem(m_hWnd, IDC_SIDE_TEXT), false);
+    EnableWindow(GetDlgItem(m_hWnd, IDC_SIDE_CBO), false);
+
+    // Set button icons
+    m_hRecord = LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_RECORD), IMAGE_ICON, 128, 128, LR_DEFAULTCOLOR);
+    m_hStop = LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_STOP), IMAGE_ICON, 128, 128, LR_DEFAULTCOLOR);
     m_hShot = LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_SHOT), IMAGE_ICON, 27, 18, LR_DEFAULTCOLOR);
     SendDlgItemMessage(m_hWnd, IDC_BUTTON_RECORD, BM_SETIMAGE, (WPARAM)IMAGE_ICON, (LPARAM)m_hRecord);
     SendDlgItemMessage(m_hWnd, IDC_BUTTON_SHOT, BM_SETIMAGE, (WPARAM)IMAGE_ICON, (LPARAM)m_hShot);
@@ -518,6 +975,9 @@ void CKinectV2Recorder::InitializeUIControls()
 /// <param name="lParam">additional message data</param>
 void CKinectV2Recorder::ProcessUI(WPARAM wParam, LPARAM)
 {
+    // The conversion thread reads the record state and the save folder while processing a frame
+    std::lock_guard<std::mutex> lock(m_mProcess);
+
     const wchar_t *Model2D[] = { L"Wing", L"Duck", L"City", L"Beach", L"Firework", L"Maple" };
     const wchar_t *Model3D[] = { L"Soda", L"Chest", L"Ironman", L"House", L"Bike", L"Jet" };
 
@@ -645,8 +1105,8 @@ void CKinectV2Recorder::ProcessUI(WPARAM wParam, LPARAM)
         case 3: StringCchPrintf(m_cSaveFolder, _countof(m_cSaveFolder), L"%s_r", m_cSaveFolder); break;
         }
     }
-    WCHAR szStatusMessage[128];
-    StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L" Save Folder: %s    FPS(Infrared, Depth, Color) = (%0.2f,  %0.2f,  %0.2f)", m_cSaveFolder, m_fInfraredFPS, m_fDepthFPS, m_fColorFPS);
+    WCHAR szStatusMessage[MAX_PATH + 256];
+    FormatStatusMessage(szStatusMessage, _countof(szStatusMessage));
     SetStatusMessage(szStatusMessage, 500, true);
 
     // If it is a record control and a button clicked event, save the video sequences
@@ -654,10 +1114,16 @@ void CKinectV2Recorder::ProcessUI(WPARAM wParam, LPARAM)
     {
         if (m_bRecord)
         {
-#ifdef VERBOSE
-            CheckImages();
-#endif
-            ResetRecordParameters();
+            m_bCheckRecord = true;
+            StopRecord();
+        }
+        else if (m_bRecordStopping)
+        {
+            SetStatusMessage(L"Wait for the record to be written.", 3000, true);
+        }
+        else if (m_bStorageProbe)
+        {
+            SetStatusMessage(L"Wait for the storage probe to finish.", 3000, true);
         }
         else
         {
@@ -725,6 +1191,11 @@ LRESULT CALLBACK CKinectV2Recorder::DlgProc(HWND hWnd, UINT message, WPARAM wPar
 
         InitializeUIControls();
 
+        // The storage probe is reached through the system menu
+        HMENU hSystemMenu = GetSystemMenu(hWnd, FALSE);
+        AppendMenuW(hSystemMenu, MF_SEPARATOR, 0, NULL);
+        AppendMenuW(hSystemMenu, MF_STRING, IDM_STORAGE_PROBE, L"Probe Storage...");
+
         // Init Direct2D
         D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &m_pD2DFactory);
 
@@ -751,10 +1222,13 @@ LRESULT CALLBACK CKinectV2Recorder::DlgProc(HWND hWnd, UINT message, WPARAM wPar
             SetStatusMessage(L"Failed to initialize the Direct2D draw device.", 10000, true);
         }
 
+        UpdatePreviewScale();
+
         // Get and initialize the default Kinect sensor
         InitializeDefaultSensor();
 
         StartMultithreading();
+        StartCapture();
     }
     break;
 
@@ -764,14 +1238,79 @@ LRESULT CALLBACK CKinectV2Recorder::DlgProc(HWND hWnd, UINT message, WPARAM wPar
         break;
 
     case WM_DESTROY:
+        // The conversion thread draws into the window, stop it first
+        StopCapture();
+
         // Quit the main message pump
         PostQuitMessage(0);
         break;
 
+    case WM_STATUS_MESSAGE:
+    {
+        std::lock_guard<std::mutex> lock(m_mStatus);
+        SetDlgItemText(m_hWnd, IDC_STATUS, m_szStatusMessage);
+        m_bStatusPosted = false;
+    }
+    break;
+
+    case WM_RECORD_MESSAGE:
+    {
+        // A record stopped by another thread is still being written, unless WM_RECORD_FINISHED has already come
+        if (wParam && m_bRecordStopping)
+        {
+            EnableWindow(GetDlgItem(hWnd, IDC_BUTTON_RECORD), false);
+        }
+
+        WCHAR szMessage[_countof(m_szRecordMessage)];
+        LPCWSTR szTitle;
+        {
+            std::lock_guard<std::mutex> lock(m_mStatus);
+            StringCchCopy(szMessage, _countof(szMessage), m_szRecordMessage);
+            szTitle = m_szRecordTitle;
+        }
+        MessageBox(hWnd,
+            szMessage,
+            szTitle,
+            MB_OK | MB_ICONERROR
+            );
+    }
+    break;
+
+    case WM_SIZE:
+        UpdatePreviewScale();
+        break;
+
     // Handle button press
     case WM_COMMAND:
         ProcessUI(wParam, lParam);
         break;
+
+    case WM_SYSCOMMAND:
+        if (IDM_STORAGE_PROBE == (wParam & 0xFFF0))
+        {
+            StartStorageProbe();
+        }
+        break;
+
+    case WM_RECORD_FINISHED:
+#ifdef VERBOSE
+        if (m_bCheckRecord)
+        {
+            CheckImages();
+        }
+#endif
+        ResetRecordParameters();
+        break;
+
+    case WM_STORAGE_PROBE_DONE:
+        m_tStorageProbe.join();
+        m_bStorageProbe = false;
+        MessageBox(hWnd,
+            m_szStorageProbeReport,
+            (S_OK == m_hrStorageProbe) ? L"Storage Probe" : (SUCCEEDED(m_hrStorageProbe) ? L"Storage Probe (too slow)" : L"Storage Probe (failed)"),
+            MB_OK | ((S_OK == m_hrStorageProbe) ? MB_ICONINFORMATION : MB_ICONWARNING)
+            );
+        break;
     }
 
     return FALSE;
@@ -783,59 +1322,23 @@ LRESULT CALLBACK CKinectV2Recorder::DlgProc(HWND hWnd, UINT message, WPARAM wPar
 /// <returns>indicates success or failure</returns>
 HRESULT CKinectV2Recorder::InitializeDefaultSensor()
 {
-    HRESULT hr;
-
-    hr = GetDefaultKinectSensor(&m_pKinectSensor);
-    if (FAILED(hr))
+    // A frame source has been given on the command line
+    if (m_pFrameSource)
     {
-        return hr;
+        return S_OK;
     }
 
-    if (m_pKinectSensor)
-    {
-        // Initialize the Kinect and get the readers
-        IInfraredFrameSource* pInfraredFrameSource = NULL;
-        IDepthFrameSource* pDepthFrameSource = NULL;
-        IColorFrameSource* pColorFrameSource = NULL;
-
-        hr = m_pKinectSensor->Open();
-
-        if (SUCCEEDED(hr))
-        {
-            hr = m_pKinectSensor->get_InfraredFrameSource(&pInfraredFrameSource);
-        }
-        if (SUCCEEDED(hr))
-        {
-            hr = pInfraredFrameSource->OpenReader(&m_pInfraredFrameReader);
-        }
-        if (SUCCEEDED(hr))
-        {
-            hr = m_pKinectSensor->get_DepthFrameSource(&pDepthFrameSource);
-        }
-        if (SUCCEEDED(hr))
-        {
-            hr = pDepthFrameSource->OpenReader(&m_pDepthFrameReader);
-        }
-        if (SUCCEEDED(hr))
-        {
-            hr = m_pKinectSensor->get_ColorFrameSource(&pColorFrameSource);
-        }
-        if (SUCCEEDED(hr))
-        {
-            hr = pColorFrameSource->OpenReader(&m_pColorFrameReader);
-        }
-
-        SafeRelease(pInfraredFrameSource);
-        SafeRelease(pDepthFrameSource);
-        SafeRelease(pColorFrameSource);
-    }
+    KinectFrameSource* pKinectSource = new KinectFrameSource();
+    HRESULT hr = pKinectSource->Initialize();
 
-    if (!m_pKinectSensor || FAILED(hr))
+    if (FAILED(hr))
     {
+        delete pKinectSource;
         SetStatusMessage(L"No ready Kinect found!", 10000, true);
         return E_FAIL;
     }
 
+    m_pFrameSource = pKinectSource;
     return hr;
 }
 
@@ -865,8 +1368,8 @@ void CKinectV2Recorder::ProcessInfrared(INT64 nTime, const UINT16* pBuffer, int
             }
         }
 
-        WCHAR szStatusMessage[128];
-        StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L" Save Folder: %s    FPS(Infrared, Depth, Color) = (%0.2f,  %0.2f,  %0.2f)", m_cSaveFolder, m_fInfraredFPS, m_fDepthFPS, m_fColorFPS);
+        WCHAR szStatusMessage[MAX_PATH + 256];
+        FormatStatusMessage(szStatusMessage, _countof(szStatusMessage));
 
         if (SetStatusMessage(szStatusMessage, 1000, false))
         {
@@ -876,93 +1379,75 @@ void CKinectV2Recorder::ProcessInfrared(INT64 nTime, const UINT16* pBuffer, int
 #ifdef VERBOSE
             if (m_bRecord && m_fInfraredFPS < 29.5)
             {
-                ResetRecordParameters();
-                MessageBox(NULL,
-                    L"Infrared frame dropping occurred...\n",
-                    L"No Good",
-                    MB_OK | MB_ICONERROR
-                    );
+                m_bRecord = false;
+                PostRecordMessage(L"Infrared frame dropping occurred...\n", L"No Good", true);
                 return;
             }
 #endif
         }
     }
 
-    if (m_pInfraredRGBX && pBuffer && (nWidth == cInfraredWidth) && (nHeight == cInfraredHeight))
+    if (pBuffer && (nWidth == cInfraredWidth) && (nHeight == cInfraredHeight))
     {
-        INT64 index = m_nInfraredIndex % BufferSize;
-        RGBQUAD* pRGBX = m_pInfraredRGBX;
-        UINT16* pUINT16 = m_pInfraredUINT16[index];
-        pBuffer += cInfraredWidth - 1;
+        // Use the spare slot if the writer still owns every slot of the ring
+        m_nInfraredSlot = m_qInfraredFrameQueue.CanPush() ? m_qInfraredFrameQueue.NextSlot() : BufferSize;
 
-        for (int i = 0; i < cInfraredHeight; ++i)
+        // Mirror, normalize and convert to Big-Endian format in one pass
+        RGBQUAD* pRGBX = reinterpret_cast<RGBQUAD*>(m_aPreviews[FrameStream_Infrared].WriteBuffer());
+        UINT16* pUINT16 = m_pInfraredUINT16[m_nInfraredSlot];
+#ifdef MAPPED_OUTPUT
+        BYTE* pMapped = (m_nInfraredSlot < BufferSize) ? AcquireMappedFrame(FrameStream_Infrared) : NULL;
+        if (pMapped)
         {
-            for (int j = 0; j < cInfraredWidth; ++j)
-            {
-                // normalize the incoming infrared data (ushort) to a float ranging from 
-                // [InfraredOutputValueMinimum, InfraredOutputValueMaximum] by
-                // 1. dividing the incoming value by the source maximum value
-                float intensityRatio = static_cast<float>(*pBuffer) / InfraredSourceValueMaximum;
-
-                // 2. dividing by the (average scene value * standard deviations)
-                intensityRatio /= InfraredSceneValueAverage * InfraredSceneStandardDeviations;
-
-                // 3. limiting the value to InfraredOutputValueMaximum
-                intensityRatio = min(InfraredOutputValueMaximum, intensityRatio);
-
-                // 4. limiting the lower value InfraredOutputValueMinimym
-                intensityRatio = max(InfraredOutputValueMinimum, intensityRatio);
-
-                // 5. converting the normalized value to a byte and using the result
-                // as the RGB components required by the image
-                byte intensity = static_cast<byte>(intensityRatio * 255.0f);
-                pRGBX->rgbRed = intensity;
-                pRGBX->rgbGreen = intensity;
-                pRGBX->rgbBlue = intensity;
-
-                // convert UINT16 to Big-Endian format
-                (*pUINT16) = ((*pBuffer) >> 8) | ((*pBuffer) << 8);
-
-                --pBuffer;
-                ++pRGBX;
-                ++pUINT16;
-            }
-            pBuffer += (cInfraredWidth << 1);
+            pUINT16 = reinterpret_cast<UINT16*>(pMapped);
         }
+        m_aInRingSlot[FrameStream_Infrared] = (NULL == pMapped);
+#endif
+        m_cConversionPool.Run(cInfraredHeight, cInfraredWidth, [=](int nFirstRow, int nRows)
+        {
+            int nOffset = nFirstRow * cInfraredWidth;
+            ConvertInfrared(pBuffer + nOffset, pRGBX + nOffset, pUINT16 + nOffset, cInfraredWidth, nRows);
+        });
 
-        // Draw the data with Direct2D
-        m_pDrawInfrared->Draw(reinterpret_cast<BYTE*>(m_pInfraredRGBX), cInfraredWidth * cInfraredHeight * sizeof(RGBQUAD));
+        // Hand the preview over to the preview thread
+        m_aPreviews[FrameStream_Infrared].Publish(cInfraredWidth, cInfraredHeight);
 
         if (m_bRecord)
         {
             if (!m_nStartTime)
             {
-                if (IsDirectoryExists(m_cSaveFolder))
+                // A previous record may have left frames on any of the stripes
+                bool bExists = false;
+                for (UINT nStripe = 0; nStripe < GetStripeCount() && !bExists; ++nStripe)
+                {
+                    WCHAR szRecordFolder[MAX_PATH];
+                    FormatStripePath(szRecordFolder, _countof(szRecordFolder), nStripe, m_cSaveFolder);
+                    bExists = IsDirectoryExists(szRecordFolder);
+                }
+                if (bExists)
                 {
-                    MessageBox(NULL,
-                        L"The related folder is not emtpy!\n",
-                        L"Frames already existed",
-                        MB_OK | MB_ICONERROR
-                        );
                     m_bRecord = false;
-                    SendDlgItemMessage(m_hWnd, IDC_BUTTON_RECORD, BM_SETIMAGE, (WPARAM)IMAGE_ICON, (LPARAM)m_hRecord);
+                    PostRecordMessage(L"The related folder is not emtpy!\n", L"Frames already existed", true);
                     return;
                 }
                 m_nStartTime = nTime;
             }
 
             // Write out the bitmap to disk (enqeue)
-            m_qInfraredTimeQueue.push(nTime - m_nStartTime);
-            m_qInfraredFrameQueue.push(m_pInfraredUINT16[index]);
-
-            ++m_nInfraredIndex;
+            if (m_nInfraredSlot < BufferSize)
+            {
+#ifdef MAPPED_OUTPUT
+                QueueMappedFrame(FrameStream_Infrared, pMapped);
+#endif
+                m_qInfraredFrameQueue.Push(nTime - m_nStartTime);
+            }
+            else
+            {
+                m_qInfraredFrameQueue.Drop();
+            }
         }
 
-        if (m_bShot)
-        {
-            m_nInfraredShotTime = nTime;
-            m_bShotReady = true;
-        }
+        SynchronizeFrame(FrameStream_Infrared, nTime);
     }
 }
 
@@ -994,9 +1479,6 @@ void CKinectV2Recorder::ProcessDepth(INT64 nTime, const UINT16* pBuffer, int nWi
             }
         }
 
-        WCHAR szStatusMessage[128];
-        StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L" Save Folder: %s    FPS(Infrared, Depth, Color) = (%0.2f,  %0.2f,  %0.2f)", m_cSaveFolder, m_fInfraredFPS, m_fDepthFPS, m_fColorFPS);
-
         if (m_nDepthFramesSinceUpdate % 30 == 0)
         {
             m_nDepthLastCounter = qpcNow.QuadPart;
@@ -1005,12 +1487,8 @@ void CKinectV2Recorder::ProcessDepth(INT64 nTime, const UINT16* pBuffer, int nWi
 #ifdef VERBOSE
             if (m_bRecord && m_fDepthFPS < 29.5)
             {
-                ResetRecordParameters();
-                MessageBox(NULL,
-                    L"Depth frame dropping occurred...\n",
-                    L"No Good",
-                    MB_OK | MB_ICONERROR
-                    );
+                m_bRecord = false;
+                PostRecordMessage(L"Depth frame dropping occurred...\n", L"No Good", true);
                 return;
             }
 #endif
@@ -1018,67 +1496,48 @@ void CKinectV2Recorder::ProcessDepth(INT64 nTime, const UINT16* pBuffer, int nWi
     }
 
     // Make sure we've received valid data
-    if (m_pDepthRGBX && pBuffer && (nWidth == cDepthWidth) && (nHeight == cDepthHeight))
+    if (pBuffer && (nWidth == cDepthWidth) && (nHeight == cDepthHeight))
     {
-        INT64 index = m_nDepthIndex % BufferSize;
-        RGBQUAD* pRGBX = m_pDepthRGBX;
-        UINT16* pUINT16 = m_pDepthUINT16[index];
-        pBuffer += cDepthWidth - 1;
-
-        for (int i = 0; i < cDepthHeight; ++i)
+        // Use the spare slot if the writer still owns every slot of the ring
+        m_nDepthSlot = m_qDepthFrameQueue.CanPush() ? m_qDepthFrameQueue.NextSlot() : BufferSize;
+        // Colorize through the lookup table, mirror and convert to Big-Endian format in one pass
+        const RGBQUAD* pLUT = m_cDepthColorizer.Prepare(pBuffer, cDepthWidth * cDepthHeight, nMinDepth, nMaxDepth);
+        RGBQUAD* pRGBX = reinterpret_cast<RGBQUAD*>(m_aPreviews[FrameStream_Depth].WriteBuffer());
+        UINT16* pUINT16 = m_pDepthUINT16[m_nDepthSlot];
+#ifdef MAPPED_OUTPUT
+        BYTE* pMapped = (m_nDepthSlot < BufferSize) ? AcquireMappedFrame(FrameStream_Depth) : NULL;
+        if (pMapped)
         {
-            for (int j = 0; j < cDepthWidth; ++j)
-            {
-                USHORT depth = *pBuffer;
-
-                // To convert to a byte, we're discarding the most-significant
-                // rather than least-significant bits.
-                // We're preserving detail, although the intensity will "wrap."
-                // Values outside the reliable depth range are mapped to 0 (black).
-
-                // Note: Using conditionals in this loop could degrade performance.
-                // Consider using a lookup table instead when writing production code.
-                if ((depth < nMinDepth) || (depth > nMaxDepth))
-                {
-                    depth = 0;
-                    pRGBX->rgbRed = 34;
-                    pRGBX->rgbGreen = 132;
-                    pRGBX->rgbBlue = 212;
-                }
-                else
-                {
-                    BYTE intensity = static_cast<BYTE>(depth % 256);
-                    pRGBX->rgbRed = intensity;
-                    pRGBX->rgbGreen = intensity;
-                    pRGBX->rgbBlue = intensity;
-                }
-
-                // convert UINT16 to Big-Endian format
-                (*pUINT16) = ((depth) >> 8) | ((depth) << 8);
-
-                --pBuffer;
-                ++pRGBX;
-                ++pUINT16;
-            }
-            pBuffer += (cDepthWidth << 1);
+            pUINT16 = reinterpret_cast<UINT16*>(pMapped);
         }
+        m_aInRingSlot[FrameStream_Depth] = (NULL == pMapped);
+#endif
+        m_cConversionPool.Run(cDepthHeight, cDepthWidth, [=](int nFirstRow, int nRows)
+        {
+            int nOffset = nFirstRow * cDepthWidth;
+            ConvertDepth(pBuffer + nOffset, pLUT, pRGBX + nOffset, pUINT16 + nOffset, cDepthWidth, nRows, nMinDepth, nMaxDepth);
+        });
 
-        // Draw the data with Direct2D
-        m_pDrawDepth->Draw(reinterpret_cast<BYTE*>(m_pDepthRGBX), cDepthWidth * cDepthHeight * sizeof(RGBQUAD));
+        // Hand the preview over to the preview thread
+        m_aPreviews[FrameStream_Depth].Publish(cDepthWidth, cDepthHeight);
 
         if (m_bRecord && m_nStartTime)
         {
             // Write out the bitmap to disk (enqeue)
-            m_qDepthTimeQueue.push(nTime - m_nStartTime);
-            m_qDepthFrameQueue.push(m_pDepthUINT16[index]);
-
-            ++m_nDepthIndex;
+            if (m_nDepthSlot < BufferSize)
+            {
+#ifdef MAPPED_OUTPUT
+                QueueMappedFrame(FrameStream_Depth, pMapped);
+#endif
+                m_qDepthFrameQueue.Push(nTime - m_nStartTime);
+            }
+            else
+            {
+                m_qDepthFrameQueue.Drop();
+            }
         }
 
-        if (m_bShotReady)
-        {
-            m_nDepthShotTime = nTime;
-        }
+        SynchronizeFrame(FrameStream_Depth, nTime);
     }
 }
 
@@ -1086,10 +1545,11 @@ void CKinectV2Recorder::ProcessDepth(INT64 nTime, const UINT16* pBuffer, int nWi
 /// Handle new color data
 /// <param name="nTime">timestamp of frame</param>
 /// <param name="pBuffer">pointer to frame data</param>
+/// <param name="nFormat">layout of frame data, ColorImageFormat_Bgra or ColorImageFormat_Yuy2</param>
 /// <param name="nWidth">width (in pixels) of input image data</param>
 /// <param name="nHeight">height (in pixels) of input image data</param>
 /// </summary>
-void CKinectV2Recorder::ProcessColor(INT64 nTime, RGBQUAD* pBuffer, int nWidth, int nHeight)
+void CKinectV2Recorder::ProcessColor(INT64 nTime, const BYTE* pBuffer, ColorImageFormat nFormat, int nWidth, int nHeight)
 {
     if (m_hWnd)
     {
@@ -1108,9 +1568,6 @@ void CKinectV2Recorder::ProcessColor(INT64 nTime, RGBQUAD* pBuffer, int nWidth,
             }
         }
 
-        WCHAR szStatusMessage[128];
-        StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L" Save Folder: %s    FPS(Infrared, Depth, Color) = (%0.2f,  %0.2f,  %0.2f)", m_cSaveFolder, m_fInfraredFPS, m_fDepthFPS, m_fColorFPS);
-
         if (m_nColorFramesSinceUpdate % 30 == 0)
         {
             m_nColorLastCounter = qpcNow.QuadPart;
@@ -1119,12 +1576,8 @@ void CKinectV2Recorder::ProcessColor(INT64 nTime, RGBQUAD* pBuffer, int nWidth,
 #ifdef VERBOSE
             if (m_bRecord && m_fColorFPS < 29.5)
             {
-                ResetRecordParameters();
-                MessageBox(NULL,
-                    L"Color frame dropping occurred...\n",
-                    L"No Good",
-                    MB_OK | MB_ICONERROR
-                    );
+                m_bRecord = false;
+                PostRecordMessage(L"Color frame dropping occurred...\n", L"No Good", true);
                 return;
             }
 #endif
@@ -1134,69 +1587,163 @@ void CKinectV2Recorder::ProcessColor(INT64 nTime, RGBQUAD* pBuffer, int nWidth,
     // Make sure we've received valid data
     if (pBuffer && (nWidth == cColorWidth) && (nHeight == cColorHeight))
     {
-        INT64 index = m_nColorIndex % BufferSize;
-        RGBQUAD* pRGBX = pBuffer;
-        RGBTRIPLE* pRGB = m_pColorRGB[index];
-
-#ifdef USE_IPP
-        const IppiSize roiSize = { cColorWidth, cColorHeight };
-        ippiMirror_8u_C4IR((Ipp8u*)pRGBX, cColorWidth * 4, roiSize, ippAxsVertical);
-#ifdef COLOR_BMP
-        ippiCopy_8u_AC4C3R((Ipp8u*)pBuffer, cColorWidth * 4, (Ipp8u*)pRGB, cColorWidth * 3, roiSize);  // BGRA to BGR
-#else // COLOR_BMP
-        const int dstOrder[3] = {2, 1, 0};
-        ippiSwapChannels_8u_C4C3R((Ipp8u*)pRGBX, cColorWidth * 4, (Ipp8u*)pRGB, cColorWidth * 3, roiSize, dstOrder); // BGRA to RGB
-#endif // COLOR_BMP
-#else // USE_IPP
-        RGBQUAD* pBegin = pBuffer;
-        RGBQUAD* pEnd = pBuffer + cColorWidth;
-        for (int i = 0; i < cColorHeight; ++i)
-        {
-            std::reverse(pBegin, pEnd);
-            pBegin += cColorWidth;
-            pEnd += cColorWidth;
-        }
+        RGBQUAD* pPreview = reinterpret_cast<RGBQUAD*>(m_aPreviews[FrameStream_Color].WriteBuffer());
+        int nScale = m_nColorPreviewScale;
 
-        // end pixel is start + width*height - 1
-        const RGBQUAD* pBufferEnd = pBuffer + (nWidth * nHeight);
+        // Use the spare slot if the writer still owns every slot of the ring
+        m_nColorSlot = m_qColorFrameQueue.CanPush() ? m_qColorFrameQueue.NextSlot() : BufferSize;
+        RGBTRIPLE* pRGB = m_pColorRGB[m_nColorSlot];
 
-        while (pRGBX < pBufferEnd)
+        // Only frames in the layout the writer expects can be recorded
+        bool bRecordable = ((nFormat == ColorImageFormat_Yuy2) == (m_nColorFormat == ColorFormat_YUY2));
+#ifdef MAPPED_OUTPUT
+        BYTE* pMapped = (m_nColorSlot < BufferSize && bRecordable) ? AcquireMappedFrame(FrameStream_Color) : NULL;
+        if (pMapped)
         {
-#ifdef COLOR_BMP
-            pRGB->rgbtRed = pRGBX->rgbRed;
-            pRGB->rgbtGreen = pRGBX->rgbGreen;
-            pRGB->rgbtBlue = pRGBX->rgbBlue;
-#else // COLOR_BMP
-            pRGB->rgbtRed = pRGBX->rgbBlue;
-            pRGB->rgbtGreen = pRGBX->rgbGreen;
-            pRGB->rgbtBlue = pRGBX->rgbRed;
-#endif // COLOR_BMP
-            ++pRGBX;
-            ++pRGB;
+            pRGB = reinterpret_cast<RGBTRIPLE*>(pMapped);
         }
-#endif // USE_IPP
-
-        // Draw the data with Direct2D
-        m_pDrawColor->Draw(reinterpret_cast<BYTE*>(pBuffer), cColorWidth * cColorHeight * sizeof(RGBQUAD));
+        m_aInRingSlot[FrameStream_Color] = (NULL == pMapped);
+#endif
 
-        if (m_bRecord && m_nStartTime)
+        if (nFormat == ColorImageFormat_Yuy2)
         {
-            // Write out the bitmap to disk (enqeue)
-            m_qColorTimeQueue.push(nTime - m_nStartTime);
-            m_qColorFrameQueue.push(m_pColorRGB[index]);
-
-            ++m_nColorIndex;
+            // Raw color goes to the ring as is, only the preview is converted (shrunk by 2 at most, sharing the chroma)
+            BYTE* pRaw = reinterpret_cast<BYTE*>(pRGB);
+            nScale = min(nScale, 2);
+            m_cConversionPool.Run(cColorHeight, cColorWidth, [=](int nFirstRow, int nRows)
+            {
+                int nOffset = nFirstRow * cColorWidth;
+                memcpy(pRaw + nOffset * 2, pBuffer + nOffset * 2, nRows * cColorWidth * 2);
+                if (nScale == 1)
+                {
+                    ConvertYUY2(pBuffer + nOffset * 2, pPreview + nOffset, cColorWidth, nRows, YUVMatrix_BT601, true);
+                }
+                else
+                {
+                    // The band shrinks the preview rows whose first source row it holds
+                    int nFirst = (nFirstRow + 1) / 2;
+                    int nEnd = min((nFirstRow + nRows + 1) / 2, cColorHeight / 2);
+                    if (nFirst < nEnd)
+                    {
+                        DownscaleYUY2(pBuffer + nFirst * 2 * cColorWidth * 2, pPreview + nFirst * (cColorWidth / 2), cColorWidth, (nEnd - nFirst) * 2, YUVMatrix_BT601, true);
+                    }
+                }
+            });
         }
-
-        if (m_bShotReady)
+        else
         {
-            m_nColorShotTime = nTime;
-            if (m_nInfraredShotTime == m_nDepthShotTime || abs(m_nColorShotTime - m_nDepthShotTime) < 100000)
+            const RGBQUAD* pBGRA = reinterpret_cast<const RGBQUAD*>(pBuffer);
+#ifdef USE_IPP
+            nScale = 1;
+            const IppiSize roiSize = { cColorWidth, cColorHeight };
+            ippiMirror_8u_C4R((const Ipp8u*)pBGRA, cColorWidth * 4, (Ipp8u*)pPreview, cColorWidth * 4, roiSize, ippAxsVertical);
+            if (m_bColorBGR)
+            {
+                ippiCopy_8u_AC4C3R((Ipp8u*)pPreview, cColorWidth * 4, (Ipp8u*)pRGB, cColorWidth * 3, roiSize);  // BGRA to BGR
+            }
+            else
+            {
+                const int dstOrder[3] = {2, 1, 0};
+                ippiSwapChannels_8u_C4C3R((Ipp8u*)pPreview, cColorWidth * 4, (Ipp8u*)pRGB, cColorWidth * 3, roiSize, dstOrder); // BGRA to RGB
+            }
+#else // USE_IPP
+            // Mirror and pack into the ring slot in one pass, the source buffer is left untouched
+            // A shrunk preview is averaged from the same rows while they are still in the cache
+            const bool bBGR = m_bColorBGR;  // BGRA to BGR (BMP) or RGB (everything else)
+            m_cConversionPool.Run(cColorHeight, cColorWidth, [=](int nFirstRow, int nRows)
+            {
+                int nOffset = nFirstRow * cColorWidth;
+                ConvertColor(pBGRA + nOffset, pRGB + nOffset, (nScale == 1) ? pPreview + nOffset : NULL, cColorWidth, nRows, bBGR);
+                if (nScale > 1)
+                {
+                    // The band shrinks the preview rows whose first source row it holds
+                    int nFirst = (nFirstRow + nScale - 1) / nScale;
+                    int nEnd = min((nFirstRow + nRows + nScale - 1) / nScale, cColorHeight / nScale);
+                    if (nFirst < nEnd)
+                    {
+                        DownscaleBGRA(pBGRA + nFirst * nScale * cColorWidth, pPreview + nFirst * (cColorWidth / nScale), cColorWidth, (nEnd - nFirst) * nScale, nScale, true);
+                    }
+                }
+            });
+#endif // USE_IPP
+        }
+
+        // Hand the preview over to the preview thread
+        m_aPreviews[FrameStream_Color].Publish(cColorWidth / nScale, cColorHeight / nScale);
+
+        if (m_bRecord && m_nStartTime)
+        {
+            // Write out the bitmap to disk (enqeue)
+            if (m_nColorSlot < BufferSize && bRecordable)
+            {
+#ifdef MAPPED_OUTPUT
+                QueueMappedFrame(FrameStream_Color, pMapped);
+#endif
+                m_qColorFrameQueue.Push(nTime - m_nStartTime);
+            }
+            else
+            {
+                m_qColorFrameQueue.Drop();
+            }
+        }
+
+        SynchronizeFrame(FrameStream_Color, nTime);
+    }
+}
+
+/// <summary>
+/// Hand a converted frame over to the synchronizer and act on the framesets it completes
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="nTime">timestamp of frame</param>
+void CKinectV2Recorder::SynchronizeFrame(FrameStream nStream, INT64 nTime)
+{
+    m_aLatestTimes[nStream] = nTime;
+    m_cStreamSync.AddFrame(nStream, nTime);
+
+    SyncEvent event;
+    while (m_cStreamSync.NextEvent(&event))
+    {
+        // Only what happened to frames of the running record counts against it
+        bool bRecorded = m_bRecord && m_nStartTime;
+        for (int i = 0; i < 3; ++i)
+        {
+            if ((event.nStreams & (1 << i)) && event.aTimes[i] < m_nStartTime)
+            {
+                bRecorded = false;
+            }
+        }
+
+        switch (event.nType)
+        {
+        case SyncEvent_Frameset:
+            // A shot is taken once the slots hold the frames of one frameset. A frame converted
+            // into a mapped record before the shot was requested never reached its slot, the
+            // shot then waits for the next frameset, which AcquireMappedFrame keeps in the slots.
+            if (m_bShot && event.aTimes[FrameStream_Infrared] == m_aLatestTimes[FrameStream_Infrared] &&
+                event.aTimes[FrameStream_Depth] == m_aLatestTimes[FrameStream_Depth] &&
+                event.aTimes[FrameStream_Color] == m_aLatestTimes[FrameStream_Color] &&
+                m_aInRingSlot[FrameStream_Infrared] && m_aInRingSlot[FrameStream_Depth] && m_aInRingSlot[FrameStream_Color])
             {
                 SaveShotImages();
                 m_bShot = false;
-                m_bShotReady = false;
             }
+            break;
+        case SyncEvent_Unmatched:
+            if (bRecorded)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    m_nSyncUnmatched += (event.nStreams >> i) & 1;
+                }
+            }
+            break;
+        case SyncEvent_Resync:
+            if (bRecorded)
+            {
+                ++m_nSyncResyncs;
+            }
+            break;
         }
     }
 }
@@ -1212,9 +1759,15 @@ bool CKinectV2Recorder::SetStatusMessage(_In_z_ WCHAR* szMessage, DWORD nShowTim
     // Unit: 1 ms
     INT64 now = GetTickCount64();
 
+    std::lock_guard<std::mutex> lock(m_mStatus);
     if (m_hWnd && (bForce || (m_nNextStatusTime <= now)))
     {
-        SetDlgItemText(m_hWnd, IDC_STATUS, szMessage);
+        // The text is shown by the UI thread, a conversion thread sending to the window could deadlock with it
+        StringCchCopy(m_szStatusMessage, _countof(m_szStatusMessage), szMessage);
+        if (!m_bStatusPosted)
+        {
+            m_bStatusPosted = (FALSE != PostMessage(m_hWnd, WM_STATUS_MESSAGE, 0, 0));
+        }
         m_nNextStatusTime = now + nShowTimeMsec;
 
         return true;
@@ -1223,6 +1776,30 @@ bool CKinectV2Recorder::SetStatusMessage(_In_z_ WCHAR* szMessage, DWORD nShowTim
     return false;
 }
 
+/// <summary>
+/// Have the UI thread show a record problem in a message box, without holding any lock
+/// </summary>
+/// <param name="szMessage">message to show</param>
+/// <param name="szTitle">title of the message box</param>
+/// <param name="bStopped">true if the record has been stopped (m_bRecord cleared) and still has to be finished</param>
+void CKinectV2Recorder::PostRecordMessage(LPCWSTR szMessage, LPCWSTR szTitle, bool bStopped)
+{
+    if (bStopped)
+    {
+        // Set before posting, so that the message finds it set unless the writers have finished already
+        m_bRecordStopping = true;
+        m_sFrameSignal.Notify();
+    }
+
+    // A modal box shown here would block the conversion thread or the UI thread behind m_mProcess
+    {
+        std::lock_guard<std::mutex> lock(m_mStatus);
+        StringCchCopy(m_szRecordMessage, _countof(m_szRecordMessage), szMessage);
+        m_szRecordTitle = szTitle;
+    }
+    PostMessage(m_hWnd, WM_RECORD_MESSAGE, bStopped, 0);
+}
+
 /// <summary>
 /// Save passed in image data to disk as a bitmap
 /// </summary>
@@ -1386,237 +1963,1162 @@ HRESULT CKinectV2Recorder::SaveToPPM(BYTE* pBitmapBits, LONG lWidth, LONG lHeigh
 }
 
 /// <summary>
-/// Check if the directory exists
-/// </summary>
-/// <param name="szDirName">directory</param>
-/// <returns>indicates exists or not</returns>
-bool CKinectV2Recorder::IsDirectoryExists(WCHAR* szDirName) {
-    DWORD attribs = ::GetFileAttributes(szDirName);
-    if (attribs == INVALID_FILE_ATTRIBUTES) {
-        return false;
-    }
-    return (attribs & FILE_ATTRIBUTE_DIRECTORY);
-}
-
-/// <summary>
-/// Save record images
+/// Save passed in image data to disk as a PAM file
 /// </summary>
-void CKinectV2Recorder::SaveRecordImages()
+/// <param name="pBitmapBits">image data to save</param>
+/// <param name="lWidth">width (in pixels) of input image data</param>
+/// <param name="lHeight">height (in pixels) of input image data</param>
+/// <param name="wBytesPerPixel">bytes per pixel of image data (PAM depth)</param>
+/// <param name="lMaxPixel">max value of a byte</param>
+/// <param name="szTupleType">layout of a pixel</param>
+/// <param name="lpszFilePath">full file path to output image to</param>
+/// <returns>indicates success or failure</returns>
+HRESULT CKinectV2Recorder::SaveToPAM(BYTE* pBitmapBits, LONG lWidth, LONG lHeight, WORD wBytesPerPixel, LONG lMaxPixel, LPCSTR szTupleType, LPCWSTR lpszFilePath)
 {
-    while (!m_bStopThread)
-    {
-        bool bInfraredWrite = !m_qInfraredFrameQueue.empty();
-        bool bDepthWrite = !m_qDepthFrameQueue.empty();
-        bool bColorWrite = !m_qColorFrameQueue.empty();
-
-        // Check if the necessary directories exist
-        if ((bInfraredWrite || bDepthWrite || bColorWrite))
-        {
-            if (!IsDirectoryExists(m_cModelFolder))
-            {
-                CreateDirectory(m_cModelFolder, NULL);
-            }
-            if (!IsDirectoryExists(m_cSaveFolder))
-            {
-                CreateDirectory(m_cSaveFolder, NULL);
-            }
-        }
-
-        if (bInfraredWrite)
-        {
-            WCHAR szSavePath[MAX_PATH];
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\ir", m_cSaveFolder);
-
-            if (!IsDirectoryExists(szSavePath))
-            {
-                CreateDirectory(szSavePath, NULL);
-            }
-
-            INT64 nTime = m_qInfraredTimeQueue.front();
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\%011.6f.pgm", szSavePath, nTime / 10000000.);
+    DWORD dwByteCount = lWidth * lHeight * wBytesPerPixel;
 
-            SaveToPGM(reinterpret_cast<BYTE*>(m_qInfraredFrameQueue.front()), cInfraredWidth, cInfraredHeight, sizeof(UINT16)* 8, 65535, szSavePath);
-           
-            m_vInfraredList.push_back(nTime);
+    CHAR szHeader[256];
+    sprintf_s(szHeader, _countof(szHeader), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n", lWidth, lHeight, wBytesPerPixel, lMaxPixel, szTupleType);
 
-            m_qInfraredTimeQueue.pop();
-            m_qInfraredFrameQueue.pop();
-        }
+    // Create the file on disk to write to
+    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-        if (bDepthWrite)
-        {
-            WCHAR szSavePath[MAX_PATH];
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\depth", m_cSaveFolder);
+    // Return if error opening file
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        return E_ACCESSDENIED;
+    }
 
-            if (!IsDirectoryExists(szSavePath))
-            {
-                CreateDirectory(szSavePath, NULL);
-            }
+    DWORD dwBytesWritten = 0;
 
-            INT64 nTime = m_qDepthTimeQueue.front();
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\%011.6f.pgm", szSavePath, nTime / 10000000.);
+    // Write the pam file header
+    if (!WriteFile(hFile, szHeader, strlen(szHeader), &dwBytesWritten, NULL))
+    {
+        CloseHandle(hFile);
+        return E_FAIL;
+    }
 
-            SaveToPGM(reinterpret_cast<BYTE*>(m_qDepthFrameQueue.front()), cDepthWidth, cDepthHeight, sizeof(UINT16)* 8, 65535, szSavePath);
+    // Write the image data
+    if (!WriteFile(hFile, pBitmapBits, dwByteCount, &dwBytesWritten, NULL))
+    {
+        CloseHandle(hFile);
+        return E_FAIL;
+    }
 
-            m_vDepthList.push_back(nTime);
+    // Close the file
+    CloseHandle(hFile);
+    return S_OK;
+}
 
-            m_qDepthTimeQueue.pop();
-            m_qDepthFrameQueue.pop();
-        }
+/// <summary>
+/// Save passed in RVL-compressed depth data to disk as a rvl file
+/// </summary>
+/// <param name="pData">compressed depth data to save</param>
+/// <param name="dwSize">size of the compressed data in bytes</param>
+/// <param name="lWidth">width (in pixels) of the depth image</param>
+/// <param name="lHeight">height (in pixels) of the depth image</param>
+/// <param name="lpszFilePath">full file path to output depth to</param>
+/// <returns>indicates success or failure</returns>
+HRESULT CKinectV2Recorder::SaveToRVL(const BYTE* pData, DWORD dwSize, LONG lWidth, LONG lHeight, LPCWSTR lpszFilePath)
+{
+    RVLFileHeader header = { 0 };
+    header.nMagic = RVLFileMagic;
+    header.nWidth = static_cast<WORD>(lWidth);
+    header.nHeight = static_cast<WORD>(lHeight);
+    header.nSize = dwSize;
 
-        if (bColorWrite)
-        {
-            WCHAR szSavePath[MAX_PATH];
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\color", m_cSaveFolder);
+    // Create the file on disk to write to
+    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-            if (!IsDirectoryExists(szSavePath))
-            {
-                CreateDirectory(szSavePath, NULL);
-            }
+    // Return if error opening file
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        return E_ACCESSDENIED;
+    }
 
-            INT64 nTime = m_qColorTimeQueue.front();
-#ifdef COLOR_BMP
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\%011.6f.bmp", szSavePath, nTime / 10000000.);
-            SaveToBMP(reinterpret_cast<BYTE*>(m_qColorFrameQueue.front()), cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, szSavePath);
-#else
-            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\%011.6f.ppm", szSavePath, nTime / 10000000.);
-            SaveToPPM(reinterpret_cast<BYTE*>(m_qColorFrameQueue.front()), cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, 255, szSavePath);
-#endif
-            m_vColorList.push_back(nTime);
+    DWORD dwBytesWritten = 0;
 
-            m_qColorTimeQueue.pop();
-            m_qColorFrameQueue.pop();
-        }
+    // Write the rvl file header
+    if (!WriteFile(hFile, &header, sizeof(header), &dwBytesWritten, NULL))
+    {
+        CloseHandle(hFile);
+        return E_FAIL;
+    }
 
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    // Write the compressed data
+    if (!WriteFile(hFile, pData, dwSize, &dwBytesWritten, NULL))
+    {
+        CloseHandle(hFile);
+        return E_FAIL;
     }
+
+    // Close the file
+    CloseHandle(hFile);
+    return S_OK;
 }
 
 /// <summary>
-/// Save shot images
+/// Save passed in encoded data to disk as is
 /// </summary>
-void CKinectV2Recorder::SaveShotImages()
+/// <param name="pData">encoded data to save</param>
+/// <param name="dwSize">size of the encoded data in bytes</param>
+/// <param name="lpszFilePath">full file path to output data to</param>
+/// <returns>indicates success or failure</returns>
+HRESULT CKinectV2Recorder::SaveToFile(const BYTE* pData, DWORD dwSize, LPCWSTR lpszFilePath)
 {
-    WCHAR* szPicturesFolder = NULL;
-    HRESULT hr = SHGetKnownFolderPath(FOLDERID_Pictures, 0, NULL, &szPicturesFolder);
+    // Create the file on disk to write to
+    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-    if (SUCCEEDED(hr))
+    // Return if error opening file
+    if (INVALID_HANDLE_VALUE == hFile)
     {
-        WCHAR szCalibrationFolder[MAX_PATH];
-        WCHAR szInfraredFolder[MAX_PATH];
-        WCHAR szDepthFolder[MAX_PATH];
-        WCHAR szColorFolder[MAX_PATH];
-        WCHAR FileName[MAX_PATH];
-        StringCchPrintfW(szCalibrationFolder, _countof(szCalibrationFolder), L"%s\\calibration", szPicturesFolder);
-        if (!IsDirectoryExists(szCalibrationFolder))
-        {
-            CreateDirectory(szCalibrationFolder, NULL);
-        }
-        GetTimeFormatEx(NULL, 0, NULL, L"HH'-'mm'-'ss", FileName, _countof(FileName));
+        return E_ACCESSDENIED;
+    }
 
-        // Save infrared image
-        StringCchPrintfW(szInfraredFolder, _countof(szInfraredFolder), L"%s\\ir", szCalibrationFolder);
-        if (!IsDirectoryExists(szInfraredFolder))
-        {
-            CreateDirectory(szInfraredFolder, NULL);
-        }
-        WCHAR szInfraredPath[MAX_PATH];
-        StringCchPrintfW(szInfraredPath, _countof(szInfraredPath), L"%s\\%s.pgm", szInfraredFolder, FileName);
-        SaveToPGM(reinterpret_cast<BYTE*>(m_pInfraredUINT16[0]), cInfraredWidth, cInfraredHeight, sizeof(UINT16)* 8, 65535, szInfraredPath);
+    DWORD dwBytesWritten = 0;
 
-        // Save depth image
-        StringCchPrintfW(szDepthFolder, _countof(szDepthFolder), L"%s\\depth", szCalibrationFolder);
-        if (!IsDirectoryExists(szDepthFolder))
-        {
-            CreateDirectory(szDepthFolder, NULL);
-        }
-        WCHAR szDepthPath[MAX_PATH];
-        StringCchPrintfW(szDepthPath, _countof(szDepthPath), L"%s\\%s.pgm", szDepthFolder, FileName);
-        SaveToPGM(reinterpret_cast<BYTE*>(m_pDepthUINT16[0]), cDepthWidth, cDepthHeight, sizeof(UINT16)* 8, 65535, szDepthPath);
-    
-        // Save Color image
-        StringCchPrintfW(szColorFolder, _countof(szColorFolder), L"%s\\color", szCalibrationFolder);
-        if (!IsDirectoryExists(szColorFolder))
-        {
-            CreateDirectory(szColorFolder, NULL);
-        }
-        WCHAR szColorPath[MAX_PATH];
-        StringCchPrintfW(szColorPath, _countof(szColorPath), L"%s\\%s.bmp", szColorFolder, FileName);
-#ifndef COLOR_BMP
-        RGBTRIPLE* pBuffer = m_pColorRGB[0];
-        // end pixel is start + width*height - 1
-        const RGBTRIPLE* pBufferEnd = pBuffer + (cColorWidth * cColorHeight);
+    // Write the encoded data
+    if (!WriteFile(hFile, pData, dwSize, &dwBytesWritten, NULL))
+    {
+        CloseHandle(hFile);
+        return E_FAIL;
+    }
 
-        while (pBuffer < pBufferEnd)
-        {
-            std::swap(pBuffer->rgbtRed, pBuffer->rgbtBlue);
-            ++pBuffer;
-        }
-#endif
-        SaveToBMP(reinterpret_cast<BYTE*>(m_pColorRGB[0]), cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, szColorPath);
+    // Close the file
+    CloseHandle(hFile);
+    return S_OK;
+}
 
-        WCHAR szStatusMessage[128];
-        StringCchPrintfW(szStatusMessage, _countof(szStatusMessage), L"Take a shot   [%s\\xxx\\%s.xxx]", szCalibrationFolder, FileName);
-        SetStatusMessage(szStatusMessage, 3000, true);
-    }
+/// <summary>
+/// Compress a depth frame of the ring buffer into m_pDepthRVL
+/// </summary>
+/// <param name="nSlot">ring slot of the depth frame</param>
+/// <returns>compressed size in bytes</returns>
+DWORD CKinectV2Recorder::CompressDepth(UINT nSlot)
+{
+    // The codec is checked by the -selftest round trip, not on the recording path
+    return CompressRVL(m_pDepthUINT16[nSlot], cDepthWidth * cDepthHeight, m_pDepthRVL);
 }
 
 /// <summary>
-/// Check if we have stored all the necessary images (no frame dropping)
+/// Encode the oldest color frame if needed and write it to disk
 /// </summary>
-void CKinectV2Recorder::CheckImages()
+void CKinectV2Recorder::SaveColorFrame()
 {
-    m_bRecord = false;
-    while (!m_qInfraredFrameQueue.empty() || !m_qDepthFrameQueue.empty() || !m_qColorFrameQueue.empty())
+#ifdef ASYNC_WRITE
+    if (SaveRecordFramesAsync(FrameStream_Color, m_qColorFrameQueue))
     {
-        std::this_thread::sleep_for(std::chrono::microseconds(33));
+        return;
     }
-    int nInfraredFrameNumber = m_vInfraredList.size();
-    int nDepthFrameNumber = m_vDepthList.size();
-    int nColorFrameNumber = m_vColorList.size();
+#endif
 
-    if (!(nInfraredFrameNumber == nDepthFrameNumber && nDepthFrameNumber == nColorFrameNumber))
+    FrameDesc colorDesc;
+    if (!m_qColorFrameQueue.Front(&colorDesc))
     {
-        MessageBox(NULL,
-            L"Frame dropping occurred...\n",
-            L"No Good",
-            MB_OK | MB_ICONERROR
-            );
         return;
     }
 
-    for (int i = 0; i < nInfraredFrameNumber; ++i)
+    PrepareRecordFolders();
+
+    BYTE* pRGB = reinterpret_cast<BYTE*>(m_pColorRGB[colorDesc.nSlot]);
+    const BYTE* pData = pRGB;
+    DWORD dwSize = cColorWidth * cColorHeight * sizeof(RGBTRIPLE);
+    HRESULT hr = E_FAIL;
+
+    if (m_nColorFormat == ColorFormat_YUY2)
+    {
+        dwSize = cColorWidth * cColorHeight * 2;
+    }
+    else if (m_nColorFormat == ColorFormat_QOI)
+    {
+        dwSize = m_cColorEncoder.Encode(pRGB, cColorWidth, cColorHeight, m_bColorBGR);
+        pData = m_cColorEncoder.GetData();
+    }
+#ifdef USE_TURBOJPEG
+    else if (m_nColorFormat == ColorFormat_JPEG)
+    {
+        // A frame the encoder failed on has no data and is counted as dropped, CheckImages reports it
+        m_cJpegEncoder.Front(&pData, &dwSize);
+    }
+#endif
+
+    if (dwSize)
     {
-        if (m_vInfraredList[i] != m_vDepthList[i] || abs(m_vColorList[i] - m_vInfraredList[i]) > 100000)
+#ifdef RECORD_CONTAINER
+        static const FrameCodec aCodecs[ColorFormat_Count] = { FrameCodec_RGB24, FrameCodec_BGR24, FrameCodec_QOI, FrameCodec_JPEG, FrameCodec_YUY2 };
+#ifdef MAPPED_OUTPUT
+        if (m_aMappedWriters[FrameStream_Color].IsOpen())
         {
-            MessageBox(NULL,
-                L"Frame dropping occurred...\n",
-                L"No Good",
-                MB_OK | MB_ICONERROR
-                );
-            return;
+            hr = m_aMappedWriters[FrameStream_Color].CommitFrame(colorDesc.nTime, pData);
         }
+        else
+#endif
+        hr = m_cwColor.AppendFrame(FrameStream_Color, aCodecs[m_nColorFormat], colorDesc.nTime, cColorWidth, cColorHeight, pData, dwSize);
+#else // RECORD_CONTAINER
+        static const LPCWSTR aExtensions[ColorFormat_Count] = { L"ppm", L"bmp", L"qoi", L"jpg", L"pam" };
+
+        WCHAR szSavePath[MAX_PATH];
+        FormatFramePath(szSavePath, _countof(szSavePath), FrameStream_Color, colorDesc, aExtensions[m_nColorFormat]);
+
+        switch (m_nColorFormat)
+        {
+        case ColorFormat_PPM:
+            hr = SaveToPPM(pRGB, cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, 255, szSavePath);
+            break;
+        case ColorFormat_BMP:
+            hr = SaveToBMP(pRGB, cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, szSavePath);
+            break;
+        case ColorFormat_YUY2:
+            hr = SaveToPAM(pRGB, cColorWidth, cColorHeight, 2, 255, "YUY2", szSavePath);
+            break;
+        default:
+            hr = SaveToFile(pData, dwSize, szSavePath);
+            break;
+        }
+#endif // RECORD_CONTAINER
+    }
+
+#ifdef USE_TURBOJPEG
+    if (m_nColorFormat == ColorFormat_JPEG)
+    {
+        m_cJpegEncoder.Pop();
     }
+#endif
+    ReleaseRecordFrame(FrameStream_Color, m_qColorFrameQueue, hr);
 }
 
 /// <summary>
-/// Reset record parameters
+/// Check if the directory exists
 /// </summary>
-void CKinectV2Recorder::ResetRecordParameters()
-{
-    m_bRecord = false;
-    while (!m_qInfraredFrameQueue.empty() || !m_qDepthFrameQueue.empty() || !m_qColorFrameQueue.empty())
-    {
-        std::this_thread::sleep_for(std::chrono::microseconds(33));
+/// <param name="szDirName">directory</param>
+/// <returns>indicates exists or not</returns>
+bool CKinectV2Recorder::IsDirectoryExists(WCHAR* szDirName) {
+    DWORD attribs = ::GetFileAttributes(szDirName);
+    if (attribs == INVALID_FILE_ATTRIBUTES) {
+        return false;
+    }
+    return (attribs & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+/// <summary>
+/// Create a folder along with every missing folder of its path
+/// </summary>
+/// <param name="szPath">folder to create</param>
+/// <returns>true if the folder exists afterwards</returns>
+bool CKinectV2Recorder::CreateFolderTree(LPCWSTR szPath)
+{
+    // SHCreateDirectoryEx only takes absolute paths, the save folder is relative to the working directory
+    WCHAR szFullPath[MAX_PATH];
+    DWORD cchFullPath = GetFullPathNameW(szPath, _countof(szFullPath), szFullPath, NULL);
+    if (!cchFullPath || cchFullPath >= _countof(szFullPath))
+    {
+        return false;
+    }
+
+    int nResult = SHCreateDirectoryExW(NULL, szFullPath, NULL);
+    return ERROR_SUCCESS == nResult || ERROR_ALREADY_EXISTS == nResult;
+}
+
+/// <summary>
+/// Check if the color lane has a frame ready to be written, feeding the JPEG encoders on the way
+/// </summary>
+/// <param name="pDeadline">receives the deadline of the oldest frame</param>
+/// <param name="pDepth">receives the number of frames waiting</param>
+/// <returns>true if the oldest frame can be written now</returns>
+bool CKinectV2Recorder::ColorFrameReady(INT64* pDeadline, UINT* pDepth)
+{
+    if (!QueueFrameReady(m_qColorFrameQueue, pDeadline, pDepth))
+    {
+        return false;
+    }
+
+#ifdef USE_TURBOJPEG
+    if (m_nColorFormat == ColorFormat_JPEG)
+    {
+        // Keep the encoders busy with the frames queued behind the oldest one
+        FrameDesc pendingDesc;
+        while (m_qColorFrameQueue.Peek(m_cJpegEncoder.InFlight(), &pendingDesc) &&
+            m_cJpegEncoder.Submit(reinterpret_cast<BYTE*>(m_pColorRGB[pendingDesc.nSlot]), m_bColorBGR))
+        {
+        }
+
+        // The oldest frame is written once it is encoded, which keeps the frame order
+        const BYTE* pData = NULL;
+        DWORD dwSize = 0;
+        return m_cJpegEncoder.Front(&pData, &dwSize);
+    }
+#endif
+
+    return true;
+}
+
+/// <summary>
+/// Write the oldest infrared frame to disk
+/// </summary>
+void CKinectV2Recorder::SaveInfraredFrame()
+{
+#ifdef ASYNC_WRITE
+    if (SaveRecordFramesAsync(FrameStream_Infrared, m_qInfraredFrameQueue))
+    {
+        return;
+    }
+#endif
+
+    FrameDesc infraredDesc;
+    if (!m_qInfraredFrameQueue.Front(&infraredDesc))
+    {
+        return;
+    }
+
+    PrepareRecordFolders();
+
+    HRESULT hr;
+#ifdef RECORD_CONTAINER
+#ifdef MAPPED_OUTPUT
+    if (m_aMappedWriters[FrameStream_Infrared].IsOpen())
+    {
+        hr = m_aMappedWriters[FrameStream_Infrared].CommitFrame(infraredDesc.nTime, reinterpret_cast<BYTE*>(m_pInfraredUINT16[infraredDesc.nSlot]));
+    }
+    else
+#endif
+    hr = m_cwInfrared.AppendFrame(FrameStream_Infrared, FrameCodec_Gray16BE, infraredDesc.nTime, cInfraredWidth, cInfraredHeight,
+        reinterpret_cast<BYTE*>(m_pInfraredUINT16[infraredDesc.nSlot]), cInfraredWidth * cInfraredHeight * sizeof(UINT16));
+#else // RECORD_CONTAINER
+    WCHAR szSavePath[MAX_PATH];
+    FormatFramePath(szSavePath, _countof(szSavePath), FrameStream_Infrared, infraredDesc, L"pgm");
+    hr = SaveToPGM(reinterpret_cast<BYTE*>(m_pInfraredUINT16[infraredDesc.nSlot]), cInfraredWidth, cInfraredHeight, sizeof(UINT16)* 8, 65535, szSavePath);
+#endif // RECORD_CONTAINER
+
+    ReleaseRecordFrame(FrameStream_Infrared, m_qInfraredFrameQueue, hr);
+}
+
+/// <summary>
+/// Write the oldest depth frame to disk
+/// </summary>
+void CKinectV2Recorder::SaveDepthFrame()
+{
+#ifdef ASYNC_WRITE
+    if (SaveRecordFramesAsync(FrameStream_Depth, m_qDepthFrameQueue))
+    {
+        return;
+    }
+#endif
+
+    FrameDesc depthDesc;
+    if (!m_qDepthFrameQueue.Front(&depthDesc))
+    {
+        return;
+    }
+
+    PrepareRecordFolders();
+
+    HRESULT hr;
+#ifdef RECORD_CONTAINER
+#ifdef DEPTH_RVL
+    hr = m_cwDepth.AppendFrame(FrameStream_Depth, FrameCodec_DepthRVL, depthDesc.nTime, cDepthWidth, cDepthHeight,
+        m_pDepthRVL, CompressDepth(depthDesc.nSlot));
+#else
+#ifdef MAPPED_OUTPUT
+    if (m_aMappedWriters[FrameStream_Depth].IsOpen())
+    {
+        hr = m_aMappedWriters[FrameStream_Depth].CommitFrame(depthDesc.nTime, reinterpret_cast<BYTE*>(m_pDepthUINT16[depthDesc.nSlot]));
+    }
+    else
+#endif
+    hr = m_cwDepth.AppendFrame(FrameStream_Depth, FrameCodec_Gray16BE, depthDesc.nTime, cDepthWidth, cDepthHeight,
+        reinterpret_cast<BYTE*>(m_pDepthUINT16[depthDesc.nSlot]), cDepthWidth * cDepthHeight * sizeof(UINT16));
+#endif
+#else // RECORD_CONTAINER
+    WCHAR szSavePath[MAX_PATH];
+
+#ifdef DEPTH_RVL
+    FormatFramePath(szSavePath, _countof(szSavePath), FrameStream_Depth, depthDesc, L"rvl");
+    hr = SaveToRVL(m_pDepthRVL, CompressDepth(depthDesc.nSlot), cDepthWidth, cDepthHeight, szSavePath);
+#else
+    FormatFramePath(szSavePath, _countof(szSavePath), FrameStream_Depth, depthDesc, L"pgm");
+    hr = SaveToPGM(reinterpret_cast<BYTE*>(m_pDepthUINT16[depthDesc.nSlot]), cDepthWidth, cDepthHeight, sizeof(UINT16)* 8, 65535, szSavePath);
+#endif
+#endif // RECORD_CONTAINER
+
+    ReleaseRecordFrame(FrameStream_Depth, m_qDepthFrameQueue, hr);
+}
+
+/// <summary>
+/// Release the oldest frame of a stream once its write is over, counting it as written or dropped
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="qFrameQueue">frames of the stream</param>
+/// <param name="hr">result of the write</param>
+void CKinectV2Recorder::ReleaseRecordFrame(FrameStream nStream, FrameQueue<BufferSize>& qFrameQueue, HRESULT hr)
+{
+    if (SUCCEEDED(hr))
+    {
+        ++m_aWrittenFrames[nStream];
+        qFrameQueue.Pop();
+    }
+    else
+    {
+        qFrameQueue.Fail();
+    }
+}
+
+/// <summary>
+/// Check if the frames of a stream are written exactly as they are stored in the ring, without encoding
+/// </summary>
+/// <param name="nStream">stream to check</param>
+/// <returns>true for PGM/PPM/BMP/YUY2 frames</returns>
+bool CKinectV2Recorder::IsRawStream(FrameStream nStream) const
+{
+    switch (nStream)
+    {
+    case FrameStream_Infrared:
+        return true;
+    case FrameStream_Depth:
+#ifdef DEPTH_RVL
+        return false;
+#else
+        return true;
+#endif
+    default:
+        return m_nColorFormat == ColorFormat_PPM || m_nColorFormat == ColorFormat_BMP || m_nColorFormat == ColorFormat_YUY2;
+    }
+}
+
+#ifdef ASYNC_WRITE
+/// <summary>
+/// Keep the writes of a lane in flight: submit the waiting frames, then complete the oldest one and release its slot
+/// </summary>
+/// <param name="nStream">stream of the lane</param>
+/// <param name="qFrameQueue">frames of the stream</param>
+/// <returns>false if the frames of the stream are encoded first and have to be written synchronously</returns>
+bool CKinectV2Recorder::SaveRecordFramesAsync(FrameStream nStream, FrameQueue<BufferSize>& qFrameQueue)
+{
+#ifdef RECORD_CONTAINER
+    return false;
+#else
+    if (!IsRawStream(nStream))
+    {
+        return false;
+    }
+
+    PrepareRecordFolders();
+
+    // The frames in flight stay in the queue, so their slots are not reused before the write is over
+    AsyncFileWriter& cWriter = m_aAsyncWriters[nStream];
+    FrameDesc desc;
+    while (cWriter.CanSubmit() && qFrameQueue.Peek(cWriter.InFlight(), &desc))
+    {
+        SubmitRecordFrame(nStream, desc);
+    }
+
+    if (cWriter.InFlight() && qFrameQueue.Front(&desc))
+    {
+        ReleaseRecordFrame(nStream, qFrameQueue, cWriter.Complete());
+    }
+    return true;
+#endif
+}
+
+/// <summary>
+/// Put the file header in front of a ring slot and submit the file
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="desc">descriptor of the frame</param>
+void CKinectV2Recorder::SubmitRecordFrame(FrameStream nStream, const FrameDesc& desc)
+{
+    static const LPCWSTR aExtensions[ColorFormat_Count] = { L"ppm", L"bmp", L"qoi", L"jpg", L"pam" };
+
+    BYTE* pPixels = NULL;
+    DWORD dwSize = 0;
+    LPCWSTR szExtension = L"pgm";
+
+    switch (nStream)
+    {
+    case FrameStream_Infrared:
+        pPixels = reinterpret_cast<BYTE*>(m_pInfraredUINT16[desc.nSlot]);
+        dwSize = cInfraredWidth * cInfraredHeight * sizeof(UINT16);
+        PutPNMHeader(pPixels, '5', cInfraredWidth, cInfraredHeight, 65535);
+        break;
+    case FrameStream_Depth:
+        pPixels = reinterpret_cast<BYTE*>(m_pDepthUINT16[desc.nSlot]);
+        dwSize = cDepthWidth * cDepthHeight * sizeof(UINT16);
+        PutPNMHeader(pPixels, '5', cDepthWidth, cDepthHeight, 65535);
+        break;
+    default:
+        pPixels = reinterpret_cast<BYTE*>(m_pColorRGB[desc.nSlot]);
+        szExtension = aExtensions[m_nColorFormat];
+        if (m_nColorFormat == ColorFormat_YUY2)
+        {
+            dwSize = cColorWidth * cColorHeight * 2;
+            PutPAMHeader(pPixels, cColorWidth, cColorHeight, 2, 255, "YUY2");
+        }
+        else
+        {
+            dwSize = cColorWidth * cColorHeight * sizeof(RGBTRIPLE);
+            if (m_nColorFormat == ColorFormat_BMP)
+            {
+                PutBMPHeader(pPixels, cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8);
+            }
+            else
+            {
+                PutPNMHeader(pPixels, '6', cColorWidth, cColorHeight, 255);
+            }
+        }
+        break;
+    }
+
+    WCHAR szSavePath[MAX_PATH];
+    FormatFramePath(szSavePath, _countof(szSavePath), nStream, desc, szExtension);
+    m_aAsyncWriters[nStream].Submit(szSavePath, pPixels - FrameHeaderRoom, FrameHeaderRoom + dwSize);
+}
+#endif
+
+#ifdef MAPPED_OUTPUT
+/// <summary>
+/// Get the record a frame can be converted into, straight in the mapped container of its stream
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <returns>payload of the record, NULL to convert into the ring slot</returns>
+BYTE* CKinectV2Recorder::AcquireMappedFrame(FrameStream nStream)
+{
+    // A pending shot reads the ring slots, and the first frame of a record opens the containers once converted
+    if (!m_bRecord || !m_nStartTime || m_bShot || !m_bContainerOpen)
+    {
+        return NULL;
+    }
+
+    return m_aMappedWriters[nStream].AcquireFrame();
+}
+
+/// <summary>
+/// Hand a frame which is about to be queued over to the mapped container of its stream
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="pMapped">record returned by AcquireMappedFrame, NULL if the frame is in its ring slot</param>
+void CKinectV2Recorder::QueueMappedFrame(FrameStream nStream, BYTE* pMapped)
+{
+    // Records are numbered from the first queued frame on, so the containers are opened before it
+    PrepareRecordFolders();
+
+    m_aMappedWriters[nStream].ReleaseFrame(pMapped, true);
+}
+#endif
+
+/// <summary>
+/// Create the folders (and containers) of the current record, once per record
+/// </summary>
+void CKinectV2Recorder::PrepareRecordFolders()
+{
+    if (m_bFoldersReady)
+    {
+        return;
+    }
+
+    // The first lane to write a frame creates the whole tree of the record
+    std::lock_guard<std::mutex> lock(m_mContainer);
+    if (m_bFoldersReady)
+    {
+        return;
+    }
+
+    static const LPCWSTR aFolders[3] = { L"ir", L"depth", L"color" };
+    bool bFolders = true;
+
+    // The stripe roots may not exist yet, every missing level of the path is created
+    for (UINT nStripe = 0; nStripe < GetStripeCount(); ++nStripe)
+    {
+        WCHAR szSavePath[MAX_PATH];
+        FormatStripePath(szSavePath, _countof(szSavePath), nStripe, m_cSaveFolder);
+        bFolders = CreateFolderTree(szSavePath) && bFolders;
+
+#ifndef RECORD_CONTAINER
+        WCHAR szRecordFolder[MAX_PATH];
+        StringCchCopyW(szRecordFolder, _countof(szRecordFolder), szSavePath);
+        for (UINT i = 0; i < _countof(aFolders); ++i)
+        {
+            StringCchPrintfW(szSavePath, _countof(szSavePath), L"%s\\%s", szRecordFolder, aFolders[i]);
+            bFolders = CreateFolderTree(szSavePath) && bFolders;
+            m_aShards[i] = 0;
+        }
+#endif
+    }
+
+    // The replay source finds the other stripes through the manifest in the first one
+    if (GetStripeCount() > 1)
+    {
+        std::wstring strManifest(1, L'\xFEFF');
+        for (UINT nStripe = 0; nStripe < GetStripeCount(); ++nStripe)
+        {
+            WCHAR szSavePath[MAX_PATH];
+            FormatStripePath(szSavePath, _countof(szSavePath), nStripe, m_cSaveFolder);
+            strManifest += szSavePath;
+            strManifest += L"\r\n";
+        }
+
+        WCHAR szManifestPath[MAX_PATH];
+        FormatStripePath(szManifestPath, _countof(szManifestPath), 0, m_cSaveFolder);
+        StringCchCatW(szManifestPath, _countof(szManifestPath), L"\\" StripeManifestName);
+        bFolders = SUCCEEDED(SaveToFile(reinterpret_cast<const BYTE*>(strManifest.c_str()), static_cast<DWORD>(strManifest.size() * sizeof(WCHAR)), szManifestPath)) && bFolders;
+    }
+
+    if (!bFolders)
+    {
+        // The frames already queued fail to be written and are counted as dropped, the record is stopped
+        m_bRecord = false;
+        PostRecordMessage(L"Failed to create the record folders!\n", L"No Good", true);
+    }
+
+#ifdef RECORD_CONTAINER
+    if (bFolders && FAILED(OpenContainers()))
+    {
+        // The frames already queued fail to be written and are counted as dropped, the record is stopped
+        m_bRecord = false;
+        PostRecordMessage(L"Failed to create the record containers!\n", L"No Good", true);
+    }
+#endif
+
+    // Set even on failure, FinishRecord then closes what has been opened
+    m_bFoldersReady = true;
+}
+
+/// <summary>
+/// Build the file path of a recorded frame, creating its shard folder when the frame opens a new one
+/// </summary>
+/// <param name="szPath">receives the path</param>
+/// <param name="cchPath">size of szPath in characters</param>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="desc">descriptor of the frame</param>
+/// <param name="szExtension">file extension</param>
+void CKinectV2Recorder::FormatFramePath(LPWSTR szPath, size_t cchPath, FrameStream nStream, const FrameDesc& desc, LPCWSTR szExtension)
+{
+    static const LPCWSTR aFolders[3] = { L"ir", L"depth", L"color" };
+
+    // Frames go round-robin over the stripes, after the running frame number (dropped frames included)
+    WCHAR szFolder[MAX_PATH];
+    StringCchPrintfW(szFolder, _countof(szFolder), L"%s\\%s", m_cSaveFolder, aFolders[nStream]);
+
+    if (m_nShardFrames)
+    {
+        UINT nShard = desc.nGeneration / m_nShardFrames;
+        WCHAR szShard[16];
+        StringCchPrintfW(szShard, _countof(szShard), L"\\%05u", nShard);
+        StringCchCatW(szFolder, _countof(szFolder), szShard);
+
+        // Only the writer of the lane creates the shards of its stream, on every stripe at once
+        if (nShard >= m_aShards[nStream])
+        {
+            for (UINT nStripe = 0; nStripe < GetStripeCount(); ++nStripe)
+            {
+                FormatStripePath(szPath, cchPath, nStripe, szFolder);
+                CreateDirectory(szPath, NULL);
+            }
+            m_aShards[nStream] = nShard + 1;
+        }
+    }
+
+    FormatStripePath(szPath, cchPath, desc.nGeneration % GetStripeCount(), szFolder);
+
+    WCHAR szFileName[32];
+    StringCchPrintfW(szFileName, _countof(szFileName), L"\\%011.6f.%s", desc.nTime / 10000000., szExtension);
+    StringCchCatW(szPath, cchPath, szFileName);
+}
+
+/// <summary>
+/// Build the path of a folder of the record on one of its stripes
+/// </summary>
+/// <param name="szPath">receives the path</param>
+/// <param name="cchPath">size of szPath in characters</param>
+/// <param name="nStripe">stripe of the folder</param>
+/// <param name="szFolder">folder relative to the root of the stripe</param>
+void CKinectV2Recorder::FormatStripePath(LPWSTR szPath, size_t cchPath, UINT nStripe, LPCWSTR szFolder)
+{
+    if (m_vRoots.empty())
+    {
+        StringCchCopyW(szPath, cchPath, szFolder);
+    }
+    else
+    {
+        StringCchPrintfW(szPath, cchPath, L"%s\\%s", m_vRoots[nStripe].c_str(), szFolder);
+    }
+}
+
+/// <summary>
+/// Configure the volumes a record is striped across, before the recorder is run
+/// </summary>
+/// <param name="szRoots">root folders separated by ';' (e.g. D:\Rec;E:\Rec), the first one holding the manifest</param>
+void CKinectV2Recorder::SetRecordRoots(LPCWSTR szRoots)
+{
+    m_vRoots.clear();
+
+    std::wstring strRoots(szRoots);
+    size_t nStart = 0;
+    while (nStart <= strRoots.size())
+    {
+        size_t nEnd = strRoots.find(L';', nStart);
+        if (nEnd == std::wstring::npos)
+        {
+            nEnd = strRoots.size();
+        }
+
+        // Trailing separators would double the backslash of the paths
+        std::wstring strRoot = strRoots.substr(nStart, nEnd - nStart);
+        while (!strRoot.empty() && (strRoot.back() == L'\\' || strRoot.back() == L'/'))
+        {
+            strRoot.pop_back();
+        }
+        if (!strRoot.empty())
+        {
+            m_vRoots.push_back(strRoot);
+        }
+
+        nStart = nEnd + 1;
+    }
+}
+
+/// <summary>
+/// Close the containers and forget the folders once the record has stopped and every frame has been written,
+/// then let the UI thread reset the record
+/// </summary>
+void CKinectV2Recorder::FinishRecord()
+{
+    if (!m_bRecord && m_bRecordStopping)
+    {
+        // A frame still waiting (e.g. for its JPEG encode) may be written by another lane at any time
+        std::lock_guard<std::mutex> lock(m_mContainer);
+        if (m_bRecordStopping && m_qInfraredFrameQueue.Empty() && m_qDepthFrameQueue.Empty() && m_qColorFrameQueue.Empty())
+        {
+            if (m_bFoldersReady)
+            {
+                CloseContainers();
+                m_bFoldersReady = false;
+            }
+            m_bRecordStopping = false;
+            PostMessage(m_hWnd, WM_RECORD_FINISHED, 0, 0);
+        }
+    }
+}
+
+/// <summary>
+/// Format the status bar text: save folder, frame rates and, while recording, the writer queues
+/// </summary>
+/// <param name="szMessage">receives the text</param>
+/// <param name="cchMessage">size of szMessage in characters</param>
+void CKinectV2Recorder::FormatStatusMessage(LPWSTR szMessage, size_t cchMessage)
+{
+    StringCchPrintf(szMessage, cchMessage, L" Save Folder: %s    FPS(Infrared, Depth, Color) = (%0.2f,  %0.2f,  %0.2f)    Color Offset = %+0.1f ms",
+        m_cSaveFolder, m_fInfraredFPS, m_fDepthFPS, m_fColorFPS, m_cStreamSync.GetOffset(FrameStream_Color));
+
+    {
+        // Average (peak) duration of each pipeline stage, and the sensor frames skipped because the conversion fell behind
+        std::lock_guard<std::mutex> lock(m_mTimings);
+        WCHAR szTimings[160];
+        StringCchPrintf(szTimings, _countof(szTimings), L"    Pipeline(Capture, Queue, Convert) = (%0.1f/%0.1f,  %0.1f/%0.1f,  %0.1f/%0.1f) ms    Skipped = %u",
+            m_aTimings[PipelineStage_Capture].fAverage, m_aTimings[PipelineStage_Capture].fMax,
+            m_aTimings[PipelineStage_Queue].fAverage, m_aTimings[PipelineStage_Queue].fMax,
+            m_aTimings[PipelineStage_Convert].fAverage, m_aTimings[PipelineStage_Convert].fMax,
+            m_aRawFrames[FrameStream_Infrared].qFrames.Dropped() + m_aRawFrames[FrameStream_Depth].qFrames.Dropped() + m_aRawFrames[FrameStream_Color].qFrames.Dropped());
+        StringCchCat(szMessage, cchMessage, szTimings);
+    }
+
+    if (m_bRecord)
+    {
+        // Frames waiting (peak) per writer lane, out of BufferSize
+        WriterLaneStats aStats[3];
+        for (UINT i = 0; i < _countof(aStats); ++i)
+        {
+            aStats[i] = m_cWriterPool.GetStats(i);
+        }
+
+        WCHAR szQueues[128];
+        StringCchPrintf(szQueues, _countof(szQueues), L"    Queue(Infrared, Depth, Color) = (%u/%u,  %u/%u,  %u/%u)",
+            aStats[FrameStream_Infrared].nDepth, aStats[FrameStream_Infrared].nMaxDepth,
+            aStats[FrameStream_Depth].nDepth, aStats[FrameStream_Depth].nMaxDepth,
+            aStats[FrameStream_Color].nDepth, aStats[FrameStream_Color].nMaxDepth);
+        StringCchCat(szMessage, cchMessage, szQueues);
+    }
+}
+
+/// <summary>
+/// Create the container files of the current record
+/// </summary>
+/// <returns>indicates success or failure</returns>
+HRESULT CKinectV2Recorder::OpenContainers()
+{
+    HRESULT hr = OpenContainer(FrameStream_Infrared, m_cwInfrared);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = OpenContainer(FrameStream_Depth, m_cwDepth);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = OpenContainer(FrameStream_Color, m_cwColor);
+    }
+
+    // Frames are only converted straight into the containers once all of them are open
+    m_bContainerOpen = SUCCEEDED(hr);
+    return hr;
+}
+
+/// <summary>
+/// Create the container file of a stream, mapped (MAPPED_OUTPUT) if its frames are stored raw
+/// </summary>
+/// <param name="nStream">stream of the container</param>
+/// <param name="cWriter">regular writer of the stream</param>
+/// <returns>indicates success or failure</returns>
+HRESULT CKinectV2Recorder::OpenContainer(FrameStream nStream, FrameContainerWriter& cWriter)
+{
+    static const LPCWSTR aNames[3] = { L"ir.kvc", L"depth.kvc", L"color.kvc" };
+
+    // Each stream has its container on its own stripe as far as there are stripes
+    WCHAR szSavePath[MAX_PATH];
+    FormatStripePath(szSavePath, _countof(szSavePath), nStream % GetStripeCount(), m_cSaveFolder);
+    StringCchCatW(szSavePath, _countof(szSavePath), L"\\");
+    StringCchCatW(szSavePath, _countof(szSavePath), aNames[nStream]);
+
+#ifdef MAPPED_OUTPUT
+    if (IsRawStream(nStream))
+    {
+        FrameCodec nCodec = FrameCodec_Gray16BE;
+        int nWidth = cInfraredWidth;
+        int nHeight = cInfraredHeight;
+        DWORD nFrameSize = cInfraredWidth * cInfraredHeight * sizeof(UINT16);
+
+        if (nStream == FrameStream_Depth)
+        {
+            nWidth = cDepthWidth;
+            nHeight = cDepthHeight;
+            nFrameSize = cDepthWidth * cDepthHeight * sizeof(UINT16);
+        }
+        else if (nStream == FrameStream_Color)
+        {
+            nCodec = (m_nColorFormat == ColorFormat_YUY2) ? FrameCodec_YUY2 : (m_bColorBGR ? FrameCodec_BGR24 : FrameCodec_RGB24);
+            nWidth = cColorWidth;
+            nHeight = cColorHeight;
+            nFrameSize = cColorWidth * cColorHeight * ((m_nColorFormat == ColorFormat_YUY2) ? 2 : sizeof(RGBTRIPLE));
+        }
+
+        // Falls back to the regular writer if the file cannot be mapped
+        if (SUCCEEDED(m_aMappedWriters[nStream].Open(szSavePath, nStream, nCodec, nWidth, nHeight, nFrameSize, ExpectedContainerSize(nStream))))
+        {
+            return S_OK;
+        }
+    }
+#endif
+
+    return cWriter.Open(szSavePath, ExpectedContainerSize(nStream));
+}
+
+/// <summary>
+/// Estimate the size of a recorded frame of a stream in its configured format
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <returns>expected size in bytes, without file header</returns>
+DWORD CKinectV2Recorder::ExpectedFrameSize(FrameStream nStream) const
+{
+    DWORD nFrameSize = 0;
+
+    switch (nStream)
+    {
+    case FrameStream_Infrared:
+        nFrameSize = cInfraredWidth * cInfraredHeight * sizeof(UINT16);
+        break;
+    case FrameStream_Depth:
+        nFrameSize = cDepthWidth * cDepthHeight * sizeof(UINT16);
+#ifdef DEPTH_RVL
+        nFrameSize /= 3;
+#endif
+        break;
+    default:
+        // Typical ratios of the encoded formats, the reservation does not need to be exact
+        nFrameSize = cColorWidth * cColorHeight * sizeof(RGBTRIPLE);
+        if (m_nColorFormat == ColorFormat_YUY2)
+        {
+            nFrameSize = cColorWidth * cColorHeight * 2;
+        }
+        else if (m_nColorFormat == ColorFormat_QOI)
+        {
+            nFrameSize = nFrameSize * 2 / 5;
+        }
+        else if (m_nColorFormat == ColorFormat_JPEG)
+        {
+            nFrameSize /= 10;
+        }
+        break;
+    }
+
+    return nFrameSize;
+}
+
+/// <summary>
+/// Estimate the size of the container of a stream for a record of the expected length
+/// </summary>
+/// <param name="nStream">stream of the container</param>
+/// <returns>expected size in bytes</returns>
+UINT64 CKinectV2Recorder::ExpectedContainerSize(FrameStream nStream) const
+{
+    UINT64 nFrameSize = ExpectedFrameSize(nStream);
+
+    // Frames at the rate of the source, each with its record header and index entry.
+    // This is only the reservation: the containers grow past it in longer records.
+    double fFrameRate = m_pFrameSource ? m_pFrameSource->GetFrameRate() : 30.0;
+    UINT64 nFrames = static_cast<UINT64>(m_nRecordSeconds * fFrameRate + 0.5);
+    return nFrames * (nFrameSize + sizeof(FrameRecordHeader) + sizeof(FrameIndexEntry) + 8);
+}
+
+/// <summary>
+/// Write frames of the configured formats to the record target and predict the sustainable frame rate and record length
+/// </summary>
+/// <param name="nSeconds">how long to write</param>
+/// <param name="szReport">receives the report</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if the target keeps up with 30 fps, S_FALSE if not, a failure code if it cannot be written</returns>
+HRESULT CKinectV2Recorder::ProbeStorage(UINT nSeconds, LPWSTR szReport, size_t cchReport)
+{
+    static const LPCWSTR aColorExtensions[ColorFormat_Count] = { L"ppm", L"bmp", L"qoi", L"jpg", L"pam" };
+
+    StorageProbeConfig config;
+    if (m_vRoots.empty())
+    {
+        config.vFolders.push_back(L".");
+    }
+    else
+    {
+        config.vFolders = m_vRoots;
+    }
+
+    // Same streams, sizes and file layout as a record, file headers included
+    StorageProbeStream infrared = { L"ir", L"pgm", ExpectedFrameSize(FrameStream_Infrared) + 16 };
+#ifdef DEPTH_RVL
+    StorageProbeStream depth = { L"depth", L"rvl", ExpectedFrameSize(FrameStream_Depth) + 16 };
+#else
+    StorageProbeStream depth = { L"depth", L"pgm", ExpectedFrameSize(FrameStream_Depth) + 16 };
+#endif
+    StorageProbeStream color = { L"color", aColorExtensions[m_nColorFormat], ExpectedFrameSize(FrameStream_Color) + 64 };
+    config.vStreams.push_back(infrared);
+    config.vStreams.push_back(depth);
+    config.vStreams.push_back(color);
+
+#ifdef RECORD_CONTAINER
+    config.bContainer = true;
+#else
+    config.bContainer = false;
+#endif
+    config.nThreads = m_nWriterThreads;
+    config.nSeconds = nSeconds;
+    config.fTargetFps = 30.0;
+    config.nQueueDepth = BufferSize;
+
+    return RunStorageProbe(config, szReport, cchReport);
+}
+
+/// <summary>
+/// Start the storage probe on a thread, the report is shown once WM_STORAGE_PROBE_DONE arrives
+/// </summary>
+void CKinectV2Recorder::StartStorageProbe()
+{
+    if (m_bRecord || m_bStorageProbe)
+    {
+        SetStatusMessage(L"The storage probe cannot run while recording or probing.", 3000, true);
+        return;
+    }
+
+    m_bStorageProbe = true;
+    SetStatusMessage(L"Probing the storage...", StorageProbeDefaultSeconds * 1000, true);
+    m_tStorageProbe = std::thread([this]
+    {
+        m_hrStorageProbe = ProbeStorage(StorageProbeDefaultSeconds, m_szStorageProbeReport, _countof(m_szStorageProbeReport));
+        PostMessage(m_hWnd, WM_STORAGE_PROBE_DONE, 0, 0);
+    });
+}
+
+/// <summary>
+/// Write the index footers and close the container files
+/// </summary>
+void CKinectV2Recorder::CloseContainers()
+{
+#ifdef MAPPED_OUTPUT
+    for (UINT i = 0; i < _countof(m_aMappedWriters); ++i)
+    {
+        m_aMappedWriters[i].Close();
+    }
+#endif
+    m_cwInfrared.Close();
+    m_cwDepth.Close();
+    m_cwColor.Close();
+    m_bContainerOpen = false;
+}
+
+/// <summary>
+/// Save shot images
+/// </summary>
+void CKinectV2Recorder::SaveShotImages()
+{
+    WCHAR* szPicturesFolder = NULL;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_Pictures, 0, NULL, &szPicturesFolder);
+
+    if (SUCCEEDED(hr))
+    {
+        WCHAR szCalibrationFolder[MAX_PATH];
+        WCHAR szInfraredFolder[MAX_PATH];
+        WCHAR szDepthFolder[MAX_PATH];
+        WCHAR szColorFolder[MAX_PATH];
+        WCHAR FileName[MAX_PATH];
+        StringCchPrintfW(szCalibrationFolder, _countof(szCalibrationFolder), L"%s\\calibration", szPicturesFolder);
+        if (!IsDirectoryExists(szCalibrationFolder))
+        {
+            CreateDirectory(szCalibrationFolder, NULL);
+        }
+        GetTimeFormatEx(NULL, 0, NULL, L"HH'-'mm'-'ss", FileName, _countof(FileName));
+
+        // Save infrared image
+        StringCchPrintfW(szInfraredFolder, _countof(szInfraredFolder), L"%s\\ir", szCalibrationFolder);
+        if (!IsDirectoryExists(szInfraredFolder))
+        {
+            CreateDirectory(szInfraredFolder, NULL);
+        }
+        WCHAR szInfraredPath[MAX_PATH];
+        StringCchPrintfW(szInfraredPath, _countof(szInfraredPath), L"%s\\%s.pgm", szInfraredFolder, FileName);
+        SaveToPGM(reinterpret_cast<BYTE*>(m_pInfraredUINT16[m_nInfraredSlot]), cInfraredWidth, cInfraredHeight, sizeof(UINT16)* 8, 65535, szInfraredPath);
+
+        // Save depth image
+        StringCchPrintfW(szDepthFolder, _countof(szDepthFolder), L"%s\\depth", szCalibrationFolder);
+        if (!IsDirectoryExists(szDepthFolder))
+        {
+            CreateDirectory(szDepthFolder, NULL);
+        }
+        WCHAR szDepthPath[MAX_PATH];
+        StringCchPrintfW(szDepthPath, _countof(szDepthPath), L"%s\\%s.pgm", szDepthFolder, FileName);
+        SaveToPGM(reinterpret_cast<BYTE*>(m_pDepthUINT16[m_nDepthSlot]), cDepthWidth, cDepthHeight, sizeof(UINT16)* 8, 65535, szDepthPath);
+    
+        // Save Color image
+        StringCchPrintfW(szColorFolder, _countof(szColorFolder), L"%s\\color", szCalibrationFolder);
+        if (!IsDirectoryExists(szColorFolder))
+        {
+            CreateDirectory(szColorFolder, NULL);
+        }
+        WCHAR szColorPath[MAX_PATH];
+        StringCchPrintfW(szColorPath, _countof(szColorPath), L"%s\\%s.bmp", szColorFolder, FileName);
+        if (m_nColorFormat == ColorFormat_YUY2)
+        {
+            // The ring holds raw YUY2, mirror it like the other shots
+            std::vector<RGBTRIPLE> vBGR(cColorWidth * cColorHeight);
+            ConvertYUY2ToRGB(reinterpret_cast<const BYTE*>(m_pColorRGB[m_nColorSlot]), vBGR.data(), cColorWidth, cColorHeight, YUVMatrix_BT601, true, true);
+            SaveToBMP(reinterpret_cast<BYTE*>(vBGR.data()), cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, szColorPath);
+        }
+        else if (!m_bColorBGR)
+        {
+            // The slot may still be queued for the writers, the channels are swapped into a copy
+            const RGBTRIPLE* pBuffer = m_pColorRGB[m_nColorSlot];
+            std::vector<RGBTRIPLE> vBGR(pBuffer, pBuffer + cColorWidth * cColorHeight);
+            for (size_t i = 0; i < vBGR.size(); ++i)
+            {
+                std::swap(vBGR[i].rgbtRed, vBGR[i].rgbtBlue);
+            }
+            SaveToBMP(reinterpret_cast<BYTE*>(vBGR.data()), cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, szColorPath);
+        }
+        else
+        {
+            SaveToBMP(reinterpret_cast<BYTE*>(m_pColorRGB[m_nColorSlot]), cColorWidth, cColorHeight, sizeof(RGBTRIPLE)* 8, szColorPath);
+        }
+
+        WCHAR szStatusMessage[128];
+        StringCchPrintfW(szStatusMessage, _countof(szStatusMessage), L"Take a shot   [%s\\xxx\\%s.xxx]", szCalibrationFolder, FileName);
+        SetStatusMessage(szStatusMessage, 3000, true);
+    }
+}
+
+/// <summary>
+/// Check if we have stored all the necessary images (no frame dropping), once the record has been written
+/// </summary>
+void CKinectV2Recorder::CheckImages()
+{
+    // Frames the writers failed to write (or encode)
+    if (m_qInfraredFrameQueue.Failed() || m_qDepthFrameQueue.Failed() || m_qColorFrameQueue.Failed())
+    {
+        WCHAR szMessage[128];
+        StringCchPrintfW(szMessage, _countof(szMessage), L"Writing failed: (Infrared, Depth, Color) = (%u, %u, %u) frames...\n",
+            m_qInfraredFrameQueue.Failed(), m_qDepthFrameQueue.Failed(), m_qColorFrameQueue.Failed());
+        PostRecordMessage(szMessage, L"No Good", false);
+        return;
+    }
+
+    // Frames dropped because the writer fell behind are never written
+    if (m_qInfraredFrameQueue.Dropped() || m_qDepthFrameQueue.Dropped() || m_qColorFrameQueue.Dropped())
+    {
+        WCHAR szMessage[256];
+        StringCchPrintfW(szMessage, _countof(szMessage), L"Writer overrun: (Infrared, Depth, Color) = (%u, %u, %u) frames dropped, (%u, %u, %u) frames queued at most...\n",
+            m_qInfraredFrameQueue.Dropped(), m_qDepthFrameQueue.Dropped(), m_qColorFrameQueue.Dropped(),
+            m_cWriterPool.GetStats(FrameStream_Infrared).nMaxDepth, m_cWriterPool.GetStats(FrameStream_Depth).nMaxDepth, m_cWriterPool.GetStats(FrameStream_Color).nMaxDepth);
+        PostRecordMessage(szMessage, L"No Good", false);
+        return;
+    }
+
+    // Every queued frame has been written or counted as dropped
+    FrameQueue<BufferSize>* aQueues[3] = { &m_qInfraredFrameQueue, &m_qDepthFrameQueue, &m_qColorFrameQueue };
+    UINT aLost[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        aLost[i] = aQueues[i]->Generation() - aQueues[i]->Dropped() - m_aWrittenFrames[i];
+    }
+
+    if (aLost[FrameStream_Infrared] || aLost[FrameStream_Depth] || aLost[FrameStream_Color])
+    {
+        WCHAR szMessage[128];
+        StringCchPrintfW(szMessage, _countof(szMessage), L"Frames lost: (Infrared, Depth, Color) = (%u, %u, %u) frames...\n",
+            aLost[FrameStream_Infrared], aLost[FrameStream_Depth], aLost[FrameStream_Color]);
+        PostRecordMessage(szMessage, L"No Good", false);
+        return;
+    }
+
+    // Every frame of the record has been matched into a frameset by the synchronizer
+    if (m_nSyncUnmatched || m_nSyncResyncs)
+    {
+        WCHAR szMessage[128];
+        StringCchPrintfW(szMessage, _countof(szMessage), L"Frame dropping occurred: %u frames without partners, %u resyncs...\n",
+            m_nSyncUnmatched, m_nSyncResyncs);
+        PostRecordMessage(szMessage, L"No Good", false);
+        return;
+    }
+}
+
+/// <summary>
+/// Stop the record and disable the record button until the writers have finished it, on the UI thread with m_mProcess held
+/// </summary>
+void CKinectV2Recorder::StopRecord()
+{
+    // FinishRecord closes the containers once the queues are drained and posts WM_RECORD_FINISHED
+    m_bRecord = false;
+    m_bRecordStopping = true;
+    EnableWindow(GetDlgItem(m_hWnd, IDC_BUTTON_RECORD), false);
+    m_sFrameSignal.Notify();
+}
+
+/// <summary>
+/// Reset record parameters once the record has been written, on the UI thread
+/// </summary>
+void CKinectV2Recorder::ResetRecordParameters()
+{
+    // The conversion thread counts the frame sets of the next record
+    std::lock_guard<std::mutex> lock(m_mProcess);
+    m_bCheckRecord = false;
+    m_qInfraredFrameQueue.ResetCounters();
+    m_qDepthFrameQueue.ResetCounters();
+    m_qColorFrameQueue.ResetCounters();
+    m_cWriterPool.ResetStats();
+    m_nSyncUnmatched = 0;
+    m_nSyncResyncs = 0;
+    ZeroMemory(m_aWrittenFrames, sizeof(m_aWrittenFrames));
+    m_nStartTime = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mTimings);
+        for (int i = 0; i < PipelineStage_Count; ++i)
+        {
+            m_aTimings[i].fMax = 0;
+        }
     }
-    m_nInfraredIndex = 0;
-    m_nDepthIndex = 0;
-    m_nColorIndex = 0;
-    m_vInfraredList.resize(0);
-    m_vDepthList.resize(0);
-    m_vColorList.resize(0);
-    m_nStartTime = 0;
-    
 
     SendDlgItemMessage(m_hWnd, IDC_BUTTON_RECORD, BM_SETIMAGE, (WPARAM)IMAGE_ICON, (LPARAM)m_hRecord);
+    EnableWindow(GetDlgItem(m_hWnd, IDC_BUTTON_RECORD), true);
 }
@@ -10,41 +10,105 @@
 
 #include "resource.h"
 #include "ImageRenderer.h"
+#include "FrameQueue.h"
+#include "FrameContainer.h"
+#include "FrameSource.h"
+#include "FrameConverter.h"
+#include "DepthColorizer.h"
+#include "ConversionPool.h"
+#include "ColorCodec.h"
+#include "JpegEncoder.h"
+#include "WriterPool.h"
+#include "AsyncFileWriter.h"
+#include "StorageProbe.h"
+#include "StreamSynchronizer.h"
+#include "PreviewMailbox.h"
 #include <thread>
+#include <mutex>
+#include <atomic>
 #include <vector>
-#include <queue>
+#include <string>
 #include <fstream>
 
-// InfraredSourceValueMaximum is the highest value that can be returned in the InfraredFrame.
-// It is cast to a float for readability in the visualization code.
-#define InfraredSourceValueMaximum static_cast<float>(USHRT_MAX)
-
-// The InfraredOutputValueMinimum value is used to set the lower limit, post processing, of the
-// infrared data that we will render.
-// Increasing or decreasing this value sets a brightness "wall" either closer or further away.
-#define InfraredOutputValueMinimum 0.01f 
-
-// The InfraredOutputValueMaximum value is the upper limit, post processing, of the
-// infrared data that we will render.
-#define InfraredOutputValueMaximum 1.0f
-
-// The InfraredSceneValueAverage value specifies the average infrared value of the scene.
-// This value was selected by analyzing the average pixel intensity for a given scene.
-// Depending on the visualization requirements for a given application, this value can be
-// hard coded, as was done here, or calculated by averaging the intensity for each pixel prior
-// to rendering.
-#define InfraredSceneValueAverage 0.08f
-
-/// The InfraredSceneStandardDeviations value specifies the number of standard deviations
-/// to apply to InfraredSceneValueAverage. This value was selected by analyzing data
-/// from a given scene.
-/// Depending on the visualization requirements for a given application, this value can be
-/// hard coded, as was done here, or calculated at runtime.
-#define InfraredSceneStandardDeviations 3.0f
+#if defined(MAPPED_OUTPUT) && !defined(RECORD_CONTAINER)
+#error MAPPED_OUTPUT requires RECORD_CONTAINER
+#endif
+
+/// Formats the color stream can be recorded in
+enum ColorFormat
+{
+    ColorFormat_PPM = 0,
+    ColorFormat_BMP,
+    ColorFormat_QOI,                // lossless, see ColorCodec.h
+    ColorFormat_JPEG,               // lossy, needs USE_TURBOJPEG
+    ColorFormat_YUY2,               // raw sensor format, not mirrored
+    ColorFormat_Count
+};
 
 /// The BufferSize value specifies the size of buffer when writing image
+/// One more slot per stream is allocated to absorb frames dropped while the buffer is full
 #define BufferSize 32
 
+/// The WM_STORAGE_PROBE_DONE message is posted to the main window when the storage probe started from the UI is done
+#define WM_STORAGE_PROBE_DONE (WM_APP + 1)
+
+/// The WM_STATUS_MESSAGE message is posted to the main window when the status bar text has changed
+#define WM_STATUS_MESSAGE (WM_APP + 2)
+
+/// The WM_RECORD_MESSAGE message is posted to the main window to report a record problem, wParam is TRUE if the record has been stopped
+#define WM_RECORD_MESSAGE (WM_APP + 3)
+
+/// The WM_RECORD_FINISHED message is posted to the main window when a stopped record has been written and its containers closed
+#define WM_RECORD_FINISHED (WM_APP + 4)
+
+/// The CaptureWaitTimeout value specifies how long (in ms) the capture thread waits for a frame before checking whether to stop
+#define CaptureWaitTimeout 100
+
+/// The PreviewDefaultFps value specifies the default cap of the preview rate, independent of the capture rate
+#define PreviewDefaultFps 30
+
+/// The PreviewMaxScale value specifies the largest factor the color preview is shrunk by before it is drawn
+#define PreviewMaxScale 4
+
+/// The PreviewMaxStretch value specifies how much the view may enlarge a shrunk preview before a larger one is drawn instead
+#define PreviewMaxStretch 1.5
+
+/// The RawQueueDepth value specifies the number of sensor frames per stream waiting for the conversion thread
+#define RawQueueDepth 4
+
+/// Stages of the capture pipeline, timed separately
+enum PipelineStage
+{
+    PipelineStage_Capture = 0,      // wake-up to the sensor frames copied and released
+    PipelineStage_Queue,            // sensor frame waiting for the conversion thread
+    PipelineStage_Convert,          // conversion, preview and hand-over to the writers
+    PipelineStage_Count
+};
+
+/// <summary>
+/// Moving average and peak duration of a pipeline stage
+/// </summary>
+struct StageTiming
+{
+    double                  fAverage;       // in ms
+    double                  fMax;           // in ms, since the last record
+};
+
+/// <summary>
+/// Sensor frames of one stream, copied by the capture thread and processed by the conversion thread
+/// </summary>
+struct RawFrameRing
+{
+    FrameQueue<RawQueueDepth> qFrames;
+    BYTE*                   aBuffers[RawQueueDepth];
+    UINT                    nBufferSize;                    // size of each buffer in bytes
+    SourceFrame             aFrames[RawQueueDepth];         // frame in each slot, pBuffer pointing into aBuffers
+    INT64                   aQueuedCounters[RawQueueDepth]; // performance counter when each slot was queued
+};
+
+/// The RecordDefaultSeconds value specifies the expected length of a record, used to reserve the containers on disk
+#define RecordDefaultSeconds 60
+
 class CKinectV2Recorder
 {
     static const int        cMinTimestampDifferenceForFrameReSync = 30; // The minimum timestamp difference between depth and color (in ms) at which they are considered un-synchronized.
@@ -96,6 +160,96 @@ public:
     /// Start multithreading
     /// </summary>
     void                    StartMultithreading();
+
+    /// <summary>
+    /// Start the capture thread, which copies the frames as they arrive, the conversion thread processing them and the preview thread
+    /// </summary>
+    void                    StartCapture();
+
+    /// <summary>
+    /// Stop and join the capture, conversion and preview threads
+    /// </summary>
+    void                    StopCapture();
+
+    /// <summary>
+    /// Use the given frame source instead of the default Kinect sensor
+    /// </summary>
+    /// <param name="pFrameSource">frame source, owned by the recorder from now on</param>
+    void                    SetFrameSource(FrameSource* pFrameSource);
+
+    /// <summary>
+    /// Select the colormap of the depth view
+    /// </summary>
+    /// <param name="nColormap">colormap used from the next depth frame on</param>
+    void                    SetDepthColormap(DepthColormap nColormap);
+
+    /// <summary>
+    /// Configure the threads converting the frames
+    /// </summary>
+    /// <param name="nThreads">number of workers besides the conversion thread, 0 to convert inline</param>
+    /// <param name="nBands">number of row bands per frame, 0 for one per thread</param>
+    /// <param name="nAffinityMask">cores the workers are pinned to in turn, 0 to leave them unpinned</param>
+    void                    SetConversionThreads(UINT nThreads, UINT nBands, DWORD_PTR nAffinityMask);
+
+    /// <summary>
+    /// Select the format the color stream is recorded in, before the recorder is run
+    /// </summary>
+    /// <param name="nFormat">color format</param>
+    void                    SetColorFormat(ColorFormat nFormat);
+
+    /// <summary>
+    /// Configure the JPEG encoding of the color stream, before the recorder is run
+    /// </summary>
+    /// <param name="nQuality">JPEG quality (1-100)</param>
+    /// <param name="nThreads">number of encoder threads</param>
+    void                    SetJpegOptions(int nQuality, UINT nThreads);
+
+    /// <summary>
+    /// Configure the number of writer threads, before the recorder is run
+    /// </summary>
+    /// <param name="nThreads">number of writer threads, at most one per stream is useful</param>
+    void                    SetWriterThreads(UINT nThreads) { m_nWriterThreads = nThreads; }
+
+    /// <summary>
+    /// Cap the rate at which the views are redrawn, before the recorder is run
+    /// </summary>
+    /// <param name="fFps">highest preview rate, 0 to draw every frame</param>
+    void                    SetPreviewRate(double fFps) { m_fPreviewFps = max(fFps, 0.0); }
+
+    /// <summary>
+    /// Configure the expected length of a record, before the recorder is run
+    /// </summary>
+    /// <param name="nSeconds">expected length in seconds, 0 to reserve nothing</param>
+    void                    SetRecordDuration(UINT nSeconds) { m_nRecordSeconds = nSeconds; }
+
+    /// <summary>
+    /// Configure the sharding of the frame folders, before the recorder is run
+    /// </summary>
+    /// <param name="nFrames">frames per subfolder (e.g. 1000), 0 to keep every frame of a stream in one folder</param>
+    void                    SetShardFrames(UINT nFrames) { m_nShardFrames = nFrames; }
+
+    /// <summary>
+    /// Configure the volumes a record is striped across, before the recorder is run
+    /// </summary>
+    /// <param name="szRoots">root folders separated by ';' (e.g. D:\Rec;E:\Rec), the first one holding the manifest</param>
+    void                    SetRecordRoots(LPCWSTR szRoots);
+
+    /// <summary>
+    /// Write frames of the configured formats to the record target and predict the sustainable frame rate and record length
+    /// </summary>
+    /// <param name="nSeconds">how long to write</param>
+    /// <param name="szReport">receives the report</param>
+    /// <param name="cchReport">size of szReport in characters</param>
+    /// <returns>S_OK if the target keeps up with 30 fps, S_FALSE if not, a failure code if it cannot be written</returns>
+    HRESULT                 ProbeStorage(UINT nSeconds, LPWSTR szReport, size_t cchReport);
+
+    /// <summary>
+    /// Find a color format by name
+    /// </summary>
+    /// <param name="szName">ppm, bmp, qoi, jpeg or yuy2</param>
+    /// <param name="pFormat">receives the color format</param>
+    /// <returns>true if the name is known and the format is available in this build</returns>
+    static bool             ParseColorFormat(LPCWSTR szName, ColorFormat* pFormat);
 private:
     HWND                    m_hWnd;
     INT64                   m_nStartTime;
@@ -107,47 +261,44 @@ private:
     DWORD                   m_nInfraredFramesSinceUpdate;
     DWORD                   m_nDepthFramesSinceUpdate;
     DWORD                   m_nColorFramesSinceUpdate;
-    bool                    m_bRecord;
-    bool                    m_bShot;
-    bool                    m_bShotReady;
+    std::atomic<bool>       m_bRecord;          // set by the UI and conversion threads, read by the writer threads
+    std::atomic<bool>       m_bShot;            // set by the UI thread, cleared by the conversion thread once saved
     bool                    m_bSelect2D;
     double                  m_fInfraredFPS;
     double                  m_fDepthFPS;
     double                  m_fColorFPS;
-    INT64                   m_nInfraredShotTime;
-    INT64                   m_nDepthShotTime;
-    INT64                   m_nColorShotTime;
+    INT64                   m_aLatestTimes[3];      // timestamp of the frame in the current slot of each stream
+    bool                    m_aInRingSlot[3];       // the latest frame of each stream was converted into its slot, not a mapped record
 
-    // Current Kinect
-    IKinectSensor*          m_pKinectSensor;
-
-    // Frame reader
-    IInfraredFrameReader*   m_pInfraredFrameReader;
-    IDepthFrameReader*      m_pDepthFrameReader;
-    IColorFrameReader*      m_pColorFrameReader;
+    // Frame source (Kinect sensor by default)
+    FrameSource*            m_pFrameSource;
 
     // Direct2D
     ID2D1Factory*           m_pD2DFactory;
     ImageRenderer*          m_pDrawInfrared;
     ImageRenderer*          m_pDrawDepth;
     ImageRenderer*          m_pDrawColor;
-    RGBQUAD*                m_pInfraredRGBX;
-    RGBQUAD*                m_pDepthRGBX;
-    RGBQUAD*                m_pColorRGBX;
+    DepthColorizer          m_cDepthColorizer;
+    ConversionPool          m_cConversionPool;
+
+    // Preview images in RGBX format, written by the conversion thread and drawn by the preview thread
+    PreviewMailbox          m_aPreviews[3];     // indexed by FrameStream
+    FrameSignal             m_sPreviewSignal;
+    std::thread             m_tPreview;
+    double                  m_fPreviewFps;
+    std::atomic<UINT>       m_nColorPreviewScale;   // factor the color preview is shrunk by, follows the size of the view
 
     // Image storage
-    int                     m_nInfraredIndex;
-    int                     m_nDepthIndex;
-    int                     m_nColorIndex;
-    UINT16*                 m_pInfraredUINT16[BufferSize];
-    UINT16*                 m_pDepthUINT16[BufferSize];
-    RGBTRIPLE*              m_pColorRGB[BufferSize];
-    std::queue<UINT16*>     m_qInfraredFrameQueue;
-    std::queue<UINT16*>     m_qDepthFrameQueue;
-    std::queue<RGBTRIPLE*>  m_qColorFrameQueue;
-    std::queue<INT64>       m_qInfraredTimeQueue;
-    std::queue<INT64>       m_qDepthTimeQueue;
-    std::queue<INT64>       m_qColorTimeQueue;
+    UINT                    m_nInfraredSlot;
+    UINT                    m_nDepthSlot;
+    UINT                    m_nColorSlot;
+    UINT16*                 m_pInfraredUINT16[BufferSize + 1];
+    UINT16*                 m_pDepthUINT16[BufferSize + 1];
+    RGBTRIPLE*              m_pColorRGB[BufferSize + 1];
+    FrameQueue<BufferSize>  m_qInfraredFrameQueue;
+    FrameQueue<BufferSize>  m_qDepthFrameQueue;
+    FrameQueue<BufferSize>  m_qColorFrameQueue;
+    FrameSignal             m_sFrameSignal;
 
     // Index
     UINT                    m_nModel2DIndex;
@@ -165,20 +316,118 @@ private:
     WCHAR                   m_cSaveFolder[MAX_PATH];
     WCHAR                   m_cModelFolder[MAX_PATH];
 
-    // Multithreading
-    std::thread             m_tSaveThread;
-    bool                    m_bStopThread;
-
-    // Check lists
-    std::vector<INT64>      m_vInfraredList;
-    std::vector<INT64>      m_vDepthList;
-    std::vector<INT64>      m_vColorList;
+    // Multithreading, one writer lane per stream (lane index = FrameStream)
+    WriterPool              m_cWriterPool;
+    UINT                    m_nWriterThreads;
+    std::mutex              m_mContainer;       // guards the creation of the folders and containers of a record
+    std::atomic<bool>       m_bFoldersReady;    // the tree of the current record exists
+    std::atomic<bool>       m_bRecordStopping;  // a stopped record is still being written, recording is blocked meanwhile
+    bool                    m_bCheckRecord;     // the record was stopped from the UI, check it once written (VERBOSE)
+    UINT                    m_nShardFrames;     // frames per subfolder of a stream, 0 for a flat folder
+    UINT                    m_aShards[3];       // shards created so far per stream, owned by the writer of each lane
+    std::vector<std::wstring> m_vRoots;         // stripe roots, empty for the working folder only
+
+    // Recording containers (RECORD_CONTAINER), each one owned by the writer of its lane
+    FrameContainerWriter    m_cwInfrared;
+    FrameContainerWriter    m_cwDepth;
+    FrameContainerWriter    m_cwColor;
+    std::atomic<bool>       m_bContainerOpen;
+    UINT                    m_nRecordSeconds;   // expected record length, sizes the container reservations
+#ifdef MAPPED_OUTPUT
+    MappedContainerWriter   m_aMappedWriters[3];    // raw streams (MAPPED_OUTPUT), filled in place by the conversion thread
+#endif
+
+    // Unbuffered overlapped writes from the ring slots (ASYNC_WRITE), one writer per lane
+#ifdef ASYNC_WRITE
+    AsyncFileWriter         m_aAsyncWriters[3];
+#endif
+
+    // Compressed depth (DEPTH_RVL), owned by the writer of the depth lane
+    BYTE*                   m_pDepthRVL;
+
+    // Color format, fixed once the recorder runs
+    ColorFormat             m_nColorFormat;
+    bool                    m_bColorBGR;        // color ring slots hold B-G-R pixels
+    int                     m_nJpegQuality;
+    UINT                    m_nJpegThreads;
+
+    // Compressed color, owned by the writer of the color lane
+    QOIEncoder              m_cColorEncoder;
+#ifdef USE_TURBOJPEG
+    JpegEncoderPool         m_cJpegEncoder;
+#endif
+
+    // Storage probe started from the UI
+    std::thread             m_tStorageProbe;
+    std::atomic<bool>       m_bStorageProbe;    // a probe is running, recording is blocked meanwhile
+    HRESULT                 m_hrStorageProbe;
+    WCHAR                   m_szStorageProbeReport[1024];
+
+    // Synchronization of the streams, fed by the conversion thread
+    StreamSynchronizer      m_cStreamSync;
+    UINT                    m_nSyncUnmatched;   // frames of the record given up without partners
+    UINT                    m_nSyncResyncs;     // color offset changes during the record
+
+    // Frames written per stream, each counter owned by the writer of its lane
+    UINT                    m_aWrittenFrames[3];
+
+    // Capture pipeline: the capture thread, woken by the frame source, copies and releases the sensor frames
+    // and the conversion thread processes them; the UI thread only pumps messages
+    std::thread             m_tCapture;
+    std::thread             m_tConvert;
+    std::atomic<bool>       m_bStopCapture;
+    std::mutex              m_mProcess;         // held while a frame is processed or a UI input is handled
+    RawFrameRing            m_aRawFrames[3];    // indexed by FrameStream
+    FrameSignal             m_sRawSignal;
+    std::mutex              m_mTimings;
+    StageTiming             m_aTimings[PipelineStage_Count];
+
+    // Status bar text, set by any thread and shown by the UI thread
+    std::mutex              m_mStatus;
+    WCHAR                   m_szStatusMessage[MAX_PATH + 256];
+    bool                    m_bStatusPosted;    // a WM_STATUS_MESSAGE is on its way
+    WCHAR                   m_szRecordMessage[256];     // shown by the UI thread on WM_RECORD_MESSAGE
+    LPCWSTR                 m_szRecordTitle;
 
     /// <summary>
-    /// Main processing function
+    /// Main capture function: copy the new sensor frames for the conversion thread and release them
     /// </summary>
     void                    Update();
 
+    /// <summary>
+    /// Copy a sensor frame into the next slot of its ring, unless the conversion thread has fallen behind
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="frame">frame held from the source</param>
+    void                    QueueRawFrame(FrameStream nStream, const SourceFrame& frame);
+
+    /// <summary>
+    /// Capture thread: wait for frames and queue them until stopped
+    /// </summary>
+    void                    CaptureFrames();
+
+    /// <summary>
+    /// Conversion thread: process the queued sensor frames until stopped
+    /// </summary>
+    void                    ConvertFrames();
+
+    /// <summary>
+    /// Preview thread: draw the newest image of every stream, at most at the preview rate, until stopped
+    /// </summary>
+    void                    RenderPreviews();
+
+    /// <summary>
+    /// Pick the factor the color preview is shrunk by from the size of its view
+    /// </summary>
+    void                    UpdatePreviewScale();
+
+    /// <summary>
+    /// Add a duration to the timing of a pipeline stage
+    /// </summary>
+    /// <param name="nStage">stage</param>
+    /// <param name="nCounters">duration in performance counter ticks</param>
+    void                    AddStageTiming(PipelineStage nStage, INT64 nCounters);
+
     /// <summary>
     /// Initialize the UI controls
     /// </summary>
@@ -219,10 +468,18 @@ private:
     /// Handle new color data
     /// <param name="nTime">timestamp of frame</param>
     /// <param name="pBuffer">pointer to frame data</param>
+    /// <param name="nFormat">layout of frame data, ColorImageFormat_Bgra or ColorImageFormat_Yuy2</param>
     /// <param name="nWidth">width (in pixels) of input image data</param>
     /// <param name="nHeight">height (in pixels) of input image data</param>
     /// </summary>
-    void                    ProcessColor(INT64 nTime, RGBQUAD* pBuffer, int nWidth, int nHeight);
+    void                    ProcessColor(INT64 nTime, const BYTE* pBuffer, ColorImageFormat nFormat, int nWidth, int nHeight);
+
+    /// <summary>
+    /// Hand a converted frame over to the synchronizer and act on the framesets it completes
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="nTime">timestamp of frame</param>
+    void                    SynchronizeFrame(FrameStream nStream, INT64 nTime);
 
     /// <summary>
     /// Set the status bar message
@@ -232,6 +489,14 @@ private:
     /// <param name="bForce">force status update</param>
     bool                    SetStatusMessage(_In_z_ WCHAR* szMessage, DWORD nShowTimeMsec, bool bForce);
 
+    /// <summary>
+    /// Have the UI thread show a record problem in a message box, without holding any lock
+    /// </summary>
+    /// <param name="szMessage">message to show</param>
+    /// <param name="szTitle">title of the message box</param>
+    /// <param name="bStopped">true if the record has been stopped (m_bRecord cleared) and still has to be reset</param>
+    void                    PostRecordMessage(LPCWSTR szMessage, LPCWSTR szTitle, bool bStopped);
+
     /// <summary>
     /// Save passed in image data to disk as a bitmap
     /// </summary>
@@ -267,6 +532,51 @@ private:
     /// <returns>indicates success or failure</returns>
     HRESULT                 SaveToPPM(BYTE* pBitmapBits, LONG lWidth, LONG lHeight, WORD wBitsPerPixel, LONG lMaxPixel, LPCWSTR lpszFilePath);
 
+    /// <summary>
+    /// Save passed in image data to disk as a PAM file
+    /// </summary>
+    /// <param name="pBitmapBits">image data to save</param>
+    /// <param name="lWidth">width (in pixels) of input image data</param>
+    /// <param name="lHeight">height (in pixels) of input image data</param>
+    /// <param name="wBytesPerPixel">bytes per pixel of image data (PAM depth)</param>
+    /// <param name="lMaxPixel">max value of a byte</param>
+    /// <param name="szTupleType">layout of a pixel</param>
+    /// <param name="lpszFilePath">full file path to output image to</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 SaveToPAM(BYTE* pBitmapBits, LONG lWidth, LONG lHeight, WORD wBytesPerPixel, LONG lMaxPixel, LPCSTR szTupleType, LPCWSTR lpszFilePath);
+
+    /// <summary>
+    /// Save passed in RVL-compressed depth data to disk as a rvl file
+    /// </summary>
+    /// <param name="pData">compressed depth data to save</param>
+    /// <param name="dwSize">size of the compressed data in bytes</param>
+    /// <param name="lWidth">width (in pixels) of the depth image</param>
+    /// <param name="lHeight">height (in pixels) of the depth image</param>
+    /// <param name="lpszFilePath">full file path to output depth to</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 SaveToRVL(const BYTE* pData, DWORD dwSize, LONG lWidth, LONG lHeight, LPCWSTR lpszFilePath);
+
+    /// <summary>
+    /// Save passed in encoded data to disk as is
+    /// </summary>
+    /// <param name="pData">encoded data to save</param>
+    /// <param name="dwSize">size of the encoded data in bytes</param>
+    /// <param name="lpszFilePath">full file path to output data to</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 SaveToFile(const BYTE* pData, DWORD dwSize, LPCWSTR lpszFilePath);
+
+    /// <summary>
+    /// Compress a depth frame of the ring buffer into m_pDepthRVL
+    /// </summary>
+    /// <param name="nSlot">ring slot of the depth frame</param>
+    /// <returns>compressed size in bytes</returns>
+    DWORD                   CompressDepth(UINT nSlot);
+
+    /// <summary>
+    /// Encode the oldest color frame if needed and write it to disk
+    /// </summary>
+    void                    SaveColorFrame();
+
     /// <summary>
     /// Check if the directory exists
     /// </summary>
@@ -275,9 +585,156 @@ private:
     bool                    IsDirectoryExists(WCHAR* szDirName);
 
     /// <summary>
-    /// Save record images
+    /// Create a folder along with every missing folder of its path
+    /// </summary>
+    /// <param name="szPath">folder to create</param>
+    /// <returns>true if the folder exists afterwards</returns>
+    bool                    CreateFolderTree(LPCWSTR szPath);
+
+    /// <summary>
+    /// Check if the color lane has a frame ready to be written, feeding the JPEG encoders on the way
+    /// </summary>
+    /// <param name="pDeadline">receives the deadline of the oldest frame</param>
+    /// <param name="pDepth">receives the number of frames waiting</param>
+    /// <returns>true if the oldest frame can be written now</returns>
+    bool                    ColorFrameReady(INT64* pDeadline, UINT* pDepth);
+
+    /// <summary>
+    /// Write the oldest infrared frame to disk
+    /// </summary>
+    void                    SaveInfraredFrame();
+
+    /// <summary>
+    /// Write the oldest depth frame to disk
+    /// </summary>
+    void                    SaveDepthFrame();
+
+    /// <summary>
+    /// Release the oldest frame of a stream once its write is over, counting it as written or dropped
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="qFrameQueue">frames of the stream</param>
+    /// <param name="hr">result of the write</param>
+    void                    ReleaseRecordFrame(FrameStream nStream, FrameQueue<BufferSize>& qFrameQueue, HRESULT hr);
+
+    /// <summary>
+    /// Check if the frames of a stream are written exactly as they are stored in the ring, without encoding
+    /// </summary>
+    /// <param name="nStream">stream to check</param>
+    /// <returns>true for PGM/PPM/BMP/YUY2 frames</returns>
+    bool                    IsRawStream(FrameStream nStream) const;
+
+#ifdef ASYNC_WRITE
+    /// <summary>
+    /// Keep the writes of a lane in flight: submit the waiting frames, then complete the oldest one and release its slot
+    /// </summary>
+    /// <param name="nStream">stream of the lane</param>
+    /// <param name="qFrameQueue">frames of the stream</param>
+    /// <returns>false if the frames of the stream are encoded first and have to be written synchronously</returns>
+    bool                    SaveRecordFramesAsync(FrameStream nStream, FrameQueue<BufferSize>& qFrameQueue);
+
+    /// <summary>
+    /// Put the file header in front of a ring slot and submit the file
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="desc">descriptor of the frame</param>
+    void                    SubmitRecordFrame(FrameStream nStream, const FrameDesc& desc);
+#endif
+
+#ifdef MAPPED_OUTPUT
+    /// <summary>
+    /// Get the record a frame can be converted into, straight in the mapped container of its stream
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <returns>payload of the record, NULL to convert into the ring slot</returns>
+    BYTE*                   AcquireMappedFrame(FrameStream nStream);
+
+    /// <summary>
+    /// Hand a frame which is about to be queued over to the mapped container of its stream
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="pMapped">record returned by AcquireMappedFrame, NULL if the frame is in its ring slot</param>
+    void                    QueueMappedFrame(FrameStream nStream, BYTE* pMapped);
+#endif
+
+    /// <summary>
+    /// Create the folders (and containers) of the current record, once per record
+    /// </summary>
+    void                    PrepareRecordFolders();
+
+    /// <summary>
+    /// Number of volumes the record is striped across
     /// </summary>
-    void                    SaveRecordImages();
+    UINT                    GetStripeCount() const { return m_vRoots.empty() ? 1 : static_cast<UINT>(m_vRoots.size()); }
+
+    /// <summary>
+    /// Build the path of a folder of the record on one of its stripes
+    /// </summary>
+    /// <param name="szPath">receives the path</param>
+    /// <param name="cchPath">size of szPath in characters</param>
+    /// <param name="nStripe">stripe of the folder</param>
+    /// <param name="szFolder">folder relative to the root of the stripe</param>
+    void                    FormatStripePath(LPWSTR szPath, size_t cchPath, UINT nStripe, LPCWSTR szFolder);
+
+    /// <summary>
+    /// Build the file path of a recorded frame, creating its shard folder when the frame opens a new one
+    /// </summary>
+    /// <param name="szPath">receives the path</param>
+    /// <param name="cchPath">size of szPath in characters</param>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="desc">descriptor of the frame</param>
+    /// <param name="szExtension">file extension</param>
+    void                    FormatFramePath(LPWSTR szPath, size_t cchPath, FrameStream nStream, const FrameDesc& desc, LPCWSTR szExtension);
+
+    /// <summary>
+    /// Close the containers and forget the folders once the record has stopped and every frame has been written
+    /// </summary>
+    void                    FinishRecord();
+
+    /// <summary>
+    /// Format the status bar text: save folder, frame rates and, while recording, the writer queues
+    /// </summary>
+    /// <param name="szMessage">receives the text</param>
+    /// <param name="cchMessage">size of szMessage in characters</param>
+    void                    FormatStatusMessage(LPWSTR szMessage, size_t cchMessage);
+
+    /// <summary>
+    /// Create the container files of the current record
+    /// </summary>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 OpenContainers();
+
+    /// <summary>
+    /// Create the container file of a stream, mapped (MAPPED_OUTPUT) if its frames are stored raw
+    /// </summary>
+    /// <param name="nStream">stream of the container</param>
+    /// <param name="cWriter">regular writer of the stream</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT                 OpenContainer(FrameStream nStream, FrameContainerWriter& cWriter);
+
+    /// <summary>
+    /// Estimate the size of a recorded frame of a stream in its configured format
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <returns>expected size in bytes, without file header</returns>
+    DWORD                   ExpectedFrameSize(FrameStream nStream) const;
+
+    /// <summary>
+    /// Start the storage probe on a thread, the report is shown once WM_STORAGE_PROBE_DONE arrives
+    /// </summary>
+    void                    StartStorageProbe();
+
+    /// <summary>
+    /// Estimate the size of the container of a stream for a record of the expected length
+    /// </summary>
+    /// <param name="nStream">stream of the container</param>
+    /// <returns>expected size in bytes</returns>
+    UINT64                  ExpectedContainerSize(FrameStream nStream) const;
+
+    /// <summary>
+    /// Write the index footers and close the container files
+    /// </summary>
+    void                    CloseContainers();
 
     /// <summary>
     /// Save shot images
@@ -290,7 +747,12 @@ private:
     void                    CheckImages();
 
     /// <summary>
-    /// Reset record parameters
+    /// Stop the record and disable the record button until the writers have finished it, on the UI thread with m_mProcess held
+    /// </summary>
+    void                    StopRecord();
+
+    /// <summary>
+    /// Reset record parameters once the record has been written, on the UI thread
     /// </summary>
     void                    ResetRecordParameters();
 };
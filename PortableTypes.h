@@ -0,0 +1,227 @@
+// PortableTypes.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Windows types used by the modules that do not need the sensor (conversion
+// kernels, codecs, pools and queues), so that they can be built on their own.
+// On Windows this is windows.h; elsewhere the few types and helpers they use
+// are defined here with the same sizes and layouts.
+
+
+#pragma once
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+#include <windows.h>
+
+#else // _WIN32
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <cstdio>
+#include <cstdarg>
+#include <cwchar>
+#include <string>
+#include <thread>
+#include <chrono>
+
+typedef unsigned char       byte;
+typedef uint8_t             BYTE;
+typedef uint16_t            WORD;
+typedef uint32_t            DWORD;
+typedef unsigned int        UINT;
+typedef unsigned short      USHORT;
+typedef uint16_t            UINT16;
+typedef uint32_t            UINT32;
+typedef int64_t             INT64;
+typedef uint64_t            UINT64;
+typedef uintptr_t           DWORD_PTR;
+typedef size_t              SIZE_T;
+typedef int32_t             LONG;
+typedef int32_t             HRESULT;
+typedef char                CHAR;
+typedef const CHAR*         LPCSTR;
+typedef wchar_t             WCHAR;
+typedef WCHAR*              LPWSTR;
+typedef const WCHAR*        LPCWSTR;
+typedef void*               HANDLE;
+
+#define S_OK                ((HRESULT)0L)
+#define E_FAIL              ((HRESULT)0x80004005L)
+#define E_POINTER           ((HRESULT)0x80004003L)
+#define E_OUTOFMEMORY       ((HRESULT)0x8007000EL)
+#define E_INVALIDARG        ((HRESULT)0x80070057L)
+#define E_PENDING           ((HRESULT)0x8000000AL)
+#define E_ACCESSDENIED      ((HRESULT)0x80070005L)
+#define SUCCEEDED(hr)       (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)          (((HRESULT)(hr)) < 0)
+
+#define UNREFERENCED_PARAMETER(P)   (void)(P)
+#define ZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define _countof(Array)     (sizeof(Array) / sizeof((Array)[0]))
+#define MAX_PATH            260
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define sprintf_s           snprintf
+
+#pragma pack(push, 1)
+struct RGBTRIPLE
+{
+    BYTE                    rgbtBlue;
+    BYTE                    rgbtGreen;
+    BYTE                    rgbtRed;
+};
+#pragma pack(pop)
+
+struct RGBQUAD
+{
+    BYTE                    rgbBlue;
+    BYTE                    rgbGreen;
+    BYTE                    rgbRed;
+    BYTE                    rgbReserved;
+};
+
+#define BI_RGB              0L
+
+#pragma pack(push, 2)
+struct BITMAPFILEHEADER
+{
+    WORD                    bfType;
+    DWORD                   bfSize;
+    WORD                    bfReserved1;
+    WORD                    bfReserved2;
+    DWORD                   bfOffBits;
+};
+#pragma pack(pop)
+
+struct BITMAPINFOHEADER
+{
+    DWORD                   biSize;
+    LONG                    biWidth;
+    LONG                    biHeight;
+    WORD                    biPlanes;
+    WORD                    biBitCount;
+    DWORD                   biCompression;
+    DWORD                   biSizeImage;
+    LONG                    biXPelsPerMeter;
+    LONG                    biYPelsPerMeter;
+    DWORD                   biClrUsed;
+    DWORD                   biClrImportant;
+};
+
+// windows.h defines min and max as macros, the modules only compare values of the same type
+template <class T>
+inline T min(T a, T b)
+{
+    return (b < a) ? b : a;
+}
+
+template <class T>
+inline T max(T a, T b)
+{
+    return (a < b) ? b : a;
+}
+
+/// <summary>
+/// Suspend the calling thread
+/// </summary>
+/// <param name="dwMilliseconds">time to sleep in milliseconds</param>
+inline void Sleep(DWORD dwMilliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(dwMilliseconds));
+}
+
+/// <summary>
+/// Format into a bounded buffer like strsafe.h, truncating (formats take %ls for wide strings)
+/// </summary>
+inline HRESULT StringCchPrintfW(LPWSTR pszDest, size_t cchDest, LPCWSTR pszFormat, ...)
+{
+    va_list args;
+    va_start(args, pszFormat);
+    int nLength = vswprintf(pszDest, cchDest, pszFormat, args);
+    va_end(args);
+    pszDest[cchDest - 1] = L'\0';
+    return (nLength >= 0) ? S_OK : E_FAIL;
+}
+
+/// <summary>
+/// Copy into a bounded buffer like strsafe.h, truncating
+/// </summary>
+inline HRESULT StringCchCopyW(LPWSTR pszDest, size_t cchDest, LPCWSTR pszSrc)
+{
+    wcsncpy(pszDest, pszSrc, cchDest - 1);
+    pszDest[cchDest - 1] = L'\0';
+    return (wcslen(pszSrc) < cchDest) ? S_OK : E_FAIL;
+}
+
+/// <summary>
+/// Append to a bounded buffer like strsafe.h, truncating
+/// </summary>
+inline HRESULT StringCchCatW(LPWSTR pszDest, size_t cchDest, LPCWSTR pszSrc)
+{
+    size_t nLength = wcslen(pszDest);
+    return (nLength < cchDest) ? StringCchCopyW(pszDest + nLength, cchDest - nLength, pszSrc) : E_FAIL;
+}
+
+/// <summary>
+/// Convert a file path to the UTF-8 the system calls take, paths being wide strings as on Windows
+/// </summary>
+/// <param name="lpszPath">wide file path</param>
+/// <returns>UTF-8 file path</returns>
+inline std::string Utf8Path(LPCWSTR lpszPath)
+{
+    std::string szPath;
+    for (; *lpszPath; ++lpszPath)
+    {
+        UINT32 c = static_cast<UINT32>(*lpszPath);
+        if (c < 0x80)
+        {
+            szPath += static_cast<char>(c);
+        }
+        else if (c < 0x800)
+        {
+            szPath += static_cast<char>(0xC0 | (c >> 6));
+            szPath += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            szPath += static_cast<char>(0xE0 | (c >> 12));
+            szPath += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            szPath += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            szPath += static_cast<char>(0xF0 | (c >> 18));
+            szPath += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            szPath += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            szPath += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    return szPath;
+}
+
+#endif // _WIN32
+
+// There is no sensor outside Windows
+#if !defined(_WIN32) && !defined(HEADLESS)
+#define HEADLESS
+#endif
+
+#ifdef HEADLESS
+/// Color formats of the Kinect SDK handed out by the frame sources, with the values of Kinect.h
+enum ColorImageFormat
+{
+    ColorImageFormat_None = 0,
+    ColorImageFormat_Rgba = 1,
+    ColorImageFormat_Yuv = 2,
+    ColorImageFormat_Bgra = 3,
+    ColorImageFormat_Bayer = 4,
+    ColorImageFormat_Yuy2 = 5
+};
+#else
+#include <Kinect.h>
+#endif
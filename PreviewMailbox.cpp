@@ -0,0 +1,89 @@
+// PreviewMailbox.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include "PreviewMailbox.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+PreviewMailbox::PreviewMailbox() :
+m_nSize(0),
+m_nBack(0),
+m_nMiddle(1),
+m_nFront(2),
+m_pSignal(NULL)
+{
+    ZeroMemory(m_aBuffers, sizeof(m_aBuffers));
+    ZeroMemory(m_aWidths, sizeof(m_aWidths));
+    ZeroMemory(m_aHeights, sizeof(m_aHeights));
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+PreviewMailbox::~PreviewMailbox()
+{
+    for (int i = 0; i < _countof(m_aBuffers); ++i)
+    {
+        delete[] m_aBuffers[i];
+    }
+}
+
+/// <summary>
+/// Allocate the three buffers, before the mailbox is used
+/// </summary>
+/// <param name="nSize">size of an image in bytes</param>
+void PreviewMailbox::Allocate(UINT nSize)
+{
+    m_nSize = nSize;
+    for (int i = 0; i < _countof(m_aBuffers); ++i)
+    {
+        delete[] m_aBuffers[i];
+        m_aBuffers[i] = new BYTE[nSize];
+        ZeroMemory(m_aBuffers[i], nSize);
+    }
+}
+
+/// <summary>
+/// Producer: publish the image written into WriteBuffer(), replacing the one not taken yet
+/// </summary>
+/// <param name="nWidth">width (in pixels) of the image</param>
+/// <param name="nHeight">height (in pixels) of the image, the image fills nWidth * nHeight * 4 bytes at most Size()</param>
+void PreviewMailbox::Publish(UINT nWidth, UINT nHeight)
+{
+    m_aWidths[m_nBack] = nWidth;
+    m_aHeights[m_nBack] = nHeight;
+
+    // The written buffer goes in between, the previous one in between (taken or stale) is written next
+    UINT nPrevious = m_nMiddle.exchange(m_nBack | cFresh, std::memory_order_acq_rel);
+    m_nBack = nPrevious & ~cFresh;
+
+    if (m_pSignal)
+    {
+        m_pSignal->Notify();
+    }
+}
+
+/// <summary>
+/// Consumer: take the newest published image
+/// </summary>
+/// <param name="pWidth">receives the width (in pixels) of the image</param>
+/// <param name="pHeight">receives the height (in pixels) of the image</param>
+/// <returns>image valid until the next call, or NULL if nothing has been published since the last call</returns>
+BYTE* PreviewMailbox::Latest(UINT* pWidth, UINT* pHeight)
+{
+    if (!(m_nMiddle.load(std::memory_order_relaxed) & cFresh))
+    {
+        return NULL;
+    }
+
+    // The shown buffer goes in between, marked as taken
+    UINT nMiddle = m_nMiddle.exchange(m_nFront, std::memory_order_acq_rel);
+    m_nFront = nMiddle & ~cFresh;
+    *pWidth = m_aWidths[m_nFront];
+    *pHeight = m_aHeights[m_nFront];
+    return m_aBuffers[m_nFront];
+}
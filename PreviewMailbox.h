@@ -0,0 +1,75 @@
+// PreviewMailbox.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Lock-free triple buffer handing preview images from the conversion thread to
+// the preview thread: the producer never waits, and the consumer always gets
+// the newest complete image, stale ones being overwritten.
+
+
+#pragma once
+
+#include "FrameQueue.h"
+#include <atomic>
+
+class PreviewMailbox
+{
+    static const UINT       cFresh = 4;     // set in m_nMiddle while the middle buffer has not been taken yet
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    PreviewMailbox();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~PreviewMailbox();
+
+    /// <summary>
+    /// Allocate the three buffers, before the mailbox is used
+    /// </summary>
+    /// <param name="nSize">size of an image in bytes</param>
+    void                    Allocate(UINT nSize);
+
+    /// <summary>
+    /// Set the signal to notify whenever an image is published
+    /// </summary>
+    /// <param name="pSignal">signal shared with the consumer</param>
+    void                    SetSignal(FrameSignal* pSignal) { m_pSignal = pSignal; }
+
+    /// <summary>
+    /// Producer: buffer the next image has to be written into
+    /// </summary>
+    BYTE*                   WriteBuffer() const { return m_aBuffers[m_nBack]; }
+
+    /// <summary>
+    /// Producer: publish the image written into WriteBuffer(), replacing the one not taken yet
+    /// </summary>
+    /// <param name="nWidth">width (in pixels) of the image</param>
+    /// <param name="nHeight">height (in pixels) of the image, the image fills nWidth * nHeight * 4 bytes at most Size()</param>
+    void                    Publish(UINT nWidth, UINT nHeight);
+
+    /// <summary>
+    /// Consumer: take the newest published image
+    /// </summary>
+    /// <param name="pWidth">receives the width (in pixels) of the image</param>
+    /// <param name="pHeight">receives the height (in pixels) of the image</param>
+    /// <returns>image valid until the next call, or NULL if nothing has been published since the last call</returns>
+    BYTE*                   Latest(UINT* pWidth, UINT* pHeight);
+
+    /// <summary>
+    /// Size of an image in bytes
+    /// </summary>
+    UINT                    Size() const { return m_nSize; }
+
+private:
+    BYTE*                   m_aBuffers[3];
+    UINT                    m_aWidths[3];   // image size of every buffer, travelling with the buffer
+    UINT                    m_aHeights[3];
+    UINT                    m_nSize;
+    UINT                    m_nBack;        // owned by the producer
+    std::atomic<UINT>       m_nMiddle;      // index of the buffer in between, plus cFresh
+    UINT                    m_nFront;       // owned by the consumer
+    FrameSignal*            m_pSignal;
+};
@@ -0,0 +1,921 @@
+// ReplayFrameSource.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include <strsafe.h>
+#include "ReplayFrameSource.h"
+#include "DepthCodec.h"
+#include "ColorCodec.h"
+#include "JpegEncoder.h"
+#include "FrameConverter.h"
+#include <algorithm>
+#include <string>
+
+/// <summary>
+/// Parse the header of a binary PGM (P5) or PPM (P6) file
+/// </summary>
+/// <param name="pData">file content</param>
+/// <param name="nSize">file size in bytes</param>
+/// <param name="cType">'5' or '6'</param>
+/// <param name="pWidth">receives the width</param>
+/// <param name="pHeight">receives the height</param>
+/// <param name="pOffset">receives the offset of the pixel data</param>
+/// <returns>indicates success or failure</returns>
+static bool ParsePNMHeader(const BYTE* pData, size_t nSize, char cType, int* pWidth, int* pHeight, size_t* pOffset)
+{
+    if (nSize < 2 || pData[0] != 'P' || pData[1] != cType)
+    {
+        return false;
+    }
+
+    int aValues[3] = { 0 };
+    size_t nPos = 2;
+    for (int i = 0; i < 3; ++i)
+    {
+        // skip white spaces and comments
+        while (nPos < nSize && (isspace(pData[nPos]) || pData[nPos] == '#'))
+        {
+            if (pData[nPos] == '#')
+            {
+                while (nPos < nSize && pData[nPos] != '\n') ++nPos;
+            }
+            else
+            {
+                ++nPos;
+            }
+        }
+
+        if (nPos >= nSize || !isdigit(pData[nPos]))
+        {
+            return false;
+        }
+
+        while (nPos < nSize && isdigit(pData[nPos]))
+        {
+            aValues[i] = aValues[i] * 10 + (pData[nPos++] - '0');
+        }
+    }
+
+    // a single white space separates the header from the pixel data
+    *pWidth = aValues[0];
+    *pHeight = aValues[1];
+    *pOffset = nPos + 1;
+    return *pOffset <= nSize;
+}
+
+/// <summary>
+/// Parse the header of a PAM (P7) file with the given tuple type
+/// </summary>
+static bool ParsePAMHeader(const BYTE* pData, size_t nSize, const char* szTupleType, int* pWidth, int* pHeight, size_t* pOffset)
+{
+    if (nSize < 3 || pData[0] != 'P' || pData[1] != '7' || pData[2] != '\n')
+    {
+        return false;
+    }
+
+    int nWidth = 0;
+    int nHeight = 0;
+    bool bTupleType = false;
+    size_t nPos = 3;
+    while (nPos < nSize)
+    {
+        size_t nEnd = nPos;
+        while (nEnd < nSize && pData[nEnd] != '\n') ++nEnd;
+        if (nEnd == nSize)
+        {
+            return false;
+        }
+
+        std::string strLine(reinterpret_cast<const char*>(pData + nPos), nEnd - nPos);
+        nPos = nEnd + 1;
+
+        if (strLine == "ENDHDR")
+        {
+            *pWidth = nWidth;
+            *pHeight = nHeight;
+            *pOffset = nPos;
+            return bTupleType && nWidth > 0 && nHeight > 0;
+        }
+        else if (strLine.compare(0, 6, "WIDTH ") == 0)
+        {
+            nWidth = atoi(strLine.c_str() + 6);
+        }
+        else if (strLine.compare(0, 7, "HEIGHT ") == 0)
+        {
+            nHeight = atoi(strLine.c_str() + 7);
+        }
+        else if (strLine.compare(0, 9, "TUPLTYPE ") == 0)
+        {
+            bTupleType = (strLine.compare(9, std::string::npos, szTupleType) == 0);
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Undo the mirroring and the big-endian conversion of a recorded UINT16 frame
+/// </summary>
+static void UnmirrorGray16BE(const BYTE* pSrc, UINT16* pDst, int nWidth, int nHeight)
+{
+    for (int i = 0; i < nHeight; ++i)
+    {
+        const BYTE* pRow = pSrc + (i * nWidth + nWidth - 1) * 2;
+        for (int j = 0; j < nWidth; ++j)
+        {
+            *pDst++ = static_cast<UINT16>((pRow[0] << 8) | pRow[1]);
+            pRow -= 2;
+        }
+    }
+}
+
+/// <summary>
+/// Undo the mirroring of a recorded 24-bit frame and expand it to BGRA
+/// </summary>
+/// <param name="bRGB">true for R-G-B byte order (PPM), false for B-G-R (BMP)</param>
+static void UnmirrorRGB24(const BYTE* pSrc, RGBQUAD* pDst, int nWidth, int nHeight, bool bRGB)
+{
+    for (int i = 0; i < nHeight; ++i)
+    {
+        const BYTE* pRow = pSrc + (i * nWidth + nWidth - 1) * 3;
+        for (int j = 0; j < nWidth; ++j)
+        {
+            pDst->rgbRed = bRGB ? pRow[0] : pRow[2];
+            pDst->rgbGreen = pRow[1];
+            pDst->rgbBlue = bRGB ? pRow[2] : pRow[0];
+            pDst->rgbReserved = 0xFF;
+            ++pDst;
+            pRow -= 3;
+        }
+    }
+}
+
+/// <summary>
+/// Read a whole file
+/// </summary>
+static HRESULT ReadWholeFile(LPCWSTR lpszFilePath, std::vector<BYTE>& vData)
+{
+    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    LARGE_INTEGER fileSize = { 0 };
+    HRESULT hr = GetFileSizeEx(hFile, &fileSize) ? S_OK : E_FAIL;
+
+    if (SUCCEEDED(hr))
+    {
+        DWORD dwBytesRead = 0;
+        vData.resize(static_cast<size_t>(fileSize.QuadPart));
+        if (!vData.empty() && (!ReadFile(hFile, &vData[0], static_cast<DWORD>(vData.size()), &dwBytesRead, NULL) || dwBytesRead != vData.size()))
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    CloseHandle(hFile);
+    return hr;
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="szFolder">record folder containing ir, depth and color (or ir.kvc, depth.kvc and color.kvc)</param>
+/// <param name="bMaxSpeed">deliver frames as fast as possible instead of at the recorded pace</param>
+ReplayFrameSource::ReplayFrameSource(LPCWSTR szFolder, bool bMaxSpeed) :
+m_strFolder(szFolder),
+m_bMaxSpeed(bMaxSpeed),
+m_nFirstTime(0),
+m_fFrameRate(30.0),
+m_bStarted(false),
+m_bStopThread(false),
+m_bColorYUY2(false),
+m_bRawColor(false)
+{
+    const FrameStream aStreams[3] = { FrameStream_Infrared, FrameStream_Depth, FrameStream_Color };
+    const int aWidths[3] = { cInfraredWidth, cDepthWidth, cColorWidth };
+    const int aHeights[3] = { cInfraredHeight, cDepthHeight, cColorHeight };
+    const UINT aBytesPerPixel[3] = { sizeof(UINT16), sizeof(UINT16), sizeof(RGBQUAD) };
+
+    for (int i = 0; i < 3; ++i)
+    {
+        ReplayStream& stream = m_aStreams[i];
+        stream.nStream = aStreams[i];
+        stream.nWidth = aWidths[i];
+        stream.nHeight = aHeights[i];
+        stream.nFrameSize = aWidths[i] * aHeights[i] * aBytesPerPixel[i];
+        stream.nFrameCount = 0;
+        stream.nNextRead = 0;
+        stream.current.nTime = 0;
+        stream.current.pBuffer = NULL;
+        stream.current.nColorFormat = ColorImageFormat_None;
+        stream.nDelivered = 0;
+
+        for (int j = 0; j < ReplayPrefetchDepth; ++j)
+        {
+            stream.vFree.push_back(new BYTE[stream.nFrameSize]);
+        }
+    }
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+ReplayFrameSource::~ReplayFrameSource()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStopThread = true;
+    }
+    m_cvSpace.notify_all();
+    if (m_tReadThread.joinable()) m_tReadThread.join();
+
+    for (int i = 0; i < 3; ++i)
+    {
+        ReplayStream& stream = m_aStreams[i];
+        for (size_t j = 0; j < stream.vFree.size(); ++j)
+        {
+            delete[] stream.vFree[j];
+        }
+        for (size_t j = 0; j < stream.qReady.size(); ++j)
+        {
+            delete[] stream.qReady[j].pBuffer;
+        }
+        if (stream.current.pBuffer)
+        {
+            delete[] stream.current.pBuffer;
+        }
+    }
+}
+
+/// <summary>
+/// Index the recording and start the background reader
+/// </summary>
+/// <returns>S_OK on success, otherwise failure code</returns>
+HRESULT ReplayFrameSource::Initialize()
+{
+    LoadStripes();
+
+    HRESULT hr = OpenStream(m_aStreams[0], L"ir", L"*.pgm");
+
+    if (SUCCEEDED(hr))
+    {
+        hr = OpenStream(m_aStreams[1], L"depth", L"*.pgm");
+        if (FAILED(hr))
+        {
+            hr = OpenStream(m_aStreams[1], L"depth", L"*.rvl");
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = OpenStream(m_aStreams[2], L"color", L"*.ppm");
+        if (FAILED(hr))
+        {
+            hr = OpenStream(m_aStreams[2], L"color", L"*.bmp");
+        }
+        if (FAILED(hr))
+        {
+            hr = OpenStream(m_aStreams[2], L"color", L"*.qoi");
+        }
+#ifdef USE_TURBOJPEG
+        if (FAILED(hr))
+        {
+            hr = OpenStream(m_aStreams[2], L"color", L"*.jpg");
+        }
+#endif
+        if (FAILED(hr))
+        {
+            hr = OpenStream(m_aStreams[2], L"color", L"*.pam");
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Raw color can be handed out as is (see SetRawColor)
+    ReplayStream& colorStream = m_aStreams[2];
+    if (colorStream.nFrameCount)
+    {
+        m_bColorYUY2 = colorStream.vFiles.empty() ?
+            (colorStream.cReader.GetEntry(0).nCodec == FrameCodec_YUY2) :
+            (colorStream.vFiles[0].strPath.compare(colorStream.vFiles[0].strPath.size() - 4, 4, L".pam") == 0);
+    }
+
+    // Replay relative to the earliest frame of the record
+    bool bFirst = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        ReplayStream& stream = m_aStreams[i];
+        if (stream.nFrameCount)
+        {
+            INT64 nTime = stream.vFiles.empty() ? stream.cReader.GetEntry(0).nTime : stream.vFiles[0].nTime;
+            m_nFirstTime = bFirst ? nTime : min(m_nFirstTime, nTime);
+            bFirst = false;
+        }
+    }
+
+    // Rate of the record, from the span of the stream timestamps
+    double fFrameRate = 0.0;
+    for (int i = 0; i < 3; ++i)
+    {
+        ReplayStream& stream = m_aStreams[i];
+        if (stream.nFrameCount > 1)
+        {
+            UINT nLast = stream.nFrameCount - 1;
+            INT64 nFirstTime = stream.vFiles.empty() ? stream.cReader.GetEntry(0).nTime : stream.vFiles[0].nTime;
+            INT64 nLastTime = stream.vFiles.empty() ? stream.cReader.GetEntry(nLast).nTime : stream.vFiles[nLast].nTime;
+            if (nLastTime > nFirstTime)
+            {
+                fFrameRate = max(fFrameRate, nLast * 10000000.0 / (nLastTime - nFirstTime));
+            }
+        }
+    }
+    if (fFrameRate > 0.0)
+    {
+        m_fFrameRate = fFrameRate;
+    }
+
+    m_tReadThread = std::thread(&ReplayFrameSource::ReadFrames, this);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Find the record folders of the stripes listed in the manifest, if any
+/// </summary>
+void ReplayFrameSource::LoadStripes()
+{
+    m_vStripes.assign(1, m_strFolder);
+
+    WCHAR szPath[MAX_PATH];
+    StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s", m_strFolder.c_str(), StripeManifestName);
+
+    HANDLE hFile = CreateFileW(szPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        return;
+    }
+
+    LARGE_INTEGER fileSize = { 0 };
+    std::wstring strManifest;
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart < 65536)
+    {
+        strManifest.resize(static_cast<size_t>(fileSize.QuadPart) / sizeof(WCHAR));
+        DWORD dwBytesRead = 0;
+        if (strManifest.empty() || !ReadFile(hFile, &strManifest[0], static_cast<DWORD>(strManifest.size() * sizeof(WCHAR)), &dwBytesRead, NULL))
+        {
+            strManifest.clear();
+        }
+    }
+    CloseHandle(hFile);
+
+    // One record folder per line, the first one is where the manifest was found (possibly moved since)
+    size_t nStart = (!strManifest.empty() && strManifest[0] == L'\xFEFF') ? 1 : 0;
+    bool bFirst = true;
+    while (nStart < strManifest.size())
+    {
+        size_t nEnd = strManifest.find_first_of(L"\r\n", nStart);
+        if (nEnd == std::wstring::npos)
+        {
+            nEnd = strManifest.size();
+        }
+
+        if (nEnd > nStart)
+        {
+            if (!bFirst)
+            {
+                m_vStripes.push_back(strManifest.substr(nStart, nEnd - nStart));
+            }
+            bFirst = false;
+        }
+
+        nStart = nEnd + 1;
+    }
+}
+
+/// <summary>
+/// Index the frames of a stream
+/// </summary>
+HRESULT ReplayFrameSource::OpenStream(ReplayStream& stream, LPCWSTR szName, LPCWSTR szPattern)
+{
+    WCHAR szPath[MAX_PATH];
+
+    // Container layout, the container may be on any stripe
+    for (size_t i = 0; i < m_vStripes.size(); ++i)
+    {
+        StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s.kvc", m_vStripes[i].c_str(), szName);
+        if (SUCCEEDED(stream.cReader.Open(szPath)))
+        {
+            stream.nFrameCount = stream.cReader.GetFrameCount();
+            return S_OK;
+        }
+    }
+
+    // One file per frame, named after its timestamp in seconds, either in the stream folder or sharded into its subfolders,
+    // on every stripe: sorting by time reassembles the stream
+    for (size_t i = 0; i < m_vStripes.size(); ++i)
+    {
+        LPCWSTR szFolder = m_vStripes[i].c_str();
+        StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s", szFolder, szName);
+        AddStreamFiles(stream, szPath, szPattern);
+
+        StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s\\*", szFolder, szName);
+
+        WIN32_FIND_DATAW findData;
+        HANDLE hFind = FindFirstFileW(szPath, &findData);
+        if (INVALID_HANDLE_VALUE != hFind)
+        {
+            do
+            {
+                if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && findData.cFileName[0] != L'.')
+                {
+                    StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s\\%s", szFolder, szName, findData.cFileName);
+                    AddStreamFiles(stream, szPath, szPattern);
+                }
+            } while (FindNextFileW(hFind, &findData));
+
+            FindClose(hFind);
+        }
+    }
+
+    if (stream.vFiles.empty())
+    {
+        return E_FAIL;
+    }
+
+    std::sort(stream.vFiles.begin(), stream.vFiles.end());
+    stream.nFrameCount = static_cast<UINT>(stream.vFiles.size());
+
+    return S_OK;
+}
+
+/// <summary>
+/// Add the frame files of a folder to a stream
+/// </summary>
+void ReplayFrameSource::AddStreamFiles(ReplayStream& stream, LPCWSTR szFolder, LPCWSTR szPattern)
+{
+    WCHAR szPath[MAX_PATH];
+    StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s", szFolder, szPattern);
+
+    WIN32_FIND_DATAW findData;
+    HANDLE hFind = FindFirstFileW(szPath, &findData);
+    if (INVALID_HANDLE_VALUE == hFind)
+    {
+        return;
+    }
+
+    do
+    {
+        ReplayFile file;
+        file.nTime = static_cast<INT64>(wcstod(findData.cFileName, NULL) * 10000000.0 + 0.5);
+        StringCchPrintfW(szPath, _countof(szPath), L"%s\\%s", szFolder, findData.cFileName);
+        file.strPath = szPath;
+        stream.vFiles.push_back(file);
+    } while (FindNextFileW(hFind, &findData));
+
+    FindClose(hFind);
+}
+
+/// <summary>
+/// Background reader, keeps ReplayPrefetchDepth frames decoded per stream
+/// </summary>
+void ReplayFrameSource::ReadFrames()
+{
+    while (true)
+    {
+        ReplayStream* pStream = NULL;
+        BYTE* pBuffer = NULL;
+        UINT nFrame = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (!m_bStopThread)
+            {
+                // Read the stream lagging behind the most, so that the streams stay aligned in time
+                bool bRemaining = false;
+                INT64 nOldest = 0;
+                for (int i = 0; i < 3; ++i)
+                {
+                    ReplayStream& stream = m_aStreams[i];
+                    if (stream.nNextRead >= stream.nFrameCount)
+                    {
+                        continue;
+                    }
+                    bRemaining = true;
+
+                    INT64 nTime = stream.vFiles.empty() ? stream.cReader.GetEntry(stream.nNextRead).nTime : stream.vFiles[stream.nNextRead].nTime;
+                    if (!stream.vFree.empty() && (!pStream || nTime < nOldest))
+                    {
+                        pStream = &stream;
+                        nOldest = nTime;
+                    }
+                }
+
+                if (!bRemaining)
+                {
+                    return;
+                }
+
+                if (pStream)
+                {
+                    break;
+                }
+
+                m_cvSpace.wait(lock);
+            }
+
+            if (m_bStopThread)
+            {
+                return;
+            }
+
+            pBuffer = pStream->vFree.back();
+            pStream->vFree.pop_back();
+            nFrame = pStream->nNextRead++;
+        }
+
+        INT64 nTime = 0;
+        ColorImageFormat nColorFormat = ColorImageFormat_None;
+        HRESULT hr = ReadFrame(*pStream, nFrame, pBuffer, &nTime, &nColorFormat);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (SUCCEEDED(hr))
+            {
+                ReplayFrame frame = { nTime, pBuffer, nColorFormat };
+                pStream->qReady.push_back(frame);
+            }
+            else
+            {
+                // Unreadable frames are skipped
+                pStream->vFree.push_back(pBuffer);
+                ++pStream->nDelivered;
+            }
+        }
+        m_cvReady.notify_one();
+    }
+}
+
+/// <summary>
+/// Read and decode one frame into a buffer in the layout produced by the sensor
+/// </summary>
+HRESULT ReplayFrameSource::ReadFrame(ReplayStream& stream, UINT nFrame, BYTE* pBuffer, INT64* pTime, ColorImageFormat* pColorFormat)
+{
+    *pColorFormat = (stream.nStream == FrameStream_Color) ? ColorImageFormat_Bgra : ColorImageFormat_None;
+
+    const BYTE* pPixels = NULL;
+    int nWidth = 0;
+    int nHeight = 0;
+    DWORD nSize = 0;
+    FrameCodec nCodec = FrameCodec_Gray16BE;
+
+    if (stream.vFiles.empty())
+    {
+        const FrameIndexEntry& entry = stream.cReader.GetEntry(nFrame);
+        m_vFileData.resize(entry.nSize);
+        HRESULT hr = stream.cReader.ReadFrame(nFrame, m_vFileData.data(), entry.nSize);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        *pTime = entry.nTime;
+        pPixels = m_vFileData.data();
+        nSize = entry.nSize;
+        nWidth = entry.nWidth;
+        nHeight = entry.nHeight;
+        nCodec = static_cast<FrameCodec>(entry.nCodec);
+    }
+    else
+    {
+        const ReplayFile& file = stream.vFiles[nFrame];
+        HRESULT hr = ReadWholeFile(file.strPath.c_str(), m_vFileData);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        *pTime = file.nTime;
+
+        size_t nOffset = 0;
+        const RVLFileHeader* pRVLHeader = reinterpret_cast<const RVLFileHeader*>(m_vFileData.data());
+        if (stream.nStream == FrameStream_Depth && m_vFileData.size() >= sizeof(RVLFileHeader) && pRVLHeader->nMagic == RVLFileMagic)
+        {
+            nCodec = FrameCodec_DepthRVL;
+            nWidth = pRVLHeader->nWidth;
+            nHeight = pRVLHeader->nHeight;
+            nOffset = sizeof(RVLFileHeader);
+            if (nOffset + pRVLHeader->nSize > m_vFileData.size())
+            {
+                return E_FAIL;
+            }
+        }
+        else if (stream.nStream != FrameStream_Color)
+        {
+            nCodec = FrameCodec_Gray16BE;
+            if (!ParsePNMHeader(m_vFileData.data(), m_vFileData.size(), '5', &nWidth, &nHeight, &nOffset))
+            {
+                return E_FAIL;
+            }
+        }
+        else if (ParsePAMHeader(m_vFileData.data(), m_vFileData.size(), "YUY2", &nWidth, &nHeight, &nOffset))
+        {
+            nCodec = FrameCodec_YUY2;
+        }
+        else if (ParseQOIHeader(m_vFileData.data(), static_cast<DWORD>(m_vFileData.size()), &nWidth, &nHeight))
+        {
+            nCodec = FrameCodec_QOI;
+        }
+        else if (m_vFileData.size() >= 2 && m_vFileData[0] == 0xFF && m_vFileData[1] == 0xD8)
+        {
+            // JPEG files are only checked for their size while decoding
+            nCodec = FrameCodec_JPEG;
+            nWidth = stream.nWidth;
+            nHeight = stream.nHeight;
+        }
+        else if (ParsePNMHeader(m_vFileData.data(), m_vFileData.size(), '6', &nWidth, &nHeight, &nOffset))
+        {
+            nCodec = FrameCodec_RGB24;
+        }
+        else if (m_vFileData.size() >= sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) && m_vFileData[0] == 'B' && m_vFileData[1] == 'M')
+        {
+            const BITMAPFILEHEADER* pFileHeader = reinterpret_cast<const BITMAPFILEHEADER*>(m_vFileData.data());
+            const BITMAPINFOHEADER* pInfoHeader = reinterpret_cast<const BITMAPINFOHEADER*>(m_vFileData.data() + sizeof(BITMAPFILEHEADER));
+
+            // Recorded bitmaps are stored top-down (negative height)
+            nCodec = FrameCodec_BGR24;
+            nWidth = pInfoHeader->biWidth;
+            nHeight = -pInfoHeader->biHeight;
+            nOffset = pFileHeader->bfOffBits;
+        }
+        else
+        {
+            return E_FAIL;
+        }
+
+        pPixels = m_vFileData.data() + nOffset;
+        nSize = static_cast<DWORD>(m_vFileData.size() - nOffset);
+        UINT nBytesPerPixel = (nCodec == FrameCodec_BGR24 || nCodec == FrameCodec_RGB24) ? 3 : 2;
+        if ((nCodec == FrameCodec_Gray16BE || nCodec == FrameCodec_RGB24 || nCodec == FrameCodec_BGR24 || nCodec == FrameCodec_YUY2) && nOffset + static_cast<size_t>(nWidth) * nHeight * nBytesPerPixel > m_vFileData.size())
+        {
+            return E_FAIL;
+        }
+    }
+
+    if (nWidth != stream.nWidth || nHeight != stream.nHeight)
+    {
+        return E_FAIL;
+    }
+
+    switch (nCodec)
+    {
+    case FrameCodec_Gray16BE:
+        UnmirrorGray16BE(pPixels, reinterpret_cast<UINT16*>(pBuffer), nWidth, nHeight);
+        break;
+    case FrameCodec_RGB24:
+        UnmirrorRGB24(pPixels, reinterpret_cast<RGBQUAD*>(pBuffer), nWidth, nHeight, true);
+        break;
+    case FrameCodec_BGR24:
+        UnmirrorRGB24(pPixels, reinterpret_cast<RGBQUAD*>(pBuffer), nWidth, nHeight, false);
+        break;
+    case FrameCodec_DepthRVL:
+        {
+            m_vDepthData.resize(nWidth * nHeight);
+            HRESULT hr = DecompressRVL(pPixels, nSize, m_vDepthData.data(), nWidth * nHeight);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            UnmirrorGray16BE(reinterpret_cast<const BYTE*>(m_vDepthData.data()), reinterpret_cast<UINT16*>(pBuffer), nWidth, nHeight);
+        }
+        break;
+    case FrameCodec_YUY2:
+        // Raw color is recorded as delivered by the sensor, i.e. not mirrored
+        if (nSize < static_cast<DWORD>(nWidth * nHeight * 2))
+        {
+            return E_FAIL;
+        }
+        if (m_bRawColor)
+        {
+            memcpy(pBuffer, pPixels, nWidth * nHeight * 2);
+            *pColorFormat = ColorImageFormat_Yuy2;
+        }
+        else
+        {
+            ConvertYUY2(pPixels, reinterpret_cast<RGBQUAD*>(pBuffer), nWidth, nHeight, YUVMatrix_BT601, false);
+        }
+        break;
+    case FrameCodec_QOI:
+        {
+            m_vColorData.resize(nWidth * nHeight * 3);
+            HRESULT hr = DecompressQOI(pPixels, nSize, m_vColorData.data(), nWidth, nHeight);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            UnmirrorRGB24(m_vColorData.data(), reinterpret_cast<RGBQUAD*>(pBuffer), nWidth, nHeight, true);
+        }
+        break;
+#ifdef USE_TURBOJPEG
+    case FrameCodec_JPEG:
+        {
+            m_vColorData.resize(nWidth * nHeight * 3);
+            HRESULT hr = DecompressJPEG(pPixels, nSize, m_vColorData.data(), nWidth, nHeight);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+            UnmirrorRGB24(m_vColorData.data(), reinterpret_cast<RGBQUAD*>(pBuffer), nWidth, nHeight, true);
+        }
+        break;
+#endif
+    default:
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Hand out the next frame of a stream when it is due
+/// </summary>
+HRESULT ReplayFrameSource::AcquireFrame(ReplayStream& stream, SourceFrame* pFrame)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (stream.qReady.empty())
+    {
+        return E_PENDING;
+    }
+
+    const ReplayFrame& frame = stream.qReady.front();
+
+    if (!m_bMaxSpeed)
+    {
+        if (!m_bStarted)
+        {
+            m_tStart = std::chrono::steady_clock::now();
+            m_bStarted = true;
+        }
+
+        // Unit: 100 ns
+        INT64 nElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_tStart).count() / 100;
+        if (frame.nTime - m_nFirstTime > nElapsed)
+        {
+            return E_PENDING;
+        }
+    }
+
+    // Every frame is delivered, even late ones, so that replays are reproducible
+    stream.current = frame;
+    stream.qReady.pop_front();
+    ++stream.nDelivered;
+
+    pFrame->nTime = stream.current.nTime - m_nFirstTime + cTimeBase;
+    pFrame->nWidth = stream.nWidth;
+    pFrame->nHeight = stream.nHeight;
+    pFrame->nMinReliableDistance = (stream.nStream == FrameStream_Depth) ? cMinReliableDistance : 0;
+    pFrame->nMaxReliableDistance = (stream.nStream == FrameStream_Depth) ? cMaxReliableDistance : 0;
+    pFrame->nBufferSize = (stream.current.nColorFormat == ColorImageFormat_Yuy2) ? stream.nWidth * stream.nHeight * 2 : stream.nFrameSize;
+    pFrame->pBuffer = stream.current.pBuffer;
+    pFrame->nColorFormat = stream.current.nColorFormat;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Block until the next decoded frame of any stream is due
+/// </summary>
+/// <param name="dwTimeout">longest wait in milliseconds</param>
+/// <returns>true if a frame is due, false if the wait timed out</returns>
+bool ReplayFrameSource::WaitForFrame(DWORD dwTimeout)
+{
+    std::chrono::steady_clock::time_point tDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(dwTimeout);
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true)
+    {
+        // Earliest recorded time among the frames ready to be acquired
+        bool bReady = false;
+        INT64 nNext = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const ReplayStream& stream = m_aStreams[i];
+            if (!stream.qReady.empty() && (!bReady || stream.qReady.front().nTime < nNext))
+            {
+                nNext = stream.qReady.front().nTime;
+                bReady = true;
+            }
+        }
+
+        std::chrono::steady_clock::time_point tWake = tDeadline;
+        if (bReady)
+        {
+            // Pacing starts with the first acquired frame
+            if (m_bMaxSpeed || !m_bStarted)
+            {
+                return true;
+            }
+
+            std::chrono::steady_clock::time_point tDue = m_tStart + std::chrono::nanoseconds((nNext - m_nFirstTime) * 100);
+            if (tDue <= std::chrono::steady_clock::now())
+            {
+                return true;
+            }
+            tWake = min(tWake, tDue);
+        }
+
+        if (std::chrono::steady_clock::now() >= tDeadline)
+        {
+            return false;
+        }
+
+        m_cvReady.wait_until(lock, tWake);
+    }
+}
+
+/// <summary>
+/// Give the acquired frame buffer of a stream back to the reader
+/// </summary>
+void ReplayFrameSource::ReleaseFrame(ReplayStream& stream)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!stream.current.pBuffer)
+        {
+            return;
+        }
+        stream.vFree.push_back(stream.current.pBuffer);
+        stream.current.pBuffer = NULL;
+    }
+    m_cvSpace.notify_one();
+}
+
+/// <summary>
+/// Check if every recorded frame has been delivered
+/// </summary>
+bool ReplayFrameSource::IsFinished()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int i = 0; i < 3; ++i)
+    {
+        if (m_aStreams[i].nDelivered < m_aStreams[i].nFrameCount)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+HRESULT ReplayFrameSource::AcquireInfraredFrame(SourceFrame* pFrame)
+{
+    return AcquireFrame(m_aStreams[0], pFrame);
+}
+
+HRESULT ReplayFrameSource::AcquireDepthFrame(SourceFrame* pFrame)
+{
+    return AcquireFrame(m_aStreams[1], pFrame);
+}
+
+HRESULT ReplayFrameSource::AcquireColorFrame(SourceFrame* pFrame)
+{
+    return AcquireFrame(m_aStreams[2], pFrame);
+}
+
+void ReplayFrameSource::ReleaseInfraredFrame()
+{
+    ReleaseFrame(m_aStreams[0]);
+}
+
+void ReplayFrameSource::ReleaseDepthFrame()
+{
+    ReleaseFrame(m_aStreams[1]);
+}
+
+void ReplayFrameSource::ReleaseColorFrame()
+{
+    ReleaseFrame(m_aStreams[2]);
+}
+
+/// <summary>
+/// Hand out raw color frames as is instead of converting them to BGRA
+/// </summary>
+/// <param name="bRaw">true for YUY2, false for BGRA</param>
+/// <returns>false if the color stream has not been recorded raw</returns>
+bool ReplayFrameSource::SetRawColor(bool bRaw)
+{
+    if (bRaw && !m_bColorYUY2)
+    {
+        return false;
+    }
+
+    // Frames already prefetched keep their format, SourceFrame tells them apart
+    m_bRawColor = bRaw;
+    return true;
+}
@@ -0,0 +1,158 @@
+// ReplayFrameSource.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Frame source streaming an existing recording back through the pipeline,
+// either paced by the recorded timestamps or as fast as possible.
+
+
+#pragma once
+
+#include "FrameSource.h"
+#include "FrameContainer.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/// The ReplayPrefetchDepth value specifies the number of decoded frames kept ready per stream
+#define ReplayPrefetchDepth 8
+
+class ReplayFrameSource : public FrameSource
+{
+    static const int        cInfraredWidth = 512;
+    static const int        cInfraredHeight = 424;
+    static const int        cDepthWidth = 512;
+    static const int        cDepthHeight = 424;
+    static const int        cColorWidth = 1920;
+    static const int        cColorHeight = 1080;
+    static const USHORT     cMinReliableDistance = 500;
+    static const USHORT     cMaxReliableDistance = 4500;
+
+    // Recorded times start at zero, which the recorder treats as "no start time yet"
+    static const INT64      cTimeBase = 10000000;
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="szFolder">record folder containing ir, depth and color (or ir.kvc, depth.kvc and color.kvc)</param>
+    /// <param name="bMaxSpeed">deliver frames as fast as possible instead of at the recorded pace</param>
+    ReplayFrameSource(LPCWSTR szFolder, bool bMaxSpeed);
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    virtual ~ReplayFrameSource();
+
+    /// <summary>
+    /// Index the recording and start the background reader
+    /// </summary>
+    /// <returns>S_OK on success, otherwise failure code</returns>
+    HRESULT                 Initialize();
+
+    /// <summary>
+    /// Check if every recorded frame has been delivered
+    /// </summary>
+    bool                    IsFinished();
+
+    virtual HRESULT         AcquireInfraredFrame(SourceFrame* pFrame);
+    virtual HRESULT         AcquireDepthFrame(SourceFrame* pFrame);
+    virtual HRESULT         AcquireColorFrame(SourceFrame* pFrame);
+    virtual void            ReleaseInfraredFrame();
+    virtual void            ReleaseDepthFrame();
+    virtual void            ReleaseColorFrame();
+    virtual bool            SetRawColor(bool bRaw);
+    virtual bool            WaitForFrame(DWORD dwTimeout);
+    virtual double          GetFrameRate() const { return m_fFrameRate; }
+
+private:
+    struct ReplayFile
+    {
+        INT64               nTime;
+        std::wstring        strPath;
+
+        bool operator<(const ReplayFile& other) const { return nTime < other.nTime; }
+    };
+
+    struct ReplayFrame
+    {
+        INT64               nTime;
+        BYTE*               pBuffer;
+        ColorImageFormat    nColorFormat;
+    };
+
+    struct ReplayStream
+    {
+        FrameStream         nStream;
+        int                 nWidth;
+        int                 nHeight;
+        UINT                nFrameSize;         // size of a decoded frame in bytes
+        std::vector<ReplayFile> vFiles;         // one file per frame layout
+        FrameContainerReader cReader;           // container layout
+        UINT                nFrameCount;
+        UINT                nNextRead;          // next frame to be read by the background reader
+        std::deque<ReplayFrame> qReady;         // decoded frames waiting to be acquired
+        std::vector<BYTE*>  vFree;              // decoded frame buffers not in use
+        ReplayFrame         current;            // frame currently acquired
+        UINT                nDelivered;
+    };
+
+    std::wstring            m_strFolder;
+    std::vector<std::wstring> m_vStripes;       // record folders of a striped record, m_strFolder first
+    bool                    m_bMaxSpeed;
+    ReplayStream            m_aStreams[3];
+    INT64                   m_nFirstTime;
+    double                  m_fFrameRate;       // recorded rate of the fastest stream, even when replayed at max speed
+    bool                    m_bStarted;
+    std::chrono::steady_clock::time_point m_tStart;
+
+    std::thread             m_tReadThread;
+    std::mutex              m_mutex;
+    std::condition_variable m_cvSpace;
+    std::condition_variable m_cvReady;          // signaled when the reader has decoded a frame
+    bool                    m_bStopThread;
+    std::vector<BYTE>       m_vFileData;
+    std::vector<UINT16>     m_vDepthData;
+    std::vector<BYTE>       m_vColorData;
+    bool                    m_bColorYUY2;       // the color stream has been recorded raw
+    std::atomic<bool>       m_bRawColor;        // hand raw color frames out as is, set by the UI thread while the read thread runs
+
+    /// <summary>
+    /// Find the record folders of the stripes listed in the manifest, if any
+    /// </summary>
+    void                    LoadStripes();
+
+    /// <summary>
+    /// Index the frames of a stream
+    /// </summary>
+    HRESULT                 OpenStream(ReplayStream& stream, LPCWSTR szName, LPCWSTR szPattern);
+
+    /// <summary>
+    /// Add the frame files of a folder to a stream
+    /// </summary>
+    void                    AddStreamFiles(ReplayStream& stream, LPCWSTR szFolder, LPCWSTR szPattern);
+
+    /// <summary>
+    /// Background reader, keeps ReplayPrefetchDepth frames decoded per stream
+    /// </summary>
+    void                    ReadFrames();
+
+    /// <summary>
+    /// Read and decode one frame into a buffer in the layout produced by the sensor
+    /// </summary>
+    HRESULT                 ReadFrame(ReplayStream& stream, UINT nFrame, BYTE* pBuffer, INT64* pTime, ColorImageFormat* pColorFormat);
+
+    /// <summary>
+    /// Hand out the next frame of a stream when it is due
+    /// </summary>
+    HRESULT                 AcquireFrame(ReplayStream& stream, SourceFrame* pFrame);
+
+    /// <summary>
+    /// Give the acquired frame buffer of a stream back to the reader
+    /// </summary>
+    void                    ReleaseFrame(ReplayStream& stream);
+};
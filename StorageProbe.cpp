@@ -0,0 +1,430 @@
+// StorageProbe.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "stdafx.h"
+#include <strsafe.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "StorageProbe.h"
+#include "FrameContainer.h"
+
+/// <summary>
+/// Writes and timings of one stream of the probe
+/// </summary>
+struct ProbeLane
+{
+    const StorageProbeStream* pStream;
+    UINT                    nIndex;         // stream index, places the container on a stripe
+    HANDLE                  hContainer;     // container mode
+    UINT64                  nPending;       // container mode: bytes waiting for a full chunk
+    UINT                    nFrames;
+    UINT64                  nBytes;
+    double                  fSyncMs;        // total time spent flushing to disk
+    UINT                    nSyncs;
+    std::vector<float>      vLatencies;     // ms per frame file, or per chunk in container mode
+    HRESULT                 hr;
+};
+
+/// <summary>
+/// Elapsed time since a counter value in milliseconds
+/// </summary>
+static double ElapsedMs(double fFreq, const LARGE_INTEGER& qpcStart)
+{
+    LARGE_INTEGER qpcNow = { 0 };
+    QueryPerformanceCounter(&qpcNow);
+    return 1000.0 * (qpcNow.QuadPart - qpcStart.QuadPart) / fFreq;
+}
+
+/// <summary>
+/// Path of a probe frame file, striped across the folders by frame number as the recorder does
+/// </summary>
+static void FormatProbeFramePath(LPWSTR szPath, size_t cchPath, const StorageProbeConfig& config, const ProbeLane& lane, UINT nFrame)
+{
+    StringCchPrintfW(szPath, cchPath, L"%s\\probe\\%s\\%06u.%s",
+        config.vFolders[nFrame % config.vFolders.size()].c_str(), lane.pStream->szName, nFrame, lane.pStream->szExtension);
+}
+
+/// <summary>
+/// Path of a probe container, one stream per stripe as the recorder does
+/// </summary>
+static void FormatProbeContainerPath(LPWSTR szPath, size_t cchPath, const StorageProbeConfig& config, const ProbeLane& lane)
+{
+    StringCchPrintfW(szPath, cchPath, L"%s\\probe\\%s.kvc",
+        config.vFolders[lane.nIndex % config.vFolders.size()].c_str(), lane.pStream->szName);
+}
+
+/// <summary>
+/// Write the next frame of a lane the way the recorder does
+/// </summary>
+static HRESULT WriteProbeFrame(const StorageProbeConfig& config, ProbeLane& lane, const BYTE* pData, double fFreq)
+{
+    DWORD nFrameSize = lane.pStream->nFrameSize;
+    bool bSync = (0 == (lane.nFrames + 1) % StorageProbeSyncInterval);
+    DWORD dwBytesWritten = 0;
+    LARGE_INTEGER qpcStart = { 0 };
+    QueryPerformanceCounter(&qpcStart);
+
+    if (config.bContainer)
+    {
+        // Frames are gathered into chunks, only a full chunk reaches the file
+        lane.nPending += nFrameSize;
+        while (lane.nPending >= ContainerChunkSize)
+        {
+            if (!WriteFile(lane.hContainer, pData, ContainerChunkSize, &dwBytesWritten, NULL))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+            lane.nPending -= ContainerChunkSize;
+            lane.nBytes += ContainerChunkSize;
+            lane.vLatencies.push_back(static_cast<float>(ElapsedMs(fFreq, qpcStart)));
+        }
+
+        if (bSync)
+        {
+            LARGE_INTEGER qpcSync = { 0 };
+            QueryPerformanceCounter(&qpcSync);
+            FlushFileBuffers(lane.hContainer);
+            lane.fSyncMs += ElapsedMs(fFreq, qpcSync);
+            ++lane.nSyncs;
+        }
+    }
+    else
+    {
+        WCHAR szPath[MAX_PATH];
+        FormatProbeFramePath(szPath, _countof(szPath), config, lane, lane.nFrames);
+
+        HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (INVALID_HANDLE_VALUE == hFile)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        // File header, then the pixels, as SaveToPGM and friends do
+        DWORD nHeaderSize = min(nFrameSize, static_cast<DWORD>(32));
+        if (!WriteFile(hFile, pData, nHeaderSize, &dwBytesWritten, NULL) ||
+            !WriteFile(hFile, pData + nHeaderSize, nFrameSize - nHeaderSize, &dwBytesWritten, NULL))
+        {
+            HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+            CloseHandle(hFile);
+            return hr;
+        }
+
+        if (bSync)
+        {
+            LARGE_INTEGER qpcSync = { 0 };
+            QueryPerformanceCounter(&qpcSync);
+            FlushFileBuffers(hFile);
+            lane.fSyncMs += ElapsedMs(fFreq, qpcSync);
+            ++lane.nSyncs;
+        }
+
+        CloseHandle(hFile);
+        lane.nBytes += nFrameSize;
+        lane.vLatencies.push_back(static_cast<float>(ElapsedMs(fFreq, qpcStart)));
+    }
+
+    ++lane.nFrames;
+    return S_OK;
+}
+
+/// <summary>
+/// Container mode: write the last, partly filled chunk of a lane and flush the container to disk,
+/// as closing a container does, so that every frame counted has reached the target
+/// </summary>
+static HRESULT FinishProbeContainer(ProbeLane& lane, const BYTE* pData, double fFreq)
+{
+    LARGE_INTEGER qpcStart = { 0 };
+    QueryPerformanceCounter(&qpcStart);
+
+    if (lane.nPending)
+    {
+        DWORD dwBytesWritten = 0;
+        if (!WriteFile(lane.hContainer, pData, static_cast<DWORD>(lane.nPending), &dwBytesWritten, NULL))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        lane.nBytes += lane.nPending;
+        lane.nPending = 0;
+    }
+
+    if (!FlushFileBuffers(lane.hContainer))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    lane.vLatencies.push_back(static_cast<float>(ElapsedMs(fFreq, qpcStart)));
+    return S_OK;
+}
+
+/// <summary>
+/// Remove the probe files and folders
+/// </summary>
+static void RemoveProbeFiles(const StorageProbeConfig& config, const std::vector<ProbeLane>& vLanes)
+{
+    WCHAR szPath[MAX_PATH];
+
+    for (size_t i = 0; i < vLanes.size(); ++i)
+    {
+        const ProbeLane& lane = vLanes[i];
+        if (config.bContainer)
+        {
+            FormatProbeContainerPath(szPath, _countof(szPath), config, lane);
+            DeleteFileW(szPath);
+            continue;
+        }
+
+        for (UINT nFrame = 0; nFrame < lane.nFrames; ++nFrame)
+        {
+            FormatProbeFramePath(szPath, _countof(szPath), config, lane, nFrame);
+            DeleteFileW(szPath);
+        }
+
+        for (size_t j = 0; j < config.vFolders.size(); ++j)
+        {
+            StringCchPrintfW(szPath, _countof(szPath), L"%s\\probe\\%s", config.vFolders[j].c_str(), lane.pStream->szName);
+            RemoveDirectoryW(szPath);
+        }
+    }
+
+    for (size_t j = 0; j < config.vFolders.size(); ++j)
+    {
+        StringCchPrintfW(szPath, _countof(szPath), L"%s\\probe", config.vFolders[j].c_str());
+        RemoveDirectoryW(szPath);
+    }
+}
+
+/// <summary>
+/// Write probe frames to the record target, remove them and report what the target sustains
+/// </summary>
+/// <param name="config">frames and target to probe</param>
+/// <param name="szReport">receives the throughput, the write latencies and the sustainable frame rate and record length</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if the target sustains the target frame rate, S_FALSE if not, a failure code if it cannot be written</returns>
+HRESULT RunStorageProbe(const StorageProbeConfig& config, LPWSTR szReport, size_t cchReport)
+{
+    LARGE_INTEGER qpcFreq = { 0 };
+    if (config.vFolders.empty() || config.vStreams.empty() || !QueryPerformanceFrequency(&qpcFreq))
+    {
+        return E_INVALIDARG;
+    }
+    double fFreq = double(qpcFreq.QuadPart);
+
+    // Never fill more than half of the emptiest target
+    UINT64 nFreeBytes = ~0ULL;
+    for (size_t i = 0; i < config.vFolders.size(); ++i)
+    {
+        ULARGE_INTEGER freeBytes = { 0 };
+        if (!GetDiskFreeSpaceExW(config.vFolders[i].c_str(), &freeBytes, NULL, NULL))
+        {
+            StringCchPrintfW(szReport, cchReport, L"Cannot access %s\n", config.vFolders[i].c_str());
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        nFreeBytes = min(nFreeBytes, freeBytes.QuadPart);
+    }
+    const UINT64 nBudget = nFreeBytes / 2 * config.vFolders.size();
+
+    // Create the probe folders and containers
+    WCHAR szPath[MAX_PATH];
+    std::vector<ProbeLane> vLanes(config.vStreams.size());
+    DWORD nMaxFrameSize = ContainerChunkSize;
+    HRESULT hr = S_OK;
+    for (size_t j = 0; j < config.vFolders.size(); ++j)
+    {
+        StringCchPrintfW(szPath, _countof(szPath), L"%s\\probe", config.vFolders[j].c_str());
+        CreateDirectoryW(szPath, NULL);
+    }
+
+    for (size_t i = 0; i < vLanes.size(); ++i)
+    {
+        ProbeLane& lane = vLanes[i];
+        lane.pStream = &config.vStreams[i];
+        lane.nIndex = static_cast<UINT>(i);
+        lane.hContainer = INVALID_HANDLE_VALUE;
+        lane.nPending = 0;
+        lane.nFrames = 0;
+        lane.nBytes = 0;
+        lane.fSyncMs = 0;
+        lane.nSyncs = 0;
+        lane.hr = S_OK;
+        lane.vLatencies.reserve(static_cast<size_t>(config.nSeconds * config.fTargetFps * 4));
+        nMaxFrameSize = max(nMaxFrameSize, lane.pStream->nFrameSize);
+
+        if (config.bContainer)
+        {
+            FormatProbeContainerPath(szPath, _countof(szPath), config, lane);
+            lane.hContainer = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (INVALID_HANDLE_VALUE == lane.hContainer)
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < config.vFolders.size(); ++j)
+            {
+                StringCchPrintfW(szPath, _countof(szPath), L"%s\\probe\\%s", config.vFolders[j].c_str(), lane.pStream->szName);
+                CreateDirectoryW(szPath, NULL);
+            }
+        }
+    }
+
+    // Noise, so that a compressing file system does not flatter the target
+    BYTE* pData = reinterpret_cast<BYTE*>(VirtualAlloc(NULL, nMaxFrameSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!pData)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+    else
+    {
+        UINT nSeed = 1;
+        for (DWORD i = 0; i < nMaxFrameSize; ++i)
+        {
+            nSeed = nSeed * 1103515245 + 12345;
+            pData[i] = static_cast<BYTE>(nSeed >> 16);
+        }
+    }
+
+    // Every thread writes its streams in turn, as fast as the target takes them
+    LARGE_INTEGER qpcStart = { 0 };
+    QueryPerformanceCounter(&qpcStart);
+    double fElapsedMs = 0;
+
+    if (SUCCEEDED(hr))
+    {
+        const double fDurationMs = 1000.0 * config.nSeconds;
+        const UINT nThreads = max(1U, min(config.nThreads, static_cast<UINT>(vLanes.size())));
+        std::atomic<UINT64> nWritten(0);
+        std::vector<std::thread> vThreads;
+
+        for (UINT t = 0; t < nThreads; ++t)
+        {
+            vThreads.push_back(std::thread([&, t]
+            {
+                bool bRunning = true;
+                while (bRunning)
+                {
+                    for (size_t i = t; i < vLanes.size() && bRunning; i += nThreads)
+                    {
+                        UINT64 nBefore = vLanes[i].nBytes;
+                        vLanes[i].hr = WriteProbeFrame(config, vLanes[i], pData, fFreq);
+                        nWritten += vLanes[i].nBytes - nBefore;
+
+                        bRunning = SUCCEEDED(vLanes[i].hr) && nWritten < nBudget && ElapsedMs(fFreq, qpcStart) < fDurationMs;
+                    }
+                }
+            }));
+        }
+
+        for (size_t t = 0; t < vThreads.size(); ++t)
+        {
+            vThreads[t].join();
+        }
+
+        // The frames of the last chunk are only written once the containers are committed, the timer runs until then
+        if (config.bContainer)
+        {
+            for (size_t i = 0; i < vLanes.size(); ++i)
+            {
+                if (SUCCEEDED(vLanes[i].hr))
+                {
+                    vLanes[i].hr = FinishProbeContainer(vLanes[i], pData, fFreq);
+                }
+            }
+        }
+        fElapsedMs = ElapsedMs(fFreq, qpcStart);
+
+        for (size_t i = 0; i < vLanes.size(); ++i)
+        {
+            if (FAILED(vLanes[i].hr))
+            {
+                hr = vLanes[i].hr;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < vLanes.size(); ++i)
+    {
+        if (INVALID_HANDLE_VALUE != vLanes[i].hContainer)
+        {
+            CloseHandle(vLanes[i].hContainer);
+        }
+    }
+    RemoveProbeFiles(config, vLanes);
+
+    if (pData)
+    {
+        VirtualFree(pData, 0, MEM_RELEASE);
+    }
+
+    if (FAILED(hr))
+    {
+        StringCchPrintfW(szReport, cchReport, L"Writing to the record target failed (0x%08X)\n", hr);
+        return hr;
+    }
+
+    // The slowest stream bounds the frame rate of the record
+    double fMaxFps = 1e9;
+    double fRequiredRate = 0;
+    double fSyncMs = 0;
+    UINT nSyncs = 0;
+    UINT64 nBytes = 0;
+    std::vector<float> vLatencies;
+    for (size_t i = 0; i < vLanes.size(); ++i)
+    {
+        const ProbeLane& lane = vLanes[i];
+        fMaxFps = min(fMaxFps, 1000.0 * lane.nFrames / fElapsedMs);
+        fRequiredRate += config.fTargetFps * lane.pStream->nFrameSize;
+        fSyncMs += lane.fSyncMs;
+        nSyncs += lane.nSyncs;
+        nBytes += lane.nBytes;
+        vLatencies.insert(vLatencies.end(), lane.vLatencies.begin(), lane.vLatencies.end());
+    }
+    std::sort(vLatencies.begin(), vLatencies.end());
+
+    const double cMB = 1024.0 * 1024.0;
+    double fRate = 1000.0 * nBytes / fElapsedMs;
+    double fMedianMs = vLatencies.empty() ? 0 : vLatencies[vLatencies.size() / 2];
+    double fTailMs = vLatencies.empty() ? 0 : vLatencies[vLatencies.size() * 99 / 100];
+    double fWorstMs = vLatencies.empty() ? 0 : vLatencies.back();
+    double fQueueMs = 1000.0 * config.nQueueDepth / config.fTargetFps;
+
+    WCHAR szLine[256];
+    StringCchPrintfW(szReport, cchReport, L"%s, %u writer thread(s), %.1f s\n",
+        config.bContainer ? L"Containers" : L"One file per frame", max(1U, min(config.nThreads, static_cast<UINT>(vLanes.size()))), fElapsedMs / 1000.0);
+    StringCchPrintfW(szLine, _countof(szLine), L"Sustained: %.1f MB/s (needed at %.0f fps: %.1f MB/s)\n", fRate / cMB, config.fTargetFps, fRequiredRate / cMB);
+    StringCchCatW(szReport, cchReport, szLine);
+    StringCchPrintfW(szLine, _countof(szLine), L"Write latency per %s: median %.1f ms, 99%% %.1f ms, worst %.1f ms\n",
+        config.bContainer ? L"chunk" : L"frame", fMedianMs, fTailMs, fWorstMs);
+    StringCchCatW(szReport, cchReport, szLine);
+    StringCchPrintfW(szLine, _countof(szLine), L"Flush to disk: %.1f ms on average\n", nSyncs ? fSyncMs / nSyncs : 0.0);
+    StringCchCatW(szReport, cchReport, szLine);
+    StringCchPrintfW(szLine, _countof(szLine), L"Maximum frame rate: %.1f fps\n", fMaxFps);
+    StringCchCatW(szReport, cchReport, szLine);
+
+    // Below the target rate, the queues fill up at the difference; above it, the free space is the limit
+    HRESULT hrResult = S_OK;
+    if (fMaxFps < config.fTargetFps)
+    {
+        double fFillSeconds = config.nQueueDepth / (config.fTargetFps - fMaxFps);
+        StringCchPrintfW(szLine, _countof(szLine), L"Frames are dropped after about %.1f s (queue of %u frames)\n", fFillSeconds, config.nQueueDepth);
+        hrResult = S_FALSE;
+    }
+    else
+    {
+        double fMinutes = (fRequiredRate > 0) ? nFreeBytes * config.vFolders.size() / fRequiredRate / 60.0 : 0;
+        StringCchPrintfW(szLine, _countof(szLine), L"Sustainable record length: about %.0f min (free space)\n", fMinutes);
+    }
+    StringCchCatW(szReport, cchReport, szLine);
+
+    if (fWorstMs > fQueueMs)
+    {
+        StringCchPrintfW(szLine, _countof(szLine), L"Warning: the worst stall exceeds the %.0f ms the queue absorbs\n", fQueueMs);
+        StringCchCatW(szReport, cchReport, szLine);
+        hrResult = S_FALSE;
+    }
+
+    return hrResult;
+}
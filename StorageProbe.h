@@ -0,0 +1,52 @@
+// StorageProbe.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Pre-flight benchmark of the record target: writes frames of the recorded sizes
+// with the write pattern of the recorder, then predicts the frame rate and the
+// record length the target sustains before the queues overflow.
+
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+/// The StorageProbeDefaultSeconds value specifies how long the storage probe writes by default
+#define StorageProbeDefaultSeconds 10
+
+/// The StorageProbeSyncInterval value specifies every how many frames of a stream the probe flushes the file to disk
+#define StorageProbeSyncInterval 30
+
+/// <summary>
+/// Frames of one stream, as written by the recorder
+/// </summary>
+struct StorageProbeStream
+{
+    LPCWSTR                 szName;         // stream folder (or container) name, e.g. ir
+    LPCWSTR                 szExtension;    // extension of the frame files, e.g. pgm
+    DWORD                   nFrameSize;     // bytes per frame, file header included
+};
+
+/// <summary>
+/// What to write and how
+/// </summary>
+struct StorageProbeConfig
+{
+    std::vector<std::wstring> vFolders;     // record roots, frames are striped across them as in a record
+    std::vector<StorageProbeStream> vStreams;
+    bool                    bContainer;     // one container per stream written in ContainerChunkSize chunks, instead of one file per frame
+    UINT                    nThreads;       // writer threads, the streams are handed out to them in turn
+    UINT                    nSeconds;       // how long to write
+    double                  fTargetFps;     // frame rate of every stream while recording
+    UINT                    nQueueDepth;    // frames a stream can queue before frames are dropped
+};
+
+/// <summary>
+/// Write probe frames to the record target, remove them and report what the target sustains
+/// </summary>
+/// <param name="config">frames and target to probe</param>
+/// <param name="szReport">receives the throughput, the write latencies and the sustainable frame rate and record length</param>
+/// <param name="cchReport">size of szReport in characters</param>
+/// <returns>S_OK if the target sustains the target frame rate, S_FALSE if not, a failure code if it cannot be written</returns>
+HRESULT RunStorageProbe(const StorageProbeConfig& config, LPWSTR szReport, size_t cchReport);
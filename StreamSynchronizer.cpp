@@ -0,0 +1,179 @@
+// StreamSynchronizer.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "StreamSynchronizer.h"
+#include <cstdlib>
+
+static const UINT cAllStreams = (1 << FrameStream_Infrared) | (1 << FrameStream_Depth) | (1 << FrameStream_Color);
+
+/// <summary>
+/// Constructor
+/// </summary>
+StreamSynchronizer::StreamSynchronizer() :
+m_nResyncThreshold(300000),
+m_nRelockOffset(0),
+m_nRelockCount(0)
+{
+    m_aOffsets[FrameStream_Infrared] = 0;
+    m_aOffsets[FrameStream_Depth] = 0;
+    m_aOffsets[FrameStream_Color] = SyncColorOffset;
+}
+
+/// <summary>
+/// Add a frame and match what can be matched
+/// </summary>
+/// <param name="nStream">stream of the frame</param>
+/// <param name="nTime">timestamp of the frame</param>
+void StreamSynchronizer::AddFrame(FrameStream nStream, INT64 nTime)
+{
+    m_aPending[nStream].push_back(nTime);
+    Match();
+}
+
+/// <summary>
+/// Take the oldest event
+/// </summary>
+/// <param name="pEvent">receives the event</param>
+/// <returns>false if there is no event</returns>
+bool StreamSynchronizer::NextEvent(SyncEvent* pEvent)
+{
+    if (m_qEvents.empty())
+    {
+        return false;
+    }
+
+    *pEvent = m_qEvents.front();
+    m_qEvents.pop_front();
+    return true;
+}
+
+/// <summary>
+/// Forget the pending frames and events, keeping the measured offsets
+/// </summary>
+void StreamSynchronizer::Reset()
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        m_aPending[i].clear();
+    }
+    m_qEvents.clear();
+    m_nRelockCount = 0;
+}
+
+/// <summary>
+/// Turn the pending frames into events as far as they can be decided
+/// </summary>
+void StreamSynchronizer::Match()
+{
+    for (;;)
+    {
+        // Wait for a frame of every stream, unless one of them has run too far ahead
+        UINT nPresent = 0;
+        size_t nMaxPending = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (!m_aPending[i].empty())
+            {
+                nPresent |= 1 << i;
+                nMaxPending = max(nMaxPending, m_aPending[i].size());
+            }
+        }
+
+        if (!nPresent || (nPresent != cAllStreams && nMaxPending <= SyncLookAhead))
+        {
+            return;
+        }
+
+        // The oldest offset-corrected frame opens the window, the frames inside it belong together
+        INT64 nOldest = 0;
+        bool bFirst = true;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (nPresent & (1 << i))
+            {
+                INT64 nCorrected = m_aPending[i].front() - m_aOffsets[i];
+                if (bFirst || nCorrected < nOldest)
+                {
+                    nOldest = nCorrected;
+                    bFirst = false;
+                }
+            }
+        }
+
+        UINT nStreams = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            if ((nPresent & (1 << i)) && m_aPending[i].front() - m_aOffsets[i] - nOldest <= SyncTolerance)
+            {
+                nStreams |= 1 << i;
+            }
+        }
+
+        if (nStreams == cAllStreams)
+        {
+            // Follow the slow drift of the offsets
+            INT64 nDepthTime = m_aPending[FrameStream_Depth].front();
+            m_aOffsets[FrameStream_Infrared] += (m_aPending[FrameStream_Infrared].front() - nDepthTime - m_aOffsets[FrameStream_Infrared]) / 8;
+            m_aOffsets[FrameStream_Color] += (m_aPending[FrameStream_Color].front() - nDepthTime - m_aOffsets[FrameStream_Color]) / 8;
+            m_nRelockCount = 0;
+            Emit(SyncEvent_Frameset, cAllStreams);
+            continue;
+        }
+
+        // Infrared and depth agree while color comes later than expected: once the same color offset
+        // has been seen often enough in a row (and stays below the threshold), it is adopted
+        const UINT nInfraredDepth = (1 << FrameStream_Infrared) | (1 << FrameStream_Depth);
+        if (nPresent == cAllStreams && nStreams == nInfraredDepth)
+        {
+            INT64 nProposed = m_aPending[FrameStream_Color].front() - m_aPending[FrameStream_Depth].front();
+            if (nProposed < m_nResyncThreshold)
+            {
+                if (m_nRelockCount && abs(nProposed - m_nRelockOffset) <= SyncTolerance)
+                {
+                    ++m_nRelockCount;
+                }
+                else
+                {
+                    m_nRelockOffset = nProposed;
+                    m_nRelockCount = 1;
+                }
+
+                if (m_nRelockCount >= SyncRelockFrames)
+                {
+                    m_aOffsets[FrameStream_Color] = nProposed;
+                    m_nRelockCount = 0;
+                    Emit(SyncEvent_Resync, cAllStreams);
+                    continue;
+                }
+            }
+        }
+
+        Emit(SyncEvent_Unmatched, nStreams);
+    }
+}
+
+/// <summary>
+/// Queue an event built from the oldest pending frame of the given streams, and drop those frames
+/// (a resync event leaves them pending for the frameset which follows)
+/// </summary>
+void StreamSynchronizer::Emit(SyncEventType nType, UINT nStreams)
+{
+    SyncEvent event = { nType, nStreams, { 0, 0, 0 } };
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (nStreams & (1 << i))
+        {
+            event.aTimes[i] = m_aPending[i].front();
+            if (nType != SyncEvent_Resync)
+            {
+                m_aPending[i].pop_front();
+            }
+        }
+    }
+
+    m_qEvents.push_back(event);
+}
@@ -0,0 +1,105 @@
+// StreamSynchronizer.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Pairs the infrared, depth and color frames into framesets by timestamp.
+// Infrared and depth share the timestamp of their exposure, color follows a few
+// milliseconds later: the offset of every stream to depth is measured on the
+// matched framesets, and frames without partners are reported instead of paired.
+
+
+#pragma once
+
+#include "FrameContainer.h"
+#include <deque>
+
+/// The SyncLookAhead value specifies how many frames a stream may run ahead before the partners it waits for are given up
+#define SyncLookAhead 4
+
+/// The SyncTolerance value specifies how far apart (unit: 100 ns) the offset-corrected timestamps of a frameset may be
+#define SyncTolerance 50000
+
+/// The SyncColorOffset value specifies the initial offset (unit: 100 ns) of color to depth, about 6 ms on Kinect V2
+#define SyncColorOffset 60000
+
+/// The SyncRelockFrames value specifies how many framesets in a row must agree on a new offset before it is adopted
+#define SyncRelockFrames 3
+
+/// <summary>
+/// Kind of synchronization event
+/// </summary>
+enum SyncEventType
+{
+    SyncEvent_Frameset = 0,     // one frame of every stream
+    SyncEvent_Unmatched,        // frames given up without partners
+    SyncEvent_Resync            // the offset of a stream has been measured again, the frames follow as a frameset
+};
+
+/// <summary>
+/// Output of the synchronizer
+/// </summary>
+struct SyncEvent
+{
+    SyncEventType           nType;
+    UINT                    nStreams;       // one bit per FrameStream present in the event
+    INT64                   aTimes[3];      // timestamps of the present frames, indexed by FrameStream
+};
+
+class StreamSynchronizer
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    StreamSynchronizer();
+
+    /// <summary>
+    /// Set the offset change from which a stream is considered out of sync rather than late
+    /// </summary>
+    /// <param name="nThreshold">largest offset to depth (unit: 100 ns) a stream is relocked to</param>
+    void                    SetResyncThreshold(INT64 nThreshold) { m_nResyncThreshold = nThreshold; }
+
+    /// <summary>
+    /// Add a frame and match what can be matched
+    /// </summary>
+    /// <param name="nStream">stream of the frame</param>
+    /// <param name="nTime">timestamp of the frame</param>
+    void                    AddFrame(FrameStream nStream, INT64 nTime);
+
+    /// <summary>
+    /// Take the oldest event
+    /// </summary>
+    /// <param name="pEvent">receives the event</param>
+    /// <returns>false if there is no event</returns>
+    bool                    NextEvent(SyncEvent* pEvent);
+
+    /// <summary>
+    /// Measured offset of a stream to depth
+    /// </summary>
+    /// <param name="nStream">stream</param>
+    /// <returns>offset in milliseconds</returns>
+    double                  GetOffset(FrameStream nStream) const { return m_aOffsets[nStream] / 10000.0; }
+
+    /// <summary>
+    /// Forget the pending frames and events, keeping the measured offsets
+    /// </summary>
+    void                    Reset();
+
+private:
+    std::deque<INT64>       m_aPending[3];
+    std::deque<SyncEvent>   m_qEvents;
+    INT64                   m_aOffsets[3];      // expected timestamp difference to depth
+    INT64                   m_nResyncThreshold;
+    INT64                   m_nRelockOffset;    // color offset proposed by the framesets that did not match
+    UINT                    m_nRelockCount;
+
+    /// <summary>
+    /// Turn the pending frames into events as far as they can be decided
+    /// </summary>
+    void                    Match();
+
+    /// <summary>
+    /// Queue an event built from the oldest pending frame of the given streams, and drop those frames
+    /// </summary>
+    void                    Emit(SyncEventType nType, UINT nStreams);
+};
@@ -0,0 +1,251 @@
+// SyntheticFrameSource.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "SyntheticFrameSource.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="fFps">frame rate of every stream</param>
+/// <param name="nJitter">maximum timestamp jitter (unit: 100 ns)</param>
+/// <param name="nColorOffset">delay of the color frames relative to infrared/depth (unit: 100 ns)</param>
+/// <param name="nSensorId">id of the virtual sensor, varies the content and the jitter sequence</param>
+SyntheticFrameSource::SyntheticFrameSource(double fFps, INT64 nJitter, INT64 nColorOffset, UINT nSensorId) :
+m_tStart(std::chrono::steady_clock::now()),
+m_nPeriod(static_cast<INT64>(10000000.0 / (fFps > 0 ? fFps : 30.0))),
+m_nJitter(nJitter),
+m_nColorOffset(nColorOffset),
+m_nSensorId(nSensorId),
+m_nInfraredFrame(-1),
+m_nDepthFrame(-1),
+m_nColorFrame(-1),
+m_pInfrared(NULL),
+m_pDepth(NULL),
+m_pColor(NULL),
+m_bRawColor(false)
+{
+    m_pInfrared = new UINT16[cInfraredWidth * cInfraredHeight];
+    m_pDepth = new UINT16[cDepthWidth * cDepthHeight];
+    m_pColor = new RGBQUAD[cColorWidth * cColorHeight];
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+SyntheticFrameSource::~SyntheticFrameSource()
+{
+    delete[] m_pInfrared;
+    delete[] m_pDepth;
+    delete[] m_pColor;
+}
+
+/// <summary>
+/// Find the latest frame due at the current time
+/// </summary>
+/// <param name="nOffset">delay of the stream relative to the start (unit: 100 ns)</param>
+/// <param name="nLastFrame">last frame handed out for the stream</param>
+/// <returns>frame number, or -1 if no new frame is due</returns>
+INT64 SyntheticFrameSource::LatestFrame(INT64 nOffset, INT64 nLastFrame) const
+{
+    // Unit: 100 ns
+    INT64 nElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_tStart).count() / 100;
+    if (nElapsed < nOffset)
+    {
+        return -1;
+    }
+
+    // Like AcquireLatestFrame, frames missed by a slow consumer are skipped
+    INT64 nFrame = (nElapsed - nOffset) / m_nPeriod;
+    return (nFrame > nLastFrame) ? nFrame : -1;
+}
+
+/// <summary>
+/// Sleep until the next frame of any stream is due
+/// </summary>
+/// <param name="dwTimeout">longest wait in milliseconds</param>
+/// <returns>true if a frame is due, false if the wait timed out</returns>
+bool SyntheticFrameSource::WaitForFrame(DWORD dwTimeout)
+{
+    // Unit: 100 ns
+    INT64 nNext = (min(m_nInfraredFrame, m_nDepthFrame) + 1) * m_nPeriod;
+    nNext = min(nNext, m_nColorOffset + (m_nColorFrame + 1) * m_nPeriod);
+
+    std::chrono::steady_clock::time_point tDue = m_tStart + std::chrono::nanoseconds(nNext * 100);
+    std::chrono::steady_clock::time_point tDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(dwTimeout);
+    if (tDue > tDeadline)
+    {
+        std::this_thread::sleep_until(tDeadline);
+        return false;
+    }
+
+    std::this_thread::sleep_until(tDue);
+    return true;
+}
+
+/// <summary>
+/// Deterministic timestamp jitter of a frame
+/// </summary>
+/// <param name="nFrame">frame number</param>
+/// <param name="nStream">0 for infrared/depth, 1 for color</param>
+/// <returns>jitter in [-m_nJitter, m_nJitter] (unit: 100 ns)</returns>
+INT64 SyntheticFrameSource::Jitter(INT64 nFrame, UINT nStream) const
+{
+    if (m_nJitter <= 0)
+    {
+        return 0;
+    }
+
+    // splitmix64 of (frame, stream, sensor)
+    UINT64 z = static_cast<UINT64>(nFrame) * 3 + nStream + (static_cast<UINT64>(m_nSensorId) << 40) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+
+    return static_cast<INT64>(z % static_cast<UINT64>(2 * m_nJitter + 1)) - m_nJitter;
+}
+
+/// <summary>
+/// Generate the latest infrared frame
+/// </summary>
+/// <param name="pFrame">receives the frame</param>
+/// <returns>S_OK on success, E_PENDING if no new frame is due</returns>
+HRESULT SyntheticFrameSource::AcquireInfraredFrame(SourceFrame* pFrame)
+{
+    INT64 nFrame = LatestFrame(0, m_nInfraredFrame);
+    if (nFrame < 0)
+    {
+        return E_PENDING;
+    }
+    m_nInfraredFrame = nFrame;
+
+    // A bright spot sweeping over a dim background
+    int nSpotX = static_cast<int>((nFrame * 4 + m_nSensorId * 97) % cInfraredWidth);
+    UINT16* pPixel = m_pInfrared;
+    for (int i = 0; i < cInfraredHeight; ++i)
+    {
+        for (int j = 0; j < cInfraredWidth; ++j)
+        {
+            int dx = j - nSpotX;
+            int dy = i - cInfraredHeight / 2;
+            int d2 = dx * dx + dy * dy;
+            *pPixel++ = static_cast<UINT16>(d2 < 2500 ? 20000 - d2 * 6 : 1500 + ((i ^ j) & 0x3FF));
+        }
+    }
+
+    pFrame->nTime = nFrame * m_nPeriod + Jitter(nFrame, 0);
+    pFrame->nWidth = cInfraredWidth;
+    pFrame->nHeight = cInfraredHeight;
+    pFrame->nMinReliableDistance = 0;
+    pFrame->nMaxReliableDistance = 0;
+    pFrame->nBufferSize = cInfraredWidth * cInfraredHeight * sizeof(UINT16);
+    pFrame->pBuffer = reinterpret_cast<BYTE*>(m_pInfrared);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Generate the latest depth frame
+/// </summary>
+/// <param name="pFrame">receives the frame</param>
+/// <returns>S_OK on success, E_PENDING if no new frame is due</returns>
+HRESULT SyntheticFrameSource::AcquireDepthFrame(SourceFrame* pFrame)
+{
+    INT64 nFrame = LatestFrame(0, m_nDepthFrame);
+    if (nFrame < 0)
+    {
+        return E_PENDING;
+    }
+    m_nDepthFrame = nFrame;
+
+    // A tilted plane with a moving box in front of it and an invalid (zero) border
+    int nBoxX = static_cast<int>((nFrame * 3 + m_nSensorId * 61) % cDepthWidth);
+    UINT16* pPixel = m_pDepth;
+    for (int i = 0; i < cDepthHeight; ++i)
+    {
+        for (int j = 0; j < cDepthWidth; ++j)
+        {
+            UINT16 depth = static_cast<UINT16>(1500 + i * 4 + j);
+            if (j < 8 || j >= cDepthWidth - 8)
+            {
+                depth = 0;
+            }
+            else if (j >= nBoxX && j < nBoxX + 96 && i >= 150 && i < 280)
+            {
+                depth = 900;
+            }
+            *pPixel++ = depth;
+        }
+    }
+
+    pFrame->nTime = nFrame * m_nPeriod + Jitter(nFrame, 0);
+    pFrame->nWidth = cDepthWidth;
+    pFrame->nHeight = cDepthHeight;
+    pFrame->nMinReliableDistance = cMinReliableDistance;
+    pFrame->nMaxReliableDistance = cMaxReliableDistance;
+    pFrame->nBufferSize = cDepthWidth * cDepthHeight * sizeof(UINT16);
+    pFrame->pBuffer = reinterpret_cast<BYTE*>(m_pDepth);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Generate the latest color frame in BGRA format
+/// </summary>
+/// <param name="pFrame">receives the frame</param>
+/// <returns>S_OK on success, E_PENDING if no new frame is due</returns>
+HRESULT SyntheticFrameSource::AcquireColorFrame(SourceFrame* pFrame)
+{
+    INT64 nFrame = LatestFrame(m_nColorOffset, m_nColorFrame);
+    if (nFrame < 0)
+    {
+        return E_PENDING;
+    }
+    m_nColorFrame = nFrame;
+
+    // Scrolling color gradients
+    BYTE nShift = static_cast<BYTE>(nFrame * 2 + m_nSensorId * 37);
+    if (m_bRawColor)
+    {
+        BYTE* pPair = reinterpret_cast<BYTE*>(m_pColor);
+        for (int i = 0; i < cColorHeight; ++i)
+        {
+            for (int j = 0; j < cColorWidth; j += 2)
+            {
+                pPair[0] = static_cast<BYTE>(16 + ((i + j) >> 3) % 220);
+                pPair[1] = static_cast<BYTE>(j + nShift);
+                pPair[2] = static_cast<BYTE>(16 + ((i + j + 1) >> 3) % 220);
+                pPair[3] = static_cast<BYTE>(i - nShift);
+                pPair += 4;
+            }
+        }
+    }
+    else
+    {
+        RGBQUAD* pPixel = m_pColor;
+        for (int i = 0; i < cColorHeight; ++i)
+        {
+            for (int j = 0; j < cColorWidth; ++j)
+            {
+                pPixel->rgbBlue = static_cast<BYTE>(j + nShift);
+                pPixel->rgbGreen = static_cast<BYTE>(i - nShift);
+                pPixel->rgbRed = static_cast<BYTE>((i + j) >> 2);
+                pPixel->rgbReserved = 0xFF;
+                ++pPixel;
+            }
+        }
+    }
+
+    pFrame->nTime = nFrame * m_nPeriod + m_nColorOffset + Jitter(nFrame, 1);
+    pFrame->nWidth = cColorWidth;
+    pFrame->nHeight = cColorHeight;
+    pFrame->nMinReliableDistance = 0;
+    pFrame->nMaxReliableDistance = 0;
+    pFrame->nBufferSize = cColorWidth * cColorHeight * (m_bRawColor ? 2 : sizeof(RGBQUAD));
+    pFrame->pBuffer = reinterpret_cast<BYTE*>(m_pColor);
+    pFrame->nColorFormat = m_bRawColor ? ColorImageFormat_Yuy2 : ColorImageFormat_Bgra;
+
+    return S_OK;
+}
@@ -0,0 +1,85 @@
+// SyntheticFrameSource.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Frame source generating Kinect-like frames without a sensor, used for
+// headless benchmarking of the conversion, queueing and writer stages.
+
+
+#pragma once
+
+#include "FrameSource.h"
+#include <chrono>
+#include <thread>
+
+class SyntheticFrameSource : public FrameSource
+{
+    static const int        cInfraredWidth = 512;
+    static const int        cInfraredHeight = 424;
+    static const int        cDepthWidth = 512;
+    static const int        cDepthHeight = 424;
+    static const int        cColorWidth = 1920;
+    static const int        cColorHeight = 1080;
+    static const USHORT     cMinReliableDistance = 500;
+    static const USHORT     cMaxReliableDistance = 4500;
+public:
+    static const INT64      cDefaultJitter = 2000;          // +-0.2 ms (unit: 100 ns)
+    static const INT64      cDefaultColorOffset = 60000;    // color follows infrared/depth by ~6 ms (unit: 100 ns)
+
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="fFps">frame rate of every stream</param>
+    /// <param name="nJitter">maximum timestamp jitter (unit: 100 ns)</param>
+    /// <param name="nColorOffset">delay of the color frames relative to infrared/depth (unit: 100 ns)</param>
+    /// <param name="nSensorId">id of the virtual sensor, varies the content and the jitter sequence</param>
+    SyntheticFrameSource(double fFps, INT64 nJitter = cDefaultJitter, INT64 nColorOffset = cDefaultColorOffset, UINT nSensorId = 0);
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    virtual ~SyntheticFrameSource();
+
+    virtual HRESULT         AcquireInfraredFrame(SourceFrame* pFrame);
+    virtual HRESULT         AcquireDepthFrame(SourceFrame* pFrame);
+    virtual HRESULT         AcquireColorFrame(SourceFrame* pFrame);
+    virtual void            ReleaseInfraredFrame() {}
+    virtual void            ReleaseDepthFrame() {}
+    virtual void            ReleaseColorFrame() {}
+    virtual bool            SetRawColor(bool bRaw) { m_bRawColor = bRaw; return true; }
+    virtual double          GetFrameRate() const { return 10000000.0 / m_nPeriod; }
+    virtual bool            WaitForFrame(DWORD dwTimeout);
+
+private:
+    std::chrono::steady_clock::time_point m_tStart;
+    INT64                   m_nPeriod;
+    INT64                   m_nJitter;
+    INT64                   m_nColorOffset;
+    UINT                    m_nSensorId;
+
+    // Frame number of the last frame handed out, -1 before the first one
+    INT64                   m_nInfraredFrame;
+    INT64                   m_nDepthFrame;
+    INT64                   m_nColorFrame;
+
+    UINT16*                 m_pInfrared;
+    UINT16*                 m_pDepth;
+    RGBQUAD*                m_pColor;           // BGRA, or YUY2 in the first half if m_bRawColor is set
+    bool                    m_bRawColor;
+
+    /// <summary>
+    /// Find the latest frame due at the current time
+    /// </summary>
+    /// <param name="nOffset">delay of the stream relative to the start (unit: 100 ns)</param>
+    /// <param name="nLastFrame">last frame handed out for the stream</param>
+    /// <returns>frame number, or -1 if no new frame is due</returns>
+    INT64                   LatestFrame(INT64 nOffset, INT64 nLastFrame) const;
+
+    /// <summary>
+    /// Deterministic timestamp jitter of a frame
+    /// </summary>
+    /// <param name="nFrame">frame number</param>
+    /// <param name="nStream">0 for infrared/depth, 1 for color</param>
+    /// <returns>jitter in [-m_nJitter, m_nJitter] (unit: 100 ns)</returns>
+    INT64                   Jitter(INT64 nFrame, UINT nStream) const;
+};
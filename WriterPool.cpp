@@ -0,0 +1,177 @@
+// WriterPool.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+
+
+#include "PortableTypes.h"
+#include "WriterPool.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+WriterPool::WriterPool() :
+m_pSignal(NULL),
+m_bStop(false)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+WriterPool::~WriterPool()
+{
+    Stop();
+}
+
+/// <summary>
+/// Add a lane, before the pool is started
+/// </summary>
+/// <param name="fnReady">checks the lane, called with the lane locked</param>
+/// <param name="fnWrite">writes the oldest frame of the lane</param>
+/// <returns>index of the lane</returns>
+UINT WriterPool::AddLane(const ReadyFunction& fnReady, const WriteFunction& fnWrite)
+{
+    WriterLane lane;
+    lane.fnReady = fnReady;
+    lane.fnWrite = fnWrite;
+    lane.bBusy = false;
+    lane.stats.nWritten = 0;
+    lane.stats.nDepth = 0;
+    lane.stats.nMaxDepth = 0;
+    m_vLanes.push_back(lane);
+    return static_cast<UINT>(m_vLanes.size() - 1);
+}
+
+/// <summary>
+/// Start the writer threads, stopping the previous ones first
+/// </summary>
+/// <param name="pSignal">signal notified whenever a lane may have become ready</param>
+/// <param name="nThreads">number of writer threads</param>
+void WriterPool::Start(FrameSignal* pSignal, UINT nThreads)
+{
+    Stop();
+
+    m_pSignal = pSignal;
+    m_bStop = false;
+
+    // More threads than lanes would never find anything to write
+    nThreads = min(max(nThreads, 1U), max(static_cast<UINT>(m_vLanes.size()), 1U));
+    for (UINT i = 0; i < nThreads; ++i)
+    {
+        m_vThreads.push_back(std::thread(&WriterPool::WorkerThread, this));
+    }
+}
+
+/// <summary>
+/// Stop and join the writer threads, frames still waiting are left in their lanes
+/// </summary>
+void WriterPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    if (m_pSignal)
+    {
+        m_pSignal->Notify();
+    }
+
+    for (size_t i = 0; i < m_vThreads.size(); ++i)
+    {
+        m_vThreads[i].join();
+    }
+    m_vThreads.clear();
+}
+
+/// <summary>
+/// Get the queue statistics of a lane
+/// </summary>
+/// <param name="nLane">index of the lane</param>
+/// <returns>statistics</returns>
+WriterLaneStats WriterPool::GetStats(UINT nLane)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_vLanes[nLane].stats;
+}
+
+/// <summary>
+/// Restart the statistics of all lanes
+/// </summary>
+void WriterPool::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_vLanes.size(); ++i)
+    {
+        m_vLanes[i].stats.nWritten = 0;
+        m_vLanes[i].stats.nDepth = 0;
+        m_vLanes[i].stats.nMaxDepth = 0;
+    }
+}
+
+/// <summary>
+/// Writer thread
+/// </summary>
+void WriterPool::WorkerThread()
+{
+    while (true)
+    {
+        // Remember the signal state before looking at the lanes so that no wake-up is missed
+        UINT64 nSequence = m_pSignal->Sequence();
+        WriterLane* pLane = NULL;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_bStop)
+            {
+                break;
+            }
+
+            // Earliest deadline first among the lanes nobody is writing
+            INT64 nEarliest = 0;
+            for (size_t i = 0; i < m_vLanes.size(); ++i)
+            {
+                WriterLane& lane = m_vLanes[i];
+                if (lane.bBusy)
+                {
+                    continue;
+                }
+
+                INT64 nDeadline = 0;
+                UINT nDepth = 0;
+                bool bReady = lane.fnReady(&nDeadline, &nDepth);
+                lane.stats.nDepth = nDepth;
+                lane.stats.nMaxDepth = max(lane.stats.nMaxDepth, nDepth);
+
+                if (bReady && (!pLane || nDeadline < nEarliest))
+                {
+                    pLane = &lane;
+                    nEarliest = nDeadline;
+                }
+            }
+
+            if (pLane)
+            {
+                pLane->bBusy = true;
+            }
+        }
+
+        // Sleep until the conversion thread enqueues a frame or an encoder finishes one
+        if (!pLane)
+        {
+            if (m_fnIdle)
+            {
+                m_fnIdle();
+            }
+            m_pSignal->Wait(nSequence, 100);
+            continue;
+        }
+
+        pLane->fnWrite();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pLane->bBusy = false;
+            ++pLane->stats.nWritten;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+// WriterPool.h
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Pool of writer threads serving one lane per recorded stream.
+// A lane is written by one thread at a time, so its frames stay in order, and the
+// idle threads always pick the lane whose oldest frame has the earliest deadline.
+
+
+#pragma once
+
+#include "FrameQueue.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+
+/// The WriterDefaultThreads value specifies the number of writer threads started by default
+#define WriterDefaultThreads 3
+
+/// <summary>
+/// Queue statistics of a writer lane
+/// </summary>
+struct WriterLaneStats
+{
+    UINT                    nWritten;       // frames written since the last ResetStats()
+    UINT                    nDepth;         // frames waiting when the lane was last looked at
+    UINT                    nMaxDepth;      // highest nDepth since the last ResetStats()
+};
+
+class WriterPool
+{
+public:
+    /// <summary>
+    /// Checks if a lane has a frame ready to be written
+    /// </summary>
+    /// <param name="pDeadline">receives the deadline of the oldest frame</param>
+    /// <param name="pDepth">receives the number of frames waiting, ready or not</param>
+    /// <returns>true if the oldest frame can be written now</returns>
+    typedef std::function<bool(INT64* pDeadline, UINT* pDepth)> ReadyFunction;
+
+    /// <summary>
+    /// Writes the oldest frame of a lane and releases it
+    /// </summary>
+    typedef std::function<void()> WriteFunction;
+
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    WriterPool();
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~WriterPool();
+
+    /// <summary>
+    /// Add a lane, before the pool is started
+    /// </summary>
+    /// <param name="fnReady">checks the lane, called with the lane locked</param>
+    /// <param name="fnWrite">writes the oldest frame of the lane</param>
+    /// <returns>index of the lane</returns>
+    UINT                    AddLane(const ReadyFunction& fnReady, const WriteFunction& fnWrite);
+
+    /// <summary>
+    /// Set the function called by a thread finding no lane to write, before the pool is started
+    /// </summary>
+    /// <param name="fnIdle">idle function, called with no lane locked</param>
+    void                    SetIdle(const std::function<void()>& fnIdle) { m_fnIdle = fnIdle; }
+
+    /// <summary>
+    /// Start the writer threads, stopping the previous ones first
+    /// </summary>
+    /// <param name="pSignal">signal notified whenever a lane may have become ready</param>
+    /// <param name="nThreads">number of writer threads</param>
+    void                    Start(FrameSignal* pSignal, UINT nThreads);
+
+    /// <summary>
+    /// Stop and join the writer threads, frames still waiting are left in their lanes
+    /// </summary>
+    void                    Stop();
+
+    /// <summary>
+    /// Get the number of writer threads
+    /// </summary>
+    UINT                    GetThreadCount() const { return static_cast<UINT>(m_vThreads.size()); }
+
+    /// <summary>
+    /// Get the queue statistics of a lane
+    /// </summary>
+    /// <param name="nLane">index of the lane</param>
+    /// <returns>statistics</returns>
+    WriterLaneStats         GetStats(UINT nLane);
+
+    /// <summary>
+    /// Restart the statistics of all lanes
+    /// </summary>
+    void                    ResetStats();
+
+private:
+    /// <summary>
+    /// One recorded stream
+    /// </summary>
+    struct WriterLane
+    {
+        ReadyFunction           fnReady;
+        WriteFunction           fnWrite;
+        bool                    bBusy;      // a thread is writing the lane
+        WriterLaneStats         stats;
+    };
+
+    std::vector<std::thread> m_vThreads;
+    std::vector<WriterLane> m_vLanes;
+    std::function<void()>   m_fnIdle;
+    std::mutex              m_mutex;
+    FrameSignal*            m_pSignal;
+    bool                    m_bStop;
+
+    /// <summary>
+    /// Writer thread
+    /// </summary>
+    void                    WorkerThread();
+};
@@ -31,6 +31,7 @@
 #define IDC_STATUS                      1015
 #define IDC_BUTTON_RECORD               1016
 #define IDC_BUTTON_SHOT                 1017
+#define IDM_STORAGE_PROBE               0x0100
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
@@ -16,6 +16,7 @@
 #include <windows.h>
 
 #include <Shlobj.h>
+#include <shellapi.h>
 
 // Direct2D Header Files
 #include <d2d1.h>
@@ -0,0 +1,153 @@
+// AsyncFileWriterTest.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Writes frames of several sizes through AsyncFileWriter, more than it keeps
+// in flight, and reads every file back: the content must match and the sector
+// padding must be cut off. A file in a missing folder must fail.
+
+
+#include "PortableTypes.h"
+#include "AsyncFileWriter.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/// The TestFrameCount value specifies the number of files written per size
+#define TestFrameCount      (AsyncWritesPerLane * 3)
+
+/// <summary>
+/// Read a whole file
+/// </summary>
+/// <returns>false if the file cannot be read</returns>
+static bool ReadTestFile(const std::string& szPath, std::vector<BYTE>& vData)
+{
+    FILE* pFile = fopen(szPath.c_str(), "rb");
+    if (!pFile)
+    {
+        return false;
+    }
+
+    vData.clear();
+    BYTE buffer[65536];
+    size_t nRead = 0;
+    while ((nRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+    {
+        vData.insert(vData.end(), buffer, buffer + nRead);
+    }
+    fclose(pFile);
+    return true;
+}
+
+/// <summary>
+/// Entry point
+/// </summary>
+/// <returns>0 if every file is written and read back exactly, 1 otherwise</returns>
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s folder\n", argv[0]);
+        return 2;
+    }
+    std::string szFolder = argv[1];
+
+    // Infrared PGM, YUY2 PAM, 24-bit BMP and a frame smaller than a sector
+    const DWORD aSizes[] = { 512 * 424 * 2, 1920 * 1080 * 2, 1920 * 1080 * 3, 1000 };
+    int nFailures = 0;
+
+    AsyncFileWriter cWriter;
+    printf("Backend: %s\n", cWriter.IsQueued() ? "queued" : "blocking");
+
+    for (size_t s = 0; s < _countof(aSizes); ++s)
+    {
+        DWORD dwSize = aSizes[s];
+        std::vector<BYTE*> vSlots(AsyncWritesPerLane);
+        for (size_t i = 0; i < vSlots.size(); ++i)
+        {
+            vSlots[i] = AllocateFrameSlot(dwSize);
+        }
+
+        std::vector<std::string> vPaths;
+        for (UINT n = 0; n < TestFrameCount; ++n)
+        {
+            // A slot is reused only once its file has been completed, as in the recorder
+            if (!cWriter.CanSubmit() && FAILED(cWriter.Complete()))
+            {
+                ++nFailures;
+            }
+
+            BYTE* pPixels = vSlots[n % AsyncWritesPerLane];
+            for (DWORD i = 0; i < dwSize; ++i)
+            {
+                pPixels[i] = static_cast<BYTE>((i * 7 + n * 13 + s) & 0xFF);
+            }
+            switch (s)
+            {
+            case 0:
+                PutPNMHeader(pPixels, '5', 512, 424, 65535);
+                break;
+            case 1:
+                PutPAMHeader(pPixels, 1920, 1080, 2, 255, "YUY2");
+                break;
+            case 2:
+                PutBMPHeader(pPixels, 1920, 1080, 24);
+                break;
+            default:
+                PutPNMHeader(pPixels, '5', 10, 50, 255);
+                break;
+            }
+
+            char szName[64];
+            sprintf_s(szName, _countof(szName), "/async_%u_%u.bin", static_cast<UINT>(s), n);
+            vPaths.push_back(szFolder + szName);
+            std::wstring szPath(vPaths.back().begin(), vPaths.back().end());
+            cWriter.Submit(szPath.c_str(), pPixels - FrameHeaderRoom, FrameHeaderRoom + dwSize);
+        }
+        while (cWriter.InFlight())
+        {
+            if (FAILED(cWriter.Complete()))
+            {
+                ++nFailures;
+            }
+        }
+
+        // Every file holds its header and pixels, without padding
+        for (UINT n = 0; n < TestFrameCount; ++n)
+        {
+            std::vector<BYTE> vData;
+            bool bMatch = ReadTestFile(vPaths[n], vData) && vData.size() == FrameHeaderRoom + dwSize;
+            for (DWORD i = 0; bMatch && i < dwSize; ++i)
+            {
+                bMatch = (vData[FrameHeaderRoom + i] == static_cast<BYTE>((i * 7 + n * 13 + s) & 0xFF));
+            }
+            if (!bMatch)
+            {
+                printf("%s: MISMATCH (%u bytes)\n", vPaths[n].c_str(), static_cast<UINT>(vData.size()));
+                ++nFailures;
+            }
+            remove(vPaths[n].c_str());
+        }
+        printf("%u bytes x %u files: %s\n", dwSize, TestFrameCount, nFailures ? "FAILED" : "ok");
+
+        for (size_t i = 0; i < vSlots.size(); ++i)
+        {
+            FreeFrameSlot(vSlots[i]);
+        }
+    }
+
+    // A file that cannot be created is reported by Complete()
+    BYTE* pPixels = AllocateFrameSlot(1000);
+    std::string szMissingPath = szFolder + "/missing/async.bin";
+    std::wstring szMissing(szMissingPath.begin(), szMissingPath.end());
+    cWriter.Submit(szMissing.c_str(), pPixels - FrameHeaderRoom, FrameHeaderRoom + 1000);
+    bool bRefused = FAILED(cWriter.Complete());
+    printf("Missing folder: %s\n", bRefused ? "refused, ok" : "ACCEPTED");
+    if (!bRefused)
+    {
+        ++nFailures;
+    }
+    FreeFrameSlot(pPixels);
+
+    return nFailures ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+// DepthCodecSelfTest.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Runs the RVL round trip of the -selftest option from the command line:
+// synthetic frames, then the .rvl files given as arguments.
+
+
+#include "PortableTypes.h"
+#include "DepthCodecTest.h"
+#include <cstdio>
+
+/// <summary>
+/// Entry point
+/// </summary>
+/// <returns>0 if every round trip is exact, 1 otherwise</returns>
+int main(int argc, char* argv[])
+{
+    std::vector<std::wstring> vFiles;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string szFile = argv[i];
+        vFiles.push_back(std::wstring(szFile.begin(), szFile.end()));
+    }
+
+    static WCHAR szReport[8192];
+    HRESULT hr = RunDepthCodecSelfTest(vFiles, szReport, _countof(szReport));
+    printf("%ls", szReport);
+
+    return SUCCEEDED(hr) ? 0 : 1;
+}
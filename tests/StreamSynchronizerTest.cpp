@@ -0,0 +1,208 @@
+// StreamSynchronizerTest.cpp
+//
+// Author: Po-Chen Wu (pcwu0329@gmail.com)
+//
+// Feeds timestamps of the three streams to StreamSynchronizer as the capture
+// thread would: frames arriving ahead of their partners must still be paired,
+// a lost frame must leave its partners unmatched without breaking the next
+// framesets, and a jump of the color timestamps must be relocked by a resync.
+
+
+#include "PortableTypes.h"
+#include "StreamSynchronizer.h"
+#include <cstdio>
+#include <vector>
+
+/// The TestPeriod value specifies the frame period of the test streams (unit: 100 ns)
+#define TestPeriod 333333
+
+static const UINT cAllStreams = (1 << FrameStream_Infrared) | (1 << FrameStream_Depth) | (1 << FrameStream_Color);
+static const UINT cInfraredDepth = (1 << FrameStream_Infrared) | (1 << FrameStream_Depth);
+
+/// <summary>
+/// Take every event the synchronizer has decided so far
+/// </summary>
+static void TakeEvents(StreamSynchronizer& cSync, std::vector<SyncEvent>& vEvents)
+{
+    SyncEvent event;
+    while (cSync.NextEvent(&event))
+    {
+        vEvents.push_back(event);
+    }
+}
+
+/// <summary>
+/// Add the frames of one frameset, infrared and depth first, color a few milliseconds later
+/// </summary>
+static void AddFrameset(StreamSynchronizer& cSync, INT64 nTime, INT64 nColorOffset)
+{
+    cSync.AddFrame(FrameStream_Infrared, nTime);
+    cSync.AddFrame(FrameStream_Depth, nTime);
+    cSync.AddFrame(FrameStream_Color, nTime + nColorOffset);
+}
+
+/// <summary>
+/// Count the events of a type
+/// </summary>
+static UINT CountEvents(const std::vector<SyncEvent>& vEvents, SyncEventType nType)
+{
+    UINT nCount = 0;
+    for (size_t i = 0; i < vEvents.size(); ++i)
+    {
+        if (vEvents[i].nType == nType)
+        {
+            ++nCount;
+        }
+    }
+    return nCount;
+}
+
+/// <summary>
+/// Report a check
+/// </summary>
+/// <returns>1 if the check failed, 0 otherwise</returns>
+static int Check(const char* szName, bool bPassed)
+{
+    printf("%s: %s\n", szName, bPassed ? "ok" : "FAILED");
+    return bPassed ? 0 : 1;
+}
+
+/// <summary>
+/// Color frames held back by up to SyncLookAhead frames are still paired with their infrared and depth frames
+/// </summary>
+static int TestLookAhead()
+{
+    StreamSynchronizer cSync;
+    std::vector<SyncEvent> vEvents;
+
+    for (INT64 n = 0; n < SyncLookAhead; ++n)
+    {
+        cSync.AddFrame(FrameStream_Infrared, n * TestPeriod);
+        cSync.AddFrame(FrameStream_Depth, n * TestPeriod);
+    }
+    TakeEvents(cSync, vEvents);
+    bool bWaited = vEvents.empty();
+
+    for (INT64 n = 0; n < SyncLookAhead; ++n)
+    {
+        cSync.AddFrame(FrameStream_Color, n * TestPeriod + SyncColorOffset);
+    }
+    TakeEvents(cSync, vEvents);
+
+    bool bPaired = (vEvents.size() == SyncLookAhead);
+    for (size_t i = 0; bPaired && i < vEvents.size(); ++i)
+    {
+        const SyncEvent& event = vEvents[i];
+        bPaired = event.nType == SyncEvent_Frameset && event.nStreams == cAllStreams &&
+            event.aTimes[FrameStream_Depth] == static_cast<INT64>(i) * TestPeriod &&
+            event.aTimes[FrameStream_Color] == static_cast<INT64>(i) * TestPeriod + SyncColorOffset;
+    }
+
+    return Check("Look-ahead matching", bWaited && bPaired);
+}
+
+/// <summary>
+/// A lost color frame leaves its infrared and depth frames unmatched, the following framesets are paired again
+/// </summary>
+static int TestUnmatched()
+{
+    StreamSynchronizer cSync;
+    std::vector<SyncEvent> vEvents;
+
+    const INT64 nLost = 5;
+    for (INT64 n = 0; n < 10; ++n)
+    {
+        cSync.AddFrame(FrameStream_Infrared, n * TestPeriod);
+        cSync.AddFrame(FrameStream_Depth, n * TestPeriod);
+        if (n != nLost)
+        {
+            cSync.AddFrame(FrameStream_Color, n * TestPeriod + SyncColorOffset);
+        }
+    }
+    TakeEvents(cSync, vEvents);
+
+    bool bReported = (CountEvents(vEvents, SyncEvent_Unmatched) == 1);
+    for (size_t i = 0; bReported && i < vEvents.size(); ++i)
+    {
+        const SyncEvent& event = vEvents[i];
+        if (event.nType == SyncEvent_Unmatched)
+        {
+            bReported = event.nStreams == cInfraredDepth && event.aTimes[FrameStream_Depth] == nLost * TestPeriod;
+        }
+    }
+
+    bool bPaired = (CountEvents(vEvents, SyncEvent_Frameset) == 9) && (CountEvents(vEvents, SyncEvent_Resync) == 0) &&
+        !vEvents.empty() && vEvents.back().nType == SyncEvent_Frameset && vEvents.back().aTimes[FrameStream_Depth] == 9 * TestPeriod;
+
+    return Check("Unmatched frames", bReported && bPaired);
+}
+
+/// <summary>
+/// A jump of all timestamps keeps the framesets paired, a jump of the color timestamps alone is relocked by one resync
+/// </summary>
+static int TestResync()
+{
+    StreamSynchronizer cSync;
+    std::vector<SyncEvent> vEvents;
+
+    // The whole timeline jumps (e.g. a replay wrapping around): the offsets still hold
+    INT64 n = 0;
+    for (; n < 10; ++n)
+    {
+        AddFrameset(cSync, n * TestPeriod, SyncColorOffset);
+    }
+    for (; n < 20; ++n)
+    {
+        AddFrameset(cSync, n * TestPeriod + 100000000, SyncColorOffset);
+    }
+    TakeEvents(cSync, vEvents);
+    bool bKept = (vEvents.size() == 20) && (CountEvents(vEvents, SyncEvent_Frameset) == 20);
+
+    // Color falls 14 ms further behind, still below the resync threshold
+    const INT64 nColorOffset = SyncColorOffset + 140000;
+    vEvents.clear();
+    for (; n < 40; ++n)
+    {
+        AddFrameset(cSync, n * TestPeriod + 100000000, nColorOffset);
+    }
+    TakeEvents(cSync, vEvents);
+
+    size_t nResync = vEvents.size();
+    for (size_t i = 0; i < vEvents.size(); ++i)
+    {
+        if (vEvents[i].nType == SyncEvent_Resync)
+        {
+            nResync = i;
+            break;
+        }
+    }
+
+    // The resync carries the frames of the frameset which follows it, and no frame is unmatched after it
+    bool bRelocked = (CountEvents(vEvents, SyncEvent_Resync) == 1) && nResync + 1 < vEvents.size() &&
+        vEvents[nResync].nStreams == cAllStreams && vEvents[nResync + 1].nType == SyncEvent_Frameset &&
+        0 == memcmp(vEvents[nResync].aTimes, vEvents[nResync + 1].aTimes, sizeof(vEvents[nResync].aTimes));
+    for (size_t i = nResync + 1; bRelocked && i < vEvents.size(); ++i)
+    {
+        bRelocked = (vEvents[i].nType == SyncEvent_Frameset);
+    }
+    bRelocked = bRelocked && cSync.GetOffset(FrameStream_Color) == nColorOffset / 10000.0;
+
+    printf("Color jump: %u framesets, %u unmatched before the resync, offset %.1f ms\n",
+        CountEvents(vEvents, SyncEvent_Frameset), CountEvents(vEvents, SyncEvent_Unmatched), cSync.GetOffset(FrameStream_Color));
+
+    return Check("Timeline jump", bKept) + Check("Resync after a color jump", bRelocked);
+}
+
+/// <summary>
+/// Entry point
+/// </summary>
+/// <returns>0 if every check passed, 1 otherwise</returns>
+int main()
+{
+    int nFailures = 0;
+    nFailures += TestLookAhead();
+    nFailures += TestUnmatched();
+    nFailures += TestResync();
+
+    return nFailures ? 1 : 0;
+}